@@ -12,7 +12,7 @@ macro(libcaca_check)
 		
 		file(GLOB LIBCACA_FRONTEND_SOURCES src/frontends/caca/*.c)
 		add_executable("sgherm-caca" ${LIBCACA_FRONTEND_SOURCES} $<TARGET_OBJECTS:sgherm-core>)
-		target_link_libraries("sgherm-caca" ${libcaca_LIBRARY})
+		target_link_libraries("sgherm-caca" ${libcaca_LIBRARY} ${CORE_LIBRARIES})
 
 		set(HAVE_FRONTEND on)
 	endif()
@@ -29,7 +29,7 @@ macro(sdl2_check)
 		
 		file(GLOB SDL2_FRONTEND_SOURCES src/frontends/sdl2/*.c)
 		add_executable("sgherm-sdl2" WIN32 ${SDL2_FRONTEND_SOURCES} $<TARGET_OBJECTS:sgherm-core>)
-		target_link_libraries("sgherm-sdl2" ${SDL2_LIBRARY})
+		target_link_libraries("sgherm-sdl2" ${SDL2_LIBRARY} ${CORE_LIBRARIES})
 
 		set(HAVE_FRONTEND on)
 	endif()
@@ -53,7 +53,7 @@ macro(win32_check)
 			set_target_properties("sgherm-gdi" PROPERTIES LINKER_LANGUAGE CXX)
 		endif()
 
-		target_link_libraries("sgherm-gdi" winmm)
+		target_link_libraries("sgherm-gdi" winmm ${CORE_LIBRARIES})
 
 		set(HAVE_FRONTEND on)
 	endif()
@@ -71,7 +71,13 @@ macro(null_check)
 	option(ENABLE_NULL "Enable a frontendless sgherm build (testing)" ${NULL_DEFAULT})
 	if(ENABLE_NULL)
 		file(GLOB NULL_FRONTEND_SOURCES src/frontends/null/*.c)
+		if(NOT HAVE_FORK)
+			# The fork server is POSIX only
+			list(REMOVE_ITEM NULL_FRONTEND_SOURCES
+				${CMAKE_CURRENT_SOURCE_DIR}/src/frontends/null/forksrv.c)
+		endif()
 		add_executable("sgherm-null" ${NULL_FRONTEND_SOURCES} $<TARGET_OBJECTS:sgherm-core>)
+		target_link_libraries("sgherm-null" ${CORE_LIBRARIES})
 	endif()
 endmacro()
 
@@ -1,6 +1,8 @@
 include(CheckIncludeFiles)
 include(CheckFunctionExists)
 include(CheckSymbolExists)
+include(CheckLibraryExists)
+include(CheckCSourceCompiles)
 include(TestBigEndian)
 
 macro(posix_check)
@@ -52,6 +54,10 @@ macro(clock_check)
 	endif()
 endmacro()
 
+macro(fork_check)
+	check_symbol_exists(fork unistd.h HAVE_FORK)
+endmacro()
+
 macro(mmap_check)
 	check_symbol_exists(mmap sys/mman.h HAVE_MMAP)
 	if(HAVE_MMAP)
@@ -71,6 +77,18 @@ macro(mmap_check)
 	endif()
 endmacro()
 
+macro(shm_check)
+	check_symbol_exists(shm_open sys/mman.h HAVE_SHM_OPEN)
+	if(NOT HAVE_SHM_OPEN)
+		# Older glibc keeps it in librt
+		check_library_exists(rt shm_open "" HAVE_LIBRT)
+		if(HAVE_LIBRT)
+			set(HAVE_SHM_OPEN 1)
+			list(APPEND CORE_LIBRARIES rt)
+		endif()
+	endif()
+endmacro()
+
 macro(madvise_check)
 	check_symbol_exists(madvise sys/mman.h HAVE_MADVISE)
 	if(NOT HAVE_MADVISE)
@@ -78,6 +96,47 @@ macro(madvise_check)
 	endif()
 endmacro()
 
+macro(simd_check)
+	check_include_files(emmintrin.h HAVE_EMMINTRIN_H)
+	check_include_files(immintrin.h HAVE_IMMINTRIN_H)
+	if(HAVE_IMMINTRIN_H)
+		# Per-function targets let us ship AVX2 kernels in a baseline build
+		# and pick them at runtime
+		check_c_source_compiles("
+			#include <immintrin.h>
+			__attribute__((target(\"avx2,fma\")))
+			static void f(float *p)
+			{
+				__m256 a = _mm256_loadu_ps(p);
+				_mm256_storeu_ps(p, _mm256_fmadd_ps(a, a, a));
+			}
+			int main(void)
+			{
+				float v[8] = { 0 };
+				__builtin_cpu_init();
+				if(__builtin_cpu_supports(\"avx2\")) f(v);
+				return 0;
+			}" HAVE_AVX2_TARGET)
+	endif()
+endmacro()
+
+macro(libm_check)
+	check_library_exists(m sin "" HAVE_LIBM)
+	if(HAVE_LIBM)
+		list(APPEND CORE_LIBRARIES m)
+	endif()
+endmacro()
+
+macro(threads_check)
+	find_package(Threads)
+	if(CMAKE_USE_PTHREADS_INIT)
+		set(HAVE_PTHREADS 1)
+		list(APPEND CORE_LIBRARIES ${CMAKE_THREAD_LIBS_INIT})
+	elseif(CMAKE_USE_WIN32_THREADS_INIT)
+		set(HAVE_WIN32_THREADS 1)
+	endif()
+endmacro()
+
 macro(platform_checks)
 	posix_check()
 	if(NOT HAVE_POSIX)
@@ -96,8 +155,15 @@ macro(platform_checks)
 	stdc_check()
 	swap_check()
 	clock_check()
+	simd_check()
+	libm_check()
+	threads_check()
 	if(HAVE_POSIX)
 		mmap_check()
+		if(HAVE_MMAP)
+			shm_check()
+		endif()
 		madvise_check()
+		fork_check()
 	endif()
 endmacro()
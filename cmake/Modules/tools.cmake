@@ -0,0 +1,64 @@
+macro(batch_tool)
+	file(GLOB BATCH_TOOL_SOURCES src/tools/batch/*.c)
+	add_executable("sgherm-batch" ${BATCH_TOOL_SOURCES} $<TARGET_OBJECTS:sgherm-core>)
+	target_link_libraries("sgherm-batch" ${CORE_LIBRARIES})
+endmacro()
+
+macro(bench_tool)
+	file(GLOB BENCH_TOOL_SOURCES src/tools/bench/*.c)
+	add_executable("sgherm-bench" ${BENCH_TOOL_SOURCES} $<TARGET_OBJECTS:sgherm-core>)
+	target_link_libraries("sgherm-bench" ${CORE_LIBRARIES})
+endmacro()
+
+macro(tracedump_tool)
+	file(GLOB TRACEDUMP_TOOL_SOURCES src/tools/tracedump/*.c)
+	add_executable("sgherm-tracedump" ${TRACEDUMP_TOOL_SOURCES} $<TARGET_OBJECTS:sgherm-core>)
+	target_link_libraries("sgherm-tracedump" ${CORE_LIBRARIES})
+endmacro()
+
+macro(top_tool)
+	# Only reads the blocks, so it needs nothing from the core
+	file(GLOB TOP_TOOL_SOURCES src/tools/top/*.c)
+	add_executable("sgherm-top" ${TOP_TOOL_SOURCES})
+	target_link_libraries("sgherm-top" ${CORE_LIBRARIES})
+endmacro()
+
+macro(microbench_tool)
+	# Synthetic ROMs are assembled into the build tree by a host tool
+	set(BENCH_ROM_DIR "${CMAKE_BINARY_DIR}/roms")
+	set(BENCH_ROM_FILES)
+	foreach(ROM alu memcpy cb banks sprites scroll apu)
+		list(APPEND BENCH_ROM_FILES "${BENCH_ROM_DIR}/${ROM}.gb")
+	endforeach()
+
+	file(GLOB ROMGEN_TOOL_SOURCES src/tools/romgen/*.c)
+	add_executable("sgherm-romgen" ${ROMGEN_TOOL_SOURCES})
+
+	add_custom_command(OUTPUT ${BENCH_ROM_FILES}
+		COMMAND ${CMAKE_COMMAND} -E make_directory "${BENCH_ROM_DIR}"
+		COMMAND "sgherm-romgen" "${BENCH_ROM_DIR}"
+		DEPENDS "sgherm-romgen"
+		COMMENT "Assembling benchmark ROMs")
+	add_custom_target("bench-roms" ALL DEPENDS ${BENCH_ROM_FILES})
+
+	file(GLOB MICROBENCH_TOOL_SOURCES src/tools/microbench/*.c)
+	add_executable("sgherm-microbench" ${MICROBENCH_TOOL_SOURCES} $<TARGET_OBJECTS:sgherm-core>)
+	target_link_libraries("sgherm-microbench" ${CORE_LIBRARIES})
+	set_property(TARGET "sgherm-microbench" APPEND PROPERTY
+		COMPILE_DEFINITIONS "BENCH_ROM_DIR=\"${BENCH_ROM_DIR}\"")
+	add_dependencies("sgherm-microbench" "bench-roms")
+endmacro()
+
+macro(tool_checks)
+	option(ENABLE_TOOLS "Build the command line tools (sgherm-batch etc.)" on)
+
+	if(ENABLE_TOOLS)
+		batch_tool()
+		bench_tool()
+		microbench_tool()
+		tracedump_tool()
+		if(HAVE_SHM_OPEN)
+			top_tool()
+		endif()
+	endif()
+endmacro()
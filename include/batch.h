@@ -0,0 +1,99 @@
+#ifndef __BATCH_H__
+#define __BATCH_H__
+
+#include "config.h"	// bool, uint[XX]_t
+#include "typedefs.h"	// emu_state, batch, batch_results
+
+#include <stddef.h>	// size_t
+#include <stdio.h>	// FILE
+
+
+//! Why an instance stopped running
+typedef enum
+{
+	BATCH_EXIT_RUNNING = 0,		//! Ran every frame asked for; can run more
+	BATCH_EXIT_CALLBACK,		//! The frame callback asked to stop
+	BATCH_EXIT_FATAL,		//! fatal() was raised in the instance
+} batch_exit;
+
+/*!
+ * @brief Called on a worker thread before each frame of an instance
+ * @param state the instance
+ * @param index which instance (0 to count - 1)
+ * @param user batch_config.user
+ * @returns false to retire the instance (BATCH_EXIT_CALLBACK)
+ * @note Instances are never run on two threads at once, but different
+ * instances run concurrently; anything shared through user must be
+ * thread-safe.
+ */
+typedef bool (*batch_frame_fn)(emu_state *restrict, size_t, void *);
+
+typedef struct
+{
+	unsigned threads;		//! Worker threads (0 = one per CPU)
+	batch_frame_fn frame;		//! Per-frame hook, usually input (may be NULL)
+	void *user;			//! Passed to frame
+
+	const uint16_t *ram_addrs;	//! Addresses to sample (must outlive the batch)
+	size_t ram_count;		//! Number of ram_addrs
+
+	FILE *log;			//! Instance messages (NULL = to_stderr)
+	bool metrics;			//! Publish live metrics for each instance
+} batch_config;
+
+//! Results, one column per field and one row per instance
+struct batch_results_t
+{
+	size_t count;			//! Rows
+	size_t ram_count;		//! Bytes per row in ram
+
+	uint8_t *exit;			//! batch_exit per instance
+	uint64_t *frames;		//! Frames run per instance
+	uint64_t *fb_hash;		//! FNV-1a of the final framebuffer
+	uint8_t *ram;			//! ram_count bytes per instance, row-major
+};
+
+
+/*!
+ * @brief Create count instances of one ROM
+ * @param rom_path ROM to map once and share read-only between instances
+ * @param count number of instances
+ * @param config threads, hooks and result columns (copied)
+ * @returns the batch, or NULL on failure
+ * @note Instances run without a save file, deterministic and unthrottled,
+ * so runs are reproducible.
+ */
+batch * batch_new(const char *, size_t, const batch_config *);
+
+/*!
+ * @brief Destroy a batch and all of its instances
+ */
+void batch_free(batch *);
+
+/*!
+ * @brief Run every live instance for up to frames more frames
+ * @returns false if an instance ended in fatal() or a signal stopped the
+ * run early
+ * @note Each step schedules one run_frame task per live instance across
+ * the pool; idle workers steal from busy ones.
+ */
+bool batch_run(batch *restrict, uint64_t);
+
+/*!
+ * @brief Gather results for every instance
+ * @returns columnar results owned by the batch, valid until the next
+ * batch_run or batch_free
+ */
+const batch_results * batch_collect(batch *);
+
+/*!
+ * @brief Get one instance (e.g. to seed inputs before running)
+ */
+emu_state * batch_instance(batch *, size_t);
+
+/*!
+ * @brief Number of worker threads actually in use
+ */
+unsigned batch_threads(const batch *);
+
+#endif /*!__BATCH_H__*/
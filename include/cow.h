@@ -0,0 +1,70 @@
+#ifndef __COW_H__
+#define __COW_H__
+
+#include "config.h"	// bool, uint[XX]_t
+#include "typedefs.h"	// emu_state, cow_block
+
+#include <stddef.h>	// size_t
+
+
+//! Large buffers an instance shares with its clones until it writes them
+typedef enum
+{
+	COW_WRAM = 0,			//! Work RAM banks (8 slots)
+	COW_VRAM = COW_WRAM + 8,	//! VRAM banks (2 slots)
+	COW_OUT = COW_VRAM + 2,		//! LCD output buffer
+	COW_CART,			//! Cart RAM, in clones only
+	COW_SLOTS,
+} cow_slot;
+
+//! A refcounted page; the data follows the header
+struct cow_block_t
+{
+	long refs;		//! Instances sharing the page (ATOMIC_INC/DEC only)
+	size_t size;		//! Bytes of data
+};
+
+#define COW_DATA(block) ((uint8_t *)((block) + 1))
+
+struct cow_state_t
+{
+	cow_block *block[COW_SLOTS];	//! Backing pages (NULL = not managed)
+	uint32_t owned;			//! Slots this instance may write in place
+};
+
+//! True if slot can be written without copying it first
+#define COW_OWNED(state, slot) ((state)->cow.owned & (1u << (slot)))
+
+
+/*!
+ * @brief Allocate the work RAM, VRAM and LCD pages of a new instance
+ */
+bool cow_init(emu_state *restrict);
+
+/*!
+ * @brief Drop this instance's references to its pages
+ */
+void cow_release(emu_state *restrict);
+
+/*!
+ * @brief Share every page of src with dst, which is a bitwise copy of src
+ * @returns false if cart RAM could not be copied
+ * @note Cart RAM owned by the save file is copied, since the original
+ * keeps writing it back in place; everything else is shared until the
+ * first write on either side.
+ */
+bool cow_share(emu_state *restrict, emu_state *restrict);
+
+/*!
+ * @brief Give this instance a private copy of a slot
+ * @returns false (and raises fatal) if the copy could not be allocated
+ * @note Call through COW_OWNED first; owned slots need no work.
+ */
+bool cow_unshare(emu_state *restrict, cow_slot);
+
+/*!
+ * @brief Make every slot private, e.g. before overwriting the whole state
+ */
+bool cow_unshare_all(emu_state *restrict);
+
+#endif /*!__COW_H__*/
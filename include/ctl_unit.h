@@ -74,6 +74,9 @@ typedef enum
 typedef void (*opcode_t)(emu_state *restrict state, uint8_t data[]);
 
 
+//! Length of each instruction in bytes, by opcode
+extern const int instr_len[0x100];
+
 void init_ctl(emu_state *restrict);
 bool execute(emu_state *restrict, int);
 
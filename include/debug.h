@@ -4,6 +4,9 @@
 #include "config.h"	// Various macros
 #include "typedefs.h"	// typedefs
 #include "ctl_unit.h"	// flags
+#include "history.h"	// history_state
+
+#include <stddef.h>	// size_t
 
 struct debug_state_t
 {
@@ -11,8 +14,11 @@ struct debug_state_t
 
 	bool instr_dump;	//! Dump instructions
 
-	uint8_t last_opcode;	//! Store last opcode
-	uint8_t last_param[2];	//! Last parameters
+	history_state history;	//! Recent instructions and MMIO writes, for crashes
+
+	profile_state *profile;	//! Guest profiler (NULL = off)
+	trace_state *trace;	//! Binary instruction trace (NULL = off)
+	tracepoint_state *tracepoints;	//! MMIO and interrupt events (NULL = off)
 };
 
 extern const char * const mnemonics[0x100];
@@ -20,6 +26,16 @@ extern const char * const mnemonics_cb[0x100];
 extern const char * const flags_expect[0x100];
 extern const char * const flags_cb_expect[0x100];
 
+/*!
+ * @brief Disassemble one instruction with its operands filled in
+ * @param out where the text goes
+ * @param len size of out; 24 is always enough
+ * @param pc address of the opcode, for JR targets
+ * @param opcode the first byte (0xCB for CB opcodes)
+ * @param operand the bytes following it
+ */
+void disassemble(char *, size_t, uint16_t, uint8_t, const uint8_t [2]);
+
 void print_cpu_state(emu_state *restrict);
 void print_cycles(emu_state *restrict);
 void print_flags(emu_state *restrict);
@@ -4,6 +4,7 @@
 #include "config.h"	// bool
 #include "typedefs.h"	// typedefs
 #include "input.h"	// input_key
+#include "movie.h"	// movie_mode
 
 
 struct frontend_audio_t
@@ -33,6 +34,8 @@ struct frontend_t
 
 	int (*event_loop)(emu_state *restrict);	//! Event loop function (for use with toolkits)
 
+	unsigned null_noticed;			//! Null stubs that have logged (bitmask)
+
 	void *data;				//! Opaque data
 };
 
@@ -53,6 +56,60 @@ bool select_frontend_all(emu_state * restrict, const frontend_audio * restrict,
 	const frontend_video * restrict, int (*)(emu_state *restrict));
 void finish_frontend(emu_state *restrict);
 
+//! Command line common to every frontend
+typedef struct
+{
+	const char *rom;		//! ROM path
+	const char *save;		//! Save file (NULL = none)
+	const char *bootrom;		//! Boot ROM (NULL = none)
+
+	movie_mode movie_mode;		//! -r records, -p plays
+	const char *movie_path;		//! Movie for movie_mode
+
+	bool deterministic;		//! -d
+	unsigned run_ahead;		//! -a (SDL2 and caca only)
+
+	const char *profile_path;	//! -g
+	const char *profile_stacks_path;//! -G
+	const char *trace_path;		//! -T
+	const char *events_path;	//! -E
+	bool metrics;			//! -M
+} frontend_args;
+
+//! Help for what frontend_parse_arg understands
+#define FRONTEND_USAGE "[options] ROM [SAVE [BOOTROM]]\n" \
+	"  -r MOVIE   record input from power-on to MOVIE\n" \
+	"  -p MOVIE   play input back from MOVIE\n" \
+	"  -d         deterministic mode: emulated RTC, audio and power-on RAM\n" \
+	"  -a FRAMES  show FRAMES frames ahead to hide input lag\n" \
+	"  -g FILE    write a flat profile of guest code to FILE on exit\n" \
+	"  -G FILE    write guest call stacks to FILE for flamegraph.pl\n" \
+	"  -T FILE    write a binary trace of the last instructions to FILE\n" \
+	"  -E FILE    write interrupt, LCDC, DMA, timer and MBC events to FILE\n" \
+	"  -M         publish live metrics for sgherm-top\n"
+
+/*!
+ * @brief Consume argv[i], and its value, if every frontend takes it
+ * @returns arguments used: 0 if argv[i] is something else, -1 if its
+ * value is missing
+ */
+int frontend_parse_arg(int, char *[], int, frontend_args *);
+
+/*!
+ * @brief Step through 1x, 2x, 4x and unlimited, for a fast-forward key
+ * @returns the new speed
+ */
+unsigned frontend_cycle_speed(emu_state *restrict);
+
+/*!
+ * @brief Present the frame opts.run_ahead frames from now, leaving state be
+ * @returns false if the run-ahead instance could not be made or died
+ * @note Call when state finishes a frame, after polling input; with
+ * run-ahead on the core never blits by itself.  Frames before the shown
+ * one are not drawn.
+ */
+bool frontend_run_ahead(emu_state *restrict);
+
 //! Null frontends
 extern const frontend_audio null_frontend_audio;
 extern const frontend_video null_frontend_video;
@@ -0,0 +1,33 @@
+#ifndef __FRONTEND_NULL_FORKSRV_H__
+#define __FRONTEND_NULL_FORKSRV_H__
+
+#include "config.h"	// bool, uint[XX]_t
+#include "typedefs.h"	// emu_state
+
+#include <stdio.h>	// FILE
+
+
+typedef struct
+{
+	uint64_t warm_frames;		//! Frames to run before serving (0 = none)
+	int32_t break_pc;		//! Stop warming up here instead (-1 = none)
+	unsigned max_children;		//! Jobs running at once (0 = 1)
+	FILE *jobs;			//! One job per line
+} forksrv_config;
+
+
+/*!
+ * @brief Boot once, then fork a copy-on-write child per job
+ * @param state a freshly initialised instance
+ * @param config warm-up condition and job source
+ * @returns 0 once the job source is exhausted or a signal arrives, -1 if
+ * warm-up failed
+ * @note A job line is "FRAMES [INPUT [SNAPSHOT]]": run FRAMES frames from
+ * the warmed-up state, applying one comma-separated hex joypad mask per
+ * frame from INPUT ("-" for none; the last mask is held), then write a
+ * save state to SNAPSHOT.  Each job prints one "ID STATUS FRAMES FB_HASH
+ * PC" line to stdout.  Children never write back cart RAM.
+ */
+int forksrv_run(emu_state *restrict, const forksrv_config *);
+
+#endif /*!__FRONTEND_NULL_FORKSRV_H__*/
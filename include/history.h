@@ -0,0 +1,78 @@
+#ifndef __HISTORY_H__
+#define __HISTORY_H__
+
+#include "config.h"	// bool, uint[XX]_t, THREAD_LOCAL
+#include "typedefs.h"	// emu_state, history_state
+
+#include <stdio.h>	// FILE
+
+
+//! Instructions kept for crash reports (a power of two)
+#define HISTORY_INSTRS 512
+
+//! MMIO writes kept for crash reports (a power of two)
+#define HISTORY_WRITES 64
+
+//! One write to FF00-FF7F or IE
+typedef struct
+{
+	uint64_t cycle;		//! state->cycles at the write
+	uint16_t pc;		//! Instruction that wrote it
+	uint16_t location;	//! Register written
+	uint8_t data;		//! Value written
+} history_write;
+
+struct history_state_t
+{
+	uint32_t instrs[HISTORY_INSTRS];	//! Recent PCs; in 4000-7FFF, bank << 16
+	history_write writes[HISTORY_WRITES];	//! Most recent MMIO writes
+	uint32_t instr_next;	//! Instructions ever recorded
+	uint32_t write_next;	//! Writes ever recorded
+	bool dumped;		//! Already reported; don't repeat it
+};
+
+//! The instance this thread is running, for the crash handlers
+extern THREAD_LOCAL emu_state *history_running;
+
+
+//! Note the instruction about to run; called from execute
+static inline void history_record_instr(history_state *restrict history,
+	uint32_t entry)
+{
+	// One store: this runs for every instruction, crash or not
+	history->instrs[history->instr_next++ & (HISTORY_INSTRS - 1)] = entry;
+}
+
+//! Address of the instruction running now
+static inline uint16_t history_last_pc(const history_state *restrict history)
+{
+	return (uint16_t)history->instrs[(history->instr_next - 1) &
+		(HISTORY_INSTRS - 1)];
+}
+
+//! Note a write to an I/O register; called from hw_write
+static inline void history_record_write(history_state *restrict history,
+	uint64_t cycle, uint16_t location, uint8_t data)
+{
+	history_write *w = &(history->writes[history->write_next++ &
+		(HISTORY_WRITES - 1)]);
+
+	w->cycle = cycle;
+	w->pc = history_last_pc(history);
+	w->location = location;
+	w->data = data;
+}
+
+/*!
+ * @brief Write the recent instructions and MMIO writes, disassembled
+ * @param state the emulator state
+ * @param out where to write them (flush it first)
+ * @note Instruction bytes are read back at dump time: ROM through the
+ * recorded bank, RAM as it is now.  Formats into a stack buffer and writes
+ * to the file descriptor directly, so it can run from a crash handler with
+ * stdio in an unknown state.  Reports once per instance, and only if it
+ * has run anything.
+ */
+void history_dump(emu_state *restrict, FILE *);
+
+#endif /*!__HISTORY_H__*/
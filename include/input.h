@@ -28,16 +28,80 @@ typedef enum
 	INPUT_START = (RAW_INPUT_P13 | RAW_INPUT_P15),
 } input_key;
 
+//! Frames in a lag second; close enough to the real 59.73
+#define LAG_SECOND_FRAMES 60
+
+/*!
+ * Frames the game's main loop didn't finish, going by whether it read the
+ * joypad before the next VBlank (see opts.lag_*).  Statistics only; not
+ * saved with the state.
+ */
+typedef struct
+{
+	uint32_t polls;		//! Counted FF00 reads since the last VBlank
+	bool lagged;		//! The frame that just ended was a lag frame
+	uint64_t frames;	//! Lag frames ever
+
+	uint32_t second_frames;	//! Frames into the current lag second
+	uint32_t second_lag;	//! Lag frames in it so far
+	uint32_t last_second;	//! Lag frames in the last whole second
+	uint32_t worst_second;	//! Most lag frames in any whole second
+	uint64_t seconds;	//! Whole seconds seen
+	uint64_t lag_seconds;	//! Whole seconds with a lag frame in them
+} lag_state;
+
 struct input_state_t
 {
 	uint8_t col;		//! P14 and P15
 	uint8_t row;		//! P10 through P13
 
 	int pressed[8];		//! Current keys pressed
+
+	lag_state lag;		//! Lag frame detection
 };
 
 
+//! Bit order for joypad masks: Right, Left, Up, Down, A, B, Select, Start
+#define INPUT_MASK_RIGHT	0x01
+#define INPUT_MASK_LEFT		0x02
+#define INPUT_MASK_UP		0x04
+#define INPUT_MASK_DOWN		0x08
+#define INPUT_MASK_A		0x10
+#define INPUT_MASK_B		0x20
+#define INPUT_MASK_SELECT	0x40
+#define INPUT_MASK_START	0x80
+
+
 int key_scan(emu_state *restrict);
 void joypad_signal(emu_state *restrict, input_key, bool);
 
+/*!
+ * @brief The INPUT_MASK_* bit for a key (0 if it isn't one)
+ */
+uint8_t joypad_key_mask(input_key);
+
+/*!
+ * @brief Press and release keys so exactly those in mask are held
+ * @param state the emulator state
+ * @param mask INPUT_MASK_* bits
+ */
+void joypad_set_mask(emu_state *restrict, uint8_t);
+
+/*!
+ * @brief Like joypad_set_mask, but bypasses movie recording and playback
+ * @note For the movie player itself.
+ */
+void joypad_apply_mask(emu_state *restrict, uint8_t);
+
+/*!
+ * @brief Keys currently held, as INPUT_MASK_* bits
+ */
+uint8_t joypad_mask(const emu_state *restrict);
+
+/*!
+ * @brief Decide whether the frame that just ended was a lag frame
+ * @note Called from lcdc_mode1 at VBlank; joypad_read counts the polls.
+ */
+void joypad_vblank(emu_state *restrict);
+
 #endif /*!__INPUT_H_*/
@@ -5,6 +5,10 @@
 #include "typedefs.h"	// typedefs
 
 
+//! Bytes in lcdc.out
+#define LCDC_OUT_SIZE (144 * 160 * sizeof(uint32_t))
+
+
 struct oam_t
 {
 	uint8_t y;
@@ -45,7 +49,7 @@ struct lcdc_state_t
 	bool initial;			//! if the LCD has just turned on
 
 	uint_fast8_t vram_bank;		//! Present VRAM bank
-	uint8_t vram[0x2][0x2000];	//! VRAM banks (DMG only uses 1)
+	uint8_t *vram[0x2];		//! VRAM banks (DMG only uses 1; COW pages)
 
 	uint8_t oam_ram[160];
 
@@ -78,13 +82,14 @@ struct lcdc_state_t
 
 	uint_fast8_t ly;	//! Present line being transferred (144-153 = V-Blank)
 	uint_fast8_t lyc;	//! LY comparison (set stat.lyc_state when == ly)
+	bool lyc_checked;	//! LY == LYC already compared on this line
 
 	bool throt_trigger; //! Trigger to allow throttling of vblank
 
 	uint8_t bg_pal;		//! Background palette
 	uint8_t obj_pal[2];	//! OAM palettes
 
-	uint32_t out[144][160];	//! Simulated LCD screen buffer
+	uint32_t (*out)[160];	//! Simulated LCD screen buffer (COW page)
 };
 
 #define LCDC_DMG_BG(state) ((state)->lcdc.lcd_control & 0x1)
@@ -109,4 +114,6 @@ void lcdc_tick(emu_state *restrict, int);
 
 void lcdc_mode_change(emu_state *restrict, uint8_t);
 
+uint64_t lcdc_screen_hash(const emu_state *);
+
 #endif /*!__LCDC_H_*/
@@ -4,7 +4,6 @@
 #include "config.h"	// bool, *int*_t
 #include "sgherm.h"	// emu_state
 #include "rom.h"	// OFF_CART_TYPE
-#include "memmap.h"	// memmap_*
 
 
 typedef enum
@@ -34,6 +33,17 @@ typedef enum
         CART_CAMERA = 0x1F
 } cart_types;
 
+//! What drives the MBC3 real-time clock
+typedef enum
+{
+	/*! Follow the host clock, including time spent switched off.  What
+	 *  you want when actually playing. */
+	RTC_MODE_WALLCLOCK = 0,
+	/*! Advance from the emulated cycle count only, so the clock is the
+	 *  same however fast the emulator runs. */
+	RTC_MODE_EMULATED,
+} rtc_mode;
+
 typedef struct mbc_common_data_t
 {
 	uint8_t ram_enable;
@@ -42,25 +52,28 @@ typedef struct mbc_common_data_t
 	// TODO various MBC hardware stuff
 } mbc_common_data;
 
+//! MBC3 RTC registers
+typedef struct mbc3_rtc_t
+{
+	uint8_t seconds;
+	uint8_t minutes;
+	uint8_t hours;
+
+	uint16_t days;
+	uint8_t halt;
+	uint8_t day_carry;
+} mbc3_rtc;
+
 typedef struct mbc3_data_t
 {
 	uint8_t ram_rtc_enable;	//! Enable reads/writes to RAM/RTC (A000-BFFF)
 	uint8_t rtc_select;	//! RTC/RAM select switch
 
-	//! RTC registers
-	struct
-	{
-		uint8_t seconds;
-		uint8_t minutes;
-		uint8_t hours;
-
-		uint16_t days;
-		uint8_t halt;
-		uint8_t day_carry;
-	} rtc[2];
+	mbc3_rtc rtc[2];	//! Live registers, then the latched copy
 
 	// Not part of hardware
-	uint64_t unix_time_last;
+	uint64_t unix_time_last;	//! Time the registers were last advanced
+	uint_fast64_t cycles_last;	//! Cycle count of the last whole second
 
 	uint8_t latched;	//! If 0x1, copy time into rtc[1] and read from that
 } mbc3_data;
@@ -84,10 +97,7 @@ struct mbc_state_t
 
 	cart_types cart;		//! Cartridge in use
 
-	uint8_t *cart_ram;		//! Cartridge RAM
-	memmap_state *cart_mm_data;	//! Opaque data for cart RAM
-	bool dirty;			//! Whether data needs to be written back
-	uint_fast32_t dirty_timer;	//! Timer for dirty write
+	uint8_t *cart_ram;		//! Cartridge RAM (owned by state->save)
 
 	unsigned ram_bank;		//! Current RAM bank
 	unsigned ram_bank_size;		//! Size of each bank
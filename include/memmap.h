@@ -5,9 +5,11 @@
 #include "sgherm.h"	// emu_state
 
 void * memmap_open(emu_state *restrict, const char *, size_t, memmap_state **);
+const void * memmap_open_ro(emu_state *restrict, const char *, size_t *, bool, memmap_state **);
 void * memmap_resize(emu_state *restrict, void *, size_t, memmap_state **);
 void memmap_close(emu_state *restrict, void *, memmap_state **);
 void memmap_sync(emu_state *restrict, void *, memmap_state **);
+void memmap_sync_range(emu_state *restrict, void *, size_t, size_t, memmap_state **);
 
 
 #endif /*!__MMAP_H__*/
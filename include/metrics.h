@@ -0,0 +1,77 @@
+#ifndef __METRICS_H__
+#define __METRICS_H__
+
+#include "config.h"	// bool, uint[XX]_t
+#include "typedefs.h"	// emu_state, metrics_state
+
+
+//! First word of every metrics block ("SGHM" read as little-endian)
+#define METRICS_MAGIC 0x4D484753
+
+//! Bump whenever metrics_block changes
+#define METRICS_VERSION 2
+
+//! Shared memory names are this, the pid, a dot and a per-process number
+#define METRICS_PREFIX "/sgherm."
+
+//! Host time per frame is counted in this many buckets
+#define METRICS_FRAME_BUCKETS 12
+
+//! Upper bound of each bucket in microseconds; the last one has none
+#define METRICS_BUCKET_LIMITS { 1000, 2000, 4000, 8000, 12000, 16000, \
+	17500, 20000, 33400, 50000, 100000, 0 }
+
+/*!
+ * What an instance publishes, in host byte order.  The instance stores each
+ * word on its own at VBlank, so a reader gets every word whole but may see
+ * them from two different frames.
+ */
+typedef struct
+{
+	uint32_t magic;		//! METRICS_MAGIC
+	uint32_t version;	//! METRICS_VERSION
+	uint32_t size;		//! sizeof(metrics_block) of the writer
+	uint32_t pid;		//! Process running the instance
+	char title[24];		//! Cart header 0x134-0x143, NUL terminated
+
+	uint64_t start_time;	//! get_time() at start
+	uint64_t update_time;	//! get_time() at the last VBlank (0 = not ready)
+	uint64_t finished;	//! Non-zero once the instance has been torn down
+
+	uint64_t cycles;	//! Emulated cycles
+	uint64_t frames;	//! VBlanks seen
+	uint64_t speed;		//! Emulated time per host time, x1000 (last 0.5s)
+	uint64_t target_speed;	//! state->speed (0 = unlimited or unthrottled)
+	uint64_t frame_time[METRICS_FRAME_BUCKETS];	//! Frames by host time taken
+
+	uint64_t audio_fill;	//! Frames waiting in the audio ring
+	uint64_t audio_size;	//! Frames the audio ring holds (0 = none)
+	uint64_t save_flushes;	//! Cart RAM write-backs
+	uint64_t halt_cycles;	//! Cycles spent in HALT or STOP
+	uint64_t lag_frames;	//! Frames the game didn't poll input in
+	uint64_t lag_second;	//! Lag frames in the last whole second (of 60)
+} metrics_block;
+
+
+/*!
+ * @brief Publish this instance's metrics in POSIX shared memory
+ * @note The name is METRICS_PREFIX, the pid and a number; sgherm-top
+ * finds and shows every block.  If it can't be made, or there is no
+ * shm_open, this warns and the instance runs without.
+ */
+void metrics_start(emu_state *restrict);
+
+/*!
+ * @brief Mark the block finished and remove it
+ * @note Does nothing if metrics_start was never called.
+ */
+void metrics_stop(emu_state *restrict);
+
+/*!
+ * @brief Update the block; called at VBlank when state->metrics is set
+ * @note Relaxed atomic stores to mapped memory: no locks, and no system
+ * calls beyond get_time(), which is in the vDSO on Linux.
+ */
+void metrics_vblank(emu_state *restrict);
+
+#endif /*!__METRICS_H__*/
@@ -0,0 +1,60 @@
+#ifndef __MOVIE_H__
+#define __MOVIE_H__
+
+#include "config.h"	// bool, uint[XX]_t
+#include "typedefs.h"	// emu_state, movie_state
+#include "input.h"	// input_key
+
+
+//! First four bytes of every movie
+#define MOVIE_MAGIC "SGHM"
+
+//! Bump whenever the layout in movie.c changes
+#define MOVIE_VERSION 2
+
+typedef enum
+{
+	MOVIE_NONE = 0,
+	MOVIE_RECORD,		//! Log every joypad transition
+	MOVIE_PLAY,		//! Replay a log, ignoring host input
+} movie_mode;
+
+
+/*!
+ * @brief Start recording joypad input
+ * @param state the emulator state
+ * @param path movie file to create
+ * @returns false if the file could not be written
+ * @note A recording started before the first step is a power-on movie and
+ * only carries cart RAM and the RAM seed; anywhere else it embeds a
+ * snapshot.  Either way playback is only exact in deterministic mode.
+ */
+bool movie_record(emu_state *restrict, const char *);
+
+/*!
+ * @brief Replay a movie
+ * @param state the emulator state, with the movie's ROM loaded
+ * @param path movie to play
+ * @returns false if the movie is corrupt, for another ROM, or a power-on
+ * movie and state has already run
+ */
+bool movie_play(emu_state *restrict, const char *);
+
+/*!
+ * @brief Stop recording or playing, finishing the file of a recording
+ */
+void movie_stop(emu_state *restrict);
+
+/*!
+ * @brief Host input hook, called by joypad_signal
+ * @returns false if the transition should be dropped (during playback)
+ */
+bool movie_input(emu_state *restrict, input_key, bool);
+
+/*!
+ * @brief Apply the playback events due at the present cycle
+ * @note Called from step_emulator whenever a movie is active.
+ */
+void movie_tick(emu_state *restrict);
+
+#endif /*!__MOVIE_H__*/
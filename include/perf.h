@@ -0,0 +1,143 @@
+#ifndef __PERF_H__
+#define __PERF_H__
+
+#include "config.h"	// PERF_COUNTERS, uint[XX]_t
+#include "typedefs.h"	// emu_state, perf_state
+
+#include <signal.h>	// sig_atomic_t
+
+
+//! Where step_emulator's host time goes
+typedef enum
+{
+	PERF_CPU = 0,		//! execute
+	PERF_LCDC,		//! lcdc_tick, less blitting
+	PERF_TIMER,		//! timer_tick
+	PERF_SOUND,		//! sound_tick and deterministic rendering
+	PERF_BLIT,		//! The frontend's blit_canvas
+	PERF_SUBSYSTEMS,
+} perf_subsystem;
+
+//! What the memory heatmap covers, each split into banks of pages
+typedef enum
+{
+	PERF_MEM_ROM = 0,	//! 0000-7FFF; bank 0 is the fixed one
+	PERF_MEM_SRAM,		//! A000-BFFF by MBC RAM bank (RTC included)
+	PERF_MEM_WRAM,		//! C000-DFFF; echo RAM lands here
+	PERF_MEM_VRAM,		//! 8000-9FFF
+	PERF_MEM_OAM,		//! FE00-FEFF
+	PERF_MEM_HRAM,		//! FF80-FFFE
+	PERF_MEM_MMIO,		//! FF00-FF7F and IE
+	PERF_MEM_REGIONS,
+} perf_mem_region;
+
+typedef enum
+{
+	PERF_MEM_READ = 0,	//! Instruction fetches included
+	PERF_MEM_WRITE,
+	PERF_MEM_EXEC,		//! Instructions starting in the page
+	PERF_MEM_KINDS,
+} perf_mem_kind;
+
+//! Accesses that leave the directly indexed paths
+typedef enum
+{
+	PERF_SLOW_MBC_READ = 0,	//! Through the MBC's function pointer
+	PERF_SLOW_MBC_WRITE,
+	PERF_SLOW_HW_READ,	//! Through the hw_read table
+	PERF_SLOW_HW_WRITE,
+	PERF_SLOW_ECHO_READ,	//! Echo RAM, which goes round again
+	PERF_SLOW_ECHO_WRITE,
+	PERF_SLOW_COW,		//! Pages copied on first write after a clone
+	PERF_SLOW_PATHS,
+} perf_slow_path;
+
+//! Heatmap pages are this many bytes
+#define PERF_PAGE_SIZE 0x100
+
+struct perf_state_t
+{
+	uint64_t op[0x100];		//! Executions per opcode
+	uint64_t op_cb[0x100];		//! Executions per CB opcode
+	uint64_t io_read[0x80];		//! Reads per register (0xFF00 + index)
+	uint64_t io_write[0x80];	//! Writes per register
+	uint64_t rom_bank_writes;	//! ROM bank selects
+	uint64_t ram_bank_writes;	//! RAM bank selects
+	uint64_t slow[PERF_SLOW_PATHS];	//! Accesses per slow path
+
+	uint64_t (*heat)[PERF_MEM_KINDS];	//! Accesses per page (NULL = none)
+	size_t heat_banks[PERF_MEM_REGIONS];	//! Banks each region has
+	size_t heat_base[PERF_MEM_REGIONS];	//! Its first page in heat
+	size_t heat_pages;			//! Pages in heat
+
+	uint64_t ticks[PERF_SUBSYSTEMS];//! perf_ticks() spent per subsystem
+	uint64_t start_ticks;		//! perf_ticks() at init, for scaling
+	uint64_t start_time;		//! get_time() at init
+	unsigned dumps_seen;		//! perf_dump_requests already answered
+};
+
+//! Cheapest host clock there is; only differences mean anything
+#if (defined(HAVE_COMPILER_GCC) || defined(HAVE_COMPILER_CLANG) || \
+	defined(HAVE_COMPILER_INTEL)) && (defined(__x86_64__) || defined(__i386__))
+#	include <x86intrin.h>	// __rdtsc
+#	define perf_ticks() ((uint64_t)__rdtsc())
+#elif defined(HAVE_COMPILER_MSVC) && (defined(_M_X64) || defined(_M_IX86))
+#	include <intrin.h>	// __rdtsc
+#	define perf_ticks() ((uint64_t)__rdtsc())
+#else
+#	include "util_time.h"	// get_time
+#	define perf_ticks() ((uint64_t)get_time())
+#endif
+
+#ifdef PERF_COUNTERS
+#	define PERF_COUNT(state, counter) ((state)->perf.counter++)
+
+//! Count an access to location in the heatmap
+#	define PERF_MEM(state, location, kind) perf_mem((state), (location), (kind))
+
+//! Run stmt, charging the host time it takes to sub
+#	define PERF_TIME(state, sub, stmt) do { \
+		const uint64_t perf_t0_ = perf_ticks(); \
+		stmt; \
+		(state)->perf.ticks[sub] += perf_ticks() - perf_t0_; \
+	} while(0)
+
+//! Bumped by SIGUSR1; every instance dumps once per bump
+extern volatile sig_atomic_t perf_dump_requests;
+#else
+#	define PERF_COUNT(state, counter) ((void)0)
+#	define PERF_MEM(state, location, kind) ((void)0)
+#	define PERF_TIME(state, sub, stmt) do { stmt; } while(0)
+#endif
+
+
+/*!
+ * @brief Start counting from zero
+ */
+void perf_init(emu_state *restrict);
+
+/*!
+ * @brief Free what perf_init allocated
+ */
+void perf_finish(emu_state *restrict);
+
+/*!
+ * @brief Print every counter through info()
+ * @note Opcodes, registers and memory pages are sorted hottest first and
+ * unused ones are left out.  Does nothing unless built with PERF_COUNTERS.
+ */
+void perf_dump(emu_state *restrict);
+
+/*!
+ * @brief Count a read, write or instruction at location, by region and bank
+ * @note Use PERF_MEM, which is nothing without PERF_COUNTERS.
+ */
+void perf_mem(emu_state *restrict, uint16_t, perf_mem_kind);
+
+/*!
+ * @brief Dump if a SIGUSR1 arrived since the last check
+ * @note Called at every VBlank when built with PERF_COUNTERS.
+ */
+void perf_poll(emu_state *restrict);
+
+#endif /*!__PERF_H__*/
@@ -14,11 +14,45 @@
 #ifdef NORETURN
 #	undef NORETURN
 #endif
+#ifdef ATOMIC_INC
+#	undef ATOMIC_INC
+#endif
+#ifdef ATOMIC_DEC
+#	undef ATOMIC_DEC
+#endif
+#ifdef ATOMIC_LOAD64
+#	undef ATOMIC_LOAD64
+#endif
+#ifdef ATOMIC_STORE64
+#	undef ATOMIC_STORE64
+#endif
+#ifdef ATOMIC_STORE64_RELAXED
+#	undef ATOMIC_STORE64_RELAXED
+#endif
+#ifdef ATOMIC_CAS64
+#	undef ATOMIC_CAS64
+#endif
+#ifdef THREAD_LOCAL
+#	undef THREAD_LOCAL
+#endif
 
 #define UNUSED __attribute__((__unused__))
 #define unlikely(x) (!!__builtin_expect((x), 0))
 #define likely(x) (!!__builtin_expect((x), 1))
 
+// Reference counting on a long; DEC returns the new value
+#define ATOMIC_INC(p) __atomic_add_fetch((p), 1, __ATOMIC_RELAXED)
+#define ATOMIC_DEC(p) __atomic_sub_fetch((p), 1, __ATOMIC_ACQ_REL)
+
+// 64-bit words for lock-free queues; CAS returns true on success
+#define ATOMIC_LOAD64(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define ATOMIC_STORE64(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#define ATOMIC_STORE64_RELAXED(p, v) __atomic_store_n((p), (v), __ATOMIC_RELAXED)
+#define ATOMIC_CAS64(p, old, new) __atomic_compare_exchange_n((p), &(old), \
+	(new), false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)
+
+#define THREAD_LOCAL __thread
+
 #if __STDC_VERSION__ >= 201112L
 #	define NORETURN _Noreturn
 #else
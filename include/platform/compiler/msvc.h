@@ -13,12 +13,60 @@
 #ifdef NORETURN
 #	undef NORETURN
 #endif
+#ifdef ATOMIC_INC
+#	undef ATOMIC_INC
+#endif
+#ifdef ATOMIC_DEC
+#	undef ATOMIC_DEC
+#endif
+#ifdef ATOMIC_LOAD64
+#	undef ATOMIC_LOAD64
+#endif
+#ifdef ATOMIC_STORE64
+#	undef ATOMIC_STORE64
+#endif
+#ifdef ATOMIC_STORE64_RELAXED
+#	undef ATOMIC_STORE64_RELAXED
+#endif
+#ifdef ATOMIC_CAS64
+#	undef ATOMIC_CAS64
+#endif
+#ifdef THREAD_LOCAL
+#	undef THREAD_LOCAL
+#endif
 
 #define unlikely(x) (x)
 #define likely(x) (x)
 
 #define NORETURN __declspec(noreturn)
 
+#define THREAD_LOCAL __declspec(thread)
+
+#include <intrin.h>
+#define ATOMIC_INC(p) _InterlockedIncrement((volatile long *)(p))
+#define ATOMIC_DEC(p) _InterlockedDecrement((volatile long *)(p))
+
+// 64-bit words for lock-free queues; CAS returns true on success and
+// updates old on failure, like the GCC builtin
+#define ATOMIC_LOAD64(p) ((uint64_t)_InterlockedOr64((volatile __int64 *)(p), 0))
+#define ATOMIC_STORE64(p, v) ((void)_InterlockedExchange64((volatile __int64 *)(p), (__int64)(v)))
+#ifdef _M_X64
+	// Aligned 64-bit stores are whole on x64
+#	define ATOMIC_STORE64_RELAXED(p, v) ((void)(*(volatile __int64 *)(p) = (__int64)(v)))
+#else
+#	define ATOMIC_STORE64_RELAXED(p, v) ATOMIC_STORE64(p, v)
+#endif
+#define ATOMIC_CAS64(p, old, new) msvc_cas64((volatile __int64 *)(p), \
+	(__int64 *)&(old), (__int64)(new))
+
+static __inline int msvc_cas64(volatile __int64 *p, __int64 *old, __int64 new_val)
+{
+	__int64 prev = _InterlockedCompareExchange64(p, new_val, *old);
+	int ok = (prev == *old);
+	*old = prev;
+	return ok;
+}
+
 #if (_MSC_VER >= 1300)
 #	define UNUSED __pragma(warning(disable:4100))
 #else
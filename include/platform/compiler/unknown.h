@@ -13,6 +13,41 @@
 #	define likely(x) (x)
 #endif
 
+// Not atomic!  Don't share ROM images between threads here.
+#ifndef ATOMIC_INC
+#	define ATOMIC_INC(p) (++*(p))
+#endif
+
+#ifndef ATOMIC_DEC
+#	define ATOMIC_DEC(p) (--*(p))
+#endif
+
+#ifndef ATOMIC_LOAD64
+#	define ATOMIC_LOAD64(p) (*(p))
+#endif
+
+#ifndef ATOMIC_STORE64
+#	define ATOMIC_STORE64(p, v) (*(p) = (v))
+#endif
+
+#ifndef ATOMIC_STORE64_RELAXED
+#	define ATOMIC_STORE64_RELAXED(p, v) (*(p) = (v))
+#endif
+
+#ifndef ATOMIC_CAS64
+#	define ATOMIC_CAS64(p, old, new) (*(p) == (old) ? \
+		(*(p) = (new), true) : ((old) = *(p), false))
+#endif
+
+#ifndef THREAD_LOCAL
+#	if __STDC_VERSION__ >= 201112L
+#		define THREAD_LOCAL _Thread_local
+#	else
+		// Crash reports may name the wrong instance with several threads
+#		define THREAD_LOCAL
+#	endif
+#endif
+
 #if __STDC_VERSION__ >= 201112L
 #	define NORETURN _Noreturn
 #else
@@ -0,0 +1,59 @@
+#ifndef __PLATFORM_THREADS_H__
+#define __PLATFORM_THREADS_H__
+
+#include "config.h"	// bool, HAVE_PTHREADS, HAVE_WIN32_THREADS
+
+/*
+ * Just enough threading for the batch workers and the log drainer.
+ * HAVE_THREADS is left undefined when there is none, and callers fall back
+ * to doing the work on the calling thread.
+ */
+
+#if defined(HAVE_PTHREADS)
+#	include <pthread.h>	// pthread_*
+#	include "util_time.h"	// sleep_nsec
+
+typedef pthread_t host_thread;
+typedef pthread_mutex_t host_mutex;
+typedef pthread_cond_t host_cond;
+
+#	define THREAD_FN(name, arg) static void * name(void *arg)
+#	define THREAD_RETURN return NULL
+#	define MUTEX_INIT(m) (pthread_mutex_init((m), NULL) == 0)
+#	define MUTEX_DESTROY(m) pthread_mutex_destroy(m)
+#	define MUTEX_LOCK(m) pthread_mutex_lock(m)
+#	define MUTEX_UNLOCK(m) pthread_mutex_unlock(m)
+#	define COND_INIT(c) (pthread_cond_init((c), NULL) == 0)
+#	define COND_DESTROY(c) pthread_cond_destroy(c)
+#	define COND_WAIT(c, m) pthread_cond_wait((c), (m))
+#	define COND_BROADCAST(c) pthread_cond_broadcast(c)
+#	define COND_SIGNAL(c) pthread_cond_signal(c)
+#	define THREAD_START(t, fn, arg) (pthread_create((t), NULL, (fn), (arg)) == 0)
+#	define THREAD_JOIN(t) pthread_join((t), NULL)
+#	define THREAD_SLEEP_MS(ms) sleep_nsec((uint64_t)(ms) * 1000000)
+#	define HAVE_THREADS
+#elif defined(HAVE_WIN32_THREADS)
+#	include <windows.h>	// CreateThread, SRWLOCK, CONDITION_VARIABLE
+
+typedef HANDLE host_thread;
+typedef SRWLOCK host_mutex;
+typedef CONDITION_VARIABLE host_cond;
+
+#	define THREAD_FN(name, arg) static DWORD WINAPI name(LPVOID arg)
+#	define THREAD_RETURN return 0
+#	define MUTEX_INIT(m) (InitializeSRWLock(m), true)
+#	define MUTEX_DESTROY(m) ((void)(m))
+#	define MUTEX_LOCK(m) AcquireSRWLockExclusive(m)
+#	define MUTEX_UNLOCK(m) ReleaseSRWLockExclusive(m)
+#	define COND_INIT(c) (InitializeConditionVariable(c), true)
+#	define COND_DESTROY(c) ((void)(c))
+#	define COND_WAIT(c, m) SleepConditionVariableSRW((c), (m), INFINITE, 0)
+#	define COND_BROADCAST(c) WakeAllConditionVariable(c)
+#	define COND_SIGNAL(c) WakeConditionVariable(c)
+#	define THREAD_START(t, fn, arg) ((*(t) = CreateThread(NULL, 0, (fn), (arg), 0, NULL)) != NULL)
+#	define THREAD_JOIN(t) (WaitForSingleObject((t), INFINITE), CloseHandle(t))
+#	define THREAD_SLEEP_MS(ms) Sleep(ms)
+#	define HAVE_THREADS
+#endif
+
+#endif /*__PLATFORM_THREADS_H__*/
@@ -1,57 +1,157 @@
 #ifndef __PRINT_H_
 #define __PRINT_H_
 
-#include "config.h"	// config
+#include "config.h"	// config, LOG_LEVEL
 #include "sgherm.h"	// emu_state
 
 #include <stdio.h>	// FILE *
 
 /*!
- * @brief	Display an error and quit fast.
+ * @brief	Display an error that the instance can't recover from.
  * @param	state	The state raising the error.  NULL if global.
  * @param	str	The format of the error to print.
- * @result	The error is printed and the program is immediately
- * 		terminated with an error exit code.
- * 		(atexit() methods are still run - use abort if you don't
- * 		like it.)
+ * @result	The error is printed, followed by the instance's recent
+ * 		instructions and I/O writes, and state->status is set to
+ * 		EMU_STATUS_FATAL, after which step_emulator returns false.
+ * 		The process keeps running; the caller must unwind.
  */
-NORETURN void fatal(emu_state *, const char *, ...);
+void fatal(emu_state *, const char *, ...);
+
+//! Message severities, least severe first; LOG_LEVEL is the least built in
+#define LOG_LEVEL_DEBUG 1
+#define LOG_LEVEL_INFO 2
+#define LOG_LEVEL_WARNING 3
+#define LOG_LEVEL_ERROR 4
+#define LOG_LEVEL_FATAL 5
+
+#ifndef LOG_LEVEL
+#	ifdef NDEBUG
+#		define LOG_LEVEL LOG_LEVEL_INFO
+#	else
+#		define LOG_LEVEL LOG_LEVEL_DEBUG
+#	endif
+#endif
+
+//! Messages one call site may log per second before the rest are suppressed
+#define LOG_BURST 10
+
+//! Rate limit state for one call site; zero is a valid start
+typedef struct
+{
+	uint64_t window;	//! Second (high half), messages in it (low half)
+	uint64_t suppressed;	//! Dropped since the last one let through
+} log_site;
+
+/*!
+ * @brief	Queue a message for the log.
+ * @param	state	The state logging it.  NULL if global.
+ * @param	level	LOG_LEVEL_*, for the prefix.
+ * @param	site	Rate limit for the call site, or NULL for none.
+ * @param	str	The format of the message.
+ * @note	Use the debug/info/warning/error/report macros rather than
+ * 		this.  An instance's messages are formatted straight away but
+ * 		written out by a background thread; global ones are written
+ * 		directly.  Messages with no site are never dropped: if the
+ * 		queue is full, the caller writes it out first.
+ */
+void log_message(emu_state *, int, log_site *, const char *, ...);
+
+/*!
+ * @brief	Write out everything the instance has queued, now.
+ */
+void log_flush(emu_state *);
+
+/*!
+ * @brief	Flush and free the instance's queue (finish_emulator).
+ * @param	summary say how many messages were suppressed or dropped
+ */
+void log_finish(emu_state *, bool);
+
+//! Log at a level, with a rate limit of its own for each place it is used
+#define LOG_AT(level, state, ...) \
+	do \
+	{ \
+		static log_site log_site_; \
+		log_message((state), (level), &log_site_, __VA_ARGS__); \
+	} while(0)
+
+//! Compiled out, but the arguments still count as used
+#define LOG_NONE(state, ...) \
+	do \
+	{ \
+		if(0) \
+		{ \
+			log_message((state), 0, NULL, __VA_ARGS__); \
+		} \
+	} while(0)
 
 /*!
  * @brief	Report an error condition to the user.
  * @param	state	The state raising the error.  NULL if global.
  * @param	str	The format of the error to print.
  */
-void error(emu_state *, const char *, ...);
+#if LOG_LEVEL <= LOG_LEVEL_ERROR
+#	define error(state, ...) LOG_AT(LOG_LEVEL_ERROR, state, __VA_ARGS__)
+#else
+#	define error(state, ...) LOG_NONE(state, __VA_ARGS__)
+#endif
+
+/*!
+ * @brief	Report a warning condition to the user
+ * @param	state	The state reporting the warning.  NULL if global.
+ * @param	str	The format of the warning to print
+ */
+#if LOG_LEVEL <= LOG_LEVEL_WARNING
+#	define warning(state, ...) LOG_AT(LOG_LEVEL_WARNING, state, __VA_ARGS__)
+#else
+#	define warning(state, ...) LOG_NONE(state, __VA_ARGS__)
+#endif
 
 /*!
  * @brief	Display information to the user.
  * @param	state	The state showing the message.  NULL if global.
  * @param	str	The format of the information to print.
  */
-void info(emu_state *, const char *, ...);
+#if LOG_LEVEL <= LOG_LEVEL_INFO
+#	define info(state, ...) LOG_AT(LOG_LEVEL_INFO, state, __VA_ARGS__)
+#else
+#	define info(state, ...) LOG_NONE(state, __VA_ARGS__)
+#endif
 
 /*!
- * @brief	Report a warning condition to the user
- * @param	state	The state reporting the warning.  NULL if global.
- * @param	str	The format of the warning to print
+ * @brief	Display one line of a long report, such as perf_dump's.
+ * @param	state	The state the report is about.  NULL if global.
+ * @param	str	The format of the line to print.
+ * @note	Like info, but never rate limited or dropped.
  */
-void warning(emu_state *, const char *, ...);
+#if LOG_LEVEL <= LOG_LEVEL_INFO
+#	define report(state, ...) \
+		log_message((state), LOG_LEVEL_INFO, NULL, __VA_ARGS__)
+#else
+#	define report(state, ...) LOG_NONE(state, __VA_ARGS__)
+#endif
 
 /*!
  * @brief	Display debug information to the user.
  * @param	state	The state being debugged.  NULL if global.
  * @param	str	The format of the information to print.
- * @note	This method is a no-op if NDEBUG is defined during
- * 		compilation.  Do not rely on this method for important
- * 		messages; use info instead.
+ * @note	Compiled out unless LOG_LEVEL is LOG_LEVEL_DEBUG, which is
+ * 		the default only without NDEBUG.  Do not rely on this for
+ * 		important messages; use info instead.
  */
-void debug(emu_state *, const char *, ...);
+#if LOG_LEVEL <= LOG_LEVEL_DEBUG
+#	define debug(state, ...) LOG_AT(LOG_LEVEL_DEBUG, state, __VA_ARGS__)
+#else
+#	define debug(state, ...) LOG_NONE(state, __VA_ARGS__)
+#endif
+
+//! Per-instance log if there is one, else the process default
+FILE * log_file(const emu_state *);
 
-//! Where stdout goes with these functions
+//! Where frontends send their own output (set once at startup)
 extern FILE *to_stdout;
 
-//! Where stderr goes with these functions
+//! Where messages go for instances without opts.log, and for NULL state
 extern FILE *to_stderr;
 
 #endif /*!__PRINT_H_*/
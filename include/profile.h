@@ -0,0 +1,46 @@
+#ifndef __PROFILE_H__
+#define __PROFILE_H__
+
+#include "config.h"	// bool, uint[XX]_t
+#include "typedefs.h"	// emu_state, profile_state
+
+
+/*!
+ * @brief Start attributing host time to guest code
+ * @param state the emulator state
+ * @returns false if out of memory
+ * @note Every instruction is charged the host time from its fetch to the
+ * end of its handler, MMIO slow paths included, against its ROM bank and
+ * address.  CALL, RST and interrupts push a shadow frame and RET/RETI pop
+ * it, giving a call tree for flame graphs.  Time outside execute (LCDC,
+ * timer, sound) is not guest code and is not charged.
+ */
+bool profile_start(emu_state *restrict);
+
+/*!
+ * @brief Write the profiles asked for in opts and stop profiling
+ * @note opts.profile_path gets a flat profile, hottest address first;
+ * opts.profile_stacks_path gets collapsed stacks for flamegraph.pl, in
+ * nanoseconds.  Does nothing if profile_start was never called.
+ */
+void profile_stop(emu_state *restrict);
+
+/*!
+ * @brief Note the instruction about to be fetched
+ * @note Called from execute when state->debug.profile is set.
+ */
+void profile_begin(emu_state *restrict);
+
+/*!
+ * @brief Charge the instruction since profile_begin and follow calls
+ * @param state the emulator state
+ * @param opcode the instruction just executed
+ */
+void profile_end(emu_state *restrict, uint8_t);
+
+/*!
+ * @brief Push a frame for the interrupt just dispatched
+ */
+void profile_interrupt(emu_state *restrict);
+
+#endif /*!__PROFILE_H__*/
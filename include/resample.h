@@ -0,0 +1,78 @@
+#ifndef __RESAMPLE_H__
+#define __RESAMPLE_H__
+
+#include "config.h"	// size_t, uint[XX]_t
+#include "typedefs.h"	// resampler
+
+#include <stddef.h>	// size_t
+
+
+/*! Filter quality: trades table size and stopband depth for speed */
+typedef enum
+{
+	RESAMPLE_QUALITY_LOW = 0,	//! 64 phases, ~50dB stopband
+	RESAMPLE_QUALITY_MEDIUM,	//! 256 phases, ~80dB stopband
+	RESAMPLE_QUALITY_HIGH,		//! 1024 phases, ~100dB stopband
+} resample_quality;
+
+/*! Filter length: trades transition band for group delay */
+typedef enum
+{
+	RESAMPLE_LATENCY_LOW = 0,	//! 8 zero crossings per side
+	RESAMPLE_LATENCY_MEDIUM,	//! 16 zero crossings per side
+	RESAMPLE_LATENCY_HIGH,		//! 32 zero crossings per side
+} resample_latency;
+
+
+/*!
+ * @brief Create a polyphase windowed-sinc resampler
+ * @param in_rate input sample rate in Hz
+ * @param out_rate output sample rate in Hz
+ * @param quality phase resolution and window shape
+ * @param latency filter length
+ * @returns the new resampler, or NULL on allocation failure
+ */
+resampler * resampler_new(unsigned, unsigned, resample_quality, resample_latency);
+
+/*!
+ * @brief Destroy a resampler
+ */
+void resampler_free(resampler *);
+
+/*!
+ * @brief Discard all buffered input and restart at phase zero
+ */
+void resampler_reset(resampler *);
+
+/*!
+ * @brief Number of input frames needed before out_frames can be pulled
+ */
+size_t resampler_input_needed(const resampler *, size_t);
+
+/*!
+ * @brief Append interleaved stereo input
+ * @param in interleaved s16 frames at the input rate
+ * @param frames number of frames
+ * @returns false if the internal buffer could not be grown
+ */
+bool resampler_push_s16(resampler *restrict, const int16_t *restrict, size_t);
+
+/*!
+ * @brief Produce interleaved stereo output
+ * @param out buffer for frames * 2 samples at the output rate
+ * @param frames number of frames wanted
+ * @returns number of frames written (less than requested on underrun)
+ */
+size_t resampler_pull_s16(resampler *restrict, int16_t *restrict, size_t);
+
+/*!
+ * @brief Name of the kernel selected for this CPU (for diagnostics)
+ */
+const char * resampler_kernel_name(const resampler *);
+
+/*!
+ * @brief Group delay of the filter in input frames
+ */
+unsigned resampler_delay(const resampler *);
+
+#endif /*!__RESAMPLE_H__*/
@@ -0,0 +1,62 @@
+#ifndef __REWIND_H__
+#define __REWIND_H__
+
+#include "config.h"	// bool, uint[XX]_t
+#include "typedefs.h"	// emu_state, rewind_state
+
+#include <stddef.h>	// size_t
+
+
+//! Default memory budget; several minutes of typical gameplay
+#define REWIND_DEFAULT_BUDGET (64 * 1024 * 1024)
+
+//! Default frames between full snapshots
+#define REWIND_DEFAULT_INTERVAL 60
+
+
+/*!
+ * @brief Create a rewind buffer for an instance
+ * @param state the emulator state (only used to size snapshots)
+ * @param budget total bytes to use, including scratch buffers
+ * @param interval frames between keyframes; other frames are stored as an
+ * XOR delta against the last keyframe
+ * @returns the new buffer, or NULL if budget is too small or allocation
+ * failed
+ */
+rewind_state * rewind_new(emu_state *restrict, size_t, unsigned);
+
+/*!
+ * @brief Destroy a rewind buffer
+ */
+void rewind_free(rewind_state *);
+
+/*!
+ * @brief Capture the current frame, dropping the oldest ones if needed
+ * @note Call once per frame, e.g. when state->frames changes
+ * @returns false if the frame could not be stored
+ */
+bool rewind_push(rewind_state *restrict, emu_state *restrict);
+
+/*!
+ * @brief Go back to an earlier captured frame
+ * @param rw the rewind buffer
+ * @param state the emulator state
+ * @param frames how far back from the newest captured frame; 0 restores
+ * the newest frame itself
+ * @returns frames actually gone back (clamped to what is held), or -1 if
+ * nothing could be restored.  Frames newer than the restored one are
+ * discarded.
+ */
+int rewind_back(rewind_state *restrict, emu_state *restrict, unsigned);
+
+/*!
+ * @brief Number of frames currently held
+ */
+size_t rewind_frames(const rewind_state *);
+
+/*!
+ * @brief Bytes of compressed frame data currently held
+ */
+size_t rewind_used(const rewind_state *);
+
+#endif /*!__REWIND_H__*/
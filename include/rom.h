@@ -98,8 +98,21 @@ struct cart_header_t
 	uint16_t cart_checksum;	// 0x14E-0x14F Unenforced
 };
 
+//! A loaded ROM file, shareable between emulator instances
+struct rom_image_t
+{
+	const uint8_t *data;	//! ROM contents (read-only)
+	size_t size;		//! Size of data
+	memmap_state *mm;	//! Opaque data for the mapping
+	long refs;		//! References held (ATOMIC_INC/DEC only)
+};
+
 extern const char *friendly_cart_names[0x20];
 
+rom_image * rom_image_open(emu_state *restrict, const char *, bool);
+rom_image * rom_image_ref(rom_image *);
+void rom_image_unref(emu_state *restrict, rom_image *);
+
 bool read_rom_data(emu_state *restrict, const char *restrict,
 	cart_header *restrict *restrict);
 bool read_bootrom_data(emu_state *restrict, const char *);
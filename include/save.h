@@ -0,0 +1,67 @@
+#ifndef __SAVE_H__
+#define __SAVE_H__
+
+#include "config.h"	// bool, uint[XX]_t
+#include "typedefs.h"	// save_state, memmap_state
+
+#include <stddef.h>	// size_t
+
+
+//! Granularity of the cart RAM dirty bitmap
+#define SAVE_PAGE_SIZE 256
+
+//! Default number of frames a dirty cart RAM may wait before write-back
+#define SAVE_DEFAULT_INTERVAL 60
+
+//! How cart RAM reaches the save file
+typedef enum
+{
+	/*! Save file is mapped shared; dirty ranges are msync'd at frame
+	 *  boundaries.  Cheapest, and survives a killed process, but a power
+	 *  loss mid-writeback can tear the file. */
+	SAVE_MODE_MMAP = 0,
+	/*! Cart RAM lives in memory; write-back goes to a temporary file that
+	 *  is fsync'd and renamed over the save, so the file on disk is always
+	 *  a complete image. */
+	SAVE_MODE_JOURNAL,
+} save_mode;
+
+struct save_state_t
+{
+	save_mode mode;			//! Write-back strategy
+	const char *path;		//! Save file (NULL = no backing store)
+	char *tmp_path;			//! Journal temporary file
+
+	uint8_t *data;			//! Cart RAM image
+	size_t size;			//! Size of data
+	memmap_state *mm;		//! Opaque data for SAVE_MODE_MMAP
+
+	uint8_t *dirty_map;		//! One bit per SAVE_PAGE_SIZE bytes
+	size_t pages;			//! Number of pages in dirty_map
+	bool dirty;			//! Any bit set in dirty_map
+
+	uint_fast64_t interval;		//! Cycles a dirty page may wait
+	uint_fast64_t flush_at;		//! Cycle count of the next write-back
+	unsigned flushes;		//! Write-backs performed (statistics)
+};
+
+
+uint8_t * save_open(emu_state *restrict, size_t);
+void save_flush(emu_state *restrict);
+void save_close(emu_state *restrict);
+
+/*!
+ * @brief Flush at a frame boundary if the write-back deadline has passed
+ * @note Called at VBlank, and from step_emulator while the LCD is off
+ */
+void save_frame(emu_state *restrict);
+
+/*!
+ * @brief Mark a byte range of cart RAM as modified
+ * @param state the emulator state
+ * @param offset offset into cart RAM
+ * @param len number of bytes
+ */
+void save_mark_range(emu_state *restrict, size_t, size_t);
+
+#endif /*!__SAVE_H__*/
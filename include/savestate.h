@@ -0,0 +1,50 @@
+#ifndef __SAVESTATE_H__
+#define __SAVESTATE_H__
+
+#include "config.h"	// bool, uint[XX]_t
+#include "typedefs.h"	// emu_state
+
+#include <stddef.h>	// size_t
+
+
+//! First four bytes of every snapshot
+#define SAVESTATE_MAGIC "SGHS"
+
+//! Bump whenever the layout in savestate.c changes
+#define SAVESTATE_VERSION 2
+
+
+/*!
+ * @brief Size of a snapshot of this instance
+ * @note Constant for the lifetime of an instance (it only depends on the
+ * cart RAM size), so a buffer can be allocated once and reused.
+ */
+size_t state_size(emu_state *restrict);
+
+/*!
+ * @brief Snapshot the emulator state
+ * @param state the emulator state
+ * @param buf buffer of at least state_size() bytes
+ * @param len size of buf
+ * @returns bytes written, or 0 if buf is too small
+ */
+size_t state_save(emu_state *restrict, void *restrict, size_t);
+
+/*!
+ * @brief Restore a snapshot taken with state_save
+ * @param state the emulator state (must have the same ROM loaded)
+ * @param buf the snapshot
+ * @param len size of the snapshot
+ * @returns false, leaving state untouched, if the snapshot is corrupt,
+ * from another version or from another ROM
+ */
+bool state_load(emu_state *restrict, const void *restrict, size_t);
+
+/*!
+ * @brief Hash everything a snapshot would hold, without writing one
+ * @returns a hash that is equal for two instances exactly when their
+ * snapshots are (barring collisions), on any host
+ */
+uint64_t state_hash(emu_state *restrict);
+
+#endif /*!__SAVESTATE_H__*/
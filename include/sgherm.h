@@ -14,6 +14,12 @@
 #include "ctl_unit.h"	// interrupts
 #include "frontend.h"	// frontend
 #include "debug.h"	// debug_state
+#include "save.h"	// save_state, save_mode
+#include "cow.h"	// cow_state
+#include "movie.h"	// movie_mode
+#include "perf.h"	// perf_state
+
+#include <stdio.h>	// FILE
 
 
 typedef enum
@@ -26,6 +32,16 @@ typedef enum
 	SYSTEM_CGB
 } system_types;
 
+//! Dot clocks per frame (154 lines of 456)
+#define CLOCKS_PER_FRAME 70224
+
+//! Whether an instance can keep running
+typedef enum
+{
+	EMU_STATUS_OK = 0,		//! Running normally
+	EMU_STATUS_FATAL,		//! fatal() was raised; see the log
+} emu_status;
+
 // 8-bit address space
 #define MEM_SIZE	0x10000
 
@@ -50,16 +66,67 @@ struct registers_t
 	uint16_t sp;		//! Stack pointer
 };
 
+//! Per-instance options, copied into the state by init_emulator
+struct emu_options_t
+{
+	save_mode save_mode;		//! How cart RAM is written back
+	unsigned save_interval;		//! Frames dirty cart RAM may wait (0 = default)
+
+	rtc_mode rtc_mode;		//! MBC3 clock source
+
+	rom_image *rom;			//! Already loaded ROM to share (NULL = load path)
+	bool rom_hugepages;		//! Ask for huge pages when mapping the ROM
+
+	FILE *log;			//! Where messages go (NULL = to_stderr)
+	bool unthrottled;		//! Never sleep for VBlank (batch runs, tools)
+
+	movie_mode movie_mode;		//! Record or play input from power-on
+	const char *movie_path;		//! Movie file for movie_mode
+	bool movie_exit;		//! Leave the event loop when playback ends
+
+	/*!
+	 * Same inputs, same bits: forces the emulated RTC, seeds power-on RAM
+	 * from seed, renders audio on the emulation thread, and keeps
+	 * frame_hash.  VBlank throttling still sleeps, but only ever delays.
+	 */
+	bool deterministic;
+	uint64_t seed;			//! Power-on RAM contents in deterministic mode
+
+	unsigned run_ahead;		//! Frames to show ahead; the real state isn't drawn
+
+	const char *profile_path;	//! Flat guest profile (NULL = none)
+	const char *profile_stacks_path;//! Collapsed call stacks (NULL = none)
+
+	const char *trace_path;		//! Binary instruction trace (NULL = none)
+	size_t trace_records;		//! Trace ring size (0 = default)
+
+	const char *events_path;	//! Chrome trace of hardware events (NULL = none)
+	size_t events_records;		//! Event ring size (0 = default)
+
+	bool metrics;			//! Publish live metrics for sgherm-top
+
+	/*!
+	 * Lag frame heuristics: a frame lags if the game reads FF00 fewer
+	 * than lag_min_polls times (0 = once) between VBlanks.  If lag_pc_hi
+	 * is set, only reads by code in lag_pc_lo..lag_pc_hi count, to leave
+	 * out interrupt handlers that poll every frame regardless.
+	 */
+	unsigned lag_min_polls;
+	uint16_t lag_pc_lo, lag_pc_hi;
+};
+
 //! The main emulation state structure
 struct emu_state_t
 {
 	uint8_t hram[0x7F];		//! High memory
-	uint8_t wram[8][0x1000];	//! Work RAM banks (1-7 CGB only)
+	uint8_t *wram[8];		//! Work RAM banks (1-7 CGB only; COW pages)
 	uint_fast32_t wram_bank;	//! current WRAM bank
 
-	uint8_t *cart_data;		//! Cartridge data
+	rom_image *rom;			//! Cartridge image (holds a reference)
+	const uint8_t *cart_data;	//! Cartridge data (rom->data)
 	uint_fast32_t cart_size;	//! Size of cartridge data
 	const char *save_path;		//! Save file
+	save_state save;		//! Cart RAM write-back
 
 	uint8_t *bootrom_data;		//! Exactly what it says on the tin
 	bool in_bootrom;		//! Executing in bootrom
@@ -74,11 +141,25 @@ struct emu_state_t
 	uint_fast32_t wait;		//! number of clocks to wait
 
 	uint_fast64_t cycles;		//! Present cycle count
+	uint_fast64_t halt_cycles;	//! Cycles spent in HALT or STOP (statistics)
+	uint_fast64_t frames;		//! VBlanks seen (frame number)
+	uint64_t frame_hash;		//! state_hash at the last VBlank (deterministic mode)
 	uint_fast64_t start_time;	//! Time started
 	uint_fast64_t next_vblank_time;	//! Timestamp for next vblank
+	unsigned speed;			//! Throttle multiplier (SPEED_UNLIMITED = none)
+	uint_fast64_t next_present_time;//! Earliest blit when unlimited
 
 	system_types system;		//! Present emulation mode
 
+	emu_options opts;		//! Options given at init time
+	emu_status status;		//! Set by fatal(); instance is dead if not OK
+	cow_state cow;			//! Pages shared with clones
+	bool quit;			//! Frontend asked to leave the event loop
+	bool hidden;			//! Run-ahead frame nobody sees; don't draw it
+	movie_state *movie;		//! Input movie being recorded or played
+	log_ring *log;			//! Messages waiting to be written (NULL until the first)
+	metrics_state *metrics;		//! Live metrics block (NULL = not published)
+
 	// CPU state
 	cpu_freq freq;			//! CPU frequency
 	uint_fast8_t step_core;		//! Ticks per step
@@ -94,6 +175,9 @@ struct emu_state_t
 	ser_state ser;
 
 	debug_state debug;
+#ifdef PERF_COUNTERS
+	perf_state perf;
+#endif
 
 	frontend front;
 };
@@ -124,8 +208,36 @@ struct emu_state_t
 
 #define IS_FLAG(state, flag) ((REG_F(state) & (flag)) == flag)
 
-emu_state * init_emulator(const char *, const char *, const char *);
+//! emu_set_speed value that never throttles
+#define SPEED_UNLIMITED 0
+
+emu_state * init_emulator(const char *, const char *, const char *, const emu_options *);
 void finish_emulator(emu_state * restrict);
+emu_state * emu_clone(emu_state * restrict);
+void emu_free_clone(emu_state * restrict);
+
+/*!
+ * @brief Give RAM the power-on garbage real hardware has, from opts.seed
+ * @note init_emulator does this in deterministic mode.  VRAM is only
+ * filled when the boot ROM runs, since it clears VRAM itself and games
+ * expect the state it leaves.
+ */
+void seed_memory(emu_state * restrict);
 bool step_emulator(emu_state * restrict);
+bool run_frame(emu_state * restrict);
+
+/*!
+ * @brief Run at speed times real time, or flat out for SPEED_UNLIMITED
+ * @note Only the VBlank throttle and presentation change; emulated state
+ * is the same at any speed.  Above 1x only every speed'th frame is blitted
+ * (at most one per host refresh when unlimited), and deterministic audio
+ * is muted.
+ */
+void emu_set_speed(emu_state * restrict, unsigned);
+
+/*!
+ * @brief Whether the frame that just finished should be blitted
+ */
+bool emu_present_due(emu_state * restrict);
 
 #endif /*!__SGHERM_H_*/
@@ -1,8 +1,29 @@
 #ifndef __SGH_SIGNALS_H__
 #define __SGH_SIGNALS_H__
 
-extern volatile bool do_exit;
+#include <signal.h>	// sig_atomic_t
+
+//! Set by the signal handlers; signals are process wide, so every instance
+//! sees it
+extern volatile sig_atomic_t exit_signal;
+
+//! True once an instance should leave its event loop
+#define EXIT_REQUESTED(state) ((state)->quit || exit_signal)
 
 void register_handlers(void);
 
+/*!
+ * @brief Give this thread its own stack for the crash handler
+ * @returns the stack, for unregister_thread_stack; NULL if there is none
+ * @note register_handlers covers the main thread.  Call this at the top of
+ * any other thread that runs instances, so a stack overflow there still
+ * reports.
+ */
+void * register_thread_stack(void);
+
+/*!
+ * @brief Take back what register_thread_stack gave, before the thread ends
+ */
+void unregister_thread_stack(void *);
+
 #endif
@@ -3,6 +3,16 @@
 
 #include "config.h"	// Various macros, uint[XX]_t
 #include "typedefs.h"	// typedefs
+#include "resample.h"	// resample_quality, resample_latency
+
+#include <stddef.h>	// size_t
+
+
+//! Rate the mixer is rendered at before resampling (period step of 4)
+#define SND_NATIVE_RATE (1<<18)
+
+//! Deterministic mode renders audio every time this many cycles pass
+#define SND_RENDER_CYCLES 8192
 
 
 struct snd_state_t
@@ -11,6 +21,19 @@ struct snd_state_t
 	int freq; //! Audio output frequency
 	int freq_rem; //! Counter for period skip calculation
 
+	resampler *rs;			//! Native rate to freq converter
+	resample_quality quality;	//! Resampler phase resolution
+	resample_latency latency;	//! Resampler filter length
+	bool rs_failed;			//! Don't retry creating the resampler
+	int16_t *native_buf;		//! Scratch for native rate frames
+	size_t native_len;		//! Frames that fit in native_buf
+
+	// Deterministic mode: the emulator renders, the device only reads
+	int16_t *ring;			//! Output frames waiting for the device
+	size_t ring_len;		//! Frames that fit in ring (power of two)
+	uint64_t ring_head;		//! Frames written (ATOMIC_*64 only)
+	uint64_t ring_tail;		//! Frames read (ATOMIC_*64 only)
+
 	struct _ch1
 	{
 		bool enabled;		//! channel enabled?
@@ -99,7 +122,17 @@ struct snd_state_t
 };
 
 
+bool sound_set_output(emu_state *restrict, int, resample_quality, resample_latency);
 void sound_fetch_s16ne(emu_state *restrict, int16_t *restrict, size_t);
+void sound_finish(emu_state *restrict);
 void sound_tick(emu_state *restrict, int);
 
+/*!
+ * @brief Render the last SND_RENDER_CYCLES of audio on the emulation thread
+ * @note Deterministic mode only; step_emulator calls this on every multiple
+ * of SND_RENDER_CYCLES, so the mixer state depends on nothing but the
+ * cycle count.  Output goes to a ring sound_fetch_s16ne drains.
+ */
+void sound_render_chunk(emu_state *restrict);
+
 #endif /*!__SOUND_H_*/
@@ -0,0 +1,76 @@
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+#include "config.h"	// bool, uint[XX]_t
+#include "typedefs.h"	// emu_state, trace_state
+
+#include <stddef.h>	// size_t
+
+
+//! First four bytes of every trace file
+#define TRACE_MAGIC "SGHT"
+
+//! Bump whenever trace_file_header or trace_record change
+#define TRACE_VERSION 1
+
+//! Tells a trace from a host of the other endianness
+#define TRACE_BYTE_ORDER 0x01020304
+
+//! Ring size when opts.trace_records is 0: 128 MiB
+#define TRACE_DEFAULT_RECORDS (1 << 22)
+
+//! One executed instruction, in host byte order
+typedef struct
+{
+	uint64_t cycle;		//! state->cycles when it was fetched
+	uint16_t pc;		//! Address of the opcode
+	uint16_t bank;		//! ROM bank if pc is in 4000-7FFF, else 0
+	uint16_t af, bc, de, hl, sp;	//! Registers before it ran
+	uint8_t opcode;		//! First byte (0xCB for CB opcodes)
+	uint8_t operand[2];	//! Following bytes, valid up to length - 1
+	uint8_t length;		//! Instruction length in bytes
+	uint8_t pad[6];		//! Round up to 32
+} trace_record;
+
+//! Start of a trace file; records follow, oldest first
+typedef struct
+{
+	char magic[4];		//! TRACE_MAGIC
+	uint16_t version;	//! TRACE_VERSION
+	uint16_t record_size;	//! sizeof(trace_record)
+	uint32_t byte_order;	//! TRACE_BYTE_ORDER
+	uint32_t pad;
+	uint64_t count;		//! Records in the file
+	uint64_t dropped;	//! Older records the ring overwrote
+	uint8_t title[16];	//! Cart header 0x134-0x143
+	uint8_t reserved[16];
+} trace_file_header;
+
+
+/*!
+ * @brief Start recording every instruction into a ring of records
+ * @param state the emulator state
+ * @param records ring capacity, 0 for TRACE_DEFAULT_RECORDS
+ * @returns false if out of memory
+ * @note The ring holds the most recent records; trace_stop writes them
+ * to opts.trace_path.  Decode with sgherm-tracedump.
+ */
+bool trace_start(emu_state *restrict, size_t);
+
+/*!
+ * @brief Write the ring to opts.trace_path and stop tracing
+ * @note Does nothing if trace_start was never called.
+ */
+void trace_stop(emu_state *restrict);
+
+/*!
+ * @brief Append the instruction about to run
+ * @param state the emulator state, with pc past the operands
+ * @param opcode the instruction
+ * @param operand the bytes following it
+ * @param length its length in bytes
+ * @note Called from execute when state->debug.trace is set.
+ */
+void trace_instr(emu_state *restrict, uint8_t, const uint8_t *, int);
+
+#endif /*!__TRACE_H__*/
@@ -0,0 +1,73 @@
+#ifndef __TRACEPOINT_H__
+#define __TRACEPOINT_H__
+
+#include "config.h"	// bool, uint[XX]_t, unlikely
+#include "typedefs.h"	// emu_state, tracepoint_state
+
+#include <stddef.h>	// size_t
+
+
+//! Ring size when opts.events_records is 0: 16 MiB
+#define TRACEPOINT_DEFAULT_RECORDS (1 << 20)
+
+//! Hardware events worth seeing on a timeline
+typedef enum
+{
+	TP_INTERRUPT = 0,	//! signal_interrupt; arg = INT_* bits raised
+	TP_LCDC_MODE,		//! lcdc_mode_change; arg = mode, extra = LY
+	TP_DMA,			//! OAM DMA started; arg = source address
+	TP_HDMA,		//! HDMA ran; arg = source << 16 | dest, extra = blocks - 1
+	TP_TIMER_OVERFLOW,	//! TIMA wrapped; arg = TMA it reloads from
+	TP_ROM_BANK,		//! MBC switched ROM bank; arg = bank
+	TP_RAM_BANK,		//! MBC switched RAM (or RTC) bank; arg = bank
+	TP_EVENTS,
+} tracepoint_event;
+
+//! One event, in host byte order
+typedef struct
+{
+	uint64_t cycle;		//! state->cycles when it happened
+	uint16_t pc;		//! Instruction running then
+	uint8_t event;		//! tracepoint_event
+	uint8_t extra;		//! Per event, see tracepoint_event
+	uint32_t arg;		//! Per event, see tracepoint_event
+} tracepoint_record;
+
+/*!
+ * Record an event if tracepoints are on.  Off, this is one branch on a
+ * pointer that doesn't change, so the sites can stay in the hot paths.
+ */
+#define TRACEPOINT(state, event, arg, extra) \
+	do \
+	{ \
+		if(unlikely((state)->debug.tracepoints != NULL)) \
+		{ \
+			tracepoint_emit((state), (event), (arg), (extra)); \
+		} \
+	} while(0)
+
+
+/*!
+ * @brief Start recording events into a ring of records
+ * @param state the emulator state
+ * @param records ring capacity, 0 for TRACEPOINT_DEFAULT_RECORDS
+ * @returns false if out of memory
+ * @note The ring keeps the most recent events; tracepoint_stop writes
+ * them to opts.events_path.
+ */
+bool tracepoint_start(emu_state *restrict, size_t);
+
+/*!
+ * @brief Write the events to opts.events_path and stop recording
+ * @note The file is Chrome trace-event JSON, for chrome://tracing or
+ * Perfetto, on an emulated-time axis.  LCDC modes and OAM DMA are spans;
+ * the rest are instants.  Does nothing if tracepoint_start wasn't called.
+ */
+void tracepoint_stop(emu_state *restrict);
+
+/*!
+ * @brief Append an event; use TRACEPOINT instead
+ */
+void tracepoint_emit(emu_state *restrict, tracepoint_event, uint32_t, uint8_t);
+
+#endif /*!__TRACEPOINT_H__*/
@@ -9,10 +9,12 @@ typedef struct oam_t oam;
 typedef struct cps_t cps;
 
 typedef struct emu_state_t emu_state;
+typedef struct emu_options_t emu_options;
 typedef struct interrupt_state_t interrupt_state;
 typedef struct input_state_t input_state;
 typedef struct lcdc_state_t lcdc_state;
 typedef struct cart_header_t cart_header;
+typedef struct rom_image_t rom_image;
 typedef struct ser_state_t ser_state;
 typedef struct registers_t register_state;
 typedef struct snd_state_t snd_state;
@@ -21,6 +23,21 @@ typedef struct mbc_state_t mbc_state;
 typedef struct mbc_func_t mbc_func;
 
 typedef struct memmap_state_t memmap_state;
+typedef struct save_state_t save_state;
+typedef struct resampler_t resampler;
+typedef struct rewind_state_t rewind_state;
+typedef struct cow_block_t cow_block;
+typedef struct cow_state_t cow_state;
+typedef struct movie_state_t movie_state;
+typedef struct perf_state_t perf_state;
+typedef struct profile_state_t profile_state;
+typedef struct trace_state_t trace_state;
+typedef struct tracepoint_state_t tracepoint_state;
+typedef struct metrics_state_t metrics_state;
+typedef struct history_state_t history_state;
+typedef struct log_ring_t log_ring;
+typedef struct batch_t batch;
+typedef struct batch_results_t batch_results;
 
 typedef struct debug_state_t debug_state;
 
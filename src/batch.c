@@ -0,0 +1,484 @@
+#include "config.h"	// bool, uint[XX]_t, ATOMIC_*
+
+#include "sgherm.h"	// emu_state, init_emulator, run_frame
+#include "batch.h"	// batch_*
+#include "frontend.h"	// NULL_*
+#include "lcdc.h"	// lcdc_screen_hash
+#include "memory.h"	// mem_read8
+#include "rom.h"	// rom_image_*
+#include "print.h"	// error
+#include "signals.h"	// exit_signal, register_thread_stack
+#include "platform/threads.h"	// host_*, THREAD_*, MUTEX_*, COND_*
+
+#include <stdlib.h>	// calloc, free
+#include <string.h>	// memset
+
+#if defined(HAVE_PTHREADS)
+#	include <unistd.h>	// sysconf
+#endif
+
+
+/*
+ * Every step runs one frame of every live instance.  The instance indices
+ * are dealt out to the workers as contiguous ranges, each packed into one
+ * 64-bit word (low half = next index, high half = end).  A worker takes
+ * single indices off the bottom of its own range; when it runs dry it
+ * takes the top half of someone else's.  Both are a single CAS, and as the
+ * word fully describes what the slot owns, a stale read just fails the CAS.
+ */
+
+#define RANGE(lo, hi) ((uint64_t)(lo) | ((uint64_t)(hi) << 32))
+#define RANGE_LO(r) ((uint32_t)(r))
+#define RANGE_HI(r) ((uint32_t)((r) >> 32))
+
+typedef struct
+{
+	uint64_t range;			//! Indices this worker still owns
+	batch *b;			//! Owning batch
+	unsigned id;			//! Index into batch.workers
+#ifdef HAVE_THREADS
+	host_thread thread;		//! Not used for worker 0 (the caller)
+#endif
+	uint8_t pad[64];		//! Keep ranges on separate cache lines
+} batch_worker;
+
+struct batch_t
+{
+	batch_config cfg;		//! Copy of the caller's config
+	rom_image *rom;			//! Shared by every instance
+
+	size_t count;			//! Number of instances
+	emu_state **inst;		//! The instances
+	uint8_t *exit;			//! batch_exit per instance
+	uint64_t *frames;		//! Frames run per instance
+	size_t live;			//! Instances still BATCH_EXIT_RUNNING
+
+	batch_results res;		//! Returned by batch_collect
+
+	unsigned threads;		//! Workers, including the caller
+	batch_worker *workers;
+
+#ifdef HAVE_THREADS
+	host_mutex lock;
+	host_cond start;		//! Workers wait here for a step
+	host_cond done;		//! Caller waits here for the step to end
+	unsigned generation;		//! Bumped once per step
+	unsigned busy;			//! Workers still in this step
+	bool shutdown;			//! Workers should exit
+	bool sync_ok;			//! lock/start/done are initialised
+#endif
+};
+
+static unsigned cpu_count(void)
+{
+#if defined(HAVE_PTHREADS) && defined(_SC_NPROCESSORS_ONLN)
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+	return n > 0 ? (unsigned)n : 1;
+#elif defined(HAVE_WIN32_THREADS)
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	return info.dwNumberOfProcessors ? info.dwNumberOfProcessors : 1;
+#else
+	return 1;
+#endif
+}
+
+static inline bool take_own(batch_worker *w, uint32_t *index)
+{
+	uint64_t r = ATOMIC_LOAD64(&(w->range));
+
+	while(RANGE_LO(r) < RANGE_HI(r))
+	{
+		if(ATOMIC_CAS64(&(w->range), r, RANGE(RANGE_LO(r) + 1, RANGE_HI(r))))
+		{
+			*index = RANGE_LO(r);
+			return true;
+		}
+	}
+
+	return false;
+}
+
+static bool steal(batch *b, batch_worker *w)
+{
+	unsigned i;
+
+	for(i = 1; i < b->threads; i++)
+	{
+		batch_worker *victim = &(b->workers[(w->id + i) % b->threads]);
+		uint64_t r = ATOMIC_LOAD64(&(victim->range));
+
+		while(RANGE_LO(r) < RANGE_HI(r))
+		{
+			uint32_t lo = RANGE_LO(r), hi = RANGE_HI(r);
+			uint32_t half = (hi - lo + 1) / 2;
+
+			if(ATOMIC_CAS64(&(victim->range), r, RANGE(lo, hi - half)))
+			{
+				// Our range is empty, so nobody else can be updating it
+				ATOMIC_STORE64(&(w->range), RANGE(hi - half, hi));
+				return true;
+			}
+		}
+	}
+
+	return false;
+}
+
+static void run_one(batch *b, uint32_t index)
+{
+	emu_state *state = b->inst[index];
+
+	if(b->exit[index] != BATCH_EXIT_RUNNING)
+	{
+		return;
+	}
+
+	if(b->cfg.frame && !b->cfg.frame(state, index, b->cfg.user))
+	{
+		b->exit[index] = BATCH_EXIT_CALLBACK;
+		return;
+	}
+
+	if(!run_frame(state))
+	{
+		b->exit[index] = BATCH_EXIT_FATAL;
+		return;
+	}
+
+	b->frames[index]++;
+}
+
+static void work(batch *b, batch_worker *w)
+{
+	uint32_t index;
+
+	do
+	{
+		while(take_own(w, &index))
+		{
+			run_one(b, index);
+		}
+	} while(steal(b, w));
+}
+
+#ifdef HAVE_THREADS
+THREAD_FN(worker_main, arg)
+{
+	batch_worker *w = (batch_worker *)arg;
+	batch *b = w->b;
+	unsigned generation = 0;
+	void *crash_stack = register_thread_stack();
+
+	for(;;)
+	{
+		MUTEX_LOCK(&(b->lock));
+		while(b->generation == generation && !b->shutdown)
+		{
+			COND_WAIT(&(b->start), &(b->lock));
+		}
+
+		if(b->shutdown)
+		{
+			MUTEX_UNLOCK(&(b->lock));
+			break;
+		}
+
+		generation = b->generation;
+		MUTEX_UNLOCK(&(b->lock));
+
+		work(b, w);
+
+		MUTEX_LOCK(&(b->lock));
+		if(--(b->busy) == 0)
+		{
+			COND_SIGNAL(&(b->done));
+		}
+		MUTEX_UNLOCK(&(b->lock));
+	}
+
+	unregister_thread_stack(crash_stack);
+	THREAD_RETURN;
+}
+
+static bool start_workers(batch *b)
+{
+	unsigned i;
+
+	if(!MUTEX_INIT(&(b->lock)))
+	{
+		return false;
+	}
+
+	if(!COND_INIT(&(b->start)))
+	{
+		MUTEX_DESTROY(&(b->lock));
+		return false;
+	}
+
+	if(!COND_INIT(&(b->done)))
+	{
+		COND_DESTROY(&(b->start));
+		MUTEX_DESTROY(&(b->lock));
+		return false;
+	}
+
+	b->sync_ok = true;
+
+	for(i = 1; i < b->threads; i++)
+	{
+		if(!THREAD_START(&(b->workers[i].thread), worker_main, &(b->workers[i])))
+		{
+			// Run with what we have
+			warning(NULL, "Could only start %u batch threads", i);
+			b->threads = i;
+			break;
+		}
+	}
+
+	return true;
+}
+
+static void stop_workers(batch *b)
+{
+	unsigned i;
+
+	if(!b->sync_ok)
+	{
+		return;
+	}
+
+	MUTEX_LOCK(&(b->lock));
+	b->shutdown = true;
+	COND_BROADCAST(&(b->start));
+	MUTEX_UNLOCK(&(b->lock));
+
+	for(i = 1; i < b->threads; i++)
+	{
+		THREAD_JOIN(b->workers[i].thread);
+	}
+
+	COND_DESTROY(&(b->done));
+	COND_DESTROY(&(b->start));
+	MUTEX_DESTROY(&(b->lock));
+}
+#endif //HAVE_THREADS
+
+batch * batch_new(const char *rom_path, size_t count, const batch_config *config)
+{
+	batch *b;
+	emu_options opts;
+	size_t i;
+
+	if(count == 0 || count > UINT32_MAX)
+	{
+		error(NULL, "Batch size %lu is out of range", (unsigned long)count);
+		return NULL;
+	}
+
+	if((b = (batch *)calloc(1, sizeof(batch))) == NULL)
+	{
+		error(NULL, "Could not allocate batch");
+		return NULL;
+	}
+
+	if(config)
+	{
+		b->cfg = *config;
+	}
+
+	b->count = b->live = count;
+	b->threads = b->cfg.threads ? b->cfg.threads : cpu_count();
+#ifndef HAVE_THREADS
+	b->threads = 1;
+#endif
+	if(b->threads > count)
+	{
+		b->threads = (unsigned)count;
+	}
+
+	b->inst = (emu_state **)calloc(count, sizeof(emu_state *));
+	b->exit = (uint8_t *)calloc(count, sizeof(uint8_t));
+	b->frames = (uint64_t *)calloc(count, sizeof(uint64_t));
+	b->res.fb_hash = (uint64_t *)calloc(count, sizeof(uint64_t));
+	b->res.ram = (uint8_t *)calloc(count, b->cfg.ram_count ? b->cfg.ram_count : 1);
+	b->workers = (batch_worker *)calloc(b->threads, sizeof(batch_worker));
+	if(!b->inst || !b->exit || !b->frames || !b->res.fb_hash ||
+		!b->res.ram || !b->workers)
+	{
+		error(NULL, "Could not allocate batch");
+		batch_free(b);
+		return NULL;
+	}
+
+	// One mapping of the ROM for everyone
+	if((b->rom = rom_image_open(NULL, rom_path, false)) == NULL)
+	{
+		batch_free(b);
+		return NULL;
+	}
+
+	memset(&opts, 0, sizeof(opts));
+	opts.rom = b->rom;
+	opts.deterministic = true;
+	opts.unthrottled = true;
+	opts.log = b->cfg.log;
+	opts.metrics = b->cfg.metrics;
+
+	for(i = 0; i < count; i++)
+	{
+		if((b->inst[i] = init_emulator(NULL, NULL, NULL, &opts)) == NULL)
+		{
+			error(NULL, "Could not create batch instance %lu",
+				(unsigned long)i);
+			batch_free(b);
+			return NULL;
+		}
+
+		select_frontend_all(b->inst[i], NULL_AUDIO, NULL_VIDEO, NULL_LOOP);
+	}
+
+	for(i = 0; i < b->threads; i++)
+	{
+		b->workers[i].b = b;
+		b->workers[i].id = (unsigned)i;
+	}
+
+#ifdef HAVE_THREADS
+	if(b->threads > 1 && !start_workers(b))
+	{
+		warning(NULL, "Could not set up batch threads, running on one");
+		b->threads = 1;
+	}
+#endif
+
+	return b;
+}
+
+void batch_free(batch *b)
+{
+	size_t i;
+
+	if(b == NULL)
+	{
+		return;
+	}
+
+#ifdef HAVE_THREADS
+	stop_workers(b);
+#endif
+
+	if(b->inst)
+	{
+		for(i = 0; i < b->count; i++)
+		{
+			if(b->inst[i])
+			{
+				finish_emulator(b->inst[i]);
+			}
+		}
+	}
+
+	rom_image_unref(NULL, b->rom);
+
+	free(b->inst);
+	free(b->exit);
+	free(b->frames);
+	free(b->res.fb_hash);
+	free(b->res.ram);
+	free(b->workers);
+	free(b);
+}
+
+bool batch_run(batch *restrict b, uint64_t frames)
+{
+	bool ok = true;
+	uint64_t f;
+
+	for(f = 0; f < frames && b->live && !exit_signal; f++)
+	{
+		unsigned t;
+		size_t i;
+
+		// Deal out even ranges; stealing evens out the rest
+		for(t = 0; t < b->threads; t++)
+		{
+			uint64_t lo = (uint64_t)b->count * t / b->threads;
+			uint64_t hi = (uint64_t)b->count * (t + 1) / b->threads;
+
+			ATOMIC_STORE64(&(b->workers[t].range), RANGE(lo, hi));
+		}
+
+#ifdef HAVE_THREADS
+		if(b->threads > 1)
+		{
+			MUTEX_LOCK(&(b->lock));
+			b->generation++;
+			b->busy = b->threads - 1;
+			COND_BROADCAST(&(b->start));
+			MUTEX_UNLOCK(&(b->lock));
+		}
+#endif
+
+		// The caller is worker 0
+		work(b, &(b->workers[0]));
+
+#ifdef HAVE_THREADS
+		if(b->threads > 1)
+		{
+			MUTEX_LOCK(&(b->lock));
+			while(b->busy)
+			{
+				COND_WAIT(&(b->done), &(b->lock));
+			}
+			MUTEX_UNLOCK(&(b->lock));
+		}
+#endif
+
+		b->live = 0;
+		for(i = 0; i < b->count; i++)
+		{
+			b->live += (b->exit[i] == BATCH_EXIT_RUNNING);
+			ok = ok && b->exit[i] != BATCH_EXIT_FATAL;
+		}
+	}
+
+	return ok && (f == frames || !b->live);
+}
+
+const batch_results * batch_collect(batch *b)
+{
+	size_t i, j;
+
+	b->res.count = b->count;
+	b->res.ram_count = b->cfg.ram_count;
+	b->res.exit = b->exit;
+	b->res.frames = b->frames;
+
+	for(i = 0; i < b->count; i++)
+	{
+		emu_state *state = b->inst[i];
+		uint8_t *row = b->res.ram + i * b->cfg.ram_count;
+
+		b->res.fb_hash[i] = lcdc_screen_hash(state);
+
+		// Through the bus, so any address works (reads of some I/O
+		// registers have side effects, though)
+		for(j = 0; j < b->cfg.ram_count; j++)
+		{
+			row[j] = mem_read8(state, b->cfg.ram_addrs[j]);
+		}
+	}
+
+	return &(b->res);
+}
+
+emu_state * batch_instance(batch *b, size_t index)
+{
+	return index < b->count ? b->inst[index] : NULL;
+}
+
+unsigned batch_threads(const batch *b)
+{
+	return b->threads;
+}
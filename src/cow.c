@@ -0,0 +1,209 @@
+#include "config.h"	// bool, uint[XX]_t, ATOMIC_*
+
+#include "sgherm.h"	// emu_state
+#include "cow.h"	// cow_*
+#include "lcdc.h"	// LCDC_OUT_SIZE
+#include "print.h"	// error, fatal
+#include "perf.h"	// PERF_COUNT
+
+#include <stdlib.h>	// malloc, calloc, free
+#include <string.h>	// memcpy
+
+
+static size_t slot_size(const emu_state *restrict state, unsigned slot)
+{
+	if(slot < COW_VRAM)
+	{
+		return 0x1000;
+	}
+	else if(slot < COW_OUT)
+	{
+		return 0x2000;
+	}
+	else if(slot == COW_OUT)
+	{
+		return LCDC_OUT_SIZE;
+	}
+
+	return state->save.size;
+}
+
+//! Point the field that slot backs at data
+static void slot_set(emu_state *restrict state, unsigned slot, uint8_t *data)
+{
+	if(slot < COW_VRAM)
+	{
+		state->wram[slot - COW_WRAM] = data;
+	}
+	else if(slot < COW_OUT)
+	{
+		state->lcdc.vram[slot - COW_VRAM] = data;
+	}
+	else if(slot == COW_OUT)
+	{
+		state->lcdc.out = (uint32_t (*)[160])data;
+	}
+	else
+	{
+		state->save.data = state->mbc.cart_ram = data;
+	}
+}
+
+static cow_block * block_new(size_t size, const uint8_t *copy)
+{
+	cow_block *block = (cow_block *)(copy ? malloc(sizeof(cow_block) + size) :
+		calloc(1, sizeof(cow_block) + size));
+
+	if(block == NULL)
+	{
+		return NULL;
+	}
+
+	block->refs = 1;
+	block->size = size;
+	if(copy)
+	{
+		memcpy(COW_DATA(block), copy, size);
+	}
+
+	return block;
+}
+
+static void block_unref(cow_block *block)
+{
+	if(block != NULL && ATOMIC_DEC(&(block->refs)) == 0)
+	{
+		free(block);
+	}
+}
+
+bool cow_init(emu_state *restrict state)
+{
+	unsigned slot;
+
+	for(slot = 0; slot < COW_CART; slot++)
+	{
+		cow_block *block = block_new(slot_size(state, slot), NULL);
+
+		if(block == NULL)
+		{
+			error(state, "Could not allocate memory pages");
+			cow_release(state);
+			return false;
+		}
+
+		state->cow.block[slot] = block;
+		slot_set(state, slot, COW_DATA(block));
+	}
+
+	// Cart RAM starts out belonging to the save file
+	state->cow.owned = (1u << COW_SLOTS) - 1;
+
+	return true;
+}
+
+void cow_release(emu_state *restrict state)
+{
+	unsigned slot;
+
+	for(slot = 0; slot < COW_SLOTS; slot++)
+	{
+		if(state->cow.block[slot] == NULL)
+		{
+			continue;
+		}
+
+		block_unref(state->cow.block[slot]);
+		state->cow.block[slot] = NULL;
+		slot_set(state, slot, NULL);
+	}
+
+	state->cow.owned = 0;
+}
+
+bool cow_share(emu_state *restrict src, emu_state *restrict dst)
+{
+	uint32_t shared = 0;
+	unsigned slot;
+
+	for(slot = 0; slot < COW_SLOTS; slot++)
+	{
+		if(src->cow.block[slot] != NULL)
+		{
+			ATOMIC_INC(&(src->cow.block[slot]->refs));
+			shared |= 1u << slot;
+		}
+	}
+
+	// Whichever side writes a shared page first copies it
+	src->cow.owned &= ~shared;
+	dst->cow.owned = src->cow.owned;
+
+	if(!(shared & (1u << COW_CART)) && src->save.data != NULL)
+	{
+		// The original writes cart RAM through to its save file, so the
+		// clone can't share it
+		cow_block *block = block_new(src->save.size, src->save.data);
+
+		if(block == NULL)
+		{
+			error(src, "Could not copy cart RAM for a clone");
+			cow_release(dst);
+			return false;
+		}
+
+		dst->cow.block[COW_CART] = block;
+		slot_set(dst, COW_CART, COW_DATA(block));
+	}
+
+	return true;
+}
+
+bool cow_unshare(emu_state *restrict state, cow_slot slot)
+{
+	cow_block *block = state->cow.block[slot], *copy;
+
+	if(block == NULL)
+	{
+		// Not managed; always writable
+		state->cow.owned |= 1u << slot;
+		return true;
+	}
+
+	// The other holders may have let go since
+	if(*(volatile long *)&(block->refs) == 1)
+	{
+		state->cow.owned |= 1u << slot;
+		return true;
+	}
+
+	PERF_COUNT(state, slow[PERF_SLOW_COW]);
+
+	if((copy = block_new(block->size, COW_DATA(block))) == NULL)
+	{
+		fatal(state, "Out of memory copying a shared page");
+		return false;
+	}
+
+	block_unref(block);
+	state->cow.block[slot] = copy;
+	state->cow.owned |= 1u << slot;
+	slot_set(state, slot, COW_DATA(copy));
+
+	return true;
+}
+
+bool cow_unshare_all(emu_state *restrict state)
+{
+	unsigned slot;
+
+	for(slot = 0; slot < COW_SLOTS; slot++)
+	{
+		if(!COW_OWNED(state, slot) && !cow_unshare(state, (cow_slot)slot))
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
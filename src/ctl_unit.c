@@ -5,10 +5,14 @@
 #include "ctl_unit.h"		// prototypes, constants, etc.
 #include "debug.h"		// state dumps etc
 #include "print.h"		// fatal
+#include "perf.h"		// PERF_COUNT, PERF_MEM
+#include "profile.h"		// profile_*
+#include "trace.h"		// trace_instr
+#include "tracepoint.h"	// TRACEPOINT
+#include "history.h"		// history_record_instr
 
 #include <assert.h>		// assert
 #include <stdlib.h>		// NULL
-#include <string.h>		// memcpy
 
 
 void compute_irq(emu_state *restrict state)
@@ -21,6 +25,7 @@ void compute_irq(emu_state *restrict state)
 
 void signal_interrupt(emu_state *restrict state, int interrupt)
 {
+	TRACEPOINT(state, TP_INTERRUPT, interrupt, 0);
 	state->interrupts.pending |= interrupt;
 	state->halt = state->stop = false;
 	compute_irq(state);
@@ -36,7 +41,7 @@ void signal_interrupt(emu_state *restrict state, int interrupt)
 
 
 //! Bit length of given instructions
-static const int instr_len[0x100] =
+const int instr_len[0x100] =
 {
 	1, 3, 1, 1, 1, 1, 2, 1, 3, 1, 1, 1, 1, 1, 2, 1,		// 0x00
 	2, 3, 1, 1, 1, 1, 2, 1, 2, 1, 1, 1, 1, 1, 2, 1,		// 0x10
@@ -187,6 +192,11 @@ static inline void call_interrupt(emu_state *restrict state)
 	// Interrupts are locked out before handling
 	state->interrupts.enabled = false;
 	state->interrupts.irq = 0;
+
+	if(unlikely(state->debug.profile != NULL))
+	{
+		profile_interrupt(state);
+	}
 }
 
 //! the emulated CU for the 'z80-ish' CPU
@@ -197,6 +207,8 @@ bool execute(emu_state *restrict state, int count)
 		uint8_t opcode;
 		uint8_t op_data[2] = {0xBE, 0xEF};
 		int op_len;
+		uint16_t pc;
+		uint32_t entry;
 		opcode_t handler;
 
 		if(unlikely(state->dma_wait))
@@ -231,11 +243,20 @@ bool execute(emu_state *restrict state, int count)
 		if(state->halt || state->stop)
 		{
 			// Waiting for an interrupt
+			state->halt_cycles += count;
 			return true;
 		}
 
+		if(unlikely(state->debug.profile != NULL))
+		{
+			profile_begin(state);
+		}
+
+		pc = REG_PC(state);
 		opcode = mem_read8(state, REG_PC(state)++);
 		op_len = instr_len[opcode] - 1;
+		PERF_COUNT(state, op[opcode]);
+		PERF_MEM(state, pc, PERF_MEM_EXEC);
 
 		if(op_len > 0)
 		{
@@ -246,11 +267,21 @@ bool execute(emu_state *restrict state, int count)
 			}
 		}
 
-		// Copy last instructions
+		// Always on: this is what a crash report shows.  The bank
+		// only means something in the switchable window
+		entry = pc;
+		if((pc & 0xC000) == 0x4000)
+		{
+			entry |= (uint32_t)state->mbc.rom_bank << 16;
+		}
+		history_record_instr(&(state->debug.history), entry);
+
 		if(state->debug.debug)
 		{
-			state->debug.last_opcode = opcode;
-			memcpy(state->debug.last_param, op_data, sizeof(op_data));
+			if(unlikely(state->debug.trace != NULL))
+			{
+				trace_instr(state, opcode, op_data, op_len + 1);
+			}
 
 			if(state->debug.instr_dump)
 			{
@@ -265,6 +296,11 @@ bool execute(emu_state *restrict state, int count)
 
 		handler = handlers[opcode];
 		handler(state, op_data);
+
+		if(unlikely(state->debug.profile != NULL))
+		{
+			profile_end(state, opcode);
+		}
 	}
 
 	return true;
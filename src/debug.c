@@ -7,6 +7,9 @@
 #include "memory.h"	// mem_read8
 #include "util_time.h"	// get_time
 
+#include <stdio.h>	// snprintf
+#include <string.h>	// strncmp
+
 const char * const mnemonics[0x100] =
 {
 	"NOP", "LD BC,d16", "LD (BC),A", "INC BC",		// 0x00
@@ -279,6 +282,65 @@ const char * const flags_cb_expect[0x100] =
 	"----", "----", "----", "----",	// 0xFC
 };
 
+void disassemble(char *out, size_t len, uint16_t pc, uint8_t opcode,
+	const uint8_t operand[2])
+{
+	const uint8_t lo = operand[0], hi = operand[1];
+	const char *m;
+	size_t n = 0;
+
+	if(opcode == 0xCB)
+	{
+		snprintf(out, len, "%s", mnemonics_cb[lo]);
+		return;
+	}
+	else if(*mnemonics[opcode] == '\0')
+	{
+		// No such instruction (hcf)
+		snprintf(out, len, "DB $%02X", opcode);
+		return;
+	}
+
+	for(m = mnemonics[opcode]; *m && n + 8 < len; m++)
+	{
+		if(strncmp(m, "d16", 3) == 0 || strncmp(m, "a16", 3) == 0)
+		{
+			n += snprintf(out + n, len - n, "$%02X%02X", hi, lo);
+			m += 2;
+		}
+		else if(strncmp(m, "d8", 2) == 0)
+		{
+			n += snprintf(out + n, len - n, "$%02X", lo);
+			m++;
+		}
+		else if(strncmp(m, "a8", 2) == 0)
+		{
+			n += snprintf(out + n, len - n, "$FF%02X", lo);
+			m++;
+		}
+		else if(strncmp(m, "r8", 2) == 0 &&
+			strncmp(mnemonics[opcode], "JR", 2) == 0)
+		{
+			// Show where it goes, not how far
+			n += snprintf(out + n, len - n, "$%04X",
+				(uint16_t)(pc + 2 + (int8_t)lo));
+			m++;
+		}
+		else if(strncmp(m, "+r8", 3) == 0 || strncmp(m, "r8", 2) == 0)
+		{
+			// ADD SP,r8 and LD HL,SP+r8: a signed offset
+			n += snprintf(out + n, len - n, "%+d", (int8_t)lo);
+			m += (*m == '+') ? 2 : 1;
+		}
+		else
+		{
+			out[n++] = *m;
+		}
+	}
+
+	out[n] = '\0';
+}
+
 void print_cpu_state(emu_state *restrict state)
 {
 	debug(state, "[%X] (af bc de hl sp %X %X %X %X %X)", REG_PC(state),
@@ -1,10 +1,12 @@
 #include "config.h"	// bool
 #include "sgherm.h"	// emu_state, UNUSED
-#include "print.h"	// debug
-#include "signals.h"	// do_exit
+#include "print.h"	// debug, info
+#include "signals.h"	// EXIT_REQUESTED
 #include "input.h"	// int
 #include "frontend.h"	// frontend
+#include "history.h"	// history_running
 
+#include <stdlib.h>	// strtoul
 #include <string.h>	// memcpy
 
 
@@ -55,6 +57,152 @@ bool select_frontend_all(emu_state *restrict state,
 	return true;
 }
 
+int frontend_parse_arg(int argc, char *argv[], int i, frontend_args *args)
+{
+	const char *arg = argv[i];
+
+	if(arg[0] != '-' || arg[1] == '\0')
+	{
+		// Positional: ROM, then save, then boot ROM
+		if(args->rom == NULL)
+		{
+			args->rom = arg;
+		}
+		else if(args->save == NULL)
+		{
+			args->save = arg;
+		}
+		else if(args->bootrom == NULL)
+		{
+			args->bootrom = arg;
+		}
+		else
+		{
+			return 0;
+		}
+
+		return 1;
+	}
+
+	if(arg[2] != '\0')
+	{
+		return 0;
+	}
+	else if(arg[1] == 'd')
+	{
+		args->deterministic = true;
+		return 1;
+	}
+	else if(arg[1] == 'M')
+	{
+		args->metrics = true;
+		return 1;
+	}
+	else if(arg[1] != 'r' && arg[1] != 'p' && arg[1] != 'a' &&
+		arg[1] != 'g' && arg[1] != 'G' && arg[1] != 'T' && arg[1] != 'E')
+	{
+		return 0;
+	}
+	else if(i + 1 >= argc)
+	{
+		return -1;
+	}
+
+	if(arg[1] == 'a')
+	{
+		args->run_ahead = (unsigned)strtoul(argv[i + 1], NULL, 0);
+		return 2;
+	}
+	else if(arg[1] == 'g')
+	{
+		args->profile_path = argv[i + 1];
+		return 2;
+	}
+	else if(arg[1] == 'G')
+	{
+		args->profile_stacks_path = argv[i + 1];
+		return 2;
+	}
+	else if(arg[1] == 'T')
+	{
+		args->trace_path = argv[i + 1];
+		return 2;
+	}
+	else if(arg[1] == 'E')
+	{
+		args->events_path = argv[i + 1];
+		return 2;
+	}
+
+	args->movie_mode = (arg[1] == 'r') ? MOVIE_RECORD : MOVIE_PLAY;
+	args->movie_path = argv[i + 1];
+
+	return 2;
+}
+
+unsigned frontend_cycle_speed(emu_state *restrict state)
+{
+	static const unsigned speeds[] = { 1, 2, 4, SPEED_UNLIMITED };
+	const size_t count = sizeof(speeds) / sizeof(*speeds);
+	size_t i;
+
+	for(i = 0; i < count && speeds[i] != state->speed; i++);
+
+	// Speeds set through emu_set_speed go back to 1x
+	i = (i < count) ? (i + 1) % count : 0;
+	emu_set_speed(state, speeds[i]);
+
+	if(speeds[i] == SPEED_UNLIMITED)
+	{
+		info(state, "Speed: unlimited");
+	}
+	else
+	{
+		info(state, "Speed: %ux", speeds[i]);
+	}
+
+	return speeds[i];
+}
+
+bool frontend_run_ahead(emu_state *restrict state)
+{
+	const unsigned frames = state->opts.run_ahead;
+	emu_state *ahead;
+	unsigned i;
+
+	// Pages are shared, so this costs little more than the frames run
+	if((ahead = emu_clone(state)) == NULL)
+	{
+		return false;
+	}
+
+	// Present the last frame through our video frontend, as it is
+	ahead->opts.run_ahead = 0;
+	ahead->speed = 1;
+	ahead->front.video = state->front.video;
+	ahead->hidden = true;
+
+	for(i = 0; i < frames; i++)
+	{
+		if(i + 1 == frames)
+		{
+			ahead->hidden = false;
+		}
+
+		if(!run_frame(ahead))
+		{
+			break;
+		}
+	}
+
+	emu_free_clone(ahead);
+
+	// run_frame pointed crash reports at the clone
+	history_running = state;
+
+	return i == frames;
+}
+
 void finish_frontend(emu_state *restrict state)
 {
 	if(state->front.audio_set)
@@ -76,14 +224,33 @@ void finish_frontend(emu_state *restrict state)
  * something, or we have no available frontends for the given thing.
  */
 
-bool null_init_video(emu_state *restrict state)
+//! Bits in front.null_noticed, so each instance logs each stub once
+enum
 {
-	static bool did_notice = false;
+	NOTICE_INIT_VIDEO = 1 << 0,
+	NOTICE_FINISH_VIDEO = 1 << 1,
+	NOTICE_INIT_AUDIO = 1 << 2,
+	NOTICE_FINISH_AUDIO = 1 << 3,
+	NOTICE_BLIT_CANVAS = 1 << 4,
+	NOTICE_OUTPUT_SAMPLE = 1 << 5,
+};
+
+static inline bool notice_once(emu_state *restrict state, unsigned bit)
+{
+	if(state->front.null_noticed & bit)
+	{
+		return false;
+	}
+
+	state->front.null_noticed |= bit;
+	return true;
+}
 
-	if(unlikely(!did_notice))
+bool null_init_video(emu_state *restrict state)
+{
+	if(unlikely(notice_once(state, NOTICE_INIT_VIDEO)))
 	{
 		debug(state, "Not initialising a null display");
-		did_notice = true;
 	}
 
 	return true;
@@ -91,23 +258,17 @@ bool null_init_video(emu_state *restrict state)
 
 void null_finish_video(emu_state *restrict state)
 {
-	static bool did_notice = false;
-
-	if(unlikely(!did_notice))
+	if(unlikely(notice_once(state, NOTICE_FINISH_VIDEO)))
 	{
 		debug(state, "Not finalising a null display");
-		did_notice = true;
 	}
 }
 
 bool null_init_audio(emu_state *restrict state)
 {
-	static bool did_notice = false;
-
-	if(unlikely(!did_notice))
+	if(unlikely(notice_once(state, NOTICE_INIT_AUDIO)))
 	{
 		debug(state, "Not initialising null audio");
-		did_notice = true;
 	}
 
 	return true;
@@ -115,34 +276,25 @@ bool null_init_audio(emu_state *restrict state)
 
 void null_finish_audio(emu_state *restrict state)
 {
-	static bool did_notice = false;
-
-	if(unlikely(!did_notice))
+	if(unlikely(notice_once(state, NOTICE_FINISH_AUDIO)))
 	{
 		debug(state, "Not finalising null audio");
-		did_notice = true;
 	}
 }
 
 void null_blit_canvas(emu_state *restrict state)
 {
-	static bool did_notice = false;
-
-	if(unlikely(!did_notice))
+	if(unlikely(notice_once(state, NOTICE_BLIT_CANVAS)))
 	{
 		debug(state, "Not blitting to null display");
-		did_notice = true;
 	}
 }
 
 void null_output_sample(emu_state *restrict state)
 {
-	static bool did_notice = false;
-
-	if(unlikely(!did_notice))
+	if(unlikely(notice_once(state, NOTICE_OUTPUT_SAMPLE)))
 	{
 		debug(state, "Not outputting to null audio");
-		did_notice = true;
 	}
 }
 
@@ -150,10 +302,16 @@ int null_event_loop(emu_state *restrict state)
 {
 	debug(state, "Executing null event loop");
 
+	// Whose history a crash on this thread should show
+	history_running = state;
+
 	do
 	{
-		step_emulator(state);
-	} while(!do_exit);
+		if(!step_emulator(state))
+		{
+			return -1;
+		}
+	} while(!EXIT_REQUESTED(state));
 
 	return 0;
 }
@@ -2,11 +2,12 @@
 
 #include "sgherm.h"	// emu_state,
 #include "print.h"	// debug
-#include "signals.h"	// do_exit
+#include "signals.h"	// EXIT_REQUESTED
+#include "history.h"	// history_running
 #include "frontend.h"	// frontend
 #include "frontends/caca/frontend.h"
 
-static inline input_key get_key(caca_event_t *ev)
+static inline input_key get_key(emu_state *state, caca_event_t *ev)
 {
 	switch(caca_get_event_key_ch(ev))
 	{
@@ -40,8 +41,15 @@ static inline input_key get_key(caca_event_t *ev)
 	case CACA_KEY_BACKSPACE:
 		return INPUT_SELECT;
 
+	case CACA_KEY_TAB:
+		if(caca_get_event_type(ev) & CACA_EVENT_KEY_PRESS)
+		{
+			frontend_cycle_speed(state);
+		}
+		return 0;
+
 	case CACA_KEY_ESCAPE:
-		do_exit = true;
+		state->quit = true;
 
 	default:
 		return 0;
@@ -50,8 +58,13 @@ static inline input_key get_key(caca_event_t *ev)
 
 int libcaca_event_loop(emu_state *state)
 {
+	uint_fast64_t last_frame = state->frames;
+
 	debug(state, "Executing libcaca event loop");
 
+	// Whose history a crash on this thread should show
+	history_running = state;
+
 	do
 	{
 		libcaca_video_data *video = state->front.video.data;
@@ -60,7 +73,20 @@ int libcaca_event_loop(emu_state *state)
 		uint_fast16_t clock = state->lcdc.curr_clk;
 		int events;
 
-		step_emulator(state);
+		if(!step_emulator(state))
+		{
+			return -1;
+		}
+
+		if(unlikely(state->opts.run_ahead && state->frames != last_frame))
+		{
+			last_frame = state->frames;
+			if(emu_present_due(state) && !frontend_run_ahead(state))
+			{
+				warning(state, "Run-ahead failed; turning it off");
+				state->opts.run_ahead = 0;
+			}
+		}
 
 		if(unlikely(mode == 1 && clock == 1 && state->input.col))
 		{
@@ -79,7 +105,7 @@ int libcaca_event_loop(emu_state *state)
 
 		if(unlikely(events & CACA_EVENT_QUIT))
 		{
-			do_exit = true;
+			state->quit = true;
 		}
 		else if(events & CACA_EVENT_RESIZE)
 		{
@@ -98,7 +124,7 @@ int libcaca_event_loop(emu_state *state)
 		else if(events & (CACA_EVENT_KEY_PRESS | CACA_EVENT_KEY_RELEASE))
 		{
 			bool pressed = (events & CACA_EVENT_KEY_PRESS) != 0;;
-			input_key key = get_key(&ev);
+			input_key key = get_key(state, &ev);
 
 			if(!key)
 			{
@@ -107,7 +133,7 @@ int libcaca_event_loop(emu_state *state)
 
 			joypad_signal(state, key, pressed);
 		}
-	} while(!do_exit);
+	} while(!EXIT_REQUESTED(state));
 
 	return 0;
 }
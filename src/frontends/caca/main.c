@@ -15,9 +15,9 @@
 int main(int argc, char *argv[])
 {
 	emu_state *state;
-	const char *save = NULL;
-	const char *bootrom = NULL;
-	int val;
+	emu_options opts;
+	frontend_args args;
+	int val, i, used;
 
 	register_handlers();
 
@@ -27,22 +27,34 @@ int main(int argc, char *argv[])
 	fprintf(to_stdout, "Super Game Herm (libcaca frontend)!\n");
 	fprintf(to_stdout, "Beta version!\n\n");
 
-	// FIXME XXX need real getopt parsing
-	if(argc < 2)
+	memset(&args, 0, sizeof(args));
+	for(i = 1; i < argc; i += used)
 	{
-		fatal(NULL, "You must specify a ROM file... -.-");
-		return EXIT_FAILURE;
-	}
-	else if(argc == 3)
-	{
-		save = argv[2];
+		if((used = frontend_parse_arg(argc, argv, i, &args)) <= 0)
+		{
+			fprintf(to_stdout, "Usage: %s " FRONTEND_USAGE, argv[0]);
+			return EXIT_FAILURE;
+		}
 	}
-	else if(argc >= 4)
+
+	if(args.rom == NULL)
 	{
-		bootrom = argv[3];
+		fatal(NULL, "You must specify a ROM file... -.-");
+		return EXIT_FAILURE;
 	}
 
-	if((state = init_emulator(bootrom, argv[1], save)) == NULL)
+	memset(&opts, 0, sizeof(opts));
+	opts.movie_mode = args.movie_mode;
+	opts.movie_path = args.movie_path;
+	opts.deterministic = args.deterministic;
+	opts.run_ahead = args.run_ahead;
+	opts.profile_path = args.profile_path;
+	opts.profile_stacks_path = args.profile_stacks_path;
+	opts.trace_path = args.trace_path;
+	opts.events_path = args.events_path;
+	opts.metrics = args.metrics;
+
+	if((state = init_emulator(args.bootrom, args.rom, args.save, &opts)) == NULL)
 	{
 		fatal(NULL, "Error initalising the emulator :(");
 		return EXIT_FAILURE;
@@ -1,6 +1,5 @@
 #include "sgherm.h"	// emu_state,
 #include "print.h"	// debug
-#include "signals.h"	// do_exit
 #include "frontend.h"	// frontend
 #include "frontends/caca/frontend.h"
 
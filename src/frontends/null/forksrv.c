@@ -0,0 +1,323 @@
+#include "config.h"	// bool, uint[XX]_t
+
+#include "sgherm.h"	// emu_state, run_frame, step_emulator
+#include "frontends/null/forksrv.h"	// forksrv_*
+#include "input.h"	// joypad_set_mask
+#include "lcdc.h"	// lcdc_screen_hash
+#include "print.h"	// to_stdout, error, info, log_flush
+#include "savestate.h"	// state_size, state_save
+#include "signals.h"	// EXIT_REQUESTED
+#include "history.h"	// history_running
+
+#include <errno.h>	// errno, EINTR
+#include <stdio.h>	// fgets, fprintf, fflush
+#include <stdlib.h>	// strtoul, malloc, free
+#include <string.h>	// strtok, strerror
+#include <sys/types.h>	// pid_t
+#include <sys/wait.h>	// waitpid, WIF*
+#include <unistd.h>	// fork, _exit
+
+
+//! Longest job line accepted
+#define JOB_LINE_MAX 4096
+
+typedef struct
+{
+	unsigned long id;		//! Sequence number, echoed in the result
+	uint64_t frames;		//! Frames to run
+	const char *input;		//! Comma-separated hex masks (NULL = none)
+	const char *snapshot;		//! Save state path (NULL = none)
+} forksrv_job;
+
+//! A child we still have to reap
+typedef struct
+{
+	pid_t pid;
+	unsigned long id;
+} forksrv_child;
+
+
+/*!
+ * @brief Run until the warm-up frame or the breakpoint, whichever is first
+ */
+static bool warm_up(emu_state *restrict state, const forksrv_config *config)
+{
+	const bool limit = config->warm_frames != 0;
+	const bool brk = config->break_pc >= 0;
+
+	if(!limit && !brk)
+	{
+		return true;
+	}
+
+	for(;;)
+	{
+		if(limit && state->frames >= config->warm_frames)
+		{
+			return true;
+		}
+
+		// Only stop on an instruction boundary
+		if(brk && state->wait == 0 &&
+			REG_PC(state) == (uint16_t)config->break_pc)
+		{
+			info(state, "Breakpoint at %04X hit on frame %llu",
+				config->break_pc,
+				(unsigned long long)state->frames);
+			return true;
+		}
+
+		if(EXIT_REQUESTED(state) || !step_emulator(state))
+		{
+			return false;
+		}
+	}
+}
+
+static bool write_snapshot(emu_state *restrict state, const char *path)
+{
+	size_t size = state_size(state);
+	uint8_t *buf = (uint8_t *)malloc(size);
+	FILE *f;
+	bool ret = false;
+
+	if(buf == NULL || state_save(state, buf, size) != size)
+	{
+		error(state, "Could not snapshot for %s", path);
+		goto end;
+	}
+
+	if((f = fopen(path, "wb")) == NULL)
+	{
+		error(state, "Could not open %s: %s", path, strerror(errno));
+		goto end;
+	}
+
+	ret = fwrite(buf, 1, size, f) == size;
+	ret = (fclose(f) == 0) && ret;
+	if(!ret)
+	{
+		error(state, "Could not write %s", path);
+	}
+
+end:
+	free(buf);
+	return ret;
+}
+
+/*!
+ * @brief The child side of a job; never returns
+ */
+static NORETURN void run_job(emu_state *restrict state, const forksrv_job *job)
+{
+	const char *in = job->input;
+	const uint64_t start = state->frames;
+	bool ok = true;
+
+	// Whatever the child does to cart RAM dies with it
+	state->save.path = NULL;
+
+	// The metrics mapping is shared with the parent; leave it the parent's
+	state->metrics = NULL;
+
+	while(state->frames - start < job->frames && !EXIT_REQUESTED(state))
+	{
+		if(in != NULL)
+		{
+			char *next;
+
+			joypad_set_mask(state, (uint8_t)strtoul(in, &next, 16));
+			in = (*next == ',') ? next + 1 : NULL;
+		}
+
+		if(!run_frame(state))
+		{
+			ok = false;
+			break;
+		}
+	}
+
+	if(ok && job->snapshot != NULL)
+	{
+		ok = write_snapshot(state, job->snapshot);
+	}
+
+	fprintf(to_stdout, "%lu %s %llu %016llx %04x\n", job->id,
+		state->status == EMU_STATUS_OK ? (ok ? "ok" : "error") : "fatal",
+		(unsigned long long)(state->frames - start),
+		(unsigned long long)lcdc_screen_hash(state), REG_PC(state));
+	log_flush(state);
+	fflush(NULL);
+
+	// Skip atexit handlers and finish_emulator; the parent owns all of it
+	_exit(ok ? EXIT_SUCCESS : EXIT_FAILURE);
+}
+
+/*!
+ * @brief Parse a job line in place
+ */
+static bool parse_job(char *line, forksrv_job *job)
+{
+	char *tok, *end;
+
+	if((tok = strtok(line, " \t\r\n")) == NULL)
+	{
+		return false;
+	}
+
+	job->frames = strtoull(tok, &end, 0);
+	if(*end != '\0')
+	{
+		return false;
+	}
+
+	job->input = strtok(NULL, " \t\r\n");
+	if(job->input != NULL && strcmp(job->input, "-") == 0)
+	{
+		job->input = NULL;
+	}
+
+	job->snapshot = strtok(NULL, " \t\r\n");
+
+	return true;
+}
+
+/*!
+ * @brief Wait for one child and report it if it didn't report itself
+ */
+static void reap_one(emu_state *restrict state, forksrv_child *children,
+	unsigned *running)
+{
+	pid_t pid;
+	int status;
+	unsigned i;
+
+	while((pid = waitpid(-1, &status, 0)) < 0)
+	{
+		if(errno != EINTR)
+		{
+			// Nothing left to wait for
+			*running = 0;
+			return;
+		}
+	}
+
+	for(i = 0; i < *running; i++)
+	{
+		if(children[i].pid == pid)
+		{
+			break;
+		}
+	}
+
+	if(i == *running)
+	{
+		return;
+	}
+
+	if(WIFSIGNALED(status))
+	{
+		// The child died before it could print its result
+		fprintf(to_stdout, "%lu signal %d\n", children[i].id,
+			WTERMSIG(status));
+		fflush(to_stdout);
+		warning(state, "Job %lu (pid %ld) killed by signal %d",
+			children[i].id, (long)pid, WTERMSIG(status));
+	}
+
+	children[i] = children[--(*running)];
+}
+
+int forksrv_run(emu_state *restrict state, const forksrv_config *config)
+{
+	const unsigned max = config->max_children ? config->max_children : 1;
+	forksrv_child *children;
+	char line[JOB_LINE_MAX];
+	unsigned long next_id = 0;
+	unsigned running = 0;
+
+	// Whose history a crash on this thread should show
+	history_running = state;
+
+	if(state->save.path != NULL && state->save.mode == SAVE_MODE_MMAP)
+	{
+		// Children would all write through the same shared mapping
+		error(state, "The fork server needs journalled saves");
+		return -1;
+	}
+
+	if((children = (forksrv_child *)calloc(max, sizeof(forksrv_child))) == NULL)
+	{
+		error(state, "Could not allocate the child table");
+		return -1;
+	}
+
+	if(!warm_up(state, config))
+	{
+		error(state, "Warm-up did not finish");
+		free(children);
+		return -1;
+	}
+
+	info(state, "Fork server ready at frame %llu, PC %04X",
+		(unsigned long long)state->frames, REG_PC(state));
+	fprintf(to_stdout, "ready %llu %04x\n",
+		(unsigned long long)state->frames, REG_PC(state));
+
+	for(;;)
+	{
+		forksrv_job job;
+		pid_t pid;
+
+		// Unflushed output would be inherited and printed twice
+		fflush(NULL);
+
+		if(fgets(line, sizeof(line), config->jobs) == NULL ||
+			EXIT_REQUESTED(state))
+		{
+			break;
+		}
+
+		job.id = next_id++;
+		if(!parse_job(line, &job))
+		{
+			fprintf(to_stdout, "%lu invalid\n", job.id);
+			continue;
+		}
+
+		while(running >= max)
+		{
+			reap_one(state, children, &running);
+		}
+
+		// Whatever is queued goes out once, from here
+		log_flush(state);
+		if((pid = fork()) < 0)
+		{
+			error(state, "Could not fork job %lu: %s", job.id,
+				strerror(errno));
+			fprintf(to_stdout, "%lu error\n", job.id);
+			continue;
+		}
+		else if(pid == 0)
+		{
+			run_job(state, &job);
+		}
+
+		children[running].pid = pid;
+		children[running].id = job.id;
+		running++;
+	}
+
+	while(running > 0)
+	{
+		reap_one(state, children, &running);
+	}
+
+	fflush(to_stdout);
+	free(children);
+
+	info(state, "Fork server ran %lu jobs", next_id);
+
+	return 0;
+}
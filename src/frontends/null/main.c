@@ -4,17 +4,41 @@
 #include "print.h"	// to_std*
 #include "signals.h"	// register_handlers
 
+#ifdef HAVE_FORK
+#	include "frontends/null/forksrv.h"	// forksrv_*
+#endif
+
 #include <stdio.h>	// file methods
-#include <stdlib.h>	// exit
+#include <stdlib.h>	// exit, strtoul
 #include <string.h>	// memset
 
 
+static void usage(const char *name)
+{
+	fprintf(to_stdout, "Usage: %s " FRONTEND_USAGE, name);
+#ifdef HAVE_FORK
+	fprintf(to_stdout,
+		"  -s         boot once, then fork a child per job read from stdin\n"
+		"  -w FRAMES  run FRAMES frames before serving jobs\n"
+		"  -b PC      stop warming up when PC (hex) is reached\n"
+		"  -j COUNT   jobs to run at once (default 1)\n");
+#endif
+}
+
 int main(int argc, char *argv[])
 {
 	emu_state *state;
-	const char *save = NULL;
-	const char *bootrom = NULL;
-	int val;
+	emu_options opts;
+	frontend_args args;
+	bool serve = false;
+	int val, i, used;
+#ifdef HAVE_FORK
+	forksrv_config server;
+
+	memset(&server, 0, sizeof(server));
+	server.break_pc = -1;
+	server.jobs = stdin;
+#endif
 
 	register_handlers();
 
@@ -24,22 +48,84 @@ int main(int argc, char *argv[])
 	fprintf(to_stdout, "Super Game Herm (null frontend)!\n");
 	fprintf(to_stdout, "Beta version!\n\n");
 
-	// FIXME use getopt
-	if(argc < 2)
+	memset(&args, 0, sizeof(args));
+	for(i = 1; i < argc; i += used)
 	{
-		fatal(NULL, "You must specify a ROM file... -.-");
+		const char *arg = argv[i];
+
+		if((used = frontend_parse_arg(argc, argv, i, &args)) > 0)
+		{
+			continue;
+		}
+
+		used = 1;
+
+#ifdef HAVE_FORK
+		if(arg[0] == '-' && arg[1] != '\0' && arg[2] == '\0')
+		{
+			switch(arg[1])
+			{
+			case 's':
+				serve = true;
+				continue;
+			case 'w':
+				if(++i < argc)
+				{
+					server.warm_frames = strtoull(argv[i], NULL, 0);
+					continue;
+				}
+				break;
+			case 'b':
+				if(++i < argc)
+				{
+					server.break_pc = (int32_t)(strtoul(argv[i], NULL, 16) & 0xFFFF);
+					continue;
+				}
+				break;
+			case 'j':
+				if(++i < argc)
+				{
+					server.max_children = (unsigned)strtoul(argv[i], NULL, 0);
+					continue;
+				}
+				break;
+			}
+		}
+#endif
+
+		usage(argv[0]);
 		return EXIT_FAILURE;
 	}
-	else if(argc == 3)
+
+	if(args.rom == NULL)
 	{
-		save = argv[2];
+		fatal(NULL, "You must specify a ROM file... -.-");
+		return EXIT_FAILURE;
 	}
-	else if(argc >= 4)
+
+	memset(&opts, 0, sizeof(opts));
+	opts.movie_mode = args.movie_mode;
+	opts.movie_path = args.movie_path;
+	opts.deterministic = args.deterministic;
+	opts.profile_path = args.profile_path;
+	opts.profile_stacks_path = args.profile_stacks_path;
+	opts.trace_path = args.trace_path;
+	opts.events_path = args.events_path;
+	opts.metrics = args.metrics;
+
+	// Nobody is there to take over once the movie ends
+	opts.movie_exit = true;
+
+	if(serve)
 	{
-		bootrom = argv[3];
+		// Cart RAM has to be private to each child, nobody is
+		// watching the clock, and equal jobs must give equal results
+		opts.save_mode = SAVE_MODE_JOURNAL;
+		opts.unthrottled = true;
+		opts.deterministic = true;
 	}
 
-	if((state = init_emulator(bootrom, argv[1], save)) == NULL)
+	if((state = init_emulator(args.bootrom, args.rom, args.save, &opts)) == NULL)
 	{
 		fatal(NULL, "Error initalising the emulator :(");
 		return EXIT_FAILURE;
@@ -48,7 +134,18 @@ int main(int argc, char *argv[])
 	// This never fails for the NULL frontend
 	select_frontend_all(state, NULL_AUDIO, NULL_VIDEO, NULL_LOOP);
 
-	if((val = EVENT_LOOP(state)))
+#ifdef HAVE_FORK
+	if(serve)
+	{
+		val = forksrv_run(state, &server);
+	}
+	else
+#endif
+	{
+		val = EVENT_LOOP(state);
+	}
+
+	if(val)
 	{
 		fatal(state, "Emulator exited abnormally");
 	}
@@ -1,6 +1,5 @@
 #include "sgherm.h"	// emu_state,
 #include "print.h"	// debug
-#include "signals.h"	// do_exit
 #include "frontend.h"	// frontend
 #include "frontends/sdl2/frontend.h"
 #include "frontends/sdl2/sdl_inc.h"	// SDL
@@ -39,6 +38,9 @@ bool sdl2_init_audio(emu_state *state)
 		return false;
 	}
 
+	// The mixer runs at SND_NATIVE_RATE; filter it down to the device
+	sound_set_output(state, aspec.freq, RESAMPLE_QUALITY_MEDIUM,
+		RESAMPLE_LATENCY_MEDIUM);
 	snd->freq = aspec.freq;
 
 	SDL_PauseAudio(0);
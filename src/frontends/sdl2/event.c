@@ -1,7 +1,9 @@
 #include "config.h"	// bool, etc
 #include "sgherm.h"	// emu_state
-#include "print.h"	// debug
-#include "signals.h"	// do_exit
+#include "print.h"	// debug, info
+#include "signals.h"	// EXIT_REQUESTED
+#include "rewind.h"	// rewind_*
+#include "history.h"	// history_running
 #include "frontends/sdl2/frontend.h"	// frontend
 #include "frontends/sdl2/sdl_inc.h"	// SDL
 
@@ -37,7 +39,7 @@ static inline input_key get_key(emu_state *state, SDL_Event *ev)
 		return INPUT_START;
 
 	case SDLK_ESCAPE:
-		do_exit = true;
+		state->quit = true;
 		return 0;
 
 	case SDLK_SPACE:
@@ -45,6 +47,14 @@ static inline input_key get_key(emu_state *state, SDL_Event *ev)
 		{
 			state->debug.instr_dump ^= 1;
 		}
+		return 0;
+
+	case SDLK_TAB:
+		if(ev->type == SDL_KEYDOWN && !ev->key.repeat)
+		{
+			frontend_cycle_speed(state);
+		}
+		return 0;
 
 	default:
 		return 0;
@@ -53,25 +63,72 @@ static inline input_key get_key(emu_state *state, SDL_Event *ev)
 
 int sdl2_event_loop(emu_state *state)
 {
+	rewind_state *rw;
+	uint_fast64_t last_frame = state->frames;
+	bool rewinding = false, ahead_due = false;
+
 	debug(state, "Executing sdl event loop");
 
+	// Whose history a crash on this thread should show
+	history_running = state;
+
 	if(SDL_Init(SDL_INIT_EVENTS))
 	{
 		error(state, "Failed to initalise input frontend: %s", SDL_GetError());
 		return -1;
 	}
 
+	if((rw = rewind_new(state, REWIND_DEFAULT_BUDGET,
+		REWIND_DEFAULT_INTERVAL)) == NULL)
+	{
+		warning(state, "Rewind is unavailable");
+	}
+
 	do
 	{
 		const uint8_t mode = LCDC_STAT_MODE_FLAG(state);
 		const uint_fast16_t clock = state->lcdc.curr_clk;
 		SDL_Event ev;
 
-		step_emulator(state);
+		if(unlikely(rewinding))
+		{
+			// Play captured frames backwards at roughly normal speed
+			if(rewind_back(rw, state, 1) > 0)
+			{
+				// Run-ahead states aren't drawn; show what it would
+				ahead_due = state->opts.run_ahead != 0;
+				if(!ahead_due)
+				{
+					BLIT_CANVAS(state);
+				}
+			}
 
-		if(unlikely(mode != 1 && clock != 0))
+			SDL_Delay(1000 / 60);
+		}
+		else
 		{
-			continue;
+			if(!step_emulator(state))
+			{
+				break;
+			}
+
+			if(unlikely(state->frames != last_frame))
+			{
+				last_frame = state->frames;
+				if(rw)
+				{
+					rewind_push(rw, state);
+				}
+
+				// Shown once this frame's input is in
+				ahead_due = state->opts.run_ahead &&
+					emu_present_due(state);
+			}
+
+			if(unlikely(mode != 1 && clock != 0))
+			{
+				continue;
+			}
 		}
 
 		// Exhaust events
@@ -80,9 +137,33 @@ int sdl2_event_loop(emu_state *state)
 			if(ev.type == SDL_KEYDOWN || ev.type == SDL_KEYUP)
 			{
 				bool pressed = (ev.type == SDL_KEYDOWN);
-				input_key key = get_key(state, &ev);
+				input_key key;
+
+				if(ev.key.keysym.sym == SDLK_r)
+				{
+					if(rw && state->movie != NULL)
+					{
+						// Cycles would run backwards under the
+						// movie and desync it
+						if(pressed && !ev.key.repeat)
+						{
+							info(state, "No rewinding while a movie "
+								"is recording or playing");
+						}
+					}
+					else if(rw && pressed != rewinding)
+					{
+						// Keep the audio callback off the state while
+						// frames are being swapped underneath it
+						rewinding = pressed;
+						SDL_PauseAudio(rewinding);
+						last_frame = state->frames;
+					}
+
+					continue;
+				}
 
-				if(!key)
+				if(!(key = get_key(state, &ev)))
 				{
 					continue;
 				}
@@ -93,16 +174,32 @@ int sdl2_event_loop(emu_state *state)
 			{
 				sdl2_video_data *video = state->front.video.data;
 				SDL_RenderClear(video->render);
-				BLIT_CANVAS(state);
+				ahead_due = state->opts.run_ahead != 0;
+				if(!ahead_due)
+				{
+					BLIT_CANVAS(state);
+				}
 			}
 			else if(unlikely(ev.type == SDL_QUIT))
 			{
-				do_exit = true;
+				state->quit = true;
+			}
+		}
+
+		if(unlikely(ahead_due))
+		{
+			ahead_due = false;
+			if(!frontend_run_ahead(state))
+			{
+				warning(state, "Run-ahead failed; turning it off");
+				state->opts.run_ahead = 0;
 			}
 		}
-	} while(!do_exit);
+	} while(!EXIT_REQUESTED(state));
+
+	rewind_free(rw);
 
 	SDL_Quit();
 
-	return 0;
+	return state->status == EMU_STATUS_OK ? 0 : -1;
 }
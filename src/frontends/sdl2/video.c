@@ -1,6 +1,5 @@
 #include "sgherm.h"	// emu_state,
 #include "print.h"	// debug
-#include "signals.h"	// do_exit
 #include "frontends/sdl2/frontend.h"	// frontend
 #include "frontends/sdl2/sdl_inc.h"	// SDL
 
@@ -17,6 +17,8 @@
 #include "config.h"
 #include "sgherm.h"
 #include "print.h"	// debug
+#include "signals.h"	// EXIT_REQUESTED
+#include "history.h"	// history_running
 #include "frontend.h"	// frontend
 #include "frontends/w32/frontend.h"
 
@@ -30,8 +32,6 @@ LRESULT CALLBACK HermProc(HWND, UINT, WPARAM, LPARAM);
 
 emu_state *g_state;
 
-extern bool do_exit;
-
 
 typedef struct video_state
 {
@@ -61,7 +61,7 @@ typedef struct audio_state
 
 void CALLBACK KillAfter30(HWND hWnd UNUSED, UINT iMsg UNUSED, UINT_PTR idEvent UNUSED, DWORD dwTime UNUSED)
 {
-	do_exit = true;
+	g_state->quit = true;
 }
 
 void w32_put_audio(emu_state *restrict state)
@@ -405,9 +405,9 @@ input_key TranslateKeyToGameBoy(emu_state *restrict state, WPARAM wParam, LPARAM
 	}
 }
 
-void StepEmulator(emu_state *restrict state)
+bool StepEmulator(emu_state *restrict state)
 {
-	step_emulator(state);
+	return step_emulator(state);
 }
 
 int w32_event_loop(emu_state *restrict state UNUSED)
@@ -415,12 +415,18 @@ int w32_event_loop(emu_state *restrict state UNUSED)
 	//video_state *s = (video_state *)state->front.video.data;
 	MSG msg;
 
-	while(!do_exit)
+	// Whose history a crash on this thread should show
+	history_running = g_state;
+
+	while(!EXIT_REQUESTED(g_state))
 	{
 		DWORD tick = GetTickCount();
 		do
 		{
-			StepEmulator(g_state);
+			if(!StepEmulator(g_state))
+			{
+				return -1;
+			}
 		} while(tick == GetTickCount());
 
 		while(PeekMessage(&msg, NULL, 0, 0, PM_REMOVE) > 0x0)
@@ -479,6 +485,7 @@ char *AskUserForFilePath(const char *title, const char *filter, BOOL open)
 int WINAPI WinMain(HINSTANCE hInstance UNUSED, HINSTANCE hPrevInstance UNUSED, char *szCmdLine, int iCmdShow UNUSED)
 {
 	char *rom_path, *save_path, *bootrom_path;
+	emu_options opts;
 
 	if(!stdout)
 	{
@@ -510,6 +517,8 @@ int WINAPI WinMain(HINSTANCE hInstance UNUSED, HINSTANCE hPrevInstance UNUSED, c
 		return -1;
 	}
 
+	memset(&opts, 0, sizeof(opts));
+
 	if(szCmdLine == NULL || strlen(szCmdLine) == 0)
 	{
 		rom_path = AskUserForFilePath("Open Game!",
@@ -524,8 +533,31 @@ int WINAPI WinMain(HINSTANCE hInstance UNUSED, HINSTANCE hPrevInstance UNUSED, c
 	}
 	else
 	{
-		rom_path = _strdup(szCmdLine);
-		bootrom_path = save_path = NULL;
+		frontend_args args;
+		int i, used;
+
+		memset(&args, 0, sizeof(args));
+		for(i = 1; i < __argc; i += used)
+		{
+			if((used = frontend_parse_arg(__argc, __argv, i, &args)) <= 0)
+			{
+				error(NULL, "Usage: %s " FRONTEND_USAGE, __argv[0]);
+				return -1;
+			}
+		}
+
+		rom_path = args.rom ? _strdup(args.rom) : NULL;
+		save_path = args.save ? _strdup(args.save) : NULL;
+		bootrom_path = args.bootrom ? _strdup(args.bootrom) : NULL;
+
+		opts.movie_mode = args.movie_mode;
+		opts.movie_path = args.movie_path;
+		opts.deterministic = args.deterministic;
+		opts.profile_path = args.profile_path;
+		opts.profile_stacks_path = args.profile_stacks_path;
+		opts.trace_path = args.trace_path;
+		opts.events_path = args.events_path;
+		opts.metrics = args.metrics;
 	}
 
 	if(rom_path == NULL)
@@ -533,7 +565,7 @@ int WINAPI WinMain(HINSTANCE hInstance UNUSED, HINSTANCE hPrevInstance UNUSED, c
 		return -1;
 	}
 
-	if((g_state = init_emulator(bootrom_path, rom_path, save_path)) == NULL)
+	if((g_state = init_emulator(bootrom_path, rom_path, save_path, &opts)) == NULL)
 	{
 		return -1;
 	}
@@ -618,7 +650,7 @@ LRESULT CALLBACK HermProc(HWND hWnd, UINT iMsg, WPARAM wParam, LPARAM lParam)
 
 		return 0;
 	case WM_CLOSE:
-		do_exit = true;
+		g_state->quit = true;
 		return 0;
 	default:
 		return DefWindowProc(hWnd, iMsg, wParam, lParam);
@@ -0,0 +1,185 @@
+#include "config.h"	// bool, uint[XX]_t, THREAD_LOCAL
+
+#include "sgherm.h"	// emu_state, REG_*
+#include "history.h"	// history_*
+#include "debug.h"	// disassemble
+#include "ctl_unit.h"	// instr_len
+
+#include <stdio.h>	// snprintf, fileno
+
+#if defined(HAVE_POSIX)
+#	include <unistd.h>	// write
+#elif defined(HAVE_WINDOWS)
+#	include <io.h>		// _write, _fileno
+#endif
+
+
+THREAD_LOCAL emu_state *history_running;
+
+
+//! Send a line straight to the descriptor, around stdio
+static void put_line(int fd, const char *line, int len)
+{
+	if(len <= 0)
+	{
+		return;
+	}
+
+#if defined(HAVE_POSIX)
+	while(len > 0)
+	{
+		const ssize_t done = write(fd, line, (size_t)len);
+
+		if(done <= 0)
+		{
+			return;
+		}
+
+		line += done;
+		len -= (int)done;
+	}
+#elif defined(HAVE_WINDOWS)
+	_write(fd, line, (unsigned)len);
+#else
+	(void)fd;
+	fwrite(line, 1, (size_t)len, stderr);
+#endif
+}
+
+/*!
+ * @brief Read back an instruction byte from the plain arrays only
+ * @returns the byte, or -1 where that would take the MBC or the hardware
+ * @note This runs from the crash handlers on a state that may be broken,
+ * so no function pointers, no registers and nothing with side effects.
+ */
+static int peek(const emu_state *restrict state, uint16_t bank, uint16_t pc)
+{
+	const uint8_t *page;
+	size_t offset;
+
+	if(pc < 0x4000)
+	{
+		offset = pc;
+	}
+	else if(pc < 0x8000)
+	{
+		// Whatever bank was in when it ran, not the one in now
+		offset = (size_t)bank * 0x4000 + (pc - 0x4000);
+	}
+	else if(pc >= 0xFF80 && pc < 0xFFFF)
+	{
+		return state->hram[pc & 0x7F];
+	}
+	else if(pc >= 0xC000 && pc < 0xFE00)
+	{
+		// Work RAM and its echo
+		if((pc & 0x1000) == 0)
+		{
+			page = state->wram[0];
+		}
+		else if(state->system == SYSTEM_CGB && state->wram_bank < 8)
+		{
+			page = state->wram[state->wram_bank];
+		}
+		else
+		{
+			page = state->wram[1];
+		}
+
+		return page != NULL ? page[pc & 0xFFF] : -1;
+	}
+	else
+	{
+		// VRAM, cart RAM, OAM and registers
+		return -1;
+	}
+
+	return state->cart_data != NULL && offset < state->cart_size ?
+		state->cart_data[offset] : -1;
+}
+
+void history_dump(emu_state *restrict state, FILE *out)
+{
+	history_state *history = &(state->debug.history);
+	const uint32_t writes = history->write_next < HISTORY_WRITES ?
+		history->write_next : HISTORY_WRITES;
+	const uint32_t instrs = history->instr_next < HISTORY_INSTRS ?
+		history->instr_next : HISTORY_INSTRS;
+	char line[160], text[32], bytes[12];
+	uint32_t i;
+	int fd;
+
+	if(history->dumped || instrs == 0)
+	{
+		return;
+	}
+
+	history->dumped = true;
+
+#if defined(HAVE_WINDOWS)
+	fd = _fileno(out);
+#else
+	fd = fileno(out);
+#endif
+
+	put_line(fd, line, snprintf(line, sizeof(line),
+		"Last %u I/O writes, oldest first:\n", writes));
+
+	for(i = history->write_next - writes; i != history->write_next; i++)
+	{
+		const history_write *w = &(history->writes[i & (HISTORY_WRITES - 1)]);
+
+		put_line(fd, line, snprintf(line, sizeof(line),
+			"  %14llu  %04X  %04X <- %02X\n",
+			(unsigned long long)w->cycle, w->pc, w->location, w->data));
+	}
+
+	put_line(fd, line, snprintf(line, sizeof(line),
+		"Last %u instructions, oldest first:\n", instrs));
+
+	for(i = history->instr_next - instrs; i != history->instr_next; i++)
+	{
+		const uint32_t r = history->instrs[i & (HISTORY_INSTRS - 1)];
+		const uint16_t pc = (uint16_t)r;
+		// The bank only means something in the switchable window
+		const uint16_t bank = (pc >= 0x4000 && pc < 0x8000) ?
+			(uint16_t)(r >> 16) : 0;
+		int raw[3];
+		uint8_t operand[2];
+		unsigned len, n;
+		size_t used;
+
+		raw[0] = peek(state, bank, pc);
+		raw[1] = peek(state, bank, (uint16_t)(pc + 1));
+		raw[2] = peek(state, bank, (uint16_t)(pc + 2));
+
+		// Unknown opcode, unknown length
+		len = raw[0] < 0 ? 1 : instr_len[raw[0]];
+
+		for(n = 0, used = 0; n < len; n++)
+		{
+			used += (size_t)snprintf(bytes + used, sizeof(bytes) - used,
+				raw[n] < 0 ? "%s??" : "%s%02X", n ? " " : "", raw[n]);
+		}
+
+		if(raw[0] < 0 || (len > 1 && raw[1] < 0) || (len > 2 && raw[2] < 0))
+		{
+			snprintf(text, sizeof(text), "??");
+		}
+		else
+		{
+			operand[0] = (uint8_t)raw[1];
+			operand[1] = (uint8_t)raw[2];
+			disassemble(text, sizeof(text), pc, (uint8_t)raw[0], operand);
+		}
+
+		put_line(fd, line, snprintf(line, sizeof(line),
+			"  %02X:%04X  %-8s  %s\n", bank, pc, bytes, text));
+	}
+
+	put_line(fd, line, snprintf(line, sizeof(line),
+		"Registers: AF=%04X BC=%04X DE=%04X HL=%04X SP=%04X PC=%04X "
+		"cycle %llu\n", REG_AF(state), REG_BC(state), REG_DE(state),
+		REG_HL(state), REG_SP(state), REG_PC(state),
+		(unsigned long long)state->cycles));
+}
@@ -4,11 +4,19 @@
 
 #include "ctl_unit.h"	// signal_interrupt
 #include "input.h"	// input_key, defines
+#include "movie.h"	// movie_input
 #include "print.h"	// error
 #include "sgherm.h"	// emu_state
 #include "util.h"	// UNUSED
 
 
+//! Inverse of key_to_index
+static const input_key index_to_key[8] =
+{
+	INPUT_RIGHT, INPUT_LEFT, INPUT_UP, INPUT_DOWN,
+	INPUT_A, INPUT_B, INPUT_SELECT, INPUT_START,
+};
+
 static inline int key_to_index(input_key key)
 {
 	switch(key)
@@ -60,7 +68,15 @@ int key_scan(emu_state *restrict state)
 	return val;
 }
 
-void joypad_signal(emu_state *restrict state, input_key key, bool down)
+uint8_t joypad_key_mask(input_key key)
+{
+	int k = key_to_index(key);
+
+	return k < 0 ? 0 : (uint8_t)(1 << k);
+}
+
+//! Press or release a key, whoever asked for it
+static void joypad_press(emu_state *restrict state, input_key key, bool down)
 {
 	int k = key_to_index(key);
 
@@ -80,3 +96,97 @@ void joypad_signal(emu_state *restrict state, input_key key, bool down)
 
 	state->input.row = key_scan(state);
 }
+
+void joypad_signal(emu_state *restrict state, input_key key, bool down)
+{
+	// Movies log host input, or replace it during playback
+	if(unlikely(state->movie != NULL) && !movie_input(state, key, down))
+	{
+		return;
+	}
+
+	joypad_press(state, key, down);
+}
+
+static void set_mask(emu_state *restrict state, uint8_t mask, bool host)
+{
+	int i;
+
+	for(i = 0; i < 8; i++)
+	{
+		bool down = (mask >> i) & 1;
+
+		if(down == (state->input.pressed[i] != 0))
+		{
+			continue;
+		}
+
+		if(host)
+		{
+			joypad_signal(state, index_to_key[i], down);
+		}
+		else
+		{
+			joypad_press(state, index_to_key[i], down);
+		}
+	}
+}
+
+void joypad_set_mask(emu_state *restrict state, uint8_t mask)
+{
+	set_mask(state, mask, true);
+}
+
+void joypad_apply_mask(emu_state *restrict state, uint8_t mask)
+{
+	set_mask(state, mask, false);
+}
+
+uint8_t joypad_mask(const emu_state *restrict state)
+{
+	uint8_t mask = 0;
+	int i;
+
+	for(i = 0; i < 8; i++)
+	{
+		if(state->input.pressed[i])
+		{
+			mask |= 1 << i;
+		}
+	}
+
+	return mask;
+}
+
+void joypad_vblank(emu_state *restrict state)
+{
+	lag_state *lag = &(state->input.lag);
+	const unsigned need = state->opts.lag_min_polls ?
+		state->opts.lag_min_polls : 1;
+
+	lag->lagged = lag->polls < need;
+	lag->polls = 0;
+
+	if(lag->lagged)
+	{
+		lag->frames++;
+		lag->second_lag++;
+	}
+
+	if(++lag->second_frames == LAG_SECOND_FRAMES)
+	{
+		lag->last_second = lag->second_lag;
+		if(lag->second_lag > lag->worst_second)
+		{
+			lag->worst_second = lag->second_lag;
+		}
+
+		lag->seconds++;
+		if(lag->second_lag)
+		{
+			lag->lag_seconds++;
+		}
+
+		lag->second_frames = lag->second_lag = 0;
+	}
+}
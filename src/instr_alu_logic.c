@@ -424,6 +424,7 @@ static inline void cb_dispatch(emu_state *restrict state, uint8_t data[] UNUSED)
 	cb_ops op;
 
 	state->wait = 12;
+	PERF_COUNT(state, op_cb[opcode]);
 
 	if(opcode >= 0x40)
 	{
@@ -4,6 +4,13 @@
 #include "ctl_unit.h"	// signal_interrupt
 #include "util.h"	// likely/unlikely
 #include "sgherm.h"	// emu_state
+#include "save.h"	// save_frame
+#include "cow.h"	// COW_OWNED, cow_unshare
+#include "savestate.h"	// state_hash
+#include "perf.h"	// PERF_TIME, perf_poll
+#include "input.h"	// joypad_vblank
+#include "metrics.h"	// metrics_vblank
+#include "tracepoint.h"	// TRACEPOINT
 #include "util_bitops.h"// bitops
 
 #include <assert.h>
@@ -497,6 +504,7 @@ void lcdc_mode_change(emu_state *restrict state, uint8_t mode)
 {
 	assert(mode < 4);
 
+	TRACEPOINT(state, TP_LCDC_MODE, mode, state->lcdc.ly);
 	state->lcdc.stat = (state->lcdc.stat & ~0x3) | mode;
 	switch(mode)
 	{
@@ -523,6 +531,11 @@ void lcdc_mode_change(emu_state *restrict state, uint8_t mode)
 
 static inline void render_scanline(emu_state *restrict state)
 {
+	if(unlikely(!COW_OWNED(state, COW_OUT)) && !cow_unshare(state, COW_OUT))
+	{
+		return;
+	}
+
 	switch(state->system)
 	{
 		case SYSTEM_DMG:
@@ -537,7 +550,7 @@ static inline void render_scanline(emu_state *restrict state)
 			else
 			{
 				memset(state->lcdc.out, dmg_palette[0],
-				       sizeof(state->lcdc.out));
+				       LCDC_OUT_SIZE);
 			}
 
 			if(LCDC_WIN(state))
@@ -560,7 +573,7 @@ static inline void render_scanline(emu_state *restrict state)
 			else
 			{
 				memset(state->lcdc.out, 0x00FFFFFF,
-				       sizeof(state->lcdc.out));
+				       LCDC_OUT_SIZE);
 			}
 
 			if(LCDC_WIN(state))
@@ -592,12 +605,11 @@ static inline void render_scanline(emu_state *restrict state)
 static inline void lcdc_mode2(emu_state *restrict state)
 {
 	uint8_t clocks = 167;
-	static bool lyc_checked = false;
 
 	if(state->lcdc.curr_clk < 80)
 	{
 		state->lcdc.next_clk = 80;
-		if(!lyc_checked)
+		if(!state->lcdc.lyc_checked)
 		{
 			if(state->lcdc.ly == state->lcdc.lyc && state->lcdc.curr_clk == 0)
 			{
@@ -613,13 +625,13 @@ static inline void lcdc_mode2(emu_state *restrict state)
 			{
 				state->lcdc.stat &= ~0x4;
 			}
-			lyc_checked = true;
+			state->lcdc.lyc_checked = true;
 		}
 	}
 	else
 	{
 		lcdc_mode_change(state, 3);
-		lyc_checked = false;
+		state->lcdc.lyc_checked = false;
 		return;
 	}
 
@@ -653,7 +665,12 @@ static inline void lcdc_mode3(emu_state *restrict state)
 
 	if(state->lcdc.curr_clk == needed_clk)
 	{
-		render_scanline(state);
+		// Under run-ahead only the clone's last frame is ever seen
+		if(likely(!state->hidden && !state->opts.run_ahead))
+		{
+			render_scanline(state);
+		}
+
 		lcdc_mode_change(state, 0);
 	}
 	else
@@ -711,10 +728,34 @@ static inline void lcdc_mode1(emu_state *restrict state)
 	{
 		// Fire the vblank interrupt
 		signal_interrupt(state, INT_VBLANK);
-		state->lcdc.throt_trigger = true;
+		state->lcdc.throt_trigger = !state->opts.unthrottled &&
+			state->speed != SPEED_UNLIMITED;
+		state->frames++;
+		joypad_vblank(state);
+
+		// Blit, unless fast-forward is skipping this one or run-ahead
+		// shows another
+		if(!state->opts.run_ahead && emu_present_due(state))
+		{
+			PERF_TIME(state, PERF_BLIT, BLIT_CANVAS(state));
+		}
+
+		// Frame boundary, write back cart RAM if it's due
+		save_frame(state);
+
+		if(unlikely(state->metrics != NULL))
+		{
+			metrics_vblank(state);
+		}
 
-		// Blit
-		BLIT_CANVAS(state);
+		if(state->opts.deterministic)
+		{
+			state->frame_hash = state_hash(state);
+		}
+
+#ifdef PERF_COUNTERS
+		perf_poll(state);
+#endif
 	}
 
 	if(state->lcdc.curr_clk % 456 == 0)
@@ -738,7 +779,7 @@ static inline void lcdc_mode1(emu_state *restrict state)
 
 typedef void (*lcdc_mode_fn)(emu_state *restrict);
 
-static lcdc_mode_fn mode_fns[0x4] = {
+static const lcdc_mode_fn mode_fns[0x4] = {
 	lcdc_mode0, lcdc_mode1, lcdc_mode2, lcdc_mode3
 };
 
@@ -764,3 +805,21 @@ void lcdc_tick(emu_state *restrict state, int count)
 		mode_fns[LCDC_STAT_MODE_FLAG(state)](state);
 	}
 }
+
+/*!
+ * @brief FNV-1a over the LCD buffer
+ * @note Cheap and good enough to tell whether two runs drew the same frame
+ */
+uint64_t lcdc_screen_hash(const emu_state *state)
+{
+	const uint8_t *p = (const uint8_t *)state->lcdc.out;
+	uint64_t h = 0xCBF29CE484222325ULL;
+	size_t i;
+
+	for(i = 0; i < LCDC_OUT_SIZE; i++)
+	{
+		h = (h ^ p[i]) * 0x100000001B3ULL;
+	}
+
+	return h;
+}
@@ -2,7 +2,10 @@
 #include "sgherm.h"	// emu_state
 #include "memory.h"	// constants
 #include "print.h"	// warning/debug
-#include "memmap.h"	// memmap_*
+#include "save.h"	// save_*
+#include "cow.h"	// COW_OWNED, cow_unshare
+#include "perf.h"	// PERF_COUNT
+#include "tracepoint.h"	// TRACEPOINT
 #include "util.h"	// unix_time_delta
 
 #include <string.h>	// memset
@@ -58,12 +61,17 @@ static inline void ram_bank_write(emu_state *restrict state, uint16_t location,
 	{
 		value |= 0xF0;
 	}
-	state->mbc.cart_ram[pos] = value;
 
-	state->mbc.dirty = true;
+	if(unlikely(!COW_OWNED(state, COW_CART)) &&
+		!cow_unshare(state, COW_CART))
+	{
+		return;
+	}
 
-	// Write back to storage
-	memmap_sync(state, state->mbc.cart_ram, &(state->mbc.cart_mm_data));
+	state->mbc.cart_ram[pos] = value;
+
+	// Written back at the next frame boundary past the deadline
+	save_mark_range(state, pos, 1);
 }
 
 // MBC-less operation
@@ -86,8 +94,7 @@ static inline bool nombc_init(emu_state *restrict state UNUSED)
 		state->mbc.ram_total = s;
 		if(state->mbc.ram_total)
 		{
-			state->mbc.cart_ram = memmap_open(state, state->save_path,
-				state->mbc.ram_total, &(state->mbc.cart_mm_data));
+			state->mbc.cart_ram = save_open(state, state->mbc.ram_total);
 
 			if(!(state->mbc.cart_ram))
 			{
@@ -136,7 +143,7 @@ static inline void nombc_finish(emu_state *restrict state)
 {
 	if(state->mbc.cart_ram)
 	{
-		memmap_close(state, state->mbc.cart_ram, &(state->mbc.cart_mm_data));
+		save_close(state);
 	}
 }
 
@@ -172,8 +179,7 @@ static inline bool mbc1_init(emu_state *restrict state)
 		state->mbc.ram_total = s;
 		if(state->mbc.ram_total)
 		{
-			state->mbc.cart_ram = memmap_open(state, state->save_path,
-				state->mbc.ram_total, &(state->mbc.cart_mm_data));
+			state->mbc.cart_ram = save_open(state, state->mbc.ram_total);
 			if(!(state->mbc.cart_ram))
 			{
 				return false;
@@ -245,6 +251,8 @@ static inline void mbc1_write(emu_state *restrict state, uint16_t location, uint
 			state->mbc.rom_bank_upper;
 
 		assert(state->mbc.rom_bank <= state->mbc.rom_bank_count);
+		PERF_COUNT(state, rom_bank_writes);
+		TRACEPOINT(state, TP_ROM_BANK, state->mbc.rom_bank, 0);
 
 		break;
 	case 0x4:
@@ -253,6 +261,8 @@ static inline void mbc1_write(emu_state *restrict state, uint16_t location, uint
 		{
 			// RAM banking mode
 			state->mbc.ram_bank = value;
+			PERF_COUNT(state, ram_bank_writes);
+			TRACEPOINT(state, TP_RAM_BANK, state->mbc.ram_bank, 0);
 		}
 		else
 		{
@@ -262,6 +272,8 @@ static inline void mbc1_write(emu_state *restrict state, uint16_t location, uint
 				state->mbc.rom_bank_upper;
 
 			assert(state->mbc.rom_bank <= state->mbc.rom_bank_count);
+			PERF_COUNT(state, rom_bank_writes);
+			TRACEPOINT(state, TP_ROM_BANK, state->mbc.rom_bank, 0);
 		}
 
 		break;
@@ -288,7 +300,7 @@ static inline void mbc1_finish(emu_state *restrict state)
 {
 	if(state->mbc.cart_ram)
 	{
-		memmap_close(state, state->mbc.cart_ram, &(state->mbc.cart_mm_data));
+		save_close(state);
 	}
 }
 
@@ -315,8 +327,7 @@ static inline bool mbc2_init(emu_state *restrict state)
 	state->mbc.ram_bank_count = 1;
 	state->mbc.ram_total = 512;
 	state->mbc.use_4bit = true;
-	state->mbc.cart_ram = memmap_open(state, state->save_path,
-		state->mbc.ram_bank_size, &(state->mbc.cart_mm_data));
+	state->mbc.cart_ram = save_open(state, state->mbc.ram_bank_size);
 	if(!(state->mbc.cart_ram))
 	{
 		return false;
@@ -378,6 +389,8 @@ static inline void mbc2_write(emu_state *restrict state, uint16_t location, uint
 			}
 
 			state->mbc.rom_bank = value & 0x1F;
+			PERF_COUNT(state, rom_bank_writes);
+			TRACEPOINT(state, TP_ROM_BANK, state->mbc.rom_bank, 0);
 		}
 		break;
 	case 0xA:
@@ -399,7 +412,7 @@ static inline void mbc2_finish(emu_state *restrict state)
 {
 	if(state->mbc.cart_ram)
 	{
-		memmap_close(state, state->mbc.cart_ram, &(state->mbc.cart_mm_data));
+		save_close(state);
 	}
 }
 
@@ -413,28 +426,12 @@ const mbc_func mbc2_func =
 
 // MBC3
 
-// XXX exported for rom.c stuff
-void adjust_mbc3_time(emu_state *restrict state)
+//! Advance the live RTC registers by a number of seconds
+static void rtc_advance(emu_state *restrict state, uint64_t secs)
 {
 	time_delta td;
-	uint64_t t = time(NULL);
-
-	if(state->mbc.mbc3.rtc[0].halt)
-	{
-		// Timer halted, no adjustment required
-		return;
-	}
-
-	if(t == state->mbc.mbc3.unix_time_last)
-	{
-		// No need to redo this expensive calculation
-		return;
-	}
-
-	unix_time_delta(t, state->mbc.mbc3.unix_time_last, &td);
 
-	// Set
-	state->mbc.mbc3.unix_time_last = t;
+	unix_time_delta(secs, 0, &td);
 
 	state->mbc.mbc3.rtc[0].seconds += td.seconds;
 	if(state->mbc.mbc3.rtc[0].seconds >= 60)
@@ -457,15 +454,74 @@ void adjust_mbc3_time(emu_state *restrict state)
 		state->mbc.mbc3.rtc[0].hours %= 24;
 	}
 
-	state->mbc.mbc3.rtc[0].days += td.days;
-	if(state->mbc.mbc3.rtc[0].days > 512)
+	// Day counter is 9 bits; the carry sticks until the game clears it
+	td.days += state->mbc.mbc3.rtc[0].days;
+	if(td.days >= 512)
 	{
 		state->mbc.mbc3.rtc[0].day_carry = 1;
-		state->mbc.mbc3.rtc[0].days %= 512;
+		td.days %= 512;
 	}
+	state->mbc.mbc3.rtc[0].days = td.days;
+}
+
+//! Restart the RTC time base from now (on init and when un-halting)
+static void rtc_rebase(emu_state *restrict state)
+{
+	state->mbc.mbc3.cycles_last = state->cycles;
 
-	// Write back
-	rtc_save(state);
+	if(state->opts.rtc_mode == RTC_MODE_WALLCLOCK)
+	{
+		state->mbc.mbc3.unix_time_last = time(NULL);
+	}
+}
+
+/*!
+ * @brief Bring the live RTC registers up to date
+ * @note This never touches the save file; persistence happens on latch,
+ * halt and exit.
+ */
+void adjust_mbc3_time(emu_state *restrict state)
+{
+	uint64_t secs;
+
+	if(state->mbc.mbc3.rtc[0].halt)
+	{
+		// Timer halted, no adjustment required
+		return;
+	}
+
+	if(state->opts.rtc_mode == RTC_MODE_EMULATED)
+	{
+		// Emulated seconds; keep the remainder so nothing drifts
+		uint_fast64_t elapsed = state->cycles - state->mbc.mbc3.cycles_last;
+
+		if(elapsed < (uint_fast64_t)state->freq)
+		{
+			return;
+		}
+
+		secs = elapsed / state->freq;
+		state->mbc.mbc3.cycles_last += secs * state->freq;
+
+		// Keep the stored timestamp moving with emulated time
+		state->mbc.mbc3.unix_time_last += secs;
+	}
+	else
+	{
+		uint64_t t = time(NULL);
+
+		if(t <= state->mbc.mbc3.unix_time_last)
+		{
+			// No need to redo this calculation (or the clock went
+			// backwards, which we don't follow)
+			return;
+		}
+
+		secs = t - state->mbc.mbc3.unix_time_last;
+		state->mbc.mbc3.unix_time_last = t;
+	}
+
+	rtc_advance(state, secs);
 }
 
 static inline bool mbc3_init(emu_state *restrict state)
@@ -490,8 +546,7 @@ static inline bool mbc3_init(emu_state *restrict state)
 		state->mbc.ram_total = s;
 
 		// Compensate for RTC data (in-file)
-		state->mbc.cart_ram = memmap_open(state, state->save_path, s + 48,
-			&(state->mbc.cart_mm_data));
+		state->mbc.cart_ram = save_open(state, s + 48);
 		if(!(state->mbc.cart_ram))
 		{
 			return false;
@@ -505,7 +560,14 @@ static inline bool mbc3_init(emu_state *restrict state)
 	}
 
 	rtc_load(state);
-	adjust_mbc3_time(state);
+
+	if(state->opts.rtc_mode == RTC_MODE_WALLCLOCK)
+	{
+		// Catch up with the time we were switched off
+		adjust_mbc3_time(state);
+	}
+
+	state->mbc.mbc3.cycles_last = state->cycles;
 
 	return true;
 }
@@ -590,29 +652,33 @@ static inline void mbc3_write(emu_state *restrict state, uint16_t location, uint
 		}
 
 		assert(state->mbc.rom_bank <= state->mbc.rom_bank_count);
+		PERF_COUNT(state, rom_bank_writes);
+		TRACEPOINT(state, TP_ROM_BANK, state->mbc.rom_bank, 0);
 		break;
 	case 0x4:
 	case 0x5:
 		state->mbc.mbc3.rtc_select = value;
+		TRACEPOINT(state, TP_RAM_BANK, value, 0);
 		if(state->mbc.mbc3.rtc_select < 0x4)
 		{
 			state->mbc.ram_bank = value;
+			PERF_COUNT(state, ram_bank_writes);
 		}
 		break;
 	case 0xA:
 	case 0xB:
 	{
-		//Select latched or unlatched value
-		size_t l_index = state->mbc.mbc3.latched == 1 ? 1 : 0;
+		// Writes always go to the live registers, latched or not
+		mbc3_rtc *rtc = &(state->mbc.mbc3.rtc[0]);
 
 		if(!((state->mbc.mbc3.ram_rtc_enable & 0xA) == 0xA))
 		{
 			return;
 		}
 
-		if(l_index == 0 && state->mbc.mbc3.rtc_select >= 0x8)
+		if(state->mbc.mbc3.rtc_select >= 0x8)
 		{
-			// Unlatched, sync clock
+			// Sync clock before it's modified
 			adjust_mbc3_time(state);
 		}
 
@@ -621,25 +687,36 @@ static inline void mbc3_write(emu_state *restrict state, uint16_t location, uint
 		switch(state->mbc.mbc3.rtc_select)
 		{
 		case 0x8:
-			state->mbc.mbc3.rtc[l_index].seconds = value;
+			rtc->seconds = value;
 			return;
 		case 0x9:
-			state->mbc.mbc3.rtc[l_index].minutes = value;
+			rtc->minutes = value;
 			return;
 		case 0xA:
-			state->mbc.mbc3.rtc[l_index].hours = value;
+			rtc->hours = value;
 			return;
 		case 0xB:
-			state->mbc.mbc3.rtc[l_index].days =
-				(state->mbc.mbc3.rtc[l_index].days & 0x100) | value;
+			rtc->days = (rtc->days & 0x100) | value;
 			return;
 		case 0xC:
 		{
-			state->mbc.mbc3.rtc[l_index].days =
-				(state->mbc.mbc3.rtc[l_index].days & 0xFF) |
-				((value & 0x1) << 8);
-			state->mbc.mbc3.rtc[l_index].halt = (value & 0x40) >> 6;
-			state->mbc.mbc3.rtc[l_index].day_carry = (value & 0x80) >> 7;
+			uint8_t halt = (value & 0x40) >> 6;
+			bool halt_changed = rtc->halt != halt;
+
+			rtc->days = (rtc->days & 0xFF) | ((value & 0x1) << 8);
+			rtc->halt = halt;
+			rtc->day_carry = (value & 0x80) >> 7;
+
+			if(halt_changed)
+			{
+				if(!halt)
+				{
+					// Don't count the time spent halted
+					rtc_rebase(state);
+				}
+
+				rtc_save(state);
+			}
 			return;
 		}
 		default:
@@ -660,6 +737,9 @@ static inline void mbc3_write(emu_state *restrict state, uint16_t location, uint
 			// Copy the present RTC value
 			memcpy(&(state->mbc.mbc3.rtc[1]), &(state->mbc.mbc3.rtc[0]),
 				sizeof(state->mbc.mbc3.rtc[1]));
+
+			// Latching is rare, so it's a good point to persist
+			rtc_save(state);
 		}
 
 		state->mbc.mbc3.latched = value;
@@ -672,10 +752,16 @@ static inline void mbc3_write(emu_state *restrict state, uint16_t location, uint
 
 static inline void mbc3_finish(emu_state *restrict state)
 {
-	rtc_save(state);
+	adjust_mbc3_time(state);
+	if(state->save.path != NULL)
+	{
+		// Only worth it if it's going to be written back
+		rtc_save(state);
+	}
+
 	if(state->mbc.cart_ram)
 	{
-		memmap_close(state, state->mbc.cart_ram, &(state->mbc.cart_mm_data));
+		save_close(state);
 	}
 }
 
@@ -744,6 +830,8 @@ static inline void mbc5_write(emu_state *restrict state, uint16_t location, uint
 			(uint16_t)(state->mbc.rom_bank_upper << 8);
 
 		assert(state->mbc.rom_bank <= state->mbc.rom_bank_count);
+		PERF_COUNT(state, rom_bank_writes);
+		TRACEPOINT(state, TP_ROM_BANK, state->mbc.rom_bank, 0);
 		break;
 	case 0x3:
 		state->mbc.rom_bank_upper = value & 0x1;
@@ -751,11 +839,15 @@ static inline void mbc5_write(emu_state *restrict state, uint16_t location, uint
 			(uint16_t)(state->mbc.rom_bank_upper << 8);
 
 		assert(state->mbc.rom_bank <= state->mbc.rom_bank_count);
+		PERF_COUNT(state, rom_bank_writes);
+		TRACEPOINT(state, TP_ROM_BANK, state->mbc.rom_bank, 0);
 		break;
 	case 0x4:
 	case 0x5:
 		// RAM banking mode
 		state->mbc.ram_bank = value & 0x0F;
+		PERF_COUNT(state, ram_bank_writes);
+		TRACEPOINT(state, TP_RAM_BANK, state->mbc.ram_bank, 0);
 		break;
 	case 0xA:
 	case 0xB:
@@ -775,7 +867,7 @@ static inline void mbc5_finish(emu_state *restrict state)
 {
 	if(state->mbc.cart_ram)
 	{
-		memmap_close(state, state->mbc.cart_ram, &(state->mbc.cart_mm_data));
+		save_close(state);
 	}
 }
 
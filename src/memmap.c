@@ -1,6 +1,7 @@
 #include "config.h"	// bool, stdint
 
 #include "sgherm.h"	// emu_state
+#include "memmap.h"	// memmap_*
 #include "print.h"	// error
 
 #include <stdlib.h>	// malloc
@@ -30,6 +31,7 @@ struct memmap_state_t
 	char *path;
 	size_t size, f_size;
 	int flags;
+	bool readonly;
 };
 
 
@@ -37,16 +39,20 @@ static inline int _open_map(const char *path, size_t size)
 {
 	int fd;
 	int64_t filesize;
+	struct stat st;
 
-	if((filesize = get_file_size(path)) < 0)
+	if((fd = open(path, O_CREAT | O_RDWR | O_APPEND, S_IRUSR | S_IWUSR)) < 0)
 	{
 		return -1;
 	}
 
-	if((fd = open(path, O_CREAT | O_RDWR | O_APPEND, S_IRUSR | S_IWUSR)) < 0)
+	// Stat after open so a save file that doesn't exist yet is just empty
+	if(fstat(fd, &st) < 0)
 	{
+		close(fd);
 		return -1;
 	}
+	filesize = st.st_size;
 
 	if((size_t)filesize < size)
 	{
@@ -108,6 +114,8 @@ void * memmap_open(emu_state *restrict state, const char *path, size_t size, mem
 		return NULL;
 	}
 
+	m_state->readonly = false;
+
 	if(path)
 	{
 		m_state->path = strdup(path);
@@ -147,7 +155,7 @@ void * memmap_open(emu_state *restrict state, const char *path, size_t size, mem
 	m_state->f_size = size;
 	m_state->size = size = _round_nearest(size, sysconf(_SC_PAGESIZE));
 
-	if((map = mmap(NULL, size, PROT_READ | PROT_WRITE, m_state->flags, fd, 0)) == -1)
+	if((map = mmap(NULL, size, PROT_READ | PROT_WRITE, m_state->flags, fd, 0)) == MAP_FAILED)
 	{
 		error(state, "Could not mmap file: %s", strerror(errno));
 
@@ -178,6 +186,73 @@ void * memmap_open(emu_state *restrict state, const char *path, size_t size, mem
 	return map;
 }
 
+const void * memmap_open_ro(emu_state *restrict state, const char *path, size_t *size, bool hugepages, memmap_state **data)
+{
+	memmap_state *m_state;
+	struct stat st;
+	void *map;
+	int fd;
+
+	*data = NULL;
+
+	if((fd = open(path, O_RDONLY)) < 0)
+	{
+		error(state, "Could not open %s: %s", path, strerror(errno));
+		return NULL;
+	}
+
+	if(fstat(fd, &st) < 0 || st.st_size <= 0)
+	{
+		error(state, "Could not get size of %s: %s", path, strerror(errno));
+		close(fd);
+		return NULL;
+	}
+
+	if((m_state = malloc(sizeof(memmap_state))) == NULL)
+	{
+		close(fd);
+		return NULL;
+	}
+
+	m_state->path = NULL;
+	m_state->readonly = true;
+	m_state->flags = MAP_PRIVATE;
+	m_state->f_size = *size = st.st_size;
+	m_state->size = _round_nearest(st.st_size, sysconf(_SC_PAGESIZE));
+
+	// Read-only private file mappings share the page cache between every
+	// process (and instance) that maps the same file
+	if((map = mmap(NULL, m_state->size, PROT_READ, m_state->flags, fd, 0)) == MAP_FAILED)
+	{
+		error(state, "Could not mmap %s: %s", path, strerror(errno));
+		close(fd);
+		free(m_state);
+		return NULL;
+	}
+
+	close(fd);
+
+#ifdef HAVE_MADVISE
+	// ROM banks are hit at random, get it all in now rather than faulting
+	madvise(map, m_state->size, MADV_WILLNEED);
+#endif //HAVE_MADVISE
+
+#ifdef MADV_HUGEPAGE
+	if(hugepages)
+	{
+		// Only helps where the kernel does THP for file mappings
+		madvise(map, m_state->size, MADV_HUGEPAGE);
+	}
+#else
+	(void)hugepages;
+#endif //MADV_HUGEPAGE
+
+	debug(state, "Mapped %ld bytes read-only", (long)*size);
+
+	*data = m_state;
+	return map;
+}
+
 #if defined(HAVE_MREMAP) && !defined(__NetBSD__)
 // Use a better implementation (NetBSD's is not compatible)
 
@@ -279,8 +354,11 @@ void memmap_close(emu_state *restrict state UNUSED, void *map, memmap_state **da
 	munmap(map, m_state->size);
 
 	// Truncate if possible
-	ret = truncate(m_state->path, m_state->f_size);
-	(void)ret;
+	if(m_state->path && !m_state->readonly)
+	{
+		ret = truncate(m_state->path, m_state->f_size);
+		(void)ret;
+	}
 
 	free(m_state->path);
 	free(m_state);
@@ -296,6 +374,29 @@ void memmap_sync(emu_state *restrict state UNUSED, void *map, memmap_state **dat
 	msync(map, m_state->size, MS_ASYNC);
 }
 
+void memmap_sync_range(emu_state *restrict state UNUSED, void *map, size_t offset, size_t len, memmap_state **data)
+{
+	memmap_state *m_state = *data;
+	size_t page = sysconf(_SC_PAGESIZE);
+	size_t start = offset - (offset % page);
+
+	assert(m_state);
+
+	if(start >= m_state->size)
+	{
+		return;
+	}
+
+	// msync wants a page-aligned address
+	len += offset - start;
+	if(start + len > m_state->size)
+	{
+		len = m_state->size - start;
+	}
+
+	msync((char *)map + start, len, MS_ASYNC);
+}
+
 #else //HAVE_MMAP
 
 // Shitty fallback implementation for lesser systems
@@ -314,15 +415,18 @@ struct memmap_state_t
 void * memmap_open(emu_state *restrict state, const char *path, size_t size, memmap_state **data)
 {
 	memmap_state *m_state = (memmap_state *)malloc(sizeof(memmap_state));
-	void *map = malloc(size);
+	void *map = calloc(size, 1);
 
 	*data = m_state;
+	m_state->size = size;
 
 	if(path)
 	{
 		m_state->anonymous = false;
 
-		if(!(m_state->f = fopen(path, "r+b")))
+		// Create the file if it isn't there yet
+		if(!(m_state->f = fopen(path, "r+b")) &&
+			!(m_state->f = fopen(path, "w+b")))
 		{
 			error(state, "Could not open file for fake mmap: %s", strerror(errno));
 			free(m_state);
@@ -351,6 +455,61 @@ void * memmap_open(emu_state *restrict state, const char *path, size_t size, mem
 	return map;
 }
 
+const void * memmap_open_ro(emu_state *restrict state, const char *path, size_t *size, bool hugepages UNUSED, memmap_state **data)
+{
+	memmap_state *m_state;
+	void *map;
+	FILE *f;
+	long len;
+
+	*data = NULL;
+
+	if((f = fopen(path, "rb")) == NULL)
+	{
+		error(state, "Could not open %s: %s", path, strerror(errno));
+		return NULL;
+	}
+
+	if(fseek(f, 0, SEEK_END) != 0 || (len = ftell(f)) <= 0)
+	{
+		error(state, "Could not get size of %s: %s", path, strerror(errno));
+		fclose(f);
+		return NULL;
+	}
+
+	rewind(f);
+
+	m_state = (memmap_state *)malloc(sizeof(memmap_state));
+	map = malloc(len);
+	if(m_state == NULL || map == NULL)
+	{
+		error(state, "Could not allocate %ld bytes for %s", len, path);
+		free(m_state);
+		free(map);
+		fclose(f);
+		return NULL;
+	}
+
+	if(fread(map, 1, len, f) != (size_t)len)
+	{
+		error(state, "Could not read %s: %s", path, strerror(errno));
+		free(m_state);
+		free(map);
+		fclose(f);
+		return NULL;
+	}
+
+	fclose(f);
+
+	// Nothing to write back, so treat it like an anonymous map
+	m_state->f = NULL;
+	m_state->anonymous = true;
+	m_state->size = *size = len;
+
+	*data = m_state;
+	return map;
+}
+
 void * memmap_resize(emu_state *restrict state, void *map, size_t size, memmap_state **data)
 {
 	memmap_state *m_state = *data;
@@ -393,6 +552,7 @@ void memmap_sync(emu_state *restrict state UNUSED, void *map, memmap_state **dat
 	if(!(m_state->anonymous))
 	{
 		// Write all data (if it fails there's not much we can do...)
+		fseek(m_state->f, 0, SEEK_SET);
 		fwrite(map, m_state->size, 1, m_state->f);
 		if(ferror(m_state->f))
 		{
@@ -403,4 +563,29 @@ void memmap_sync(emu_state *restrict state UNUSED, void *map, memmap_state **dat
 	}
 }
 
+void memmap_sync_range(emu_state *restrict state, void *map, size_t offset, size_t len, memmap_state **data)
+{
+	memmap_state *m_state = *data;
+
+	if(m_state->anonymous || offset >= m_state->size)
+	{
+		return;
+	}
+
+	if(offset + len > m_state->size)
+	{
+		len = m_state->size - offset;
+	}
+
+	// Only rewrite the range asked for
+	fseek(m_state->f, offset, SEEK_SET);
+	fwrite((char *)map + offset, len, 1, m_state->f);
+	if(ferror(m_state->f))
+	{
+		error(state, "Could not write back file for fake mmap: %s", strerror(errno));
+	}
+
+	fflush(m_state->f);
+}
+
 #endif //HAVE_MMAP
@@ -7,8 +7,25 @@
 #include "mmio.h"	// hw_*
 #include "print.h"	// fatal
 #include "util.h"	// likely/unlikely
+#include "cow.h"	// COW_OWNED, cow_unshare
+#include "history.h"	// history_record_write
+#include "perf.h"	// PERF_COUNT, PERF_MEM
 
 
+//! Write one byte to a page that may be shared with a clone
+static inline void mem_write_page(emu_state *restrict state, unsigned slot,
+	uint8_t *const *page, uint16_t offset, uint8_t data)
+{
+	if(unlikely(!COW_OWNED(state, slot)) &&
+		!cow_unshare(state, (cow_slot)slot))
+	{
+		return;
+	}
+
+	// Unsharing repoints *page at the private copy
+	(*page)[offset] = data;
+}
+
 /*!
  * @brief	Read a byte (8 bits) out of memory.
  * @param	state		The emulator state to use when reading.
@@ -31,6 +48,8 @@ uint8_t mem_read8(emu_state *restrict state, uint16_t location)
 		return state->bootrom_data[location];
 	}
 
+	PERF_MEM(state, location, PERF_MEM_READ);
+
 	switch(location >> 12)
 	{
 	case 0x0:
@@ -45,30 +64,32 @@ uint8_t mem_read8(emu_state *restrict state, uint16_t location)
 	case 0xA:
 	case 0xB:
 		// switchable RAM bank - 0xA000-0xBFFF (depends on MBC)
+		PERF_COUNT(state, slow[PERF_SLOW_MBC_READ]);
 		return MBC_READ(state, location);
 	case 0x8:
 	case 0x9:
 		// video memory - 0x8000..0x9FFF
 		// TODO - hooks for debug on bad read
-		return state->lcdc.vram[state->lcdc.vram_bank][location & 0x7FFF];
+		return state->lcdc.vram[state->lcdc.vram_bank][location & 0x1FFF];
 	case 0xC:
 		// Work RAM - 0xC000..0xCFFF
-		return state->wram[0][location & 0x3FFF];
+		return state->wram[0][location & 0xFFF];
 	case 0xD:
 		// Work RAM banks 1-7 - 0xD000.0xDFFF
 		if(state->system == SYSTEM_CGB)
 		{
-			return state->wram[state->wram_bank][location & 0x2FFF];
+			return state->wram[state->wram_bank][location & 0xFFF];
 		}
 		else
 		{
-			return state->wram[1][location & 0x2FFF];
+			return state->wram[1][location & 0xFFF];
 		}
 	case 0xE:
 	case 0xF:
 		if(unlikely(location <= 0xFDFF))
 		{
 			// Echo RAM - 0xE000..0xFDFF
+			PERF_COUNT(state, slow[PERF_SLOW_ECHO_READ]);
 			return mem_read8(state, location & 0xDFFF);
 		}
 		else if(location <= 0xFE9F)
@@ -84,6 +105,7 @@ uint8_t mem_read8(emu_state *restrict state, uint16_t location)
 		else if(location <= 0xFF7F)
 		{
 			// Hardware - 0xFF00..0xFF7F
+			PERF_COUNT(state, slow[PERF_SLOW_HW_READ]);
 			return hw_read(state, location);
 		}
 		else if(location <= 0xFFFE)
@@ -131,6 +153,8 @@ void mem_write8(emu_state *restrict state, uint16_t location, uint8_t data)
 		return;
 	}
 
+	PERF_MEM(state, location, PERF_MEM_WRITE);
+
 	switch(location >> 12)
 	{
 	case 0x0:
@@ -145,26 +169,32 @@ void mem_write8(emu_state *restrict state, uint16_t location, uint8_t data)
 	case 0xA:
 	case 0xB:
 		// switched RAM bank (depends on MBC)
+		PERF_COUNT(state, slow[PERF_SLOW_MBC_WRITE]);
 		MBC_WRITE(state, location, data);
 		return;
 	case 0x8:
 	case 0x9:
 		// VRAM
 		// TODO - hook on bad writes outside vblank
-		state->lcdc.vram[state->lcdc.vram_bank][location & 0x7FFF] = data;
+		mem_write_page(state, COW_VRAM + state->lcdc.vram_bank,
+			&(state->lcdc.vram[state->lcdc.vram_bank]),
+			location & 0x1FFF, data);
 		return;
 	case 0xC:
-		state->wram[0][location & 0x3FFF] = data;
+		mem_write_page(state, COW_WRAM, &(state->wram[0]),
+			location & 0xFFF, data);
 		return;
 	case 0xD:
 		if(state->system == SYSTEM_CGB)
 		{
-			state->wram[state->wram_bank][location & 0x2FFF] = data;
+			mem_write_page(state, COW_WRAM + state->wram_bank,
+				&(state->wram[state->wram_bank]),
+				location & 0xFFF, data);
 		}
 		else
 		{
-			state->wram[1][location & 0x2FFF] = data;
-			return;
+			mem_write_page(state, COW_WRAM + 1, &(state->wram[1]),
+				location & 0xFFF, data);
 		}
 		return;
 	case 0xE:
@@ -172,6 +202,7 @@ void mem_write8(emu_state *restrict state, uint16_t location, uint8_t data)
 		if(unlikely(location <= 0xFDFF))
 		{
 			// Echo RAM - 0xE000..0xFDFF
+			PERF_COUNT(state, slow[PERF_SLOW_ECHO_WRITE]);
 			mem_write8(state, location & 0xDFFF, data);
 		}
 		else if(location <= 0xFE9F)
@@ -187,6 +218,7 @@ void mem_write8(emu_state *restrict state, uint16_t location, uint8_t data)
 		else if(location <= 0xFF7F)
 		{
 			// Hardware - 0xFF00..0xFF7F
+			PERF_COUNT(state, slow[PERF_SLOW_HW_WRITE]);
 			hw_write(state, location, data);
 		}
 		else if(location <= 0xFFFE)
@@ -197,6 +229,8 @@ void mem_write8(emu_state *restrict state, uint16_t location, uint8_t data)
 		else
 		{
 			// Interrupt mask flag - 0xFFFF
+			history_record_write(&(state->debug.history),
+				state->cycles, location, data);
 			state->interrupts.mask = data;
 			compute_irq(state);
 		}
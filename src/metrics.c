@@ -0,0 +1,167 @@
+#include "config.h"	// bool, uint[XX]_t, ATOMIC_*
+
+#include "sgherm.h"	// emu_state
+#include "metrics.h"	// metrics_*
+#include "print.h"	// info, warning
+#include "util_time.h"	// get_time
+
+#include <stdio.h>	// snprintf
+#include <stdlib.h>	// calloc, free
+#include <string.h>	// memcpy
+
+#ifdef HAVE_SHM_OPEN
+#	include <fcntl.h>	// O_*
+#	include <sys/mman.h>	// shm_open, shm_unlink, mmap, munmap
+#	include <unistd.h>	// ftruncate, close, getpid
+#endif
+
+
+//! Host time speed is averaged over
+#define METRICS_SPEED_WINDOW 500000000ULL
+
+struct metrics_state_t
+{
+	metrics_block *block;	//! The shared mapping
+	char name[48];		//! Its shm_open name
+	uint64_t last_time;	//! get_time() at the previous VBlank
+	uint64_t window_time;	//! Start of the speed window
+	uint64_t window_cycles;	//! state->cycles then
+};
+
+static const uint64_t bucket_limits[METRICS_FRAME_BUCKETS] =
+	METRICS_BUCKET_LIMITS;
+
+
+//! Store everything but the frame time; the instance is the only writer
+static void publish(emu_state *restrict state, metrics_block *block,
+	uint64_t now)
+{
+	ATOMIC_STORE64_RELAXED(&(block->cycles), state->cycles);
+	ATOMIC_STORE64_RELAXED(&(block->frames), state->frames);
+	ATOMIC_STORE64_RELAXED(&(block->target_speed),
+		state->opts.unthrottled ? SPEED_UNLIMITED : state->speed);
+	ATOMIC_STORE64_RELAXED(&(block->audio_fill),
+		ATOMIC_LOAD64(&(state->snd.ring_head)) -
+		ATOMIC_LOAD64(&(state->snd.ring_tail)));
+	ATOMIC_STORE64_RELAXED(&(block->audio_size), state->snd.ring_len);
+	ATOMIC_STORE64_RELAXED(&(block->save_flushes), state->save.flushes);
+	ATOMIC_STORE64_RELAXED(&(block->halt_cycles), state->halt_cycles);
+	ATOMIC_STORE64_RELAXED(&(block->lag_frames), state->input.lag.frames);
+	ATOMIC_STORE64_RELAXED(&(block->lag_second), state->input.lag.last_second);
+	ATOMIC_STORE64_RELAXED(&(block->update_time), now);
+}
+
+void metrics_vblank(emu_state *restrict state)
+{
+	metrics_state *metrics = state->metrics;
+	metrics_block *block = metrics->block;
+	const uint64_t now = get_time();
+	const uint64_t took = (now - metrics->last_time) / 1000;
+	unsigned i;
+
+	for(i = 0; i < METRICS_FRAME_BUCKETS - 1 && took >= bucket_limits[i]; i++);
+
+	ATOMIC_STORE64_RELAXED(&(block->frame_time[i]), block->frame_time[i] + 1);
+	metrics->last_time = now;
+
+	if(now - metrics->window_time >= METRICS_SPEED_WINDOW)
+	{
+		// Emulated nanoseconds, in GB time like print_cycles
+		const uint64_t emulated = (state->cycles - metrics->window_cycles) *
+			1000000000ULL / CPU_FREQ_DMG;
+
+		ATOMIC_STORE64_RELAXED(&(block->speed),
+			emulated * 1000 / (now - metrics->window_time));
+		metrics->window_time = now;
+		metrics->window_cycles = state->cycles;
+	}
+
+	publish(state, block, now);
+}
+
+
+#ifdef HAVE_SHM_OPEN
+//! Instances this process has published, for unique names
+static long metrics_count;
+
+void metrics_start(emu_state *restrict state)
+{
+	metrics_state *metrics = (metrics_state *)calloc(1, sizeof(metrics_state));
+	metrics_block *block;
+	int fd = -1;
+
+	if(metrics == NULL)
+	{
+		warning(state, "Could not allocate metrics");
+		return;
+	}
+
+	snprintf(metrics->name, sizeof(metrics->name), "%s%ld.%ld",
+		METRICS_PREFIX, (long)getpid(), (long)ATOMIC_INC(&metrics_count));
+
+	if((fd = shm_open(metrics->name, O_RDWR | O_CREAT | O_EXCL, 0644)) < 0 ||
+		ftruncate(fd, sizeof(metrics_block)) < 0 ||
+		(block = (metrics_block *)mmap(NULL, sizeof(metrics_block),
+		PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED)
+	{
+		warning(state, "Could not publish metrics as %s", metrics->name);
+
+		if(fd >= 0)
+		{
+			close(fd);
+			shm_unlink(metrics->name);
+		}
+
+		free(metrics);
+		return;
+	}
+
+	// The mapping keeps it alive
+	close(fd);
+
+	// ftruncate gave us zeroes; readers wait for update_time
+	block->magic = METRICS_MAGIC;
+	block->version = METRICS_VERSION;
+	block->size = sizeof(metrics_block);
+	block->pid = (uint32_t)getpid();
+	memcpy(block->title, state->cart_data + 0x134, 16);
+	block->start_time = state->start_time;
+	ATOMIC_STORE64(&(block->update_time), state->start_time);
+
+	metrics->block = block;
+	metrics->last_time = metrics->window_time = state->start_time;
+	state->metrics = metrics;
+
+	info(state, "Publishing metrics as %s", metrics->name);
+}
+
+void metrics_stop(emu_state *restrict state)
+{
+	metrics_state *metrics = state->metrics;
+
+	if(metrics == NULL)
+	{
+		return;
+	}
+
+	state->metrics = NULL;
+
+	// Anyone still looking sees the last numbers and that we're done
+	publish(state, metrics->block, get_time());
+	ATOMIC_STORE64(&(metrics->block->finished), 1);
+
+	munmap(metrics->block, sizeof(metrics_block));
+	shm_unlink(metrics->name);
+	free(metrics);
+}
+#else
+void metrics_start(emu_state *restrict state)
+{
+	warning(state, "Metrics need POSIX shared memory, which this build lacks");
+}
+
+void metrics_stop(emu_state *restrict state)
+{
+	(void)state;
+}
+#endif //HAVE_SHM_OPEN
@@ -6,12 +6,15 @@
 #include "sgherm.h"	// emu_state
 #include "ctl_unit.h"	// int_flag_*
 #include "input.h"	// joypad_*
+#include "history.h"	// history_record_write, history_last_pc
 #include "lcdc.h"	// lcdc_read
 #include "memory.h"	// Constants and what have you
+#include "perf.h"	// PERF_COUNT
 #include "print.h"	// fatal
 #include "serio.h"	// serial_*
 #include "sound.h"	// sound_*
 #include "timer.h"	// timer_*
+#include "tracepoint.h"	// TRACEPOINT
 #include "util.h"	// likely/unlikely
 
 /***********************************************************************
@@ -69,7 +72,7 @@ static inline void no_hw_write(emu_state *restrict state, uint16_t location, uin
 
 
 //! a table of hardware register read methods
-static mem_read_fn hw_reg_read[0x80] =
+static const mem_read_fn hw_reg_read[0x80] =
 {
 	joypad_read, // 00 - P1 - joypad
 	serial_read, // 01 - SB - serial data
@@ -159,7 +162,7 @@ static mem_read_fn hw_reg_read[0x80] =
 	no_hw_read, no_hw_read, no_hw_read, no_hw_read  // 0x7F
 };
 
-static mem_write8_fn hw_reg_write[0x80] =
+static const mem_write8_fn hw_reg_write[0x80] =
 {
 	joypad_write, // 00 - P1 - joypad
 	serial_write, // 01 - SB - serial data
@@ -265,11 +268,14 @@ static mem_write8_fn hw_reg_write[0x80] =
 
 uint8_t hw_read(emu_state *restrict state, uint16_t location)
 {
+	PERF_COUNT(state, io_read[location & 0x7F]);
 	return hw_reg_read[location & 0xFF](state, location);
 }
 
 void hw_write(emu_state *restrict state, uint16_t location, uint8_t data)
 {
+	PERF_COUNT(state, io_write[location & 0x7F]);
+	history_record_write(&(state->debug.history), state->cycles, location, data);
 	hw_reg_write[location & 0xFF](state, location, data);
 }
 
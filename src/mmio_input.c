@@ -1,5 +1,20 @@
 static inline uint8_t joypad_read(emu_state *restrict state, uint16_t reg UNUSED)
 {
+	// Polls only count from the game's input routine, if it was given
+	if(likely(state->opts.lag_pc_hi == 0))
+	{
+		state->input.lag.polls++;
+	}
+	else
+	{
+		const uint16_t pc = history_last_pc(&(state->debug.history));
+
+		if(pc >= state->opts.lag_pc_lo && pc <= state->opts.lag_pc_hi)
+		{
+			state->input.lag.polls++;
+		}
+	}
+
 	return (state->input.col << 4) | key_scan(state);
 }
 
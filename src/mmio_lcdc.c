@@ -339,6 +339,8 @@ static inline void hdma_reg_write(emu_state *restrict state, uint16_t reg, uint8
 		case 0x55: // Start transfer
 			// TODO: do this properly!
 			// TODO: clamp/verify addresses correctly
+			TRACEPOINT(state, TP_HDMA, (uint32_t)state->lcdc.hsrc << 16 |
+				state->lcdc.hdst, data & 0x7F);
 			for(i = 0; i < 16*((data&0x7F)+1); i++)
 			{
 				if(((state->lcdc.hsrc <= 0x7FFF)
@@ -408,6 +410,8 @@ static inline void dma_write(emu_state *restrict state, uint16_t location UNUSED
 	uint16_t addr = data << 8;
 	int curr = 0;
 
+	TRACEPOINT(state, TP_DMA, addr, 0);
+
 	for (; curr < 160; curr++, addr++)
 	{
 		state->lcdc.oam_ram[curr] = mem_read8(state, addr);
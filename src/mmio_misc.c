@@ -31,6 +31,7 @@ static inline void bootrom_exit(emu_state *restrict state, uint16_t location UNU
 		state->bootrom_size = 0;
 
 		free(state->bootrom_data);
+		state->bootrom_data = NULL;
 	}
 }
 
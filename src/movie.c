@@ -0,0 +1,449 @@
+#include "config.h"	// bool, uint[XX]_t
+
+#include "sgherm.h"	// emu_state
+#include "movie.h"	// movie_*
+#include "input.h"	// joypad_*
+#include "savestate.h"	// state_*
+#include "save.h"	// save_mark_range
+#include "cow.h"	// COW_OWNED, cow_unshare
+#include "rom.h"	// rtc_load
+#include "print.h"	// error, warning, info
+#include "util.h"	// get_file_size
+
+#include <stdio.h>	// fopen, fwrite, fread, fseek
+#include <stdlib.h>	// malloc, free
+#include <string.h>	// memcpy, memcmp
+
+
+/*
+ * Layout (all little endian):
+ *
+ *   0	magic
+ *   4	u16 version
+ *   6	u8 flags (MOVIE_FLAG_*)
+ *   7	u8 zero
+ *   8	cart header bytes 0x134..0x14F, to recognise the ROM
+ *  36	u64 cycle count at the end (0 = recording didn't finish)
+ *  44	u64 frame count at the end
+ *  52	u32 length of the initial state
+ *  56	u64 seed of power-on RAM (opts.seed)
+ *  64	initial state: cart RAM for power-on movies, else a snapshot
+ *
+ * followed by one EVENT_SIZE record per joypad transition: the u64 cycle
+ * count it happened at and the u8 INPUT_MASK_* state after it.
+ */
+
+#define CART_ID_START	0x134
+#define CART_ID_SIZE	(0x150 - CART_ID_START)
+
+#define END_OFFSET	36
+#define SEED_OFFSET	56
+#define HEADER_SIZE	64
+#define EVENT_SIZE	9
+
+#define MOVIE_FLAG_POWER_ON	0x01	//! Starts from reset; initial state is cart RAM
+#define MOVIE_FLAG_BOOTROM	0x02	//! Power-on through the boot ROM
+
+typedef struct
+{
+	uint64_t cycle;		//! Apply when state->cycles reaches this
+	uint8_t mask;		//! Keys held from then on
+} movie_event;
+
+struct movie_state_t
+{
+	movie_mode mode;
+
+	// Recording
+	FILE *file;			//! Movie being written
+
+	// Playback
+	movie_event *events;		//! Every transition in the movie
+	size_t count;			//! Number of events
+	size_t next;			//! Next event to apply
+	uint64_t end_cycle;		//! Where the recording stopped
+	uint64_t end_frame;		//! Frame count it stopped on
+};
+
+
+static void put_le(uint8_t *p, uint64_t v, int bytes)
+{
+	int i;
+
+	for(i = 0; i < bytes; i++)
+	{
+		p[i] = (uint8_t)(v >> (8 * i));
+	}
+}
+
+static uint64_t get_le(const uint8_t *p, int bytes)
+{
+	uint64_t v = 0;
+	int i;
+
+	for(i = bytes - 1; i >= 0; i--)
+	{
+		v = (v << 8) | p[i];
+	}
+
+	return v;
+}
+
+static void end_fields(uint8_t *p, const emu_state *restrict state)
+{
+	put_le(p, state->cycles, 8);
+	put_le(p + 8, state->frames, 8);
+}
+
+bool movie_record(emu_state *restrict state, const char *path)
+{
+	const bool power_on = (state->cycles == 0);
+	uint8_t header[HEADER_SIZE];
+	uint8_t *init = NULL;
+	size_t init_len;
+	movie_state *m;
+	bool ok;
+
+	movie_stop(state);
+
+	if(!state->opts.deterministic)
+	{
+		warning(state, "Not in deterministic mode; the movie may desync");
+	}
+
+	if(power_on)
+	{
+		// Everything else is fixed by the ROM and boot ROM
+		init_len = state->save.data ? state->save.size : 0;
+	}
+	else
+	{
+		init_len = state_size(state);
+		if((init = (uint8_t *)malloc(init_len)) == NULL ||
+			state_save(state, init, init_len) != init_len)
+		{
+			error(state, "Could not snapshot the state for a movie");
+			free(init);
+			return false;
+		}
+	}
+
+	if((m = (movie_state *)calloc(1, sizeof(movie_state))) == NULL ||
+		(m->file = fopen(path, "wb")) == NULL)
+	{
+		error(state, "Could not create movie %s", path);
+		free(m);
+		free(init);
+		return false;
+	}
+
+	memset(header, 0, sizeof(header));
+	memcpy(header, MOVIE_MAGIC, 4);
+	put_le(header + 4, MOVIE_VERSION, 2);
+	header[6] = (power_on ? MOVIE_FLAG_POWER_ON : 0) |
+		(state->in_bootrom ? MOVIE_FLAG_BOOTROM : 0);
+	memcpy(header + 8, state->cart_data + CART_ID_START, CART_ID_SIZE);
+	put_le(header + 52, init_len, 4);
+	put_le(header + SEED_OFFSET, state->opts.seed, 8);
+
+	ok = fwrite(header, sizeof(header), 1, m->file) == 1;
+	if(init_len > 0)
+	{
+		ok = ok && fwrite(init ? init : state->save.data, init_len, 1,
+			m->file) == 1;
+	}
+
+	free(init);
+
+	if(!ok)
+	{
+		error(state, "Could not write movie %s", path);
+		fclose(m->file);
+		free(m);
+		return false;
+	}
+
+	m->mode = MOVIE_RECORD;
+	state->movie = m;
+
+	info(state, "Recording %s movie to %s",
+		power_on ? "power-on" : "snapshot", path);
+
+	return true;
+}
+
+//! Check a loaded movie and put state where it starts
+static bool play_init(emu_state *restrict state, const uint8_t *buf,
+	size_t len, size_t *events_at)
+{
+	uint8_t flags;
+	size_t init_len;
+
+	if(len < HEADER_SIZE || memcmp(buf, MOVIE_MAGIC, 4) != 0)
+	{
+		error(state, "Not a movie");
+		return false;
+	}
+
+	if(get_le(buf + 4, 2) != MOVIE_VERSION)
+	{
+		error(state, "Movie is version %u, expected %u",
+			(unsigned)get_le(buf + 4, 2), MOVIE_VERSION);
+		return false;
+	}
+
+	if(memcmp(buf + 8, state->cart_data + CART_ID_START, CART_ID_SIZE) != 0)
+	{
+		error(state, "Movie was recorded with another ROM");
+		return false;
+	}
+
+	flags = buf[6];
+	init_len = (size_t)get_le(buf + 52, 4);
+	if(init_len > len - HEADER_SIZE ||
+		(len - HEADER_SIZE - init_len) % EVENT_SIZE != 0)
+	{
+		error(state, "Movie is truncated");
+		return false;
+	}
+
+	if(get_le(buf + END_OFFSET, 8) == 0)
+	{
+		warning(state, "Movie recording never finished; playing what there is");
+	}
+
+	if(flags & MOVIE_FLAG_POWER_ON)
+	{
+		const bool bootrom = (flags & MOVIE_FLAG_BOOTROM) != 0;
+		const size_t ram_len = state->save.data ? state->save.size : 0;
+
+		if(state->cycles != 0)
+		{
+			error(state, "Power-on movies must be played from power-on");
+			return false;
+		}
+		else if(bootrom != state->in_bootrom)
+		{
+			error(state, "Movie was recorded %s the boot ROM",
+				bootrom ? "with" : "without");
+			return false;
+		}
+		else if(init_len != ram_len)
+		{
+			error(state, "Movie has %lu bytes of cart RAM, expected %lu",
+				(unsigned long)init_len, (unsigned long)ram_len);
+			return false;
+		}
+
+		// Power-on RAM as it was for the recording
+		state->opts.seed = get_le(buf + SEED_OFFSET, 8);
+		seed_memory(state);
+
+		if(init_len > 0)
+		{
+			if(!COW_OWNED(state, COW_CART) && !cow_unshare(state, COW_CART))
+			{
+				return false;
+			}
+
+			// As if the save file had held it
+			memcpy(state->save.data, buf + HEADER_SIZE, init_len);
+			save_mark_range(state, 0, init_len);
+			rtc_load(state);
+		}
+	}
+	else if(!state_load(state, buf + HEADER_SIZE, init_len))
+	{
+		return false;
+	}
+
+	*events_at = HEADER_SIZE + init_len;
+	return true;
+}
+
+bool movie_play(emu_state *restrict state, const char *path)
+{
+	int size = get_file_size(path);
+	uint8_t *buf = NULL;
+	movie_state *m = NULL;
+	size_t events_at, i;
+	FILE *f = NULL;
+
+	movie_stop(state);
+
+	if(size < 0 || (buf = (uint8_t *)malloc(size > 0 ? size : 1)) == NULL ||
+		(f = fopen(path, "rb")) == NULL ||
+		fread(buf, 1, size, f) != (size_t)size)
+	{
+		error(state, "Could not read movie %s", path);
+		goto fail;
+	}
+
+	fclose(f);
+	f = NULL;
+
+	if(!play_init(state, buf, size, &events_at))
+	{
+		goto fail;
+	}
+
+	if((m = (movie_state *)calloc(1, sizeof(movie_state))) == NULL)
+	{
+		error(state, "Could not allocate movie");
+		goto fail;
+	}
+
+	m->mode = MOVIE_PLAY;
+	m->count = (size - events_at) / EVENT_SIZE;
+	m->end_cycle = get_le(buf + END_OFFSET, 8);
+	m->end_frame = get_le(buf + END_OFFSET + 8, 8);
+
+	if(m->count > 0 && (m->events = (movie_event *)malloc(
+		m->count * sizeof(movie_event))) == NULL)
+	{
+		error(state, "Could not allocate movie");
+		goto fail;
+	}
+
+	for(i = 0; i < m->count; i++)
+	{
+		const uint8_t *p = buf + events_at + i * EVENT_SIZE;
+
+		m->events[i].cycle = get_le(p, 8);
+		m->events[i].mask = p[8];
+	}
+
+	free(buf);
+
+	// Whatever the host holds doesn't count
+	joypad_apply_mask(state, 0);
+	state->movie = m;
+
+	info(state, "Playing %s (%lu transitions, %llu frames)", path,
+		(unsigned long)m->count, (unsigned long long)m->end_frame);
+
+	return true;
+
+fail:
+	if(f)
+	{
+		fclose(f);
+	}
+
+	if(m)
+	{
+		free(m->events);
+		free(m);
+	}
+
+	free(buf);
+	return false;
+}
+
+void movie_stop(emu_state *restrict state)
+{
+	movie_state *m = state->movie;
+
+	if(m == NULL)
+	{
+		return;
+	}
+
+	state->movie = NULL;
+
+	if(m->mode == MOVIE_RECORD)
+	{
+		uint8_t end[16];
+		bool ok;
+
+		end_fields(end, state);
+		ok = fseek(m->file, END_OFFSET, SEEK_SET) == 0 &&
+			fwrite(end, sizeof(end), 1, m->file) == 1;
+		ok = (fclose(m->file) == 0) && ok;
+
+		if(ok)
+		{
+			info(state, "Movie recorded up to frame %llu",
+				(unsigned long long)state->frames);
+		}
+		else
+		{
+			error(state, "Could not finish writing the movie");
+		}
+	}
+	else
+	{
+		free(m->events);
+	}
+
+	free(m);
+}
+
+bool movie_input(emu_state *restrict state, input_key key, bool down)
+{
+	movie_state *m = state->movie;
+	uint8_t mask, rec[EVENT_SIZE];
+
+	if(m->mode == MOVIE_PLAY)
+	{
+		return false;
+	}
+
+	mask = joypad_mask(state);
+	mask = down ? (mask | joypad_key_mask(key)) : (mask & ~joypad_key_mask(key));
+	if(mask == joypad_mask(state))
+	{
+		// Key repeat, or a key we don't know
+		return true;
+	}
+
+	put_le(rec, state->cycles, 8);
+	rec[8] = mask;
+	if(fwrite(rec, sizeof(rec), 1, m->file) != 1)
+	{
+		error(state, "Could not write to the movie; stopping");
+		movie_stop(state);
+	}
+
+	return true;
+}
+
+void movie_tick(emu_state *restrict state)
+{
+	movie_state *m = state->movie;
+
+	if(m->mode != MOVIE_PLAY)
+	{
+		return;
+	}
+
+	while(m->next < m->count && m->events[m->next].cycle <= state->cycles)
+	{
+		joypad_apply_mask(state, m->events[m->next].mask);
+		m->next++;
+	}
+
+	if(m->next < m->count || state->cycles < m->end_cycle)
+	{
+		return;
+	}
+
+	if(m->end_cycle != 0 && state->frames != m->end_frame)
+	{
+		warning(state, "Movie desynced: ended on frame %llu, recorded on %llu",
+			(unsigned long long)state->frames,
+			(unsigned long long)m->end_frame);
+	}
+	else
+	{
+		info(state, "Movie finished on frame %llu",
+			(unsigned long long)state->frames);
+	}
+
+	movie_stop(state);
+
+	if(state->opts.movie_exit)
+	{
+		state->quit = true;
+	}
+}
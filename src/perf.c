@@ -0,0 +1,503 @@
+#include "config.h"	// PERF_COUNTERS, uint[XX]_t
+
+#include "sgherm.h"	// emu_state
+#include "perf.h"	// perf_*
+#include "debug.h"	// mnemonics, mnemonics_cb
+#include "print.h"	// report
+#include "input.h"	// lag_state, LAG_SECOND_FRAMES
+#include "util_time.h"	// get_time
+
+#include <stdlib.h>	// calloc, free, qsort
+#include <string.h>	// memset
+
+
+#ifdef PERF_COUNTERS
+
+volatile sig_atomic_t perf_dump_requests = 0;
+
+static const char * const subsystem_names[PERF_SUBSYSTEMS] =
+{
+	"cpu", "lcdc", "timer", "sound", "blit",
+};
+
+static const char * const region_names[PERF_MEM_REGIONS] =
+{
+	"ROM", "SRAM", "WRAM", "VRAM", "OAM", "HRAM", "I/O",
+};
+
+//! Pages in one bank of each region
+static const size_t region_pages[PERF_MEM_REGIONS] =
+{
+	0x4000 / PERF_PAGE_SIZE, 0x2000 / PERF_PAGE_SIZE,
+	0x1000 / PERF_PAGE_SIZE, 0x2000 / PERF_PAGE_SIZE, 1, 1, 1,
+};
+
+static const char * const slow_names[PERF_SLOW_PATHS] =
+{
+	"MBC read", "MBC write", "hw_read", "hw_write", "echo read",
+	"echo write", "COW copy",
+};
+
+//! Most pages listed in the heatmap report
+#define HOT_PAGES 24
+
+//! Returned by heat_page for accesses counted elsewhere
+#define NO_PAGE ((size_t)-1)
+
+//! One line of the region report
+typedef struct
+{
+	perf_mem_region region;
+	size_t bank;
+	uint64_t count[PERF_MEM_KINDS];
+	uint64_t total;
+} heat_row;
+
+//! Indices of the non-zero counts, largest first; returns how many
+static size_t sort_by_count(const uint64_t *counts, size_t n, uint16_t *order)
+{
+	size_t used = 0, i, j;
+
+	// n is at most 256, so insertion sort is plenty
+	for(i = 0; i < n; i++)
+	{
+		if(counts[i] == 0)
+		{
+			continue;
+		}
+
+		for(j = used; j > 0 && counts[order[j - 1]] < counts[i]; j--)
+		{
+			order[j] = order[j - 1];
+		}
+
+		order[j] = (uint16_t)i;
+		used++;
+	}
+
+	return used;
+}
+
+static uint64_t sum(const uint64_t *counts, size_t n)
+{
+	uint64_t total = 0;
+	size_t i;
+
+	for(i = 0; i < n; i++)
+	{
+		total += counts[i];
+	}
+
+	return total;
+}
+
+static void dump_times(emu_state *restrict state)
+{
+	const perf_state *perf = &(state->perf);
+	const uint64_t wall = get_time() - perf->start_time;
+	const uint64_t ticks = perf_ticks() - perf->start_ticks;
+	const double ns_per_tick = ticks ? (double)wall / ticks : 0;
+	uint64_t self[PERF_SUBSYSTEMS], counted = 0;
+	size_t i;
+
+	memcpy(self, perf->ticks, sizeof(self));
+
+	// The blit happens inside lcdc_tick
+	self[PERF_LCDC] -= (self[PERF_BLIT] < self[PERF_LCDC]) ?
+		self[PERF_BLIT] : self[PERF_LCDC];
+
+	report(state, "Host time over %.3f s:", wall / 1e9);
+	for(i = 0; i < PERF_SUBSYSTEMS; i++)
+	{
+		const double ns = self[i] * ns_per_tick;
+
+		counted += self[i];
+		report(state, "  %-6s %10.3f ms  %5.1f%%", subsystem_names[i],
+			ns / 1e6, wall ? 100.0 * ns / wall : 0);
+	}
+
+	report(state, "  %-6s %10.3f ms  %5.1f%%", "other",
+		(wall - counted * ns_per_tick) / 1e6,
+		wall ? 100.0 * (wall - counted * ns_per_tick) / wall : 0);
+}
+
+static void dump_opcodes(emu_state *restrict state, const uint64_t *counts,
+	const char * const *names, const char *title)
+{
+	const uint64_t total = sum(counts, 0x100);
+	uint16_t order[0x100];
+	size_t used, i;
+
+	if(total == 0)
+	{
+		return;
+	}
+
+	used = sort_by_count(counts, 0x100, order);
+
+	report(state, "%s (%llu executed):", title, (unsigned long long)total);
+	for(i = 0; i < used; i++)
+	{
+		const uint64_t n = counts[order[i]];
+
+		report(state, "  %02X %-14s %14llu  %5.2f%%", order[i],
+			names[order[i]], (unsigned long long)n, 100.0 * n / total);
+	}
+}
+
+static void dump_io(emu_state *restrict state)
+{
+	const perf_state *perf = &(state->perf);
+	uint64_t both[0x80];
+	uint16_t order[0x80];
+	size_t used, i;
+
+	for(i = 0; i < 0x80; i++)
+	{
+		both[i] = perf->io_read[i] + perf->io_write[i];
+	}
+
+	if((used = sort_by_count(both, 0x80, order)) == 0)
+	{
+		return;
+	}
+
+	report(state, "I/O registers (reads, writes):");
+	for(i = 0; i < used; i++)
+	{
+		report(state, "  FF%02X %14llu %14llu", order[i],
+			(unsigned long long)perf->io_read[order[i]],
+			(unsigned long long)perf->io_write[order[i]]);
+	}
+}
+
+static void dump_lag(emu_state *restrict state)
+{
+	const lag_state *lag = &(state->input.lag);
+
+	report(state, "Lag frames: %llu of %llu (%.2f%%)",
+		(unsigned long long)lag->frames, (unsigned long long)state->frames,
+		state->frames ? 100.0 * lag->frames / state->frames : 0);
+	report(state, "  %llu of %llu seconds lagged; worst %u/%d, last %u/%d",
+		(unsigned long long)lag->lag_seconds,
+		(unsigned long long)lag->seconds, lag->worst_second,
+		LAG_SECOND_FRAMES, lag->last_second, LAG_SECOND_FRAMES);
+}
+
+//! Where location is in the heatmap, with the banks as they are now
+static size_t heat_page(emu_state *restrict state, uint16_t location)
+{
+	const perf_state *perf = &(state->perf);
+	perf_mem_region region;
+	size_t bank = 0, page = 0;
+
+	switch(location >> 12)
+	{
+	case 0x0:
+	case 0x1:
+	case 0x2:
+	case 0x3:
+		region = PERF_MEM_ROM;
+		page = location / PERF_PAGE_SIZE;
+		break;
+	case 0x4:
+	case 0x5:
+	case 0x6:
+	case 0x7:
+		region = PERF_MEM_ROM;
+		bank = state->mbc.rom_bank;
+		page = (location - 0x4000) / PERF_PAGE_SIZE;
+		break;
+	case 0x8:
+	case 0x9:
+		region = PERF_MEM_VRAM;
+		bank = state->lcdc.vram_bank;
+		page = (location & 0x1FFF) / PERF_PAGE_SIZE;
+		break;
+	case 0xA:
+	case 0xB:
+		region = PERF_MEM_SRAM;
+		bank = state->mbc.ram_bank;
+		page = (location & 0x1FFF) / PERF_PAGE_SIZE;
+		break;
+	case 0xC:
+		region = PERF_MEM_WRAM;
+		page = (location & 0xFFF) / PERF_PAGE_SIZE;
+		break;
+	case 0xD:
+		region = PERF_MEM_WRAM;
+		bank = (state->system == SYSTEM_CGB) ? state->wram_bank : 1;
+		page = (location & 0xFFF) / PERF_PAGE_SIZE;
+		break;
+	default:
+		if(location <= 0xFDFF)
+		{
+			// Echo RAM goes round again as WRAM
+			return NO_PAGE;
+		}
+		else if(location <= 0xFEFF)
+		{
+			region = PERF_MEM_OAM;
+		}
+		else if(location <= 0xFF7F || location == 0xFFFF)
+		{
+			region = PERF_MEM_MMIO;
+		}
+		else
+		{
+			region = PERF_MEM_HRAM;
+		}
+		break;
+	}
+
+	return perf->heat_base[region] +
+		(bank % perf->heat_banks[region]) * region_pages[region] + page;
+}
+
+void perf_mem(emu_state *restrict state, uint16_t location, perf_mem_kind kind)
+{
+	size_t page;
+
+	if(state->perf.heat != NULL &&
+		(page = heat_page(state, location)) != NO_PAGE)
+	{
+		state->perf.heat[page][kind]++;
+	}
+}
+
+//! CPU address of a heatmap page, as it would be mapped
+static uint16_t page_address(perf_mem_region region, size_t bank, size_t page)
+{
+	switch(region)
+	{
+	case PERF_MEM_ROM:
+		return (uint16_t)((bank ? 0x4000 : 0) + page * PERF_PAGE_SIZE);
+	case PERF_MEM_SRAM:
+		return (uint16_t)(0xA000 + page * PERF_PAGE_SIZE);
+	case PERF_MEM_WRAM:
+		return (uint16_t)((bank ? 0xD000 : 0xC000) + page * PERF_PAGE_SIZE);
+	case PERF_MEM_VRAM:
+		return (uint16_t)(0x8000 + page * PERF_PAGE_SIZE);
+	case PERF_MEM_OAM:
+		return 0xFE00;
+	case PERF_MEM_HRAM:
+		return 0xFF80;
+	default:
+		return 0xFF00;
+	}
+}
+
+static int compare_rows(const void *a, const void *b)
+{
+	const uint64_t x = ((const heat_row *)a)->total;
+	const uint64_t y = ((const heat_row *)b)->total;
+
+	return (x < y) - (x > y);
+}
+
+//! Totals per region and bank, then the hottest pages
+static void dump_heat(emu_state *restrict state)
+{
+	const perf_state *perf = &(state->perf);
+	heat_row *rows, hot[HOT_PAGES];
+	size_t nrows = 0, nhot = 0, region, bank, page, i;
+	uint64_t all = 0;
+
+	if(perf->heat == NULL || (rows = (heat_row *)calloc(perf->heat_pages,
+		sizeof(heat_row))) == NULL)
+	{
+		return;
+	}
+
+	for(region = 0; region < PERF_MEM_REGIONS; region++)
+	{
+		for(bank = 0; bank < perf->heat_banks[region]; bank++)
+		{
+			heat_row *row = &(rows[nrows]);
+
+			row->region = (perf_mem_region)region;
+			row->bank = bank;
+
+			for(page = 0; page < region_pages[region]; page++)
+			{
+				const uint64_t *count = perf->heat[perf->heat_base[region] +
+					bank * region_pages[region] + page];
+				heat_row cell;
+
+				for(i = 0; i < PERF_MEM_KINDS; i++)
+				{
+					row->count[i] += count[i];
+					cell.count[i] = count[i];
+				}
+				cell.total = count[PERF_MEM_READ] + count[PERF_MEM_WRITE];
+
+				if(cell.total == 0 && count[PERF_MEM_EXEC] == 0)
+				{
+					continue;
+				}
+
+				// Keep the hottest pages; bank holds the page here
+				cell.region = (perf_mem_region)region;
+				cell.bank = bank * region_pages[region] + page;
+				if(nhot < HOT_PAGES)
+				{
+					hot[nhot++] = cell;
+				}
+				else if(cell.total > hot[HOT_PAGES - 1].total)
+				{
+					hot[HOT_PAGES - 1] = cell;
+				}
+				else
+				{
+					continue;
+				}
+
+				qsort(hot, nhot, sizeof(heat_row), compare_rows);
+			}
+
+			// Fetches are reads already; don't count them twice
+			row->total = row->count[PERF_MEM_READ] +
+				row->count[PERF_MEM_WRITE];
+			all += row->total;
+
+			if(row->total || row->count[PERF_MEM_EXEC])
+			{
+				nrows++;
+			}
+			else
+			{
+				memset(row, 0, sizeof(heat_row));
+			}
+		}
+	}
+
+	if(nrows == 0)
+	{
+		free(rows);
+		return;
+	}
+
+	qsort(rows, nrows, sizeof(heat_row), compare_rows);
+
+	report(state, "Memory by region and bank (reads, writes, instructions):");
+	for(i = 0; i < nrows; i++)
+	{
+		report(state, "  %-4s %3lu %14llu %14llu %14llu  %5.2f%%",
+			region_names[rows[i].region], (unsigned long)rows[i].bank,
+			(unsigned long long)rows[i].count[PERF_MEM_READ],
+			(unsigned long long)rows[i].count[PERF_MEM_WRITE],
+			(unsigned long long)rows[i].count[PERF_MEM_EXEC],
+			all ? 100.0 * rows[i].total / all : 0);
+	}
+
+	report(state, "Hottest %lu-byte pages:", (unsigned long)PERF_PAGE_SIZE);
+	for(i = 0; i < nhot; i++)
+	{
+		const size_t per = region_pages[hot[i].region];
+		const size_t bank_of = hot[i].bank / per;
+
+		report(state, "  %-4s %3lu:%04X %14llu %14llu %14llu",
+			region_names[hot[i].region], (unsigned long)bank_of,
+			page_address(hot[i].region, bank_of, hot[i].bank % per),
+			(unsigned long long)hot[i].count[PERF_MEM_READ],
+			(unsigned long long)hot[i].count[PERF_MEM_WRITE],
+			(unsigned long long)hot[i].count[PERF_MEM_EXEC]);
+	}
+
+	report(state, "Slow paths:");
+	for(i = 0; i < PERF_SLOW_PATHS; i++)
+	{
+		report(state, "  %-10s %14llu  %5.2f%%", slow_names[i],
+			(unsigned long long)perf->slow[i],
+			all ? 100.0 * perf->slow[i] / all : 0);
+	}
+
+	free(rows);
+}
+
+void perf_init(emu_state *restrict state)
+{
+	perf_state *perf = &(state->perf);
+	size_t region;
+
+	// A clone's copied heat pointer is its original's, not ours to free;
+	// the clone counts into a map of its own
+	memset(perf, 0, sizeof(*perf));
+	perf->start_ticks = perf_ticks();
+	perf->start_time = get_time();
+	perf->dumps_seen = (unsigned)perf_dump_requests;
+
+	perf->heat_banks[PERF_MEM_ROM] = state->mbc.rom_bank_count > 2 ?
+		state->mbc.rom_bank_count : 2;
+	perf->heat_banks[PERF_MEM_SRAM] = 16;
+	perf->heat_banks[PERF_MEM_WRAM] = 8;
+	perf->heat_banks[PERF_MEM_VRAM] = 2;
+	perf->heat_banks[PERF_MEM_OAM] = 1;
+	perf->heat_banks[PERF_MEM_HRAM] = 1;
+	perf->heat_banks[PERF_MEM_MMIO] = 1;
+
+	for(region = 0; region < PERF_MEM_REGIONS; region++)
+	{
+		perf->heat_base[region] = perf->heat_pages;
+		perf->heat_pages += perf->heat_banks[region] * region_pages[region];
+	}
+
+	// Without it there's no heatmap, and nothing else changes
+	perf->heat = (uint64_t (*)[PERF_MEM_KINDS])calloc(perf->heat_pages,
+		sizeof(*(perf->heat)));
+}
+
+void perf_finish(emu_state *restrict state)
+{
+	free(state->perf.heat);
+	state->perf.heat = NULL;
+}
+
+void perf_dump(emu_state *restrict state)
+{
+	report(state, "Performance counters at frame %llu:",
+		(unsigned long long)state->frames);
+
+	dump_times(state);
+	dump_opcodes(state, state->perf.op, mnemonics, "Opcodes");
+	dump_opcodes(state, state->perf.op_cb, mnemonics_cb, "CB opcodes");
+	dump_io(state);
+
+	report(state, "Bank selects: %llu ROM, %llu RAM",
+		(unsigned long long)state->perf.rom_bank_writes,
+		(unsigned long long)state->perf.ram_bank_writes);
+
+	dump_lag(state);
+	dump_heat(state);
+}
+
+void perf_poll(emu_state *restrict state)
+{
+	const unsigned requests = (unsigned)perf_dump_requests;
+
+	if(unlikely(state->perf.dumps_seen != requests))
+	{
+		state->perf.dumps_seen = requests;
+		perf_dump(state);
+	}
+}
+
+#else
+
+void perf_init(emu_state *restrict state UNUSED)
+{
+}
+
+void perf_finish(emu_state *restrict state UNUSED)
+{
+}
+
+void perf_dump(emu_state *restrict state UNUSED)
+{
+}
+
+void perf_poll(emu_state *restrict state UNUSED)
+{
+}
+
+#endif /*PERF_COUNTERS*/
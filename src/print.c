@@ -1,79 +1,564 @@
-#include "config.h"	// macros
+#include "config.h"	// macros, ATOMIC_*
 #include <stdarg.h>	// required for gcc, because lol. (not clang/msvc)
 #include <stdio.h>	// ?fprintf
-#include <stdlib.h>	// exit
+#include <stdlib.h>	// calloc, free
 
 #include "sgherm.h"	// emu_state
-#include "util.h"	// UNUSED
+#include "print.h"	// log_site, LOG_*
+#include "history.h"	// history_dump
+#include "util_time.h"	// get_time
+#include "platform/threads.h"	// host_*, THREAD_*, MUTEX_*
+
+
+/*
+ * Messages from an instance are formatted on its own thread into a ring of
+ * fixed-size lines, which a single background thread writes out.  The
+ * instance is the only writer of head and the drainer the only writer of
+ * tail, so neither side waits on the other; when the ring is full the
+ * message is dropped and counted.  The drainer holds log_lock while it
+ * walks the rings, which only keeps rings from being freed under it.
+ *
+ * The drainer sleeps on log_wake_cond until a line is queued.  log_wake is
+ * only ever changed by swapping it, so the drainer's "going to sleep" and
+ * an instance's "posted a line" are ordered one way or the other and no
+ * wakeup is lost; an instance only takes log_wake_lock when the drainer
+ * is actually asleep.  The drainer is joined when the last ring goes, and
+ * started again by the next instance to log.
+ *
+ * Messages with no instance, fatal errors, and builds without threads are
+ * written straight away.  So is everything in a forked child, which has no
+ * drainer; lines queued before the fork are the parent's to write.
+ */
+
+//! Lines each instance can have waiting
+#define LOG_RING_SLOTS 64
+
+//! Longest line, prefix and newline included; longer ones are cut short
+#define LOG_LINE_MAX 192
+
+//! Suppressed messages between looks at the clock for a new second
+#define LOG_SITE_RECHECK 64
+
+struct log_ring_t
+{
+	uint64_t head;		//! Lines ever queued (written by the instance)
+	uint64_t tail;		//! Lines ever written out (written by the drainer)
+	uint64_t dropped;	//! Lines lost to a full ring
+	uint64_t suppressed;	//! Lines held back by a call site's rate limit
+	FILE *out;		//! log_file() of the instance
+	log_ring *next;		//! Next live ring
+	char lines[LOG_RING_SLOTS][LOG_LINE_MAX];
+};
 
 
 FILE *to_stdout;
 FILE *to_stderr;
 
-NORETURN void fatal(emu_state *state UNUSED, const char *str, ...)
+static const char * const log_prefix[] =
 {
-	va_list argp;
-	va_start(argp, str);
+	"",				// Unused
+	"",				// LOG_LEVEL_DEBUG
+	"info: ",			// LOG_LEVEL_INFO
+	"WARNING: ",			// LOG_LEVEL_WARNING
+	"ERROR during execution: ",	// LOG_LEVEL_ERROR
+	"FATAL ERROR during execution: ",	// LOG_LEVEL_FATAL
+};
 
-	fprintf(to_stderr, "FATAL ERROR during execution: ");
-	vfprintf(to_stderr, str, argp);
-	fprintf(to_stderr, "\n");
+#ifdef HAVE_THREADS
+//! States of the drainer, in log_init
+enum
+{
+	LOG_NONE,	//! Never started
+	LOG_CHANGING,	//! Being started or stopped; wait
+	LOG_UP,		//! Running
+	LOG_IDLE,	//! Stopped with no rings left; start it again
+	LOG_DIRECT,	//! Failed to start, or a forked child; write directly
+};
 
-	va_end(argp);
+//! What the drainer is up to, in log_wake
+enum
+{
+	LOG_WAKE_BUSY,		//! Draining
+	LOG_WAKE_ASLEEP,	//! Waiting on log_wake_cond
+	LOG_WAKE_POSTED,	//! A line was queued since it last looked
+};
+
+static host_mutex log_lock;
+static host_mutex log_wake_lock;
+static host_cond log_wake_cond;
+static host_thread log_thread;
+static log_ring *log_rings;	//! Every live ring
+static uint64_t log_init;	//! LOG_NONE etc.
+static uint64_t log_wake;	//! LOG_WAKE_*
+static bool log_stop;		//! Drainer should exit (under log_wake_lock)
+
+//! Replace log_wake, returning what it was
+static uint64_t log_wake_swap(uint64_t to)
+{
+	uint64_t old = ATOMIC_LOAD64(&log_wake);
 
-	exit(EXIT_FAILURE);
+	while(!ATOMIC_CAS64(&log_wake, old, to));
+
+	return old;
 }
 
-void error(emu_state *state UNUSED, const char *str, ...)
+static void drain_ring(log_ring *ring)
 {
-	va_list argp;
-	va_start(argp, str);
+	const uint64_t head = ATOMIC_LOAD64(&(ring->head));
+	uint64_t tail = ring->tail;
 
-	fprintf(to_stderr, "ERROR during execution: ");
-	vfprintf(to_stderr, str, argp);
-	fprintf(to_stderr, "\n");
+	if(tail == head)
+	{
+		return;
+	}
 
-	va_end(argp);
+	for(; tail != head; tail++)
+	{
+		fputs(ring->lines[tail % LOG_RING_SLOTS], ring->out);
+	}
+
+	fflush(ring->out);
+	ATOMIC_STORE64(&(ring->tail), tail);
 }
 
-void info(emu_state *state UNUSED, const char *str, ...)
+THREAD_FN(log_drain, arg)
 {
-	va_list argp;
-	va_start(argp, str);
+	bool stop = false;
 
-	fprintf(to_stderr, "info: ");
-	vfprintf(to_stderr, str, argp);
-	fprintf(to_stderr, "\n");
+	(void)arg;
 
-	va_end(argp);
+	while(!stop)
+	{
+		log_ring *ring;
+		uint64_t wake = LOG_WAKE_BUSY;
+
+		// Lines posted from here on are seen by this pass or the next
+		log_wake_swap(LOG_WAKE_BUSY);
+
+		MUTEX_LOCK(&log_lock);
+		for(ring = log_rings; ring != NULL; ring = ring->next)
+		{
+			drain_ring(ring);
+		}
+		MUTEX_UNLOCK(&log_lock);
+
+		if(!ATOMIC_CAS64(&log_wake, wake, LOG_WAKE_ASLEEP))
+		{
+			// Posted to while draining; go round again
+			continue;
+		}
+
+		MUTEX_LOCK(&log_wake_lock);
+		while(!log_stop && ATOMIC_LOAD64(&log_wake) == LOG_WAKE_ASLEEP)
+		{
+			COND_WAIT(&log_wake_cond, &log_wake_lock);
+		}
+		stop = log_stop;
+		MUTEX_UNLOCK(&log_wake_lock);
+	}
+
+	THREAD_RETURN;
 }
 
-void warning(emu_state *state UNUSED, const char *str, ...)
+#ifdef HAVE_PTHREADS
+//! Hold log_lock across fork so the child never inherits it mid-drain
+static void log_fork_prepare(void)
 {
+	MUTEX_LOCK(&log_lock);
+}
+
+static void log_fork_parent(void)
+{
+	MUTEX_UNLOCK(&log_lock);
+}
+
+//! The drainer didn't come along; write directly from here on
+static void log_fork_child(void)
+{
+	log_ring *ring;
+
+	(void)MUTEX_INIT(&log_lock);
+
+	for(ring = log_rings; ring != NULL; ring = ring->next)
+	{
+		ring->tail = ring->head;
+	}
+
+	ATOMIC_STORE64(&log_init, LOG_DIRECT);
+}
+#endif
+
+//! Set up the locks the first time through
+static bool log_init_locks(void)
+{
+	if(!MUTEX_INIT(&log_lock))
+	{
+		return false;
+	}
+
+	if(!MUTEX_INIT(&log_wake_lock))
+	{
+		MUTEX_DESTROY(&log_lock);
+		return false;
+	}
+
+	if(!COND_INIT(&log_wake_cond))
+	{
+		MUTEX_DESTROY(&log_wake_lock);
+		MUTEX_DESTROY(&log_lock);
+		return false;
+	}
+
+#ifdef HAVE_PTHREADS
+	pthread_atfork(log_fork_prepare, log_fork_parent, log_fork_child);
+#endif
+
+	return true;
+}
+
+//! Start the drainer if it isn't up; false if messages must be written directly
+static bool log_start(void)
+{
+	for(;;)
+	{
+		uint64_t now = ATOMIC_LOAD64(&log_init);
+		bool ok;
+
+		if(now == LOG_UP || now == LOG_DIRECT)
+		{
+			return now == LOG_UP;
+		}
+		else if(now == LOG_CHANGING ||
+			!ATOMIC_CAS64(&log_init, now, LOG_CHANGING))
+		{
+			// Someone else is starting or stopping it
+			continue;
+		}
+
+		ok = now == LOG_IDLE || log_init_locks();
+		ok = ok && THREAD_START(&log_thread, log_drain, NULL);
+
+		ATOMIC_STORE64(&log_init, ok ? LOG_UP : LOG_DIRECT);
+		return ok;
+	}
+}
+
+//! Stop the drainer once the last ring has gone
+static void log_stop_drainer(void)
+{
+	MUTEX_LOCK(&log_wake_lock);
+	log_stop = true;
+	COND_SIGNAL(&log_wake_cond);
+	MUTEX_UNLOCK(&log_wake_lock);
+
+	THREAD_JOIN(log_thread);
+	log_stop = false;
+
+	ATOMIC_STORE64(&log_init, LOG_IDLE);
+}
+
+//! Let the drainer know a line was queued
+static void log_wake_drainer(void)
+{
+	if(log_wake_swap(LOG_WAKE_POSTED) == LOG_WAKE_ASLEEP)
+	{
+		MUTEX_LOCK(&log_wake_lock);
+		COND_SIGNAL(&log_wake_cond);
+		MUTEX_UNLOCK(&log_wake_lock);
+	}
+}
+
+//! The instance's ring, made on its first message; NULL to write directly
+static log_ring * log_ring_get(emu_state *state)
+{
+	log_ring *ring = state->log;
+
+	if(likely(ring != NULL))
+	{
+		// Not after a fork, though
+		return likely(ATOMIC_LOAD64(&log_init) == LOG_UP) ? ring : NULL;
+	}
+
+	if(!log_start() ||
+		(ring = (log_ring *)calloc(1, sizeof(log_ring))) == NULL)
+	{
+		return NULL;
+	}
+
+	ring->out = log_file(state);
+
+	for(;;)
+	{
+		MUTEX_LOCK(&log_lock);
+		if(ATOMIC_LOAD64(&log_init) == LOG_UP)
+		{
+			ring->next = log_rings;
+			log_rings = ring;
+			MUTEX_UNLOCK(&log_lock);
+			break;
+		}
+		MUTEX_UNLOCK(&log_lock);
+
+		// The last ring went while this one was made; start it again
+		if(!log_start())
+		{
+			free(ring);
+			return NULL;
+		}
+	}
+
+	state->log = ring;
+	return ring;
+}
+#endif //HAVE_THREADS
+
+FILE * log_file(const emu_state *state)
+{
+	if(state != NULL && state->opts.log != NULL)
+	{
+		return state->opts.log;
+	}
+
+	return to_stderr != NULL ? to_stderr : stderr;
+}
+
+/*!
+ * @brief	Count this message against its site.
+ * @result	false if it should be dropped.
+ * @note	The clock is only read once the burst is used up, and then
+ * 		only every LOG_SITE_RECHECK suppressed messages, so a flood
+ * 		costs next to nothing per message; a new second may go
+ * 		unnoticed for that many.
+ */
+static bool log_site_allow(log_site *site, uint64_t *suppressed)
+{
+	uint64_t old = ATOMIC_LOAD64(&(site->window)), next, second, count;
+	bool allow;
+
+	do
+	{
+		count = (uint32_t)old;
+		allow = true;
+
+		if(count < LOG_BURST)
+		{
+			next = old + 1;
+		}
+		else if(count == LOG_BURST && (second = (get_time() /
+			1000000000ULL) & 0xFFFFFFFF) != (old >> 32))
+		{
+			// New second, new allowance
+			next = (second << 32) | 1;
+		}
+		else
+		{
+			// Counts up to the next look at the clock, then wraps
+			next = (old & ~0xFFFFFFFFULL) | (LOG_BURST +
+				(count + 1 - LOG_BURST) % LOG_SITE_RECHECK);
+			allow = false;
+		}
+	} while(!ATOMIC_CAS64(&(site->window), old, next));
+
+	if(!allow)
+	{
+		count = ATOMIC_LOAD64(&(site->suppressed));
+		while(!ATOMIC_CAS64(&(site->suppressed), count, count + 1));
+		return false;
+	}
+
+	// This message carries the count of the ones dropped before it
+	*suppressed = ATOMIC_LOAD64(&(site->suppressed));
+	while(*suppressed && !ATOMIC_CAS64(&(site->suppressed), *suppressed, 0));
+
+	return true;
+}
+
+//! Format a whole line, prefix to newline
+static void log_format(char *buf, size_t len, int level, uint64_t suppressed,
+	const char *str, va_list argp)
+{
+	int n = snprintf(buf, len, "%s", log_prefix[level]);
+
+	if(n >= 0 && (size_t)n < len)
+	{
+		n += vsnprintf(buf + n, len - n, str, argp);
+	}
+
+	if(suppressed && n >= 0 && (size_t)n < len)
+	{
+		n += snprintf(buf + n, len - n, " (%llu more like this suppressed)",
+			(unsigned long long)suppressed);
+	}
+
+	if(n < 0 || (size_t)n >= len - 1)
+	{
+		// Cut short; keep the newline
+		n = (int)len - 2;
+	}
+
+	buf[n] = '\n';
+	buf[n + 1] = '\0';
+}
+
+void log_message(emu_state *state, int level, log_site *site,
+	const char *str, ...)
+{
+	uint64_t suppressed = 0;
 	va_list argp;
+#ifdef HAVE_THREADS
+	log_ring *ring;
+#endif
+
+	if(site != NULL && !log_site_allow(site, &suppressed))
+	{
+#ifdef HAVE_THREADS
+		// Sites are shared; this says how many were this instance's
+		if(state != NULL && (ring = log_ring_get(state)) != NULL)
+		{
+			ring->suppressed++;
+		}
+#endif
+		return;
+	}
+
 	va_start(argp, str);
 
-	fprintf(to_stderr, "WARNING: ");
-	vfprintf(to_stderr, str, argp);
-	fprintf(to_stderr, "\n");
+#ifdef HAVE_THREADS
+	if(state != NULL && (ring = log_ring_get(state)) != NULL)
+	{
+		const uint64_t head = ring->head;
+
+		if(site == NULL && head - ATOMIC_LOAD64(&(ring->tail)) >=
+			LOG_RING_SLOTS)
+		{
+			// Reports go out whole; make room rather than drop
+			log_flush(state);
+		}
+
+		if(head - ATOMIC_LOAD64(&(ring->tail)) >= LOG_RING_SLOTS)
+		{
+			ring->dropped++;
+		}
+		else
+		{
+			log_format(ring->lines[head % LOG_RING_SLOTS], LOG_LINE_MAX,
+				level, suppressed, str, argp);
+			ATOMIC_STORE64(&(ring->head), head + 1);
+			log_wake_drainer();
+		}
+
+		va_end(argp);
+		return;
+	}
+#endif
+
+	{
+		char buf[1024];
+
+		log_format(buf, sizeof(buf), level, suppressed, str, argp);
+		fputs(buf, log_file(state));
+	}
 
 	va_end(argp);
 }
 
-#ifdef NDEBUG
-void debug(emu_state *state UNUSED, const char *str UNUSED, ...)
+void log_flush(emu_state *state)
 {
-	// Stub
+#ifdef HAVE_THREADS
+	if(state->log != NULL)
+	{
+		MUTEX_LOCK(&log_lock);
+		drain_ring(state->log);
+		MUTEX_UNLOCK(&log_lock);
+	}
+#else
+	(void)state;
+#endif
 }
+
+void log_finish(emu_state *state, bool summary)
+{
+#ifdef HAVE_THREADS
+	log_ring *ring = state->log, **link;
+	bool last;
+
+	if(ring == NULL)
+	{
+		return;
+	}
+
+	MUTEX_LOCK(&log_lock);
+	for(link = &log_rings; *link != NULL; link = &((*link)->next))
+	{
+		if(*link == ring)
+		{
+			*link = ring->next;
+			break;
+		}
+	}
+	drain_ring(ring);
+
+	// Nothing left to drain; don't keep a thread around for it
+	last = log_rings == NULL && ATOMIC_LOAD64(&log_init) == LOG_UP;
+	if(last)
+	{
+		ATOMIC_STORE64(&log_init, LOG_CHANGING);
+	}
+	MUTEX_UNLOCK(&log_lock);
+
+	if(last)
+	{
+		log_stop_drainer();
+	}
+
+	state->log = NULL;
+
+	if(summary && ring->suppressed)
+	{
+		fprintf(ring->out, "%s%llu messages were suppressed by rate limits\n",
+			log_prefix[LOG_LEVEL_INFO],
+			(unsigned long long)ring->suppressed);
+	}
+
+	if(summary && ring->dropped)
+	{
+		fprintf(ring->out, "%s%llu messages were dropped (log ring full)\n",
+			log_prefix[LOG_LEVEL_WARNING],
+			(unsigned long long)ring->dropped);
+	}
+
+	free(ring);
 #else
-void debug(emu_state *state UNUSED, const char *str, ...)
+	(void)state;
+	(void)summary;
+#endif
+}
+
+void fatal(emu_state *state, const char *str, ...)
 {
+	FILE *out = log_file(state);
 	va_list argp;
+
+	if(state != NULL)
+	{
+		// Everything queued before this goes out before it
+		log_flush(state);
+	}
+
 	va_start(argp, str);
 
-	vfprintf(to_stderr, str, argp);
-	fprintf(to_stderr, "\n");
+	fprintf(out, "%s", log_prefix[LOG_LEVEL_FATAL]);
+	vfprintf(out, str, argp);
+	fprintf(out, "\n");
 
 	va_end(argp);
+
+	if(state != NULL)
+	{
+		// What led up to it; hcf lands here too
+		fflush(out);
+		history_dump(state, out);
+
+		state->status = EMU_STATUS_FATAL;
+	}
 }
-#endif //NDEBUG
@@ -0,0 +1,452 @@
+#include "config.h"	// bool, uint[XX]_t
+
+#include "sgherm.h"	// emu_state
+#include "profile.h"	// profile_*
+#include "ctl_unit.h"	// REG_*
+#include "debug.h"	// mnemonics, mnemonics_cb
+#include "perf.h"	// perf_ticks
+#include "print.h"	// error, info
+#include "util_time.h"	// get_time
+
+#include <stdio.h>	// fopen, fprintf
+#include <stdlib.h>	// calloc, realloc, free
+
+
+//! Deepest shadow call stack; deeper calls are charged to their caller
+#define PROFILE_MAX_DEPTH	256
+
+#define NO_ENTRY	UINT32_MAX
+#define ROOT_KEY	UINT64_MAX
+#define IRQ_FRAME	((uint64_t)1 << 31)
+
+//! Where time went: one address (flat) or one call path (tree)
+typedef struct
+{
+	uint64_t key;		//! (bank << 16) | addr, tree nodes add parent << 32
+	uint64_t count;		//! Instructions executed
+	uint64_t ticks;		//! perf_ticks() spent in them
+	uint32_t parent;	//! Caller's node (tree only)
+} profile_entry;
+
+//! Open addressed index over a growing array of entries
+typedef struct
+{
+	profile_entry *entries;
+	size_t used, size;
+
+	uint32_t *slots;	//! Entry index + 1, 0 = empty
+	size_t mask;		//! Slot count - 1
+} profile_table;
+
+typedef struct
+{
+	uint32_t node;		//! Tree node of the callee
+	uint16_t sp;		//! SP just after the return address was pushed
+} profile_frame;
+
+struct profile_state_t
+{
+	profile_table flat;	//! Per (bank, address)
+	profile_table tree;	//! Per call path; entry 0 is the root
+
+	profile_frame frames[PROFILE_MAX_DEPTH];
+	unsigned depth;
+
+	// The instruction in flight
+	uint32_t loc;		//! Its (bank << 16) | addr
+	uint16_t sp;		//! SP before it ran
+	uint64_t t0;		//! perf_ticks() before its fetch
+
+	uint64_t start_ticks;	//! perf_ticks() at start, for scaling
+	uint64_t start_time;	//! get_time() at start
+	uint64_t lost;		//! Instructions not counted for want of memory
+};
+
+
+static inline uint32_t location(const emu_state *restrict state, uint16_t addr)
+{
+	// Only the switchable ROM window is ambiguous without a bank
+	const uint32_t bank = (addr >= 0x4000 && addr < 0x8000) ?
+		state->mbc.rom_bank : 0;
+
+	return (bank << 16) | addr;
+}
+
+static bool table_grow(profile_table *table)
+{
+	const size_t count = (table->mask + 1) * 2;
+	uint32_t *slots = (uint32_t *)calloc(count, sizeof(uint32_t));
+	size_t i;
+
+	if(slots == NULL)
+	{
+		return false;
+	}
+
+	for(i = 0; i < table->used; i++)
+	{
+		size_t slot = (size_t)((table->entries[i].key *
+			0x9E3779B97F4A7C15ULL) >> 32) & (count - 1);
+
+		while(slots[slot])
+		{
+			slot = (slot + 1) & (count - 1);
+		}
+
+		slots[slot] = (uint32_t)i + 1;
+	}
+
+	free(table->slots);
+	table->slots = slots;
+	table->mask = count - 1;
+
+	return true;
+}
+
+//! Index of the entry for key, added if new; NO_ENTRY if out of memory
+static uint32_t table_find(profile_table *table, uint64_t key, uint32_t parent)
+{
+	size_t slot = (size_t)((key * 0x9E3779B97F4A7C15ULL) >> 32) & table->mask;
+	profile_entry *entry;
+
+	while(table->slots[slot])
+	{
+		const uint32_t i = table->slots[slot] - 1;
+
+		if(table->entries[i].key == key)
+		{
+			return i;
+		}
+
+		slot = (slot + 1) & table->mask;
+	}
+
+	if(table->used == table->mask)
+	{
+		// Slots could not grow; one must stay free for probing to end
+		return NO_ENTRY;
+	}
+	else if(table->used == table->size)
+	{
+		const size_t size = table->size * 2;
+		profile_entry *entries = (profile_entry *)realloc(table->entries,
+			size * sizeof(profile_entry));
+
+		if(entries == NULL)
+		{
+			return NO_ENTRY;
+		}
+
+		table->entries = entries;
+		table->size = size;
+	}
+
+	entry = &(table->entries[table->used]);
+	entry->key = key;
+	entry->count = entry->ticks = 0;
+	entry->parent = parent;
+	table->slots[slot] = (uint32_t)table->used + 1;
+
+	// Keep at least half the slots free; failing that, it just gets fuller
+	if(++table->used * 2 > table->mask + 1)
+	{
+		table_grow(table);
+	}
+
+	return (uint32_t)table->used - 1;
+}
+
+static bool table_init(profile_table *table)
+{
+	table->size = 1024;
+	table->mask = 4096 - 1;
+	table->entries = (profile_entry *)malloc(table->size * sizeof(profile_entry));
+	table->slots = (uint32_t *)calloc(table->mask + 1, sizeof(uint32_t));
+
+	return table->entries != NULL && table->slots != NULL;
+}
+
+static void table_free(profile_table *table)
+{
+	free(table->entries);
+	free(table->slots);
+}
+
+static inline uint32_t current_node(const profile_state *prof)
+{
+	return prof->depth ? prof->frames[prof->depth - 1].node : 0;
+}
+
+static void push_frame(profile_state *prof, uint64_t callee, uint16_t sp)
+{
+	const uint32_t parent = current_node(prof);
+	uint32_t node;
+
+	if(prof->depth == PROFILE_MAX_DEPTH ||
+		(node = table_find(&(prof->tree), ((uint64_t)parent << 32) | callee,
+		parent)) == NO_ENTRY)
+	{
+		// The deeper RET finds nothing to pop, since sp is lower
+		return;
+	}
+
+	prof->frames[prof->depth].node = node;
+	prof->frames[prof->depth].sp = sp;
+	prof->depth++;
+}
+
+bool profile_start(emu_state *restrict state)
+{
+	profile_state *prof = (profile_state *)calloc(1, sizeof(profile_state));
+
+	if(prof == NULL || !table_init(&(prof->flat)) ||
+		!table_init(&(prof->tree)) ||
+		table_find(&(prof->tree), ROOT_KEY, 0) != 0)
+	{
+		error(state, "Could not allocate the profiler");
+		if(prof)
+		{
+			table_free(&(prof->flat));
+			table_free(&(prof->tree));
+			free(prof);
+		}
+
+		return false;
+	}
+
+	prof->start_ticks = perf_ticks();
+	prof->start_time = get_time();
+	state->debug.profile = prof;
+
+	return true;
+}
+
+void profile_begin(emu_state *restrict state)
+{
+	profile_state *prof = state->debug.profile;
+
+	prof->loc = location(state, REG_PC(state));
+	prof->sp = REG_SP(state);
+	prof->t0 = perf_ticks();
+}
+
+void profile_end(emu_state *restrict state, uint8_t opcode)
+{
+	profile_state *prof = state->debug.profile;
+	const uint64_t ticks = perf_ticks() - prof->t0;
+	const uint16_t sp = REG_SP(state);
+	profile_entry *node = &(prof->tree.entries[current_node(prof)]);
+	uint32_t i;
+
+	node->count++;
+	node->ticks += ticks;
+
+	if((i = table_find(&(prof->flat), prof->loc, 0)) != NO_ENTRY)
+	{
+		prof->flat.entries[i].count++;
+		prof->flat.entries[i].ticks += ticks;
+	}
+	else
+	{
+		prof->lost++;
+	}
+
+	switch(opcode)
+	{
+	case 0xC4: case 0xCC: case 0xCD: case 0xD4: case 0xDC:	// CALL
+	case 0xC7: case 0xCF: case 0xD7: case 0xDF:		// RST
+	case 0xE7: case 0xEF: case 0xF7: case 0xFF:
+		// Conditional calls only push when taken
+		if(sp == (uint16_t)(prof->sp - 2))
+		{
+			push_frame(prof, location(state, REG_PC(state)), sp);
+		}
+		break;
+	case 0xC0: case 0xC8: case 0xC9: case 0xD0: case 0xD8:	// RET
+	case 0xD9:						// RETI
+		// Pop everything the stack has unwound past, which also
+		// copes with callers that drop their return address
+		while(prof->depth && prof->frames[prof->depth - 1].sp < sp)
+		{
+			prof->depth--;
+		}
+		break;
+	}
+}
+
+void profile_interrupt(emu_state *restrict state)
+{
+	profile_state *prof = state->debug.profile;
+
+	push_frame(prof, IRQ_FRAME | REG_PC(state), REG_SP(state));
+}
+
+static const char * mnemonic_at(const emu_state *restrict state, uint32_t loc)
+{
+	const uint16_t addr = loc & 0xFFFF;
+	size_t offset;
+
+	if(addr >= 0x8000)
+	{
+		// RAM may have been rewritten since
+		return "";
+	}
+
+	offset = (addr < 0x4000) ? addr : (size_t)(loc >> 16) * 0x4000 + addr - 0x4000;
+	if(offset + 1 >= state->cart_size)
+	{
+		return "";
+	}
+
+	return state->cart_data[offset] == 0xCB ?
+		mnemonics_cb[state->cart_data[offset + 1]] :
+		mnemonics[state->cart_data[offset]];
+}
+
+static int by_ticks(const void *a, const void *b)
+{
+	const profile_entry *x = (const profile_entry *)a;
+	const profile_entry *y = (const profile_entry *)b;
+
+	return (x->ticks < y->ticks) - (x->ticks > y->ticks);
+}
+
+static bool write_flat(emu_state *restrict state, FILE *f, double ns_per_tick)
+{
+	profile_table *flat = &(state->debug.profile->flat);
+	uint64_t count = 0, ticks = 0;
+	size_t i;
+
+	// The index is useless from here on
+	qsort(flat->entries, flat->used, sizeof(profile_entry), by_ticks);
+
+	for(i = 0; i < flat->used; i++)
+	{
+		count += flat->entries[i].count;
+		ticks += flat->entries[i].ticks;
+	}
+
+	fprintf(f, "# %llu instructions, %.3f ms of host time in execute\n",
+		(unsigned long long)count, ticks * ns_per_tick / 1e6);
+	fprintf(f, "# bank:addr     instructions      host ms  host %%  instruction\n");
+
+	for(i = 0; i < flat->used; i++)
+	{
+		const profile_entry *e = &(flat->entries[i]);
+
+		fprintf(f, "%02X:%04X %20llu %12.3f %7.2f  %s\n",
+			(unsigned)(e->key >> 16), (unsigned)(e->key & 0xFFFF),
+			(unsigned long long)e->count, e->ticks * ns_per_tick / 1e6,
+			ticks ? 100.0 * e->ticks / ticks : 0,
+			mnemonic_at(state, (uint32_t)e->key));
+	}
+
+	return !ferror(f);
+}
+
+static bool write_stacks(emu_state *restrict state, FILE *f, double ns_per_tick)
+{
+	const profile_table *tree = &(state->debug.profile->tree);
+	uint32_t path[PROFILE_MAX_DEPTH + 1];
+	size_t i;
+
+	for(i = 0; i < tree->used; i++)
+	{
+		const unsigned long long ns = (unsigned long long)(
+			tree->entries[i].ticks * ns_per_tick + 0.5);
+		uint32_t node = (uint32_t)i;
+		int depth = 0;
+
+		if(ns == 0)
+		{
+			continue;
+		}
+
+		for(; node != 0; node = tree->entries[node].parent)
+		{
+			path[depth++] = node;
+		}
+
+		fputs("top", f);
+		while(depth-- > 0)
+		{
+			const uint64_t key = tree->entries[path[depth]].key;
+
+			if(key & IRQ_FRAME)
+			{
+				fprintf(f, ";irq@%04X", (unsigned)(key & 0xFFFF));
+			}
+			else
+			{
+				fprintf(f, ";%02X:%04X", (unsigned)((key >> 16) & 0x7FFF),
+					(unsigned)(key & 0xFFFF));
+			}
+		}
+
+		fprintf(f, " %llu\n", ns);
+	}
+
+	return !ferror(f);
+}
+
+static void write_profile(emu_state *restrict state, const char *path,
+	bool (*writer)(emu_state *restrict, FILE *, double), double ns_per_tick)
+{
+	FILE *f;
+	bool ok;
+
+	if(path == NULL)
+	{
+		return;
+	}
+
+	if((f = fopen(path, "w")) == NULL)
+	{
+		error(state, "Could not create profile %s", path);
+		return;
+	}
+
+	ok = writer(state, f, ns_per_tick);
+	ok = (fclose(f) == 0) && ok;
+
+	if(ok)
+	{
+		info(state, "Wrote profile %s", path);
+	}
+	else
+	{
+		error(state, "Could not write profile %s", path);
+	}
+}
+
+void profile_stop(emu_state *restrict state)
+{
+	profile_state *prof = state->debug.profile;
+	uint64_t wall, ticks;
+	double ns_per_tick;
+
+	if(prof == NULL)
+	{
+		return;
+	}
+
+	wall = get_time() - prof->start_time;
+	ticks = perf_ticks() - prof->start_ticks;
+	ns_per_tick = ticks ? (double)wall / ticks : 0;
+
+	if(prof->lost)
+	{
+		warning(state, "Profiler ran out of memory; %llu instructions missing",
+			(unsigned long long)prof->lost);
+	}
+
+	// Stacks first; the flat writer sorts its table in place
+	write_profile(state, state->opts.profile_stacks_path, write_stacks,
+		ns_per_tick);
+	write_profile(state, state->opts.profile_path, write_flat, ns_per_tick);
+
+	table_free(&(prof->flat));
+	table_free(&(prof->tree));
+	free(prof);
+	state->debug.profile = NULL;
+}
@@ -0,0 +1,457 @@
+#include "config.h"	// HAVE_*, restrict
+
+#include "resample.h"	// resampler, resample_*
+
+#include <stdlib.h>	// malloc, free
+#include <string.h>	// memmove, memset
+#include <math.h>	// sin, sqrt, ceil
+
+#if defined(HAVE_EMMINTRIN_H) && (defined(__SSE2__) || defined(_M_X64) || \
+	(defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#	define RESAMPLE_SSE2
+#	include <emmintrin.h>	// _mm_*_ps
+#endif
+
+#if defined(HAVE_IMMINTRIN_H) && defined(HAVE_AVX2_TARGET)
+#	define RESAMPLE_AVX2
+#	include <immintrin.h>	// _mm256_*_ps
+#endif
+
+
+#ifndef M_PI
+#	define M_PI 3.14159265358979323846
+#endif
+
+//! Coefficient rows are padded to this many floats (one AVX register)
+#define TAP_ALIGN 8
+
+//! Input frames appended to the history buffer per growth step
+#define GROW_FRAMES 4096
+
+
+typedef void (*resample_kernel)(const float *restrict coef,
+	const float *restrict l, const float *restrict r, unsigned taps,
+	float *out_l, float *out_r);
+
+struct resampler_t
+{
+	unsigned in_rate, out_rate;
+
+	unsigned taps;		//! Taps per phase (multiple of TAP_ALIGN)
+	unsigned phases;	//! Phase count (power of two)
+	unsigned phase_shift;	//! 32 - log2(phases)
+	void *coef_alloc;	//! Unaligned allocation backing coef
+	float *coef;		//! (phases + 1) rows of taps coefficients
+
+	float *hist_l, *hist_r;	//! Planar input history
+	size_t fill, cap;	//! Frames held / frames allocated
+
+	uint64_t pos;		//! 32.32 position of the next output in hist
+	uint64_t step;		//! 32.32 input frames per output frame
+
+	resample_kernel kernel;
+	const char *kernel_name;
+};
+
+
+static void kernel_scalar(const float *restrict coef,
+	const float *restrict l, const float *restrict r, unsigned taps,
+	float *out_l, float *out_r)
+{
+	float al[4] = { 0, 0, 0, 0 }, ar[4] = { 0, 0, 0, 0 };
+	unsigned i;
+
+	// Four independent accumulators so the compiler can pipeline
+	for(i = 0; i < taps; i += 4)
+	{
+		al[0] += coef[i+0] * l[i+0]; ar[0] += coef[i+0] * r[i+0];
+		al[1] += coef[i+1] * l[i+1]; ar[1] += coef[i+1] * r[i+1];
+		al[2] += coef[i+2] * l[i+2]; ar[2] += coef[i+2] * r[i+2];
+		al[3] += coef[i+3] * l[i+3]; ar[3] += coef[i+3] * r[i+3];
+	}
+
+	*out_l = (al[0] + al[1]) + (al[2] + al[3]);
+	*out_r = (ar[0] + ar[1]) + (ar[2] + ar[3]);
+}
+
+#ifdef RESAMPLE_SSE2
+static inline float hsum_sse2(__m128 v)
+{
+	__m128 shuf = _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 3, 0, 1));
+	v = _mm_add_ps(v, shuf);
+	shuf = _mm_movehl_ps(shuf, v);
+	v = _mm_add_ss(v, shuf);
+	return _mm_cvtss_f32(v);
+}
+
+static void kernel_sse2(const float *restrict coef,
+	const float *restrict l, const float *restrict r, unsigned taps,
+	float *out_l, float *out_r)
+{
+	__m128 al0 = _mm_setzero_ps(), al1 = _mm_setzero_ps();
+	__m128 ar0 = _mm_setzero_ps(), ar1 = _mm_setzero_ps();
+	unsigned i;
+
+	for(i = 0; i < taps; i += 8)
+	{
+		__m128 c0 = _mm_load_ps(coef + i);
+		__m128 c1 = _mm_load_ps(coef + i + 4);
+
+		al0 = _mm_add_ps(al0, _mm_mul_ps(c0, _mm_loadu_ps(l + i)));
+		al1 = _mm_add_ps(al1, _mm_mul_ps(c1, _mm_loadu_ps(l + i + 4)));
+		ar0 = _mm_add_ps(ar0, _mm_mul_ps(c0, _mm_loadu_ps(r + i)));
+		ar1 = _mm_add_ps(ar1, _mm_mul_ps(c1, _mm_loadu_ps(r + i + 4)));
+	}
+
+	*out_l = hsum_sse2(_mm_add_ps(al0, al1));
+	*out_r = hsum_sse2(_mm_add_ps(ar0, ar1));
+}
+#endif //RESAMPLE_SSE2
+
+#ifdef RESAMPLE_AVX2
+__attribute__((target("avx2,fma")))
+static inline float hsum_avx(__m256 v)
+{
+	__m128 lo = _mm256_castps256_ps128(v);
+	__m128 hi = _mm256_extractf128_ps(v, 1);
+	lo = _mm_add_ps(lo, hi);
+	hi = _mm_movehl_ps(hi, lo);
+	lo = _mm_add_ps(lo, hi);
+	hi = _mm_shuffle_ps(lo, lo, 1);
+	return _mm_cvtss_f32(_mm_add_ss(lo, hi));
+}
+
+__attribute__((target("avx2,fma")))
+static void kernel_avx2(const float *restrict coef,
+	const float *restrict l, const float *restrict r, unsigned taps,
+	float *out_l, float *out_r)
+{
+	__m256 al0 = _mm256_setzero_ps(), al1 = _mm256_setzero_ps();
+	__m256 ar0 = _mm256_setzero_ps(), ar1 = _mm256_setzero_ps();
+	unsigned i = 0;
+
+	for(; i + 16 <= taps; i += 16)
+	{
+		__m256 c0 = _mm256_load_ps(coef + i);
+		__m256 c1 = _mm256_load_ps(coef + i + 8);
+
+		al0 = _mm256_fmadd_ps(c0, _mm256_loadu_ps(l + i), al0);
+		al1 = _mm256_fmadd_ps(c1, _mm256_loadu_ps(l + i + 8), al1);
+		ar0 = _mm256_fmadd_ps(c0, _mm256_loadu_ps(r + i), ar0);
+		ar1 = _mm256_fmadd_ps(c1, _mm256_loadu_ps(r + i + 8), ar1);
+	}
+
+	if(i < taps)
+	{
+		// taps is a multiple of 8, so at most one register remains
+		__m256 c0 = _mm256_load_ps(coef + i);
+		al0 = _mm256_fmadd_ps(c0, _mm256_loadu_ps(l + i), al0);
+		ar0 = _mm256_fmadd_ps(c0, _mm256_loadu_ps(r + i), ar0);
+	}
+
+	*out_l = hsum_avx(_mm256_add_ps(al0, al1));
+	*out_r = hsum_avx(_mm256_add_ps(ar0, ar1));
+}
+#endif //RESAMPLE_AVX2
+
+static void select_kernel(resampler *rs)
+{
+	rs->kernel = kernel_scalar;
+	rs->kernel_name = "scalar";
+
+#ifdef RESAMPLE_SSE2
+	rs->kernel = kernel_sse2;
+	rs->kernel_name = "sse2";
+#endif
+
+#ifdef RESAMPLE_AVX2
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+	{
+		rs->kernel = kernel_avx2;
+		rs->kernel_name = "avx2";
+	}
+#endif
+}
+
+//! Zeroth-order modified Bessel function of the first kind
+static double bessel_i0(double x)
+{
+	double sum = 1.0, term = 1.0, q = x * x / 4.0;
+	unsigned k;
+
+	for(k = 1; k < 64 && term > sum * 1e-12; k++)
+	{
+		term *= q / ((double)k * k);
+		sum += term;
+	}
+
+	return sum;
+}
+
+static void build_table(resampler *rs, unsigned half, double fc, double beta)
+{
+	const double i0_beta = bessel_i0(beta);
+	const unsigned centre = half - 1;
+	unsigned p, j;
+
+	for(p = 0; p <= rs->phases; p++)
+	{
+		float *row = rs->coef + (size_t)p * rs->taps;
+		double frac = (double)p / rs->phases;
+		double sum = 0.0;
+
+		for(j = 0; j < rs->taps; j++)
+		{
+			double d = (double)j - centre - frac;
+			double w, h, x;
+
+			if(j >= 2 * half || fabs(d) >= half)
+			{
+				row[j] = 0.0f;
+				continue;
+			}
+
+			x = d / half;
+			w = bessel_i0(beta * sqrt(1.0 - x * x)) / i0_beta;
+			h = (d == 0.0 ? 2.0 * fc : sin(2.0 * M_PI * fc * d) / (M_PI * d));
+
+			row[j] = (float)(h * w);
+			sum += h * w;
+		}
+
+		// Unity DC gain for every phase, otherwise the phases ripple
+		for(j = 0; j < rs->taps; j++)
+		{
+			row[j] = (float)(row[j] / sum);
+		}
+	}
+}
+
+resampler * resampler_new(unsigned in_rate, unsigned out_rate,
+	resample_quality quality, resample_latency latency)
+{
+	static const unsigned phase_bits[] = { 6, 8, 10 };
+	static const double betas[] = { 5.0, 7.86, 10.06 };
+	static const unsigned crossings[] = { 8, 16, 32 };
+
+	resampler *rs;
+	unsigned half, zc;
+	double fc, ratio;
+	size_t rows;
+
+	if(in_rate == 0 || out_rate == 0 ||
+		quality > RESAMPLE_QUALITY_HIGH || latency > RESAMPLE_LATENCY_HIGH)
+	{
+		return NULL;
+	}
+
+	if((rs = (resampler *)calloc(1, sizeof(resampler))) == NULL)
+	{
+		return NULL;
+	}
+
+	rs->in_rate = in_rate;
+	rs->out_rate = out_rate;
+	rs->phases = 1U << phase_bits[quality];
+	rs->phase_shift = 32 - phase_bits[quality];
+
+	// Cutoff in cycles per input sample, pulled in 10% to leave room for
+	// the transition band below the output Nyquist
+	ratio = (double)out_rate / in_rate;
+	fc = 0.5 * (ratio < 1.0 ? ratio : 1.0) * 0.9;
+
+	// Zero crossings of the sinc are 1/(2fc) input samples apart
+	zc = crossings[latency];
+	half = (unsigned)ceil(zc / (2.0 * fc));
+	rs->taps = (2 * half + TAP_ALIGN - 1) & ~(TAP_ALIGN - 1);
+
+	rows = (size_t)rs->phases + 1;
+	rs->coef_alloc = malloc(rows * rs->taps * sizeof(float) + 32);
+	if(rs->coef_alloc == NULL)
+	{
+		free(rs);
+		return NULL;
+	}
+	rs->coef = (float *)(((uintptr_t)rs->coef_alloc + 31) & ~(uintptr_t)31);
+
+	build_table(rs, half, fc, betas[quality]);
+
+	rs->step = ((uint64_t)in_rate << 32) / out_rate;
+
+	select_kernel(rs);
+	resampler_reset(rs);
+
+	return rs;
+}
+
+void resampler_free(resampler *rs)
+{
+	if(rs == NULL)
+	{
+		return;
+	}
+
+	free(rs->coef_alloc);
+	free(rs->hist_l);
+	free(rs->hist_r);
+	free(rs);
+}
+
+void resampler_reset(resampler *rs)
+{
+	// Prime with half a filter of silence so the first output is centred
+	// on the first real input frame
+	rs->fill = 0;
+	rs->pos = 0;
+	resampler_push_s16(rs, NULL, rs->taps / 2);
+}
+
+size_t resampler_input_needed(const resampler *rs, size_t out_frames)
+{
+	uint64_t last;
+	size_t need;
+
+	if(out_frames == 0)
+	{
+		return 0;
+	}
+
+	last = rs->pos + (uint64_t)(out_frames - 1) * rs->step;
+	need = (size_t)(last >> 32) + rs->taps;
+
+	return need > rs->fill ? need - rs->fill : 0;
+}
+
+static bool grow(resampler *rs, size_t want)
+{
+	size_t cap = rs->cap ? rs->cap : GROW_FRAMES;
+	float *l, *r;
+
+	while(cap < want)
+	{
+		cap *= 2;
+	}
+
+	if(cap == rs->cap)
+	{
+		return true;
+	}
+
+	if((l = (float *)realloc(rs->hist_l, cap * sizeof(float))) == NULL)
+	{
+		return false;
+	}
+	rs->hist_l = l;
+
+	if((r = (float *)realloc(rs->hist_r, cap * sizeof(float))) == NULL)
+	{
+		return false;
+	}
+	rs->hist_r = r;
+
+	rs->cap = cap;
+	return true;
+}
+
+bool resampler_push_s16(resampler *restrict rs, const int16_t *restrict in, size_t frames)
+{
+	float *restrict l, *restrict r;
+	size_t i;
+
+	if(rs->fill + frames > rs->cap && !grow(rs, rs->fill + frames))
+	{
+		return false;
+	}
+
+	l = rs->hist_l + rs->fill;
+	r = rs->hist_r + rs->fill;
+
+	if(in == NULL)
+	{
+		memset(l, 0, frames * sizeof(float));
+		memset(r, 0, frames * sizeof(float));
+	}
+	else
+	{
+		// Deinterleave so both channels share one coefficient load
+		for(i = 0; i < frames; i++)
+		{
+			l[i] = in[2*i];
+			r[i] = in[2*i+1];
+		}
+	}
+
+	rs->fill += frames;
+	return true;
+}
+
+static inline int16_t clamp_s16(float v)
+{
+	v += (v < 0 ? -0.5f : 0.5f);
+
+	if(v >= 32767.0f) return 32767;
+	if(v <= -32768.0f) return -32768;
+
+	return (int16_t)v;
+}
+
+size_t resampler_pull_s16(resampler *restrict rs, int16_t *restrict out, size_t frames)
+{
+	const unsigned taps = rs->taps;
+	const unsigned shift = rs->phase_shift;
+	const uint64_t round = (uint64_t)1 << (shift - 1);
+	size_t n, consumed;
+
+	for(n = 0; n < frames; n++)
+	{
+		size_t ipos = (size_t)(rs->pos >> 32);
+		uint32_t frac = (uint32_t)rs->pos;
+		unsigned phase;
+		float vl, vr;
+
+		if(ipos + taps > rs->fill)
+		{
+			break;
+		}
+
+		// Round to the nearest phase; the table has phases + 1 rows so
+		// rounding up off the end is fine
+		phase = (unsigned)(((uint64_t)frac + round) >> shift);
+
+		rs->kernel(rs->coef + (size_t)phase * taps,
+			rs->hist_l + ipos, rs->hist_r + ipos, taps, &vl, &vr);
+
+		*(out++) = clamp_s16(vl);
+		*(out++) = clamp_s16(vr);
+
+		rs->pos += rs->step;
+	}
+
+	// Drop history no future output can reach
+	consumed = (size_t)(rs->pos >> 32);
+	if(consumed > rs->fill)
+	{
+		consumed = rs->fill;
+	}
+
+	if(consumed > 0)
+	{
+		memmove(rs->hist_l, rs->hist_l + consumed, (rs->fill - consumed) * sizeof(float));
+		memmove(rs->hist_r, rs->hist_r + consumed, (rs->fill - consumed) * sizeof(float));
+		rs->fill -= consumed;
+		rs->pos -= (uint64_t)consumed << 32;
+	}
+
+	return n;
+}
+
+const char * resampler_kernel_name(const resampler *rs)
+{
+	return rs->kernel_name;
+}
+
+unsigned resampler_delay(const resampler *rs)
+{
+	return rs->taps / 2;
+}
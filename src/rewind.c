@@ -0,0 +1,465 @@
+#include "config.h"	// bool, uint[XX]_t
+
+#include "sgherm.h"	// emu_state
+#include "rewind.h"	// rewind_*
+#include "savestate.h"	// state_*
+#include "print.h"	// error
+
+#include <stdlib.h>	// malloc, calloc, free
+#include <string.h>	// memcpy, memset
+
+
+/*
+ * Every frame is a save state.  Consecutive frames differ in a handful of
+ * bytes (registers, timers, a few lines of WRAM and VRAM), so each one is
+ * XORed against the last keyframe, which leaves long runs of zeroes, and
+ * then packed as (zero run, literal run) pairs.  Keyframes are packed the
+ * same way against nothing, which still squeezes out empty RAM.
+ *
+ * Packed frames live back to back in a byte ring; when it fills up the
+ * oldest keyframe and all the deltas that depend on it are dropped.
+ */
+
+//! Zero bytes needed to end a literal run; shorter gaps aren't worth a pair
+#define MIN_ZERO_RUN 8
+
+//! Budget bytes per index slot; caps the frame count of near-static scenes
+#define BYTES_PER_ENTRY 512
+
+typedef struct
+{
+	uint32_t off;			//! Offset into the ring
+	uint32_t len;			//! Packed length
+	bool key;			//! Keyframe (not a delta)
+} rewind_entry;
+
+struct rewind_state_t
+{
+	size_t snap_size;		//! state_size() of the instance
+
+	uint8_t *cur;			//! Scratch snapshot
+	uint8_t *key;			//! Unpacked keyframe
+	uint64_t key_seq;		//! Sequence number of the frame in key
+	bool key_valid;			//! key holds a frame still in the ring
+	unsigned interval;		//! Frames between keyframes
+	unsigned since_key;		//! Frames pushed since (and including) key
+
+	uint8_t *pack;			//! Scratch for packing
+	size_t pack_size;		//! Worst case packed size
+
+	uint8_t *ring;			//! Packed frames
+	size_t ring_size;		//! Size of ring
+	size_t head;			//! End of the newest frame
+	size_t used;			//! Bytes of packed frames held
+
+	rewind_entry *ent;		//! Index, oldest first from ent_first
+	size_t ent_cap;			//! Slots in ent
+	size_t ent_first;		//! Slot of the oldest frame
+	size_t ent_count;		//! Frames held
+	uint64_t base;			//! Sequence number of the oldest frame
+};
+
+#define ENTRY(rw, i) (&((rw)->ent[((rw)->ent_first + (i)) % (rw)->ent_cap]))
+
+static inline size_t put_varint(uint8_t *p, size_t v)
+{
+	size_t n = 0;
+
+	while(v >= 0x80)
+	{
+		p[n++] = (v & 0x7F) | 0x80;
+		v >>= 7;
+	}
+
+	p[n++] = v;
+	return n;
+}
+
+static inline const uint8_t * get_varint(const uint8_t *p, const uint8_t *end,
+	size_t *v)
+{
+	unsigned shift = 0;
+
+	*v = 0;
+	while(p < end && shift < 35)
+	{
+		*v |= (size_t)(*p & 0x7F) << shift;
+		if(!(*p++ & 0x80))
+		{
+			return p;
+		}
+
+		shift += 7;
+	}
+
+	return NULL;
+}
+
+//! Byte i of a XOR ref (or a itself when there is no ref)
+#define DIFF(a, ref, i) ((ref) ? (a)[i] ^ (ref)[i] : (a)[i])
+
+//! Length of the run of zero DIFF bytes starting at i
+static inline size_t zero_run(const uint8_t *restrict a,
+	const uint8_t *restrict ref, size_t i, size_t n)
+{
+	const size_t start = i;
+
+	// A word at a time; state is mostly unchanged
+	while(i + 8 <= n)
+	{
+		uint64_t x, y = 0;
+
+		memcpy(&x, a + i, 8);
+		if(ref)
+		{
+			memcpy(&y, ref + i, 8);
+		}
+
+		if(x != y)
+		{
+			break;
+		}
+
+		i += 8;
+	}
+
+	while(i < n && DIFF(a, ref, i) == 0)
+	{
+		i++;
+	}
+
+	return i - start;
+}
+
+static size_t pack(const uint8_t *restrict a, const uint8_t *restrict ref,
+	size_t n, uint8_t *restrict out)
+{
+	size_t i = 0, o = 0;
+
+	while(i < n)
+	{
+		size_t zeroes = zero_run(a, ref, i, n), start, j;
+
+		i += zeroes;
+		start = j = i;
+
+		// Literal run ends at a long enough gap or at the end
+		while(j < n)
+		{
+			size_t gap;
+
+			if(DIFF(a, ref, j) != 0)
+			{
+				j++;
+				continue;
+			}
+
+			gap = zero_run(a, ref, j, n);
+			if(gap >= MIN_ZERO_RUN || j + gap == n)
+			{
+				break;
+			}
+
+			j += gap;
+		}
+
+		o += put_varint(out + o, zeroes);
+		o += put_varint(out + o, j - start);
+		for(; i < j; i++)
+		{
+			out[o++] = DIFF(a, ref, i);
+		}
+	}
+
+	return o;
+}
+
+static bool unpack(const uint8_t *restrict in, size_t len,
+	const uint8_t *restrict ref, uint8_t *restrict out, size_t n)
+{
+	const uint8_t *end = in + len;
+	size_t i = 0;
+
+	if(ref)
+	{
+		memcpy(out, ref, n);
+	}
+	else
+	{
+		memset(out, 0, n);
+	}
+
+	while(in < end)
+	{
+		size_t zeroes, lit;
+
+		if((in = get_varint(in, end, &zeroes)) == NULL ||
+			(in = get_varint(in, end, &lit)) == NULL ||
+			zeroes > n - i || lit > n - i - zeroes ||
+			lit > (size_t)(end - in))
+		{
+			return false;
+		}
+
+		i += zeroes;
+		for(; lit; lit--, i++)
+		{
+			out[i] ^= *in++;
+		}
+	}
+
+	return i == n;
+}
+
+//! Drop the oldest keyframe and every delta that depends on it
+static void evict(rewind_state *rw)
+{
+	do
+	{
+		rewind_entry *e = ENTRY(rw, 0);
+
+		if(e->key && rw->key_seq == rw->base)
+		{
+			rw->key_valid = false;
+		}
+
+		rw->used -= e->len;
+		rw->ent_first = (rw->ent_first + 1) % rw->ent_cap;
+		rw->ent_count--;
+		rw->base++;
+	} while(rw->ent_count && !ENTRY(rw, 0)->key);
+}
+
+//! Find room for len bytes, evicting as needed
+static size_t ring_alloc(rewind_state *rw, size_t len)
+{
+	for(;;)
+	{
+		size_t tail;
+
+		if(rw->ent_count == 0)
+		{
+			rw->head = 0;
+			return 0;
+		}
+
+		tail = ENTRY(rw, 0)->off;
+		if(rw->ent_count < rw->ent_cap)
+		{
+			if(rw->head > tail)
+			{
+				if(rw->ring_size - rw->head >= len)
+				{
+					return rw->head;
+				}
+				else if(tail >= len)
+				{
+					// Wrap; the end of the ring goes unused this lap
+					return 0;
+				}
+			}
+			else if(rw->head < tail && tail - rw->head >= len)
+			{
+				return rw->head;
+			}
+		}
+
+		evict(rw);
+	}
+}
+
+rewind_state * rewind_new(emu_state *restrict state, size_t budget,
+	unsigned interval)
+{
+	rewind_state *rw;
+	size_t snap = state_size(state);
+	size_t pack_size = snap + 10 * (snap / (MIN_ZERO_RUN + 1) + 2);
+	size_t ent_cap = budget / BYTES_PER_ENTRY;
+	size_t fixed = sizeof(rewind_state) + 2 * snap + pack_size +
+		ent_cap * sizeof(rewind_entry);
+
+	// Room for at least one keyframe in the worst case
+	if(budget < fixed + pack_size || ent_cap < 2)
+	{
+		error(state, "Rewind budget of %lu bytes is too small (need %lu)",
+			(unsigned long)budget, (unsigned long)(fixed + pack_size));
+		return NULL;
+	}
+
+	if((rw = (rewind_state *)calloc(1, sizeof(rewind_state))) == NULL)
+	{
+		error(state, "Could not allocate rewind buffer");
+		return NULL;
+	}
+
+	rw->snap_size = snap;
+	rw->interval = interval ? interval : REWIND_DEFAULT_INTERVAL;
+	rw->pack_size = pack_size;
+	rw->ent_cap = ent_cap;
+	rw->ring_size = budget - fixed;
+	if(rw->ring_size > UINT32_MAX)
+	{
+		rw->ring_size = UINT32_MAX;
+	}
+
+	rw->cur = (uint8_t *)malloc(snap);
+	rw->key = (uint8_t *)malloc(snap);
+	rw->pack = (uint8_t *)malloc(pack_size);
+	rw->ent = (rewind_entry *)malloc(ent_cap * sizeof(rewind_entry));
+	rw->ring = (uint8_t *)malloc(rw->ring_size);
+	if(!rw->cur || !rw->key || !rw->pack || !rw->ent || !rw->ring)
+	{
+		error(state, "Could not allocate rewind buffer");
+		rewind_free(rw);
+		return NULL;
+	}
+
+	return rw;
+}
+
+void rewind_free(rewind_state *rw)
+{
+	if(rw == NULL)
+	{
+		return;
+	}
+
+	free(rw->cur);
+	free(rw->key);
+	free(rw->pack);
+	free(rw->ent);
+	free(rw->ring);
+	free(rw);
+}
+
+bool rewind_push(rewind_state *restrict rw, emu_state *restrict state)
+{
+	rewind_entry *e;
+	bool key;
+	size_t len, off;
+
+	if(state_save(state, rw->cur, rw->snap_size) != rw->snap_size)
+	{
+		return false;
+	}
+
+	key = !rw->key_valid || rw->since_key >= rw->interval;
+	for(;;)
+	{
+		len = pack(rw->cur, key ? NULL : rw->key, rw->snap_size, rw->pack);
+		off = ring_alloc(rw, len);
+
+		if(key || rw->key_valid)
+		{
+			break;
+		}
+
+		// Making room threw out our keyframe; this frame becomes one
+		key = true;
+	}
+
+	memcpy(rw->ring + off, rw->pack, len);
+	rw->head = off + len;
+	rw->used += len;
+
+	e = ENTRY(rw, rw->ent_count);
+	e->off = (uint32_t)off;
+	e->len = (uint32_t)len;
+	e->key = key;
+
+	if(key)
+	{
+		// The snapshot we just took is the new reference
+		uint8_t *tmp = rw->key;
+		rw->key = rw->cur;
+		rw->cur = tmp;
+
+		rw->key_seq = rw->base + rw->ent_count;
+		rw->key_valid = true;
+		rw->since_key = 0;
+	}
+
+	rw->since_key++;
+	rw->ent_count++;
+
+	return true;
+}
+
+int rewind_back(rewind_state *restrict rw, emu_state *restrict state,
+	unsigned frames)
+{
+	rewind_entry *e, *k;
+	size_t idx, kidx, i;
+	const uint8_t *snap;
+
+	if(rw->ent_count == 0)
+	{
+		return -1;
+	}
+
+	if(frames > rw->ent_count - 1)
+	{
+		frames = (unsigned)(rw->ent_count - 1);
+	}
+
+	idx = rw->ent_count - 1 - frames;
+	e = ENTRY(rw, idx);
+
+	// The oldest frame is always a keyframe, so this terminates
+	for(kidx = idx; !ENTRY(rw, kidx)->key; kidx--);
+	k = ENTRY(rw, kidx);
+
+	if(!rw->key_valid || rw->key_seq != rw->base + kidx)
+	{
+		if(!unpack(rw->ring + k->off, k->len, NULL, rw->key, rw->snap_size))
+		{
+			rw->key_valid = false;
+			error(state, "Rewind keyframe is corrupt");
+			return -1;
+		}
+
+		rw->key_seq = rw->base + kidx;
+		rw->key_valid = true;
+	}
+
+	if(kidx == idx)
+	{
+		snap = rw->key;
+	}
+	else if(unpack(rw->ring + e->off, e->len, rw->key, rw->cur, rw->snap_size))
+	{
+		snap = rw->cur;
+	}
+	else
+	{
+		error(state, "Rewind frame is corrupt");
+		return -1;
+	}
+
+	if(!state_load(state, snap, rw->snap_size))
+	{
+		return -1;
+	}
+
+	// Everything after the restored frame is now an alternate future
+	for(i = idx + 1; i < rw->ent_count; i++)
+	{
+		rw->used -= ENTRY(rw, i)->len;
+	}
+
+	rw->ent_count = idx + 1;
+	rw->head = e->off + e->len;
+	rw->since_key = (unsigned)(idx - kidx + 1);
+
+	return (int)frames;
+}
+
+size_t rewind_frames(const rewind_state *rw)
+{
+	return rw->ent_count;
+}
+
+size_t rewind_used(const rewind_state *rw)
+{
+	return rw->used;
+}
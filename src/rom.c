@@ -11,6 +11,8 @@
 #include "rom.h"	// constants, cart_header, etc.
 #include "util.h"	// likely/unlikely
 #include "memmap.h"	// memmap_*
+#include "save.h"	// save_mark_range
+#include "cow.h"	// COW_OWNED, cow_unshare
 #include "platform/swap.h"	// letoh32, htole32
 
 
@@ -87,55 +89,86 @@ bool read_bootrom_data(emu_state *restrict state, const char *bootrom_path)
 	return true;
 }
 
+/*!
+ * Map a ROM file read-only
+ * @param state state structure for messages (may be NULL)
+ * @param rom_path path to the ROM
+ * @param hugepages hint the kernel to back the mapping with huge pages
+ * @returns the image with one reference held, or NULL on failure
+ * @note pass the image in emu_options.rom to share it between instances
+ */
+rom_image * rom_image_open(emu_state *restrict state, const char *rom_path, bool hugepages)
+{
+	rom_image *rom;
+
+	if((rom = (rom_image *)calloc(1, sizeof(rom_image))) == NULL)
+	{
+		error(state, "Could not allocate ROM image");
+		return NULL;
+	}
+
+	rom->data = (const uint8_t *)memmap_open_ro(state, rom_path,
+		&(rom->size), hugepages, &(rom->mm));
+	if(rom->data == NULL)
+	{
+		free(rom);
+		return NULL;
+	}
+
+	rom->refs = 1;
+	return rom;
+}
+
+//! Take another reference to a ROM image
+rom_image * rom_image_ref(rom_image *rom)
+{
+	ATOMIC_INC(&(rom->refs));
+	return rom;
+}
+
+//! Drop a reference to a ROM image, unmapping it with the last one
+void rom_image_unref(emu_state *restrict state, rom_image *rom)
+{
+	if(rom == NULL || ATOMIC_DEC(&(rom->refs)) > 0)
+	{
+		return;
+	}
+
+	memmap_close(state, (void *)rom->data, &(rom->mm));
+	free(rom);
+}
+
 bool read_rom_data(emu_state *restrict state, const char *restrict rom_path,
 	cart_header *restrict *restrict header)
 {
 	int i;
 	size_t read_size, cart_size;
-	size_t result;
 	int8_t checksum = 0;
 	char title[20] = "\0", publisher[5] = "\0"; // Max sizes
 	const cart_offsets begin = OFF_GRAPHIC_BEGIN;
 	bool err = true;
-	FILE *rom = NULL;
 
 	// Initalise
 	*header = NULL;
 
-	// Get ROM size
-	if((i = get_file_size(rom_path)) < 0)
+	if(state->opts.rom)
 	{
-		fatal(state, "Could not get size of ROM: %s", strerror(errno));
-		goto close_rom;
+		// Shared with other instances
+		state->rom = rom_image_ref(state->opts.rom);
 	}
-
-	state->cart_size = cart_size = i;
-
-	if(unlikely(cart_size < 0x8000))
+	else if((state->rom = rom_image_open(state, rom_path,
+		state->opts.rom_hugepages)) == NULL)
 	{
-		fatal(state, "ROM is too small");
+		fatal(state, "Could not load ROM %s", rom_path);
 		goto close_rom;
 	}
 
-	if((rom = fopen(rom_path, "rb")) == NULL)
-	{
-		fatal(state, "Could not open ROM: %s", strerror(errno));
-		goto close_rom;
-	}
+	state->cart_data = state->rom->data;
+	state->cart_size = cart_size = state->rom->size;
 
-	state->cart_size = cart_size;
-
-	if(unlikely((state->cart_data = (uint8_t *)malloc(cart_size)) == NULL))
-	{
-		fatal(state, "Could not allocate RAM for ROM");
-		goto close_rom;
-	}
-
-	result = fread(state->cart_data, 1, cart_size, rom);
-
-	if(unlikely(result != cart_size))
+	if(unlikely(cart_size < 0x8000))
 	{
-		fatal(state, "Could not read ROM: %s", strerror(errno));
+		fatal(state, "ROM is too small");
 		goto close_rom;
 	}
 
@@ -241,12 +274,9 @@ bool read_rom_data(emu_state *restrict state, const char *restrict rom_path,
 close_rom:
 	if(err)
 	{
-		free(state->cart_data);
-	}
-
-	if(rom)
-	{
-		fclose(rom);
+		rom_image_unref(state, state->rom);
+		state->rom = NULL;
+		state->cart_data = NULL;
 	}
 
 	return !err;
@@ -313,7 +343,7 @@ void rtc_save(emu_state *state)
 
 	if(ram_total <= 0)
 	{
-		info(state, "Not writing save state, cart is ROM only");
+		// Called on every latch, so don't complain here
 		return;
 	}
 
@@ -341,10 +371,15 @@ void rtc_save(emu_state *state)
 		data[10] = htole32(state->mbc.mbc3.unix_time_last & 0xFFFFFFFF);
 		data[11] = htole32(state->mbc.mbc3.unix_time_last >> 32);
 
+		if(!COW_OWNED(state, COW_CART) && !cow_unshare(state, COW_CART))
+		{
+			break;
+		}
+
 		memcpy(state->mbc.cart_ram + ram_total, data, sizeof(data));
 
 		// Need writeback
-		state->mbc.dirty = true;
+		save_mark_range(state, ram_total, sizeof(data));
 
 		//info(state, "RTC data saved");
 	default:
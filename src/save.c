@@ -0,0 +1,363 @@
+#include "config.h"	// bool, uint[XX]_t
+
+#include "sgherm.h"	// emu_state
+#include "save.h"	// save_state, save_*
+#include "memmap.h"	// memmap_*
+#include "cow.h"	// COW_CART
+#include "print.h"	// error, debug
+
+#include <stdio.h>	// fopen, fread, fwrite, rename, remove
+#include <stdlib.h>	// calloc, free
+#include <string.h>	// memset, strlen, strerror
+#include <errno.h>	// errno
+
+#if defined(HAVE_POSIX)
+#	include <unistd.h>	// fsync
+#	include <fcntl.h>	// open
+#elif defined(HAVE_WINDOWS)
+#	include <windows.h>	// MoveFileEx
+#	include <io.h>		// _commit
+#endif
+
+
+static inline bool page_dirty(const save_state *restrict save, size_t page)
+{
+	return (save->dirty_map[page >> 3] >> (page & 7)) & 1;
+}
+
+static bool journal_sync_file(FILE *f)
+{
+	if(fflush(f) != 0)
+	{
+		return false;
+	}
+
+#if defined(HAVE_POSIX)
+	return fsync(fileno(f)) == 0;
+#elif defined(HAVE_WINDOWS)
+	return _commit(_fileno(f)) == 0;
+#else
+	return true;
+#endif
+}
+
+static void journal_sync_dir(const char *path)
+{
+#if defined(HAVE_POSIX)
+	// The rename itself isn't durable until the directory is synced
+	const char *slash = strrchr(path, '/');
+	char *dir;
+	int fd;
+
+	if(slash == NULL)
+	{
+		dir = strdup(".");
+	}
+	else if(slash == path)
+	{
+		dir = strdup("/");
+	}
+	else
+	{
+		dir = strdup(path);
+		if(dir != NULL)
+		{
+			dir[slash - path] = '\0';
+		}
+	}
+
+	if(dir == NULL)
+	{
+		return;
+	}
+
+	if((fd = open(dir, O_RDONLY)) >= 0)
+	{
+		int ret = fsync(fd);
+		(void)ret;
+		close(fd);
+	}
+
+	free(dir);
+#else
+	(void)path;
+#endif
+}
+
+static bool journal_replace(const char *from, const char *to)
+{
+#if defined(HAVE_WINDOWS)
+	return MoveFileExA(from, to, MOVEFILE_REPLACE_EXISTING |
+		MOVEFILE_WRITE_THROUGH) != 0;
+#else
+	return rename(from, to) == 0;
+#endif
+}
+
+static bool journal_load(emu_state *restrict state, save_state *restrict save)
+{
+	FILE *f;
+
+	// A leftover temporary means we died mid-flush; the old save is intact
+	remove(save->tmp_path);
+
+	if((f = fopen(save->path, "rb")) == NULL)
+	{
+		if(errno == ENOENT)
+		{
+			// New save, start from blank RAM
+			return true;
+		}
+
+		error(state, "Could not open save file %s: %s", save->path,
+			strerror(errno));
+		return false;
+	}
+
+	if(fread(save->data, 1, save->size, f) < save->size && ferror(f))
+	{
+		error(state, "Could not read save file %s: %s", save->path,
+			strerror(errno));
+		fclose(f);
+		return false;
+	}
+
+	fclose(f);
+	return true;
+}
+
+static bool journal_flush(emu_state *restrict state, save_state *restrict save)
+{
+	FILE *f;
+
+	if((f = fopen(save->tmp_path, "wb")) == NULL)
+	{
+		error(state, "Could not open save journal %s: %s",
+			save->tmp_path, strerror(errno));
+		return false;
+	}
+
+	if(fwrite(save->data, 1, save->size, f) < save->size ||
+		!journal_sync_file(f))
+	{
+		error(state, "Could not write save journal %s: %s",
+			save->tmp_path, strerror(errno));
+		fclose(f);
+		remove(save->tmp_path);
+		return false;
+	}
+
+	fclose(f);
+
+	if(!journal_replace(save->tmp_path, save->path))
+	{
+		error(state, "Could not replace save file %s: %s",
+			save->path, strerror(errno));
+		remove(save->tmp_path);
+		return false;
+	}
+
+	journal_sync_dir(save->path);
+	return true;
+}
+
+static void mmap_flush(emu_state *restrict state, save_state *restrict save)
+{
+	size_t page = 0;
+
+	// Coalesce runs of dirty pages into one sync each
+	while(page < save->pages)
+	{
+		size_t start;
+
+		if(!page_dirty(save, page))
+		{
+			page++;
+			continue;
+		}
+
+		start = page;
+		while(page < save->pages && page_dirty(save, page))
+		{
+			page++;
+		}
+
+		memmap_sync_range(state, save->data, start * SAVE_PAGE_SIZE,
+			(page - start) * SAVE_PAGE_SIZE, &(save->mm));
+	}
+}
+
+/*!
+ * @brief Open the cart RAM backing store
+ * @param state the emulator state (save_path and options already set)
+ * @param size size of cart RAM, including any trailing RTC data
+ * @returns pointer to cart RAM, or NULL on failure
+ */
+uint8_t * save_open(emu_state *restrict state, size_t size)
+{
+	save_state *save = &(state->save);
+
+	save->path = state->save_path;
+	save->mode = state->opts.save_mode;
+	save->size = size;
+	save->pages = (size + SAVE_PAGE_SIZE - 1) / SAVE_PAGE_SIZE;
+	save->interval = (uint_fast64_t)(state->opts.save_interval ?
+		state->opts.save_interval : SAVE_DEFAULT_INTERVAL) *
+		CLOCKS_PER_FRAME;
+	save->dirty = false;
+
+	if((save->dirty_map = (uint8_t *)calloc((save->pages + 7) / 8, 1)) == NULL)
+	{
+		error(state, "Could not allocate save dirty map");
+		return NULL;
+	}
+
+	if(save->path == NULL || save->mode == SAVE_MODE_MMAP)
+	{
+		// No path gives an anonymous mapping, which never needs flushing
+		save->data = (uint8_t *)memmap_open(state, save->path, size,
+			&(save->mm));
+	}
+	else
+	{
+		size_t len = strlen(save->path);
+
+		save->tmp_path = (char *)malloc(len + 5);
+		save->data = (uint8_t *)calloc(size, 1);
+		if(save->tmp_path == NULL || save->data == NULL)
+		{
+			error(state, "Could not allocate save journal");
+			goto fail;
+		}
+
+		memcpy(save->tmp_path, save->path, len);
+		memcpy(save->tmp_path + len, ".tmp", 5);
+
+		if(!journal_load(state, save))
+		{
+			goto fail;
+		}
+	}
+
+	if(save->data == NULL)
+	{
+		goto fail;
+	}
+
+	return save->data;
+
+fail:
+	free(save->tmp_path);
+	save->tmp_path = NULL;
+	if(save->mode == SAVE_MODE_JOURNAL)
+	{
+		free(save->data);
+	}
+	save->data = NULL;
+	free(save->dirty_map);
+	save->dirty_map = NULL;
+	return NULL;
+}
+
+void save_mark_range(emu_state *restrict state, size_t offset, size_t len)
+{
+	save_state *save = &(state->save);
+	size_t page, last;
+
+	if(unlikely(len == 0 || save->dirty_map == NULL))
+	{
+		return;
+	}
+
+	last = (offset + len - 1) / SAVE_PAGE_SIZE;
+	for(page = offset / SAVE_PAGE_SIZE; page <= last && page < save->pages; page++)
+	{
+		save->dirty_map[page >> 3] |= 1 << (page & 7);
+	}
+
+	if(!save->dirty)
+	{
+		// First write since the last flush starts the clock
+		save->dirty = true;
+		save->flush_at = state->cycles + save->interval;
+	}
+}
+
+/*!
+ * @brief Write back all dirty cart RAM now
+ */
+void save_flush(emu_state *restrict state)
+{
+	save_state *save = &(state->save);
+
+	if(!save->dirty)
+	{
+		return;
+	}
+
+	if(save->path != NULL)
+	{
+		if(save->mode == SAVE_MODE_JOURNAL)
+		{
+			if(!journal_flush(state, save))
+			{
+				// Keep the bitmap and try again next interval
+				save->flush_at = state->cycles + save->interval;
+				return;
+			}
+		}
+		else
+		{
+			mmap_flush(state, save);
+		}
+
+		save->flushes++;
+	}
+
+	memset(save->dirty_map, 0, (save->pages + 7) / 8);
+	save->dirty = false;
+}
+
+void save_frame(emu_state *restrict state)
+{
+	if(unlikely(state->save.dirty) && state->cycles >= state->save.flush_at)
+	{
+		save_flush(state);
+	}
+}
+
+/*!
+ * @brief Flush and release the cart RAM backing store
+ */
+void save_close(emu_state *restrict state)
+{
+	save_state *save = &(state->save);
+
+	if(save->data == NULL)
+	{
+		return;
+	}
+
+	save_flush(state);
+
+	if(state->cow.block[COW_CART] != NULL)
+	{
+		// A clone's cart RAM is a shared page; cow_release drops it
+	}
+	else if(save->path == NULL || save->mode == SAVE_MODE_MMAP)
+	{
+		memmap_close(state, save->data, &(save->mm));
+	}
+	else
+	{
+		free(save->data);
+	}
+
+	debug(state, "Cart RAM written back %u times", save->flushes);
+
+	free(save->tmp_path);
+	free(save->dirty_map);
+	save->tmp_path = NULL;
+	save->dirty_map = NULL;
+	save->data = NULL;
+}
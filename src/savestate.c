@@ -0,0 +1,597 @@
+#include "config.h"	// bool, uint[XX]_t
+
+#include "sgherm.h"	// emu_state
+#include "savestate.h"	// SAVESTATE_*
+#include "save.h"	// save_mark_range
+#include "cow.h"	// cow_unshare_all
+#include "print.h"	// error
+
+#include <string.h>	// memcpy, memcmp
+
+
+/*
+ * Layout is a fixed header followed by every field in the order the visit
+ * functions below touch them.  All integers are little endian; byte arrays
+ * are copied as-is.  The same visit functions do sizing, saving and
+ * loading, so the three can't drift apart.
+ *
+ * Host-side things are deliberately left out: pointers (cart_data, the MBC
+ * and frontend function tables, cart RAM mapping), wall-clock timestamps,
+ * the audio output rate and resampler, and debug flags.
+ *
+ * state_hash folds the same body into a hash instead of a buffer, so two
+ * instances hash equal exactly when their snapshots would match, screen
+ * aside: whether a frame was drawn (run-ahead skips it) isn't emulation.
+ */
+
+//! Bytes before the body: magic, version, ROM identity, cart RAM size
+#define HEADER_SIZE (4 + 2 + 2 + 4 + 1 + 2 + 16 + 1 + 4)
+
+//! Where visit_cpu puts in_bootrom (after six registers and interrupts)
+#define IN_BOOTROM_OFFSET (HEADER_SIZE + 6 * 2 + 5)
+
+typedef enum
+{
+	IO_SIZE,
+	IO_SAVE,
+	IO_LOAD,
+	IO_HASH,
+} io_dir;
+
+typedef struct
+{
+	io_dir dir;
+	uint8_t *buf;
+	size_t pos;
+	uint64_t hash;		//! Running hash for IO_HASH
+} cursor;
+
+#define HASH_BASIS 0xCBF29CE484222325ULL
+#define HASH_PRIME 0x100000001B3ULL
+
+static inline uint64_t load_le64(const uint8_t *p)
+{
+	return (uint64_t)p[0] | ((uint64_t)p[1] << 8) |
+		((uint64_t)p[2] << 16) | ((uint64_t)p[3] << 24) |
+		((uint64_t)p[4] << 32) | ((uint64_t)p[5] << 40) |
+		((uint64_t)p[6] << 48) | ((uint64_t)p[7] << 56);
+}
+
+/*!
+ * @brief FNV-1a style, over 32 byte blocks where possible
+ * @note Snapshots are mostly RAM and pixels.  The four words of a block
+ * are multiplied independently so only one multiply per block is on the
+ * dependency chain; block boundaries only depend on len, so callers that
+ * split a buffer at multiples of 32 get the same hash.
+ */
+static void hash_bytes(cursor *restrict c, const uint8_t *p, size_t len)
+{
+	uint64_t h = c->hash;
+	size_t i;
+
+	for(i = 0; i + 32 <= len; i += 32)
+	{
+		uint64_t m = (load_le64(p + i) * 0x9E3779B97F4A7C15ULL) ^
+			(load_le64(p + i + 8) * 0xC2B2AE3D27D4EB4FULL) ^
+			(load_le64(p + i + 16) * 0x165667B19E3779F9ULL) ^
+			(load_le64(p + i + 24) * 0x27D4EB2F165667C5ULL);
+
+		h = (h ^ m) * HASH_PRIME;
+		h ^= h >> 32;
+	}
+
+	for(; i < len; i++)
+	{
+		h = (h ^ p[i]) * HASH_PRIME;
+	}
+
+	c->hash = h;
+}
+
+static inline void io_u8(cursor *restrict c, uint8_t *v)
+{
+	if(c->dir == IO_SAVE)
+	{
+		c->buf[c->pos] = *v;
+	}
+	else if(c->dir == IO_LOAD)
+	{
+		*v = c->buf[c->pos];
+	}
+	else if(c->dir == IO_HASH)
+	{
+		hash_bytes(c, v, 1);
+	}
+
+	c->pos++;
+}
+
+static inline void io_u16(cursor *restrict c, uint16_t *v)
+{
+	if(c->dir == IO_SAVE)
+	{
+		c->buf[c->pos] = *v & 0xFF;
+		c->buf[c->pos+1] = *v >> 8;
+	}
+	else if(c->dir == IO_LOAD)
+	{
+		*v = c->buf[c->pos] | (uint16_t)(c->buf[c->pos+1] << 8);
+	}
+	else if(c->dir == IO_HASH)
+	{
+		uint8_t le[2] = { *v & 0xFF, *v >> 8 };
+
+		hash_bytes(c, le, 2);
+	}
+
+	c->pos += 2;
+}
+
+static inline void io_u32(cursor *restrict c, uint32_t *v)
+{
+	uint16_t lo = *v & 0xFFFF, hi = *v >> 16;
+
+	io_u16(c, &lo);
+	io_u16(c, &hi);
+	*v = lo | ((uint32_t)hi << 16);
+}
+
+static inline void io_u64(cursor *restrict c, uint64_t *v)
+{
+	uint32_t lo = *v & 0xFFFFFFFF, hi = *v >> 32;
+
+	io_u32(c, &lo);
+	io_u32(c, &hi);
+	*v = lo | ((uint64_t)hi << 32);
+}
+
+static inline void io_bytes(cursor *restrict c, void *v, size_t len)
+{
+	if(c->dir == IO_SAVE)
+	{
+		memcpy(c->buf + c->pos, v, len);
+	}
+	else if(c->dir == IO_LOAD)
+	{
+		memcpy(v, c->buf + c->pos, len);
+	}
+	else if(c->dir == IO_HASH)
+	{
+		hash_bytes(c, (const uint8_t *)v, len);
+	}
+
+	c->pos += len;
+}
+
+static inline void io_u32_array(cursor *restrict c, uint32_t *v, size_t count)
+{
+#ifdef LITTLE_ENDIAN
+	// Already in the right order, and this is most of the snapshot
+	io_bytes(c, v, count * sizeof(uint32_t));
+#else
+	size_t i;
+
+	if(c->dir == IO_HASH)
+	{
+		// Hash the little endian bytes, in whole words like io_bytes
+		uint8_t le[256];
+		size_t n = 0;
+
+		for(i = 0; i < count; i++)
+		{
+			le[n++] = v[i] & 0xFF;
+			le[n++] = (v[i] >> 8) & 0xFF;
+			le[n++] = (v[i] >> 16) & 0xFF;
+			le[n++] = v[i] >> 24;
+
+			if(n == sizeof(le) || i + 1 == count)
+			{
+				hash_bytes(c, le, n);
+				n = 0;
+			}
+		}
+
+		c->pos += count * sizeof(uint32_t);
+		return;
+	}
+
+	for(i = 0; i < count; i++)
+	{
+		io_u32(c, &v[i]);
+	}
+#endif
+}
+
+// Field helpers: round-trip through a fixed-width temporary so fields of
+// any integer (or bool) type can be used
+#define IO8(c, f) do { uint8_t t_ = (uint8_t)(f); io_u8(c, &t_); (f) = t_; } while(0)
+#define IO16(c, f) do { uint16_t t_ = (uint16_t)(f); io_u16(c, &t_); (f) = t_; } while(0)
+#define IO32(c, f) do { uint32_t t_ = (uint32_t)(f); io_u32(c, &t_); (f) = t_; } while(0)
+#define IO64(c, f) do { uint64_t t_ = (uint64_t)(f); io_u64(c, &t_); (f) = t_; } while(0)
+
+static void visit_cpu(cursor *restrict c, emu_state *restrict state)
+{
+	IO16(c, state->registers.af);
+	IO16(c, state->registers.bc);
+	IO16(c, state->registers.de);
+	IO16(c, state->registers.hl);
+	IO16(c, state->registers.pc);
+	IO16(c, state->registers.sp);
+
+	IO8(c, state->interrupts.enable_ctr);
+	IO8(c, state->interrupts.enabled);
+	IO8(c, state->interrupts.mask);
+	IO8(c, state->interrupts.pending);
+	IO8(c, state->interrupts.irq);
+
+	IO8(c, state->in_bootrom);
+	IO8(c, state->halt);
+	IO8(c, state->stop);
+	IO8(c, state->key1);
+	IO32(c, state->dma_wait);
+	IO32(c, state->wait);
+	IO64(c, state->cycles);
+	IO64(c, state->frames);
+	IO8(c, state->system);
+	IO32(c, state->freq);
+	IO8(c, state->step_core);
+}
+
+static void visit_memory(cursor *restrict c, emu_state *restrict state)
+{
+	size_t i;
+
+	io_bytes(c, state->hram, sizeof(state->hram));
+	for(i = 0; i < 8; i++)
+	{
+		io_bytes(c, state->wram[i], 0x1000);
+	}
+
+	IO8(c, state->wram_bank);
+}
+
+static void visit_lcdc(cursor *restrict c, emu_state *restrict state)
+{
+	lcdc_state *lcdc = &(state->lcdc);
+
+	IO16(c, lcdc->curr_clk);
+	IO16(c, lcdc->next_clk);
+	IO8(c, lcdc->curr_m3_clks);
+	IO8(c, lcdc->curr_h_blk);
+	IO8(c, lcdc->initial);
+
+	IO8(c, lcdc->vram_bank);
+	io_bytes(c, lcdc->vram[0], 0x2000);
+	io_bytes(c, lcdc->vram[1], 0x2000);
+	io_bytes(c, lcdc->oam_ram, sizeof(lcdc->oam_ram));
+
+	IO8(c, lcdc->lcd_control);
+	IO8(c, lcdc->stat);
+
+	IO8(c, lcdc->bcpi);
+	io_bytes(c, lcdc->bcpd, sizeof(lcdc->bcpd));
+	io_u32_array(c, lcdc->bcpal, 32);
+	IO8(c, lcdc->ocpi);
+	io_bytes(c, lcdc->ocpd, sizeof(lcdc->ocpd));
+	io_u32_array(c, lcdc->ocpal, 32);
+	IO16(c, lcdc->hsrc);
+	IO16(c, lcdc->hdst);
+	IO8(c, lcdc->hlen);
+
+	IO8(c, lcdc->scroll_y);
+	IO8(c, lcdc->scroll_x);
+	IO8(c, lcdc->window_y);
+	IO8(c, lcdc->window_x);
+	IO8(c, lcdc->ly);
+	IO8(c, lcdc->lyc);
+	IO8(c, lcdc->lyc_checked);
+	IO8(c, lcdc->throt_trigger);
+
+	IO8(c, lcdc->bg_pal);
+	IO8(c, lcdc->obj_pal[0]);
+	IO8(c, lcdc->obj_pal[1]);
+
+	// The screen, so a restored state can be shown without running a frame
+	if(c->dir != IO_HASH)
+	{
+		io_u32_array(c, &(lcdc->out[0][0]), 144 * 160);
+	}
+}
+
+static void visit_timer_serial_input(cursor *restrict c, emu_state *restrict state)
+{
+	unsigned i;
+
+	IO8(c, state->timer.div);
+	IO8(c, state->timer.tima);
+	IO8(c, state->timer.rounds);
+	IO16(c, state->timer.ticks_per_tima);
+	IO8(c, state->timer.curr_clk);
+	IO8(c, state->timer.div_clk);
+	IO8(c, state->timer.enabled);
+
+	IO16(c, state->ser.curr_clk);
+	IO8(c, state->ser.out);
+	IO8(c, state->ser.cur_bit);
+	IO8(c, state->ser.enabled);
+	IO8(c, state->ser.use_internal);
+
+	IO8(c, state->input.col);
+	IO8(c, state->input.row);
+	for(i = 0; i < 8; i++)
+	{
+		IO32(c, state->input.pressed[i]);
+	}
+}
+
+static void visit_sound(cursor *restrict c, emu_state *restrict state)
+{
+	snd_state *snd = &(state->snd);
+
+	IO32(c, snd->per_env);
+	IO32(c, snd->freq_rem);
+
+	IO8(c, snd->ch1.enabled);
+	IO8(c, snd->ch1.initial);
+	IO8(c, snd->ch1.sweep_time);
+	IO8(c, snd->ch1.sweep_dec);
+	IO8(c, snd->ch1.sweep_shift);
+	IO8(c, snd->ch1.wave_duty);
+	IO8(c, snd->ch1.length);
+	IO8(c, snd->ch1.envelope_volume);
+	IO8(c, snd->ch1.envelope_amp);
+	IO8(c, snd->ch1.envelope_speed);
+	IO8(c, snd->ch1.counter);
+	IO16(c, snd->ch1.period);
+	IO8(c, snd->ch1.s01);
+	IO8(c, snd->ch1.s02);
+	IO16(c, snd->ch1.per_remain);
+	IO8(c, snd->ch1.outseq);
+
+	IO8(c, snd->ch2.enabled);
+	IO8(c, snd->ch2.initial);
+	IO8(c, snd->ch2.wave_duty);
+	IO8(c, snd->ch2.length);
+	IO8(c, snd->ch2.envelope_volume);
+	IO8(c, snd->ch2.envelope_amp);
+	IO8(c, snd->ch2.envelope_speed);
+	IO8(c, snd->ch2.counter);
+	IO16(c, snd->ch2.period);
+	IO8(c, snd->ch2.s01);
+	IO8(c, snd->ch2.s02);
+	IO16(c, snd->ch2.per_remain);
+	IO8(c, snd->ch2.outseq);
+
+	IO8(c, snd->ch3.enabled);
+	IO8(c, snd->ch3.initial);
+	IO8(c, snd->ch3.counter);
+	IO8(c, snd->ch3.length);
+	IO8(c, snd->ch3.volume);
+	IO16(c, snd->ch3.period);
+	io_bytes(c, snd->ch3.wave, sizeof(snd->ch3.wave));
+	IO8(c, snd->ch3.s01);
+	IO8(c, snd->ch3.s02);
+	IO16(c, snd->ch3.per_remain);
+	IO8(c, snd->ch3.outseq);
+
+	IO8(c, snd->ch4.enabled);
+	IO8(c, snd->ch4.initial);
+	IO8(c, snd->ch4.length);
+	IO8(c, snd->ch4.envelope_volume);
+	IO8(c, snd->ch4.envelope_amp);
+	IO8(c, snd->ch4.envelope_speed);
+	IO8(c, snd->ch4.period_exp);
+	IO8(c, snd->ch4.period_mul);
+	IO8(c, snd->ch4.is_short);
+	IO8(c, snd->ch4.counter);
+	IO8(c, snd->ch4.s01);
+	IO8(c, snd->ch4.s02);
+	IO32(c, snd->ch4.per_remain);
+	IO16(c, snd->ch4.lfsr);
+
+	IO8(c, snd->enabled);
+	IO8(c, snd->s01);
+	IO8(c, snd->s01_volume);
+	IO8(c, snd->s02);
+	IO8(c, snd->s02_volume);
+}
+
+static void visit_mbc(cursor *restrict c, emu_state *restrict state)
+{
+	mbc_state *mbc = &(state->mbc);
+	unsigned i;
+
+	IO32(c, mbc->ram_bank);
+	IO32(c, mbc->rom_bank);
+	IO8(c, mbc->rom_bank_upper);
+	IO8(c, mbc->rom_bank_lower);
+
+	// mbc_common aliases the first two bytes of mbc3, so this covers
+	// every mapper
+	IO8(c, mbc->mbc3.ram_rtc_enable);
+	IO8(c, mbc->mbc3.rtc_select);
+	for(i = 0; i < 2; i++)
+	{
+		IO8(c, mbc->mbc3.rtc[i].seconds);
+		IO8(c, mbc->mbc3.rtc[i].minutes);
+		IO8(c, mbc->mbc3.rtc[i].hours);
+		IO16(c, mbc->mbc3.rtc[i].days);
+		IO8(c, mbc->mbc3.rtc[i].halt);
+		IO8(c, mbc->mbc3.rtc[i].day_carry);
+	}
+	IO64(c, mbc->mbc3.unix_time_last);
+	IO64(c, mbc->mbc3.cycles_last);
+	IO8(c, mbc->mbc3.latched);
+
+	// Cart RAM, including the RTC block on MBC3
+	if(state->save.data)
+	{
+		io_bytes(c, state->save.data, state->save.size);
+	}
+}
+
+static void visit_all(cursor *restrict c, emu_state *restrict state)
+{
+	visit_cpu(c, state);
+	visit_memory(c, state);
+	visit_lcdc(c, state);
+	visit_timer_serial_input(c, state);
+	visit_sound(c, state);
+	visit_mbc(c, state);
+}
+
+//! Write or check the header; returns false on mismatch when loading
+static bool visit_header(cursor *restrict c, emu_state *restrict state)
+{
+	uint8_t magic[4], title[16], header_sum, cart;
+	uint16_t version = SAVESTATE_VERSION, reserved = 0, global_sum;
+	uint32_t cart_size = state->cart_size;
+	uint32_t ram_size = state->save.data ? state->save.size : 0;
+
+	memcpy(magic, SAVESTATE_MAGIC, 4);
+	memcpy(title, state->cart_data + 0x134, 16);
+	header_sum = state->cart_data[0x14D];
+	global_sum = (state->cart_data[0x14E] << 8) | state->cart_data[0x14F];
+	cart = state->mbc.cart;
+
+	if(c->dir != IO_LOAD)
+	{
+		io_bytes(c, magic, 4);
+		io_u16(c, &version);
+		io_u16(c, &reserved);
+		io_u32(c, &cart_size);
+		io_u8(c, &header_sum);
+		io_u16(c, &global_sum);
+		io_bytes(c, title, 16);
+		io_u8(c, &cart);
+		io_u32(c, &ram_size);
+		return true;
+	}
+	else
+	{
+		uint8_t f_magic[4], f_title[16], f_header_sum, f_cart;
+		uint16_t f_version, f_reserved, f_global_sum;
+		uint32_t f_cart_size, f_ram_size;
+
+		io_bytes(c, f_magic, 4);
+		if(memcmp(f_magic, magic, 4) != 0)
+		{
+			error(state, "Not a save state");
+			return false;
+		}
+
+		io_u16(c, &f_version);
+		if(f_version != version)
+		{
+			error(state, "Save state version %u, expected %u",
+				f_version, version);
+			return false;
+		}
+
+		io_u16(c, &f_reserved);
+		io_u32(c, &f_cart_size);
+		io_u8(c, &f_header_sum);
+		io_u16(c, &f_global_sum);
+		io_bytes(c, f_title, 16);
+		io_u8(c, &f_cart);
+		io_u32(c, &f_ram_size);
+
+		if(f_cart_size != cart_size || f_header_sum != header_sum ||
+			f_global_sum != global_sum || f_cart != cart ||
+			memcmp(f_title, title, 16) != 0)
+		{
+			error(state, "Save state is for a different ROM");
+			return false;
+		}
+
+		if(f_ram_size != ram_size)
+		{
+			error(state, "Save state cart RAM size %u, expected %u",
+				f_ram_size, ram_size);
+			return false;
+		}
+
+		return true;
+	}
+}
+
+size_t state_size(emu_state *restrict state)
+{
+	cursor c = { IO_SIZE, NULL, 0, 0 };
+
+	visit_header(&c, state);
+	visit_all(&c, state);
+
+	return c.pos;
+}
+
+size_t state_save(emu_state *restrict state, void *restrict buf, size_t len)
+{
+	cursor c = { IO_SAVE, (uint8_t *)buf, 0, 0 };
+
+	if(len < state_size(state))
+	{
+		return 0;
+	}
+
+	visit_header(&c, state);
+	visit_all(&c, state);
+
+	return c.pos;
+}
+
+bool state_load(emu_state *restrict state, const void *restrict buf, size_t len)
+{
+	// Loading only ever reads through buf
+	cursor c = { IO_LOAD, (uint8_t *)buf, 0, 0 };
+
+	if(len < HEADER_SIZE)
+	{
+		error(state, "Save state is truncated");
+		return false;
+	}
+
+	if(!visit_header(&c, state))
+	{
+		return false;
+	}
+
+	// Body size is fixed once the ROM and RAM size match
+	if(len != state_size(state))
+	{
+		error(state, "Save state is %lu bytes, expected %lu",
+			(unsigned long)len, (unsigned long)state_size(state));
+		return false;
+	}
+
+	if(state->bootrom_data == NULL && c.buf[IN_BOOTROM_OFFSET] != 0)
+	{
+		error(state, "Save state was taken in the boot ROM, which isn't loaded");
+		return false;
+	}
+
+	// Every page is about to be overwritten
+	if(!cow_unshare_all(state))
+	{
+		return false;
+	}
+
+	visit_all(&c, state);
+
+	// Whatever the cart RAM held before is gone; write the new image back
+	if(state->save.data)
+	{
+		save_mark_range(state, 0, state->save.size);
+	}
+
+	return true;
+}
+
+uint64_t state_hash(emu_state *restrict state)
+{
+	cursor c = { IO_HASH, NULL, 0, HASH_BASIS };
+
+	visit_all(&c, state);
+
+	return c.hash;
+}
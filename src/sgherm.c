@@ -3,13 +3,24 @@
 #include "sgherm.h"	// emu_state, constants
 #include "ctl_unit.h"	// init_ctl, execute
 #include "lcdc.h"	// lcdc_tick
-#include "sound.h"	// sound_tick
+#include "sound.h"	// sound_tick, sound_render_chunk, sound_finish
 #include "timer.h"	// timer_tick
 #include "serio.h"	// serial_tick
 #include "debug.h"	// print_cycles
 #include "print.h"	// fatal, error, debug
 #include "util_time.h"	// get_time
 #include "mbc.h"	// MBC_FINISH
+#include "save.h"	// save_frame
+#include "rom.h"	// rom_image_ref, rom_image_unref
+#include "cow.h"	// cow_*
+#include "movie.h"	// movie_*
+#include "frontend.h"	// select_frontend_all, NULL_*
+#include "perf.h"	// perf_*, PERF_TIME
+#include "profile.h"	// profile_*
+#include "trace.h"	// trace_*
+#include "tracepoint.h"	// tracepoint_*
+#include "history.h"	// history_running
+#include "metrics.h"	// metrics_*
 
 #include <stdio.h>	// file methods
 #include <stdlib.h>	// exit
@@ -19,36 +30,102 @@
 
 
 #define NSEC_PER_SECOND 1000000000L
-#define NSEC_PER_VBLANK NSEC_PER_SECOND / 60
+#define NSEC_PER_VBLANK (NSEC_PER_SECOND / 60)
 
 
-emu_state * init_emulator(const char *bootrom_path, const char *rom_path, const char *save_path)
+//! splitmix64; only has to be fixed, not good
+static uint64_t seed_next(uint64_t *restrict seed)
+{
+	uint64_t z = (*seed += 0x9E3779B97F4A7C15ULL);
+
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+	return z ^ (z >> 31);
+}
+
+static void seed_fill(uint64_t *restrict seed, uint8_t *buf, size_t len)
+{
+	size_t i;
+
+	for(i = 0; i < len; i++)
+	{
+		buf[i] = (uint8_t)seed_next(seed);
+	}
+}
+
+void seed_memory(emu_state *restrict state)
+{
+	uint64_t seed = state->opts.seed;
+	size_t i;
+
+	for(i = 0; i < 8; i++)
+	{
+		seed_fill(&seed, state->wram[i], 0x1000);
+	}
+
+	seed_fill(&seed, state->hram, sizeof(state->hram));
+	seed_fill(&seed, state->lcdc.oam_ram, sizeof(state->lcdc.oam_ram));
+
+	if(state->in_bootrom)
+	{
+		seed_fill(&seed, state->lcdc.vram[0], 0x2000);
+		seed_fill(&seed, state->lcdc.vram[1], 0x2000);
+	}
+}
+
+emu_state * init_emulator(const char *bootrom_path, const char *rom_path,
+	const char *save_path, const emu_options *opts)
 {
 	emu_state *state = (emu_state *)calloc(1, sizeof(emu_state));
 	cart_header *header;
 
-	if(!rom_path)
+	if(opts)
+	{
+		state->opts = *opts;
+	}
+
+	if(state->opts.movie_mode != MOVIE_NONE)
+	{
+		// A movie is worthless if replaying it can diverge
+		state->opts.deterministic = true;
+	}
+
+	if(state->opts.deterministic)
+	{
+		// The host clock would make every run different
+		state->opts.rtc_mode = RTC_MODE_EMULATED;
+	}
+
+	if(!rom_path && !state->opts.rom)
 	{
 		error(state, "Unspecified ROM path!");
+		free(state);
 		return NULL;
 	}
 
-	if(save_path && strcmp(rom_path, save_path) == 0)
+	if(save_path && rom_path && strcmp(rom_path, save_path) == 0)
 	{
 		error(state, "Save path can't be the same as ROM path (ignoring)");
 		save_path = NULL;
 	}
 
 	if(bootrom_path && ((save_path && strcmp(bootrom_path, save_path) == 0) ||
-		strcmp(bootrom_path, rom_path) == 0))
+		(rom_path && strcmp(bootrom_path, rom_path) == 0)))
 	{
 		warning(state, "Boot ROM path cannot be same as ROM path or save path (ignoring)");
 		bootrom_path = NULL;
 	}
 
+	if(!cow_init(state))
+	{
+		free(state);
+		return NULL;
+	}
+
 	state->save_path = save_path ? strdup(save_path) : NULL;
 
 	state->interrupts.enabled = true;
+	state->wram_bank = 1;
 	state->wait = 1;
 	state->freq = CPU_FREQ_DMG;
 	state->step_core = 1;
@@ -56,6 +133,8 @@ emu_state * init_emulator(const char *bootrom_path, const char *rom_path, const
 	if(unlikely(!read_rom_data(state, rom_path, &header)))
 	{
 		error(state, "Can't read ROM data (ROM is corrupt)?");
+		cow_release(state);
+		free((void *)state->save_path);
 		free(state);
 		return NULL;
 	}
@@ -76,33 +155,208 @@ emu_state * init_emulator(const char *bootrom_path, const char *rom_path, const
 	init_ctl(state);
 	init_lcdc(state);
 
+	if(state->opts.deterministic)
+	{
+		seed_memory(state);
+	}
+
 	// Start the clock
+	perf_init(state);
 	state->start_time = get_time();
 	state->next_vblank_time = state->start_time + NSEC_PER_VBLANK;
+	state->speed = 1;
+
+	if(((state->opts.profile_path || state->opts.profile_stacks_path) &&
+		!profile_start(state)) ||
+		(state->opts.trace_path &&
+		!trace_start(state, state->opts.trace_records)) ||
+		(state->opts.events_path &&
+		!tracepoint_start(state, state->opts.events_records)) ||
+		(state->opts.movie_mode == MOVIE_RECORD &&
+		!movie_record(state, state->opts.movie_path)) ||
+		(state->opts.movie_mode == MOVIE_PLAY &&
+		!movie_play(state, state->opts.movie_path)))
+	{
+		finish_emulator(state);
+		return NULL;
+	}
+
+	if(state->opts.metrics)
+	{
+		metrics_start(state);
+	}
 
 	return state;
 }
 
 void finish_emulator(emu_state *restrict state)
 {
+	movie_stop(state);
+	profile_stop(state);
+	trace_stop(state);
+	tracepoint_stop(state);
+
+	perf_dump(state);
+	perf_finish(state);
 	print_cycles(state);
 
 	MBC_FINISH(state);
 
-	free(state->cart_data);
+	// After the last write-back, so the block counts it
+	metrics_stop(state);
+
+	sound_finish(state);
+
+	cow_release(state);
+
+	free(state->bootrom_data);
+
+	rom_image_unref(state, state->rom);
 	if(state->save_path != NULL)
 	{
 		free((void *)state->save_path);
 	}
+
+	if(history_running == state)
+	{
+		history_running = NULL;
+	}
+
+	log_finish(state, true);
 	free(state);
 }
 
+/*!
+ * @brief Make an independent copy of an instance
+ * @param state the instance to copy; it keeps running unchanged
+ * @returns the clone, or NULL on failure
+ * @note Work RAM, VRAM, the screen and cart RAM are shared page by page and
+ * copied on first write, so a clone costs little more than the state
+ * structure.  Clones have the null frontend and no save file.
+ */
+emu_state * emu_clone(emu_state *restrict state)
+{
+	emu_state *clone = (emu_state *)malloc(sizeof(emu_state));
+
+	if(clone == NULL)
+	{
+		error(state, "Could not allocate a clone");
+		return NULL;
+	}
+
+	memcpy(clone, state, sizeof(emu_state));
+
+	// Its messages get a queue of their own on the first one
+	clone->log = NULL;
+
+	// Nothing the clone does reaches the original's save file
+	clone->save_path = NULL;
+	clone->save.path = NULL;
+	clone->save.tmp_path = NULL;
+	clone->save.dirty_map = NULL;
+	clone->save.pages = 0;
+	clone->save.dirty = false;
+	clone->save.mm = NULL;
+	clone->save.flushes = 0;
+
+	clone->bootrom_data = NULL;
+	if(state->bootrom_data != NULL)
+	{
+		if((clone->bootrom_data = (uint8_t *)malloc(state->bootrom_size)) == NULL)
+		{
+			error(state, "Could not copy the boot ROM for a clone");
+			free(clone);
+			return NULL;
+		}
+
+		memcpy(clone->bootrom_data, state->bootrom_data, state->bootrom_size);
+	}
+
+	if(!cow_share(state, clone))
+	{
+		free(clone->bootrom_data);
+		free(clone);
+		return NULL;
+	}
+
+	clone->rom = rom_image_ref(state->rom);
+
+	// Output state is per frontend and rebuilt on demand
+	clone->snd.rs = NULL;
+	clone->snd.native_buf = NULL;
+	clone->snd.native_len = 0;
+	clone->snd.freq = 0;
+	clone->snd.ring = NULL;
+	clone->snd.ring_len = 0;
+	clone->snd.ring_head = clone->snd.ring_tail = 0;
+
+	// The original has announced the null stubs already, if it uses them
+	memset(&(clone->front), 0, sizeof(clone->front));
+	clone->front.null_noticed = ~0U;
+	select_frontend_all(clone, NULL_AUDIO, NULL_VIDEO, NULL_LOOP);
+
+	clone->quit = false;
+	clone->movie = NULL;
+	clone->debug.profile = NULL;
+	clone->debug.trace = NULL;
+	clone->debug.tracepoints = NULL;
+	clone->metrics = NULL;
+	perf_init(clone);
+
+	return clone;
+}
+
+/*!
+ * @brief Free a clone without reporting on it
+ * @note For throwaway clones like run-ahead's: no counters, cycle counts
+ * or log summary.  Anything the clone started beyond what emu_clone gives
+ * it needs finish_emulator instead.
+ */
+void emu_free_clone(emu_state *restrict clone)
+{
+	assert(clone->movie == NULL && clone->debug.profile == NULL &&
+		clone->debug.trace == NULL && clone->debug.tracepoints == NULL &&
+		clone->metrics == NULL);
+
+	perf_finish(clone);
+
+	// No MBC_FINISH: cart RAM is a shared page with no file behind it
+	sound_finish(clone);
+	cow_release(clone);
+
+	free(clone->bootrom_data);
+	rom_image_unref(clone, clone->rom);
+
+	if(history_running == clone)
+	{
+		history_running = NULL;
+	}
+
+	log_finish(clone, false);
+	free(clone);
+}
+
+/*!
+ * @brief Run the hardware for one step
+ * @returns false if the instance hit a fatal error; don't step it again
+ * @note Set history_running before a loop of these; run_frame does.
+ */
 bool step_emulator(emu_state *restrict state)
 {
 	// TODO: handle CGB speed better
 	int count_per_step = 1;
 	int count_per_step_core = state->step_core;
 
+	if(unlikely(state->movie != NULL))
+	{
+		movie_tick(state);
+		if(state->quit)
+		{
+			// Stop on the exact cycle the recording did
+			return true;
+		}
+	}
+
 	// The overhead of calling execute is enough where this is worthwhile
 	if(state->wait)
 	{
@@ -115,12 +369,12 @@ bool step_emulator(emu_state *restrict state)
 	}
 	else
 	{
-		execute(state, count_per_step_core);
+		PERF_TIME(state, PERF_CPU, execute(state, count_per_step_core));
 	}
 
 	if(likely(LCDC_ENABLE(state)) && !unlikely(state->stop))
 	{
-		lcdc_tick(state, count_per_step);
+		PERF_TIME(state, PERF_LCDC, lcdc_tick(state, count_per_step));
 	}
 
 	if(unlikely(state->ser.enabled))
@@ -128,21 +382,26 @@ bool step_emulator(emu_state *restrict state)
 		serial_tick(state, count_per_step_core);
 	}
 
-	timer_tick(state, count_per_step_core);
+	PERF_TIME(state, PERF_TIMER, timer_tick(state, count_per_step_core));
 
 	if(likely(state->snd.enabled))
 	{
-		sound_tick(state, count_per_step);
+		PERF_TIME(state, PERF_SOUND, sound_tick(state, count_per_step));
 	}
 
 	state->cycles += count_per_step_core;
 
-	if(unlikely(state->mbc.dirty && ++(state->mbc.dirty_timer) == state->freq))
+	if(unlikely(state->opts.deterministic) &&
+		(state->cycles & (SND_RENDER_CYCLES - 1)) < (unsigned)count_per_step_core)
 	{
-		// Do a write back
-		memmap_sync(state, state->mbc.cart_ram, &(state->mbc.cart_mm_data));
-		state->mbc.dirty = false;
-		state->mbc.dirty_timer = 0;
+		// Audio on a fixed cycle grid instead of the device's schedule
+		PERF_TIME(state, PERF_SOUND, sound_render_chunk(state));
+	}
+
+	if(unlikely(state->save.dirty) && !LCDC_ENABLE(state))
+	{
+		// No VBlank to hang the write-back on with the LCD off
+		save_frame(state);
 	}
 
 #ifdef THROTTLE_VBLANK
@@ -160,7 +419,8 @@ bool step_emulator(emu_state *restrict state)
 			sleep_nsec(wait);
 		}
 
-		state->next_vblank_time += (int64_t)NSEC_PER_VBLANK;
+		state->next_vblank_time += (int64_t)(NSEC_PER_VBLANK /
+			(state->speed == SPEED_UNLIMITED ? 1 : state->speed));
 
 		// Ensure we don't throttle too much
 		if(state->next_vblank_time + (int64_t)(NSEC_PER_VBLANK*5) < t)
@@ -171,5 +431,74 @@ bool step_emulator(emu_state *restrict state)
 	}
 #endif //THROTTLE_VBLANK
 
+	return state->status == EMU_STATUS_OK;
+}
+
+/*!
+ * @brief Run until the next frame boundary (VBlank)
+ * @returns false if the instance hit a fatal error
+ * @note With the LCD off there is no VBlank, so this gives up after a
+ * frame's worth of clocks instead
+ */
+bool run_frame(emu_state *restrict state)
+{
+	const uint_fast64_t frame = state->frames;
+	unsigned clocks;
+
+	if(unlikely(state->status != EMU_STATUS_OK))
+	{
+		// A fatal error left this instance in an undefined state
+		return false;
+	}
+
+	// Whose history a crash on this thread should show
+	history_running = state;
+
+	for(clocks = 0; clocks < CLOCKS_PER_FRAME && state->frames == frame;
+		clocks++)
+	{
+		if(unlikely(!step_emulator(state)))
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+void emu_set_speed(emu_state *restrict state, unsigned speed)
+{
+	state->speed = speed;
+
+	// Start pacing afresh rather than sprinting to catch up
+	state->next_vblank_time = get_time() +
+		NSEC_PER_VBLANK / (speed == SPEED_UNLIMITED ? 1 : speed);
+	state->next_present_time = 0;
+}
+
+bool emu_present_due(emu_state *restrict state)
+{
+	uint64_t t;
+
+	if(unlikely(state->hidden))
+	{
+		return false;
+	}
+	else if(likely(state->speed == 1))
+	{
+		return true;
+	}
+	else if(state->speed != SPEED_UNLIMITED)
+	{
+		return state->frames % state->speed == 0;
+	}
+
+	// No frame count to go by; don't outrun the host's refresh
+	if((t = get_time()) < state->next_present_time)
+	{
+		return false;
+	}
+
+	state->next_present_time = t + NSEC_PER_VBLANK;
 	return true;
 }
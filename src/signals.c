@@ -1,25 +1,53 @@
 #include "config.h"	// macros
 
+#include "signals.h"	// exit_signal
 #include "print.h"	// error
 #include "debug.h"	// print_cycles
 #include "util.h"	// UNUSED
 #include "sgherm.h"	// emu_state
+#include "perf.h"	// perf_dump_requests
+#include "history.h"	// history_running, history_dump
 
 
-volatile bool do_exit = false;
+volatile sig_atomic_t exit_signal = 0;
 
 #ifdef HAVE_POSIX
 
-#include <signal.h>	// sigaction
+#include <signal.h>	// sigaction, sigaltstack, raise
+#include <stdlib.h>	// malloc, free
+
+//! Stack for the crash handler, so a guest-driven stack overflow still reports
+static char crash_stack[65536];
 
 static void sig_handler(int signal UNUSED)
 {
-	do_exit = true;
+	exit_signal = 1;
+}
+
+static void crash_handler(int signal)
+{
+	emu_state *state = history_running;
+
+	if(state != NULL)
+	{
+		history_dump(state, log_file(state));
+	}
+
+	// SA_RESETHAND put the default action back; take it, core and all
+	raise(signal);
+}
+
+#ifdef PERF_COUNTERS
+static void perf_sig_handler(int signal UNUSED)
+{
+	perf_dump_requests++;
 }
+#endif
 
 void register_handlers(void)
 {
 	struct sigaction sa;
+	stack_t stack;
 
 	sigemptyset(&sa.sa_mask);
 	sa.sa_handler = &sig_handler;
@@ -42,6 +70,68 @@ void register_handlers(void)
 	{
 		error(NULL, "Could not initalise signal handlers, possibly no stats printing :(");
 	}
+
+	// Say what the guest was doing before going down
+	stack.ss_sp = crash_stack;
+	stack.ss_size = sizeof(crash_stack);
+	stack.ss_flags = 0;
+	sa.sa_handler = &crash_handler;
+	sa.sa_flags = SA_RESETHAND | (sigaltstack(&stack, NULL) == 0 ? SA_ONSTACK : 0);
+	if (sigaction(SIGSEGV, &sa, NULL) ||
+		sigaction(SIGBUS, &sa, NULL) ||
+		sigaction(SIGILL, &sa, NULL) ||
+		sigaction(SIGFPE, &sa, NULL) ||
+		sigaction(SIGABRT, &sa, NULL))
+	{
+		error(NULL, "Could not install the crash handlers, no history on crashes");
+	}
+	sa.sa_flags = 0;
+
+#ifdef PERF_COUNTERS
+	// kill -USR1 dumps the counters at the next VBlank
+	sa.sa_handler = &perf_sig_handler;
+	if (sigaction(SIGUSR1, &sa, NULL))
+	{
+		error(NULL, "Could not install the SIGUSR1 handler for counter dumps");
+	}
+#endif
+}
+
+void * register_thread_stack(void)
+{
+	stack_t stack;
+
+	// Alternate stacks are per thread; the handlers already ask for one
+	if((stack.ss_sp = malloc(sizeof(crash_stack))) == NULL)
+	{
+		return NULL;
+	}
+
+	stack.ss_size = sizeof(crash_stack);
+	stack.ss_flags = 0;
+	if(sigaltstack(&stack, NULL) != 0)
+	{
+		free(stack.ss_sp);
+		return NULL;
+	}
+
+	return stack.ss_sp;
+}
+
+void unregister_thread_stack(void *sp)
+{
+	stack_t stack;
+
+	if(sp == NULL)
+	{
+		return;
+	}
+
+	stack.ss_sp = NULL;
+	stack.ss_size = 0;
+	stack.ss_flags = SS_DISABLE;
+	sigaltstack(&stack, NULL);
+	free(sp);
 }
 
 #elif defined(_WIN32)
@@ -62,7 +152,7 @@ BOOL WINAPI ctrl_event_handler(DWORD type)
 	case CTRL_C_EVENT:
 	case CTRL_BREAK_EVENT:
 	default:
-		do_exit = true;
+		exit_signal = 1;
 		return TRUE;
 	case CTRL_CLOSE_EVENT:
 		// console window is closed
@@ -75,9 +165,28 @@ BOOL WINAPI ctrl_event_handler(DWORD type)
 	}
 }
 
+/*!
+ * @brief Report the guest's recent history on an unhandled exception.
+ * @result EXCEPTION_CONTINUE_SEARCH, so Windows still reports the crash.
+ */
+LONG WINAPI crash_filter(EXCEPTION_POINTERS *info)
+{
+	emu_state *state = history_running;
+
+	(void)info;
+
+	if(state != NULL)
+	{
+		history_dump(state, log_file(state));
+	}
+
+	return EXCEPTION_CONTINUE_SEARCH;
+}
+
 void register_handlers(void)
 {
 	SetConsoleCtrlHandler(ctrl_event_handler, TRUE);
+	SetUnhandledExceptionFilter(crash_filter);
 }
 
 #else // !HAVE_POSIX, !_WIN32
@@ -87,3 +196,15 @@ void register_handlers(void)
 }
 
 #endif // HAVE_POSIX
+
+#ifndef HAVE_POSIX
+void * register_thread_stack(void)
+{
+	// The exception filter runs on the faulting thread's own stack
+	return NULL;
+}
+
+void unregister_thread_stack(void *sp UNUSED)
+{
+}
+#endif // !HAVE_POSIX
@@ -1,11 +1,20 @@
-#include "config.h"	// Various macros, uint[XX]_t
+#include "config.h"	// Various macros, uint[XX]_t, ATOMIC_*
 
 #include "print.h"
 #include "sgherm.h"	// emu_state
+#include "resample.h"	// resampler_*
+
+#include <stdlib.h>	// malloc, realloc, free
+#include <string.h>	// memset
 
 const uint8_t au_pulses[4] = { 0x80, 0xC0, 0xF0, 0x3F, };
 
-void sound_fetch_s16ne(emu_state *restrict state, int16_t *restrict outbuf, size_t len_samples)
+/*!
+ * @brief Render the mixer output directly at the given rate
+ * @note this point-samples the channels; at SND_NATIVE_RATE the period
+ * increment is exact and the result is fed through the resampler
+ */
+static void sound_render(emu_state *restrict state, int16_t *restrict outbuf, size_t len_samples, int rate)
 {
 	size_t i;
 	uint16_t lfsr_tap;
@@ -33,9 +42,9 @@ void sound_fetch_s16ne(emu_state *restrict state, int16_t *restrict outbuf, size
 		int16_t vr = 0;
 
 		// Calculate period increment
-		// TODO: drop the divide, use shift instead - ARMv6 does div in software!
-		int32_t pinc = ((1<<(22-2)) + snd->freq_rem) / snd->freq;
-		snd->freq_rem = ((1<<(22-2)) + snd->freq_rem) % snd->freq;
+		// At SND_NATIVE_RATE this is a constant with no remainder
+		int32_t pinc = ((1<<(22-2)) + snd->freq_rem) / rate;
+		snd->freq_rem = ((1<<(22-2)) + snd->freq_rem) % rate;
 
 		// Update envelopes
 		snd->per_env += pinc;
@@ -160,6 +169,234 @@ void sound_fetch_s16ne(emu_state *restrict state, int16_t *restrict outbuf, size
 	}
 }
 
+bool sound_set_output(emu_state *restrict state, int freq, resample_quality quality, resample_latency latency)
+{
+	snd_state *snd = &state->snd;
+	resampler *rs = resampler_new(SND_NATIVE_RATE, freq, quality, latency);
+
+	if(rs == NULL)
+	{
+		error(state, "Could not create %d Hz resampler, falling back to point sampling", freq);
+		return false;
+	}
+
+	resampler_free(snd->rs);
+	snd->rs = rs;
+	snd->freq = freq;
+	snd->quality = quality;
+	snd->latency = latency;
+
+	debug(state, "Audio resampling %d Hz -> %d Hz (%s kernel, %u frame delay)",
+		SND_NATIVE_RATE, freq, resampler_kernel_name(rs), resampler_delay(rs));
+
+	return true;
+}
+
+//! Make room for at least frames native rate frames in native_buf
+static bool native_reserve(snd_state *restrict snd, size_t frames)
+{
+	int16_t *buf;
+
+	if(frames <= snd->native_len)
+	{
+		return true;
+	}
+
+	if((buf = (int16_t *)realloc(snd->native_buf, frames * 2 * sizeof(int16_t))) == NULL)
+	{
+		return false;
+	}
+
+	snd->native_buf = buf;
+	snd->native_len = frames;
+	return true;
+}
+
+//! Device side of the deterministic ring; never touches the mixer
+static void ring_read(snd_state *restrict snd, int16_t *restrict outbuf, size_t len_samples)
+{
+	const uint64_t head = ATOMIC_LOAD64(&(snd->ring_head));
+	const uint64_t tail = snd->ring_tail;
+	size_t avail = (size_t)(head - tail), at, first;
+
+	if(avail > len_samples)
+	{
+		avail = len_samples;
+	}
+
+	if(avail > 0)
+	{
+		at = (size_t)tail & (snd->ring_len - 1);
+		first = snd->ring_len - at;
+		if(first > avail)
+		{
+			first = avail;
+		}
+
+		memcpy(outbuf, snd->ring + at * 2, first * 2 * sizeof(int16_t));
+		memcpy(outbuf + first * 2, snd->ring, (avail - first) * 2 * sizeof(int16_t));
+
+		ATOMIC_STORE64(&(snd->ring_tail), tail + avail);
+	}
+
+	if(avail < len_samples)
+	{
+		memset(outbuf + avail * 2, 0, (len_samples - avail) * 2 * sizeof(int16_t));
+	}
+}
+
+void sound_render_chunk(emu_state *restrict state)
+{
+	snd_state *snd = &state->snd;
+	const size_t frames = SND_RENDER_CYCLES / (state->freq / SND_NATIVE_RATE);
+	uint64_t head, tail;
+	size_t space, at, want, got;
+
+	if(!native_reserve(snd, frames))
+	{
+		fatal(state, "Out of memory rendering audio");
+		return;
+	}
+
+	// The mixer advances whether or not anyone is listening
+	sound_render(state, snd->native_buf, frames, SND_NATIVE_RATE);
+
+	if(snd->freq == 0 || state->speed != 1)
+	{
+		// The ring is real time; fast-forward is silent
+		return;
+	}
+
+	if(snd->rs == NULL && !snd->rs_failed)
+	{
+		snd->rs_failed = !sound_set_output(state, snd->freq,
+			RESAMPLE_QUALITY_MEDIUM, RESAMPLE_LATENCY_MEDIUM);
+	}
+
+	if(snd->ring == NULL && snd->rs != NULL)
+	{
+		// About an eighth of a second of output
+		size_t len = 1;
+
+		while(len < (size_t)snd->freq / 8)
+		{
+			len <<= 1;
+		}
+
+		if((snd->ring = (int16_t *)malloc(len * 2 * sizeof(int16_t))) == NULL)
+		{
+			error(state, "Could not allocate the audio ring; muting");
+			resampler_free(snd->rs);
+			snd->rs = NULL;
+			snd->rs_failed = true;
+			return;
+		}
+
+		snd->ring_len = len;
+	}
+
+	if(snd->rs == NULL || !resampler_push_s16(snd->rs, snd->native_buf, frames))
+	{
+		return;
+	}
+
+	head = snd->ring_head;
+	tail = ATOMIC_LOAD64(&(snd->ring_tail));
+	space = snd->ring_len - (size_t)(head - tail);
+
+	while(space > 0)
+	{
+		at = (size_t)head & (snd->ring_len - 1);
+		want = snd->ring_len - at;
+		if(want > space)
+		{
+			want = space;
+		}
+
+		got = resampler_pull_s16(snd->rs, snd->ring + at * 2, want);
+		head += got;
+		space -= got;
+
+		if(got < want)
+		{
+			break;
+		}
+	}
+
+	ATOMIC_STORE64(&(snd->ring_head), head);
+
+	if(space == 0)
+	{
+		// The device is behind (or we're unthrottled); drop the rest
+		while(resampler_pull_s16(snd->rs, snd->native_buf, frames) == frames);
+	}
+}
+
+void sound_fetch_s16ne(emu_state *restrict state, int16_t *restrict outbuf, size_t len_samples)
+{
+	snd_state *snd = &state->snd;
+	size_t need, got;
+
+	if(state->opts.deterministic)
+	{
+		ring_read(snd, outbuf, len_samples);
+		return;
+	}
+
+	// Frontends that only set freq get the default filter on first use
+	if(snd->rs == NULL && !snd->rs_failed)
+	{
+		snd->rs_failed = !sound_set_output(state, snd->freq,
+			RESAMPLE_QUALITY_MEDIUM, RESAMPLE_LATENCY_MEDIUM);
+	}
+
+	if(snd->rs == NULL)
+	{
+		sound_render(state, outbuf, len_samples, snd->freq);
+		return;
+	}
+
+	need = resampler_input_needed(snd->rs, len_samples);
+	if(!native_reserve(snd, need))
+	{
+		memset(outbuf, 0, len_samples * 2 * sizeof(int16_t));
+		return;
+	}
+
+	if(need > 0)
+	{
+		sound_render(state, snd->native_buf, need, SND_NATIVE_RATE);
+		if(!resampler_push_s16(snd->rs, snd->native_buf, need))
+		{
+			memset(outbuf, 0, len_samples * 2 * sizeof(int16_t));
+			return;
+		}
+	}
+
+	got = resampler_pull_s16(snd->rs, outbuf, len_samples);
+	if(got < len_samples)
+	{
+		memset(outbuf + got * 2, 0, (len_samples - got) * 2 * sizeof(int16_t));
+	}
+}
+
+void sound_finish(emu_state *restrict state)
+{
+	snd_state *snd = &state->snd;
+
+	resampler_free(snd->rs);
+	snd->rs = NULL;
+
+	free(snd->native_buf);
+	snd->native_buf = NULL;
+	snd->native_len = 0;
+
+	free(snd->ring);
+	snd->ring = NULL;
+	snd->ring_len = 0;
+	snd->ring_head = snd->ring_tail = 0;
+}
+
 void sound_tick(emu_state *restrict state, int count UNUSED)
 {
 #ifdef DEFENSIVE
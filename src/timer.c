@@ -3,6 +3,7 @@
 #include "ctl_unit.h"	// signal_interrupt, INT_TIMER
 #include "print.h"	// error
 #include "sgherm.h"	// emu_state
+#include "tracepoint.h"	// TRACEPOINT
 
 
 void timer_tick(emu_state *restrict state, int count)
@@ -26,6 +27,7 @@ void timer_tick(emu_state *restrict state, int count)
 		{
 			if(++state->timer.tima == 0)	// overflow!
 			{
+				TRACEPOINT(state, TP_TIMER_OVERFLOW, state->timer.rounds, 0);
 				state->timer.rounds++;
 				signal_interrupt(state, INT_TIMER);
 			}
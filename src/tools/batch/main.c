@@ -0,0 +1,235 @@
+#include "config.h"	// bool, uint[XX]_t
+
+#include "sgherm.h"	// emu_state
+#include "batch.h"	// batch_*
+#include "input.h"	// joypad_set_mask
+#include "print.h"	// to_stdout, to_stderr
+#include "signals.h"	// register_handlers
+#include "util_time.h"	// get_time
+
+#include <stdio.h>	// fprintf, fopen
+#include <stdlib.h>	// strtoul, calloc, free
+#include <string.h>	// strcmp
+
+
+//! Frames each random joypad state is held for
+#define HOLD_FRAMES 8
+
+//! Most -r options accepted
+#define MAX_RAM_ADDRS 64
+
+typedef struct
+{
+	uint64_t *rng;		//! xorshift state per instance
+	uint32_t *frame;	//! Frames seen per instance
+	bool random_input;	//! Press random buttons
+} tool_ctx;
+
+static inline uint64_t xorshift64(uint64_t *s)
+{
+	uint64_t x = *s;
+
+	x ^= x << 13;
+	x ^= x >> 7;
+	x ^= x << 17;
+	return *s = x;
+}
+
+static bool frame_input(emu_state *restrict state, size_t index, void *user)
+{
+	tool_ctx *ctx = (tool_ctx *)user;
+
+	// Each instance has its own generator, so results don't depend on
+	// which thread ran what
+	if(ctx->random_input && ctx->frame[index]++ % HOLD_FRAMES == 0)
+	{
+		joypad_set_mask(state, (uint8_t)(xorshift64(&(ctx->rng[index])) >> 24));
+	}
+
+	return true;
+}
+
+static void usage(const char *name)
+{
+	fprintf(to_stderr, "Usage: %s [options] ROM\n"
+		"  -n COUNT   instances to run (default 64)\n"
+		"  -f FRAMES  frames to run each instance for (default 600)\n"
+		"  -t THREADS worker threads (default one per CPU)\n"
+		"  -s SEED    random input seed, 0 for no input (default 1)\n"
+		"  -r ADDR    sample this address (hex) into the results; repeatable\n"
+		"  -l FILE    write instance messages to FILE\n"
+		"  -m         publish live metrics for sgherm-top\n"
+		"Results are written to stdout as CSV, one row per instance.\n",
+		name);
+}
+
+int main(int argc, char *argv[])
+{
+	const char *rom = NULL, *log_path = NULL;
+	unsigned long count = 64, frames = 600, threads = 0, seed = 1;
+	bool metrics = false, ok;
+	uint16_t addrs[MAX_RAM_ADDRS];
+	size_t naddrs = 0, i, j;
+	batch_config config;
+	tool_ctx ctx;
+	batch *b;
+	const batch_results *res;
+	uint64_t start, elapsed;
+	int i_arg;
+
+	static const char *exit_names[] = { "ok", "callback", "fatal" };
+
+	to_stdout = stdout;
+	to_stderr = stderr;
+
+	register_handlers();
+
+	for(i_arg = 1; i_arg < argc; i_arg++)
+	{
+		const char *arg = argv[i_arg];
+
+		if(arg[0] != '-' || arg[1] == '\0')
+		{
+			rom = arg;
+			continue;
+		}
+		else if(arg[1] == 'm' && arg[2] == '\0')
+		{
+			metrics = true;
+			continue;
+		}
+
+		if(arg[2] != '\0' || i_arg + 1 >= argc)
+		{
+			usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+
+		switch(arg[1])
+		{
+		case 'n':
+			count = strtoul(argv[++i_arg], NULL, 0);
+			break;
+		case 'f':
+			frames = strtoul(argv[++i_arg], NULL, 0);
+			break;
+		case 't':
+			threads = strtoul(argv[++i_arg], NULL, 0);
+			break;
+		case 's':
+			seed = strtoul(argv[++i_arg], NULL, 0);
+			break;
+		case 'r':
+			if(naddrs == MAX_RAM_ADDRS)
+			{
+				fprintf(to_stderr, "At most %d addresses\n", MAX_RAM_ADDRS);
+				return EXIT_FAILURE;
+			}
+			addrs[naddrs++] = (uint16_t)strtoul(argv[++i_arg], NULL, 16);
+			break;
+		case 'l':
+			log_path = argv[++i_arg];
+			break;
+		default:
+			usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	if(rom == NULL || count == 0)
+	{
+		usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	memset(&config, 0, sizeof(config));
+	memset(&ctx, 0, sizeof(ctx));
+
+	if(log_path && (config.log = fopen(log_path, "w")) == NULL)
+	{
+		fprintf(to_stderr, "Could not open %s\n", log_path);
+		return EXIT_FAILURE;
+	}
+
+	ctx.random_input = (seed != 0);
+	ctx.rng = (uint64_t *)calloc(count, sizeof(uint64_t));
+	ctx.frame = (uint32_t *)calloc(count, sizeof(uint32_t));
+	if(ctx.rng == NULL || ctx.frame == NULL)
+	{
+		fprintf(to_stderr, "Out of memory\n");
+		return EXIT_FAILURE;
+	}
+
+	for(i = 0; i < count; i++)
+	{
+		// Never zero, or xorshift gets stuck
+		ctx.rng[i] = ((uint64_t)seed << 32) ^ (i * 0x9E3779B97F4A7C15ULL) ^ 1;
+	}
+
+	config.threads = (unsigned)threads;
+	config.frame = frame_input;
+	config.user = &ctx;
+	config.ram_addrs = addrs;
+	config.ram_count = naddrs;
+	config.metrics = metrics;
+
+	if((b = batch_new(rom, count, &config)) == NULL)
+	{
+		return EXIT_FAILURE;
+	}
+
+	start = get_time();
+	ok = batch_run(b, frames);
+	elapsed = get_time() - start;
+
+	res = batch_collect(b);
+
+	fprintf(to_stdout, "instance,exit,frames,fb_hash");
+	for(j = 0; j < naddrs; j++)
+	{
+		fprintf(to_stdout, ",ram_%04x", addrs[j]);
+	}
+	fprintf(to_stdout, "\n");
+
+	for(i = 0; i < res->count; i++)
+	{
+		fprintf(to_stdout, "%lu,%s,%llu,%016llx", (unsigned long)i,
+			exit_names[res->exit[i]],
+			(unsigned long long)res->frames[i],
+			(unsigned long long)res->fb_hash[i]);
+
+		for(j = 0; j < res->ram_count; j++)
+		{
+			fprintf(to_stdout, ",%u", res->ram[i * res->ram_count + j]);
+		}
+
+		fprintf(to_stdout, "\n");
+	}
+
+	{
+		uint64_t total = 0;
+
+		for(i = 0; i < res->count; i++)
+		{
+			total += res->frames[i];
+		}
+
+		fprintf(to_stderr, "%llu instance-frames on %u threads in %.3f s "
+			"(%.1f frames/s)\n", (unsigned long long)total,
+			batch_threads(b), elapsed / 1e9,
+			elapsed ? total * 1e9 / elapsed : 0.0);
+	}
+
+	batch_free(b);
+
+	if(config.log)
+	{
+		fclose(config.log);
+	}
+
+	free(ctx.rng);
+	free(ctx.frame);
+
+	// The results are still worth having; the exit status says they're short
+	return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,387 @@
+#include "config.h"	// bool, uint[XX]_t
+
+#include "sgherm.h"	// emu_state, init_emulator, run_frame
+#include "batch.h"	// batch_*
+#include "frontend.h"	// NULL_*
+#include "lcdc.h"	// lcdc_screen_hash
+#include "input.h"	// lag_state, LAG_SECOND_FRAMES
+#include "movie.h"	// movie_play
+#include "print.h"	// to_stdout, to_stderr
+#include "signals.h"	// register_handlers, exit_signal
+#include "util_time.h"	// get_time
+
+#include <stdio.h>	// fprintf, fopen
+#include <stdlib.h>	// strtoul, malloc, qsort, free
+#include <string.h>	// memset
+
+#ifdef HAVE_POSIX
+#	include <sys/resource.h>	// getrusage
+#endif
+
+
+//! Most -t threads accepted
+#define MAX_THREADS 256
+
+typedef struct
+{
+	unsigned threads;	//! Threads (and instances) used
+	double fps;		//! Instance-frames per second over all of them
+	bool consistent;	//! Every instance ended on the single run's screen
+} scale_result;
+
+
+static void usage(const char *name)
+{
+	fprintf(to_stderr, "Usage: %s [options] ROM\n"
+		"  -f FRAMES  frames to run (default 1800)\n"
+		"  -m MOVIE   play input from MOVIE (see -r in the frontends)\n"
+		"  -t THREADS also run THREADS copies on 1..THREADS threads\n"
+		"  -o FILE    write the JSON report to FILE instead of stdout\n"
+		"  -l FILE    write emulator messages to FILE\n"
+		"  -P POLLS   joypad reads a frame needs not to count as lag (default 1)\n"
+		"  -R LO:HI   only count joypad reads by code in LO..HI (hex)\n"
+		"Runs unthrottled and deterministic with the null frontend.\n",
+		name);
+}
+
+static int compare_u64(const void *a, const void *b)
+{
+	const uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return (x > y) - (x < y);
+}
+
+//! Nearest-rank quantile of sorted values
+static uint64_t quantile(const uint64_t *sorted, size_t n, double q)
+{
+	return n ? sorted[(size_t)((n - 1) * q + 0.5)] : 0;
+}
+
+//! Peak resident set in KiB, or -1 if the platform won't say
+static long peak_rss_kib(void)
+{
+#ifdef HAVE_POSIX
+	struct rusage usage;
+
+	if(getrusage(RUSAGE_SELF, &usage) == 0)
+	{
+#	ifdef __APPLE__
+		// Bytes here, KiB everywhere else
+		return (long)(usage.ru_maxrss / 1024);
+#	else
+		return (long)usage.ru_maxrss;
+#	endif
+	}
+#endif
+
+	return -1;
+}
+
+static void json_string(FILE *f, const char *s)
+{
+	if(s == NULL)
+	{
+		fputs("null", f);
+		return;
+	}
+
+	fputc('"', f);
+	for(; *s; s++)
+	{
+		if(*s == '"' || *s == '\\')
+		{
+			fprintf(f, "\\%c", *s);
+		}
+		else if((unsigned char)*s < 0x20)
+		{
+			fprintf(f, "\\u%04x", (unsigned char)*s);
+		}
+		else
+		{
+			fputc(*s, f);
+		}
+	}
+	fputc('"', f);
+}
+
+//! The same workload on threads threads, one instance each
+static bool run_scaled(const char *rom, const char *movie, unsigned threads,
+	unsigned long frames, FILE *log, uint64_t fb_hash, scale_result *out)
+{
+	const batch_results *res;
+	batch_config config;
+	uint64_t start, elapsed, total = 0;
+	batch *b;
+	size_t i;
+
+	memset(&config, 0, sizeof(config));
+	config.threads = threads;
+	config.log = log;
+
+	if((b = batch_new(rom, threads, &config)) == NULL)
+	{
+		return false;
+	}
+
+	for(i = 0; i < threads; i++)
+	{
+		if(movie && !movie_play(batch_instance(b, i), movie))
+		{
+			batch_free(b);
+			return false;
+		}
+	}
+
+	start = get_time();
+	// An instance that died or was stopped short didn't do the work
+	out->consistent = batch_run(b, frames);
+	elapsed = get_time() - start;
+
+	res = batch_collect(b);
+
+	out->threads = batch_threads(b);
+	for(i = 0; i < res->count; i++)
+	{
+		total += res->frames[i];
+		out->consistent = out->consistent && res->fb_hash[i] == fb_hash;
+	}
+
+	out->fps = elapsed ? total * 1e9 / elapsed : 0;
+
+	batch_free(b);
+	return true;
+}
+
+int main(int argc, char *argv[])
+{
+	const char *rom = NULL, *movie = NULL, *out_path = NULL, *log_path = NULL;
+	unsigned long frames = 1800, max_threads = 0, f, lag_polls = 0;
+	unsigned long lag_lo = 0, lag_hi = 0, lag_count = 0, lag_alloc;
+	scale_result scale[MAX_THREADS];
+	uint64_t *frame_ns, start, elapsed, cycles, fb_hash, vblanks, seconds = 0;
+	uint32_t *lag_per_second;
+	lag_state lag;
+	char *end;
+	FILE *out = stdout, *log = NULL;
+	emu_options opts;
+	emu_state *state;
+	unsigned t;
+	long rss;
+	int i_arg;
+
+	to_stdout = stdout;
+	to_stderr = stderr;
+
+	register_handlers();
+
+	for(i_arg = 1; i_arg < argc; i_arg++)
+	{
+		const char *arg = argv[i_arg];
+
+		if(arg[0] != '-' || arg[1] == '\0')
+		{
+			rom = arg;
+			continue;
+		}
+
+		if(arg[2] != '\0' || i_arg + 1 >= argc)
+		{
+			usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+
+		switch(arg[1])
+		{
+		case 'f':
+			frames = strtoul(argv[++i_arg], NULL, 0);
+			break;
+		case 'm':
+			movie = argv[++i_arg];
+			break;
+		case 't':
+			max_threads = strtoul(argv[++i_arg], NULL, 0);
+			break;
+		case 'o':
+			out_path = argv[++i_arg];
+			break;
+		case 'l':
+			log_path = argv[++i_arg];
+			break;
+		case 'P':
+			lag_polls = strtoul(argv[++i_arg], NULL, 0);
+			break;
+		case 'R':
+			lag_lo = strtoul(argv[++i_arg], &end, 16);
+			if(*end != ':' || (lag_hi = strtoul(end + 1, NULL, 16)) == 0)
+			{
+				usage(argv[0]);
+				return EXIT_FAILURE;
+			}
+			break;
+		default:
+			usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	if(rom == NULL || frames == 0 || max_threads > MAX_THREADS)
+	{
+		usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	if(log_path && (log = fopen(log_path, "w")) == NULL)
+	{
+		fprintf(to_stderr, "Could not open %s\n", log_path);
+		return EXIT_FAILURE;
+	}
+
+	// run_frame sees at most one VBlank, so at most this many lag seconds
+	lag_alloc = frames / LAG_SECOND_FRAMES + 1;
+	if((frame_ns = (uint64_t *)malloc(frames * sizeof(uint64_t))) == NULL ||
+		(lag_per_second = (uint32_t *)malloc(lag_alloc *
+		sizeof(uint32_t))) == NULL)
+	{
+		fprintf(to_stderr, "Out of memory\n");
+		return EXIT_FAILURE;
+	}
+
+	memset(&opts, 0, sizeof(opts));
+	opts.deterministic = true;
+	opts.unthrottled = true;
+	opts.log = log;
+	opts.movie_mode = movie ? MOVIE_PLAY : MOVIE_NONE;
+	opts.movie_path = movie;
+	opts.lag_min_polls = (unsigned)lag_polls;
+	opts.lag_pc_lo = (uint16_t)lag_lo;
+	opts.lag_pc_hi = (uint16_t)lag_hi;
+
+	if((state = init_emulator(NULL, rom, NULL, &opts)) == NULL)
+	{
+		return EXIT_FAILURE;
+	}
+
+	select_frontend_all(state, NULL_AUDIO, NULL_VIDEO, NULL_LOOP);
+
+	start = get_time();
+	for(f = 0; f < frames && !exit_signal; f++)
+	{
+		const uint64_t frame_start = get_time();
+
+		if(!run_frame(state))
+		{
+			fprintf(to_stderr, "Emulator failed on frame %lu\n", f);
+			finish_emulator(state);
+			return EXIT_FAILURE;
+		}
+
+		frame_ns[f] = get_time() - frame_start;
+
+		// With the LCD off run_frame returns without a VBlank, so look
+		// for a new second rather than at the frame count in it
+		if(state->input.lag.seconds != seconds)
+		{
+			seconds = state->input.lag.seconds;
+			if(lag_count < lag_alloc)
+			{
+				lag_per_second[lag_count++] = state->input.lag.last_second;
+			}
+		}
+	}
+	elapsed = get_time() - start;
+
+	// Before the scaling runs pile more instances on
+	rss = peak_rss_kib();
+
+	// frames is run_frame calls from here on; vblanks is what the game saw
+	frames = f;
+	vblanks = state->frames;
+	cycles = state->cycles;
+	fb_hash = lcdc_screen_hash(state);
+	lag = state->input.lag;
+	finish_emulator(state);
+
+	qsort(frame_ns, frames, sizeof(uint64_t), compare_u64);
+
+	for(t = 1; t <= max_threads && !exit_signal; t++)
+	{
+		if(!run_scaled(rom, movie, t, frames, log, fb_hash, &scale[t - 1]))
+		{
+			fprintf(to_stderr, "Scaling run on %u threads failed\n", t);
+			return EXIT_FAILURE;
+		}
+
+		fprintf(to_stderr, "%u threads: %.1f frames/s\n", t, scale[t - 1].fps);
+	}
+	max_threads = t - 1;
+
+	if(out_path && (out = fopen(out_path, "w")) == NULL)
+	{
+		fprintf(to_stderr, "Could not create %s\n", out_path);
+		return EXIT_FAILURE;
+	}
+
+	fprintf(out, "{\n\t\"rom\": ");
+	json_string(out, rom);
+	fprintf(out, ",\n\t\"movie\": ");
+	json_string(out, movie);
+	fprintf(out, ",\n\t\"frames\": %llu,\n", (unsigned long long)vblanks);
+	fprintf(out, "\t\"cycles\": %llu,\n", (unsigned long long)cycles);
+	fprintf(out, "\t\"seconds\": %.6f,\n", elapsed / 1e9);
+	fprintf(out, "\t\"cycles_per_second\": %.1f,\n",
+		elapsed ? cycles * 1e9 / elapsed : 0.0);
+	fprintf(out, "\t\"frames_per_second\": %.2f,\n",
+		elapsed ? vblanks * 1e9 / elapsed : 0.0);
+	fprintf(out, "\t\"frame_ns\": { \"p50\": %llu, \"p99\": %llu, \"max\": %llu },\n",
+		(unsigned long long)quantile(frame_ns, frames, 0.5),
+		(unsigned long long)quantile(frame_ns, frames, 0.99),
+		(unsigned long long)quantile(frame_ns, frames, 1.0));
+	if(rss < 0)
+	{
+		fprintf(out, "\t\"peak_rss_kib\": null,\n");
+	}
+	else
+	{
+		fprintf(out, "\t\"peak_rss_kib\": %ld,\n", rss);
+	}
+	fprintf(out, "\t\"fb_hash\": \"%016llx\",\n", (unsigned long long)fb_hash);
+
+	fprintf(out, "\t\"lag\": { \"frames\": %llu, \"seconds_with_lag\": %llu, "
+		"\"worst_second\": %u, \"per_second\": [",
+		(unsigned long long)lag.frames, (unsigned long long)lag.lag_seconds,
+		lag.worst_second);
+	for(f = 0; f < lag_count; f++)
+	{
+		fprintf(out, "%s%u", f ? ", " : "", lag_per_second[f]);
+	}
+	fprintf(out, "] },\n");
+
+	fprintf(out, "\t\"scaling\": [");
+	for(t = 0; t < max_threads; t++)
+	{
+		// Perfect scaling keeps per-thread throughput at one thread's
+		const double efficiency = scale[0].fps ?
+			scale[t].fps / (scale[t].threads * scale[0].fps) : 0;
+
+		fprintf(out, "%s\n\t\t{ \"threads\": %u, \"frames_per_second\": %.2f, "
+			"\"efficiency\": %.3f, \"consistent\": %s }", t ? "," : "",
+			scale[t].threads, scale[t].fps, efficiency,
+			scale[t].consistent ? "true" : "false");
+	}
+	fprintf(out, "%s]\n}\n", max_threads ? "\n\t" : "");
+
+	if(out != stdout)
+	{
+		fclose(out);
+	}
+
+	if(log)
+	{
+		fclose(log);
+	}
+
+	free(frame_ns);
+	free(lag_per_second);
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,368 @@
+#include "config.h"	// bool, uint[XX]_t
+
+#include "sgherm.h"	// emu_state, init_emulator, run_frame
+#include "ctl_unit.h"	// execute
+#include "frontend.h"	// NULL_*
+#include "lcdc.h"	// lcdc_tick
+#include "memory.h"	// mem_read8, mem_write8
+#include "sound.h"	// sound_set_output, sound_fetch_s16ne
+#include "print.h"	// to_stdout, to_stderr
+#include "signals.h"	// register_handlers, exit_signal
+#include "util_time.h"	// get_time
+
+#include <stdio.h>	// fprintf, fopen, snprintf
+#include <stdlib.h>	// strtoul, qsort
+#include <string.h>	// strncmp, memset
+
+#ifndef BENCH_ROM_DIR
+#	define BENCH_ROM_DIR "."
+#endif
+
+//! Addresses in each access pattern
+#define PATTERN_LEN 4096
+
+//! Frames per round of the LCDC benchmarks
+#define LCDC_FRAMES 20
+
+typedef struct
+{
+	const char *name;	//! What the command line selects
+	const char *rom;	//! Generated ROM to run on
+	const char *unit;	//! What one operation is
+	unsigned warm_frames;	//! Frames to run first, to set the scene up
+	uint64_t ops;		//! Operations per timed round
+	void (*run)(emu_state *restrict, uint64_t);
+} microbench;
+
+
+static uint16_t pattern_mixed[PATTERN_LEN];	//! ROM, WRAM and HRAM
+static uint16_t pattern_ram[PATTERN_LEN];	//! WRAM and HRAM
+static uint16_t pattern_io[PATTERN_LEN];	//! Registers that are cheap to poll
+
+//! Where results go so the compiler can't drop the reads
+static volatile uint8_t sink;
+
+static void make_patterns(void)
+{
+	static const uint16_t io_regs[] =
+	{
+		0xFF0F, 0xFF40, 0xFF41, 0xFF42, 0xFF43, 0xFF44, 0xFF47, 0xFFFF,
+	};
+	uint64_t x = 0x9E3779B97F4A7C15ULL;
+	size_t i;
+
+	for(i = 0; i < PATTERN_LEN; i++)
+	{
+		uint16_t r;
+
+		// xorshift, fixed seed: the same addresses every run
+		x ^= x << 13;
+		x ^= x >> 7;
+		x ^= x << 17;
+		r = (uint16_t)(x >> 32);
+
+		switch(i & 3)
+		{
+		case 0:
+			pattern_mixed[i] = r & 0x3FFF;
+			break;
+		case 1:
+			pattern_mixed[i] = 0x4000 | (r & 0x3FFF);
+			break;
+		case 2:
+			pattern_mixed[i] = 0xC000 | (r & 0x1FFF);
+			break;
+		default:
+			pattern_mixed[i] = 0xFF80 | (r % 0x7F);
+			break;
+		}
+
+		pattern_ram[i] = (i & 3) ? 0xC000 | (r & 0x1FFF) : 0xFF80 | (r % 0x7F);
+		pattern_io[i] = io_regs[r % (sizeof(io_regs) / sizeof(*io_regs))];
+	}
+}
+
+static void run_execute(emu_state *restrict state, uint64_t ops)
+{
+	// No LCDC, timer or sound: the CPU alone
+	execute(state, (int)ops);
+}
+
+static void read_pattern(emu_state *restrict state, uint64_t ops,
+	const uint16_t *pattern)
+{
+	uint8_t acc = 0;
+	uint64_t i;
+
+	for(i = 0; i < ops; i++)
+	{
+		acc ^= mem_read8(state, pattern[i & (PATTERN_LEN - 1)]);
+	}
+
+	sink = acc;
+}
+
+static void run_read_mixed(emu_state *restrict state, uint64_t ops)
+{
+	read_pattern(state, ops, pattern_mixed);
+}
+
+static void run_read_io(emu_state *restrict state, uint64_t ops)
+{
+	read_pattern(state, ops, pattern_io);
+}
+
+static void run_write_ram(emu_state *restrict state, uint64_t ops)
+{
+	uint64_t i;
+
+	for(i = 0; i < ops; i++)
+	{
+		mem_write8(state, pattern_ram[i & (PATTERN_LEN - 1)], (uint8_t)i);
+	}
+}
+
+static void run_write_mbc(emu_state *restrict state, uint64_t ops)
+{
+	uint64_t i;
+
+	// ROM bank, then RAM bank, as a bank-switching game would
+	for(i = 0; i < ops; i++)
+	{
+		if(i & 1)
+		{
+			mem_write8(state, 0x4000, (uint8_t)(i >> 1) & 0x03);
+		}
+		else
+		{
+			mem_write8(state, 0x2000, (uint8_t)(i >> 1) & 0x1F);
+		}
+	}
+}
+
+static void run_lcdc(emu_state *restrict state, uint64_t ops)
+{
+	uint64_t i;
+
+	// One dot per call, as step_emulator does; render_scanline runs
+	// from in here once per line
+	for(i = 0; i < ops; i++)
+	{
+		lcdc_tick(state, 1);
+	}
+}
+
+static void run_sound(emu_state *restrict state, uint64_t ops)
+{
+	int16_t buf[1024 * 2];
+	uint64_t i;
+
+	for(i = 0; i < ops; i += 1024)
+	{
+		sound_fetch_s16ne(state, buf, 1024);
+	}
+}
+
+static const microbench benches[] =
+{
+	{ "execute/alu", "alu.gb", "instr", 1, 1 << 22, run_execute },
+	{ "execute/memcpy", "memcpy.gb", "instr", 1, 1 << 22, run_execute },
+	{ "execute/cb", "cb.gb", "instr", 1, 1 << 22, run_execute },
+	{ "execute/banks", "banks.gb", "instr", 1, 1 << 22, run_execute },
+	{ "mem_read8/mixed", "memcpy.gb", "read", 1, 1 << 23, run_read_mixed },
+	{ "mem_read8/io", "memcpy.gb", "read", 1, 1 << 23, run_read_io },
+	{ "mem_write8/ram", "memcpy.gb", "write", 1, 1 << 23, run_write_ram },
+	{ "mem_write8/mbc", "banks.gb", "write", 1, 1 << 22, run_write_mbc },
+	{ "lcdc_tick/sprites", "sprites.gb", "dot", 60,
+		LCDC_FRAMES * CLOCKS_PER_FRAME, run_lcdc },
+	{ "lcdc_tick/scroll", "scroll.gb", "dot", 60,
+		LCDC_FRAMES * CLOCKS_PER_FRAME, run_lcdc },
+	{ "sound_fetch_s16ne/apu", "apu.gb", "frame", 60, 1 << 18, run_sound },
+};
+
+static int compare_double(const void *a, const void *b)
+{
+	const double x = *(const double *)a, y = *(const double *)b;
+
+	return (x > y) - (x < y);
+}
+
+static void usage(const char *name)
+{
+	size_t i;
+
+	fprintf(to_stderr, "Usage: %s [options] [BENCHMARK...]\n"
+		"  -d DIR     generated ROMs (default %s)\n"
+		"  -r ROUNDS  timed rounds per benchmark (default 9)\n"
+		"  -l FILE    write emulator messages to FILE\n"
+		"BENCHMARK selects by prefix; the default is all of:\n",
+		name, BENCH_ROM_DIR);
+
+	for(i = 0; i < sizeof(benches) / sizeof(*benches); i++)
+	{
+		fprintf(to_stderr, "  %s\n", benches[i].name);
+	}
+}
+
+static bool selected(const char *name, char *filters[], int count)
+{
+	int i;
+
+	for(i = 0; i < count; i++)
+	{
+		if(strncmp(name, filters[i], strlen(filters[i])) == 0)
+		{
+			return true;
+		}
+	}
+
+	return count == 0;
+}
+
+//! Run one benchmark; false if its ROM would not load
+static bool run_bench(const microbench *bench, const char *dir,
+	unsigned rounds, FILE *log)
+{
+	double rates[64];
+	char path[4096];
+	emu_options opts;
+	emu_state *state;
+	unsigned r, f;
+
+	snprintf(path, sizeof(path), "%s/%s", dir, bench->rom);
+
+	memset(&opts, 0, sizeof(opts));
+	opts.unthrottled = true;
+	opts.log = log;
+
+	if((state = init_emulator(NULL, path, NULL, &opts)) == NULL)
+	{
+		return false;
+	}
+
+	select_frontend_all(state, NULL_AUDIO, NULL_VIDEO, NULL_LOOP);
+	sound_set_output(state, 48000, RESAMPLE_QUALITY_MEDIUM,
+		RESAMPLE_LATENCY_MEDIUM);
+
+	for(f = 0; f < bench->warm_frames; f++)
+	{
+		run_frame(state);
+	}
+
+	// One untimed round for caches and page faults
+	bench->run(state, bench->ops);
+
+	for(r = 0; r < rounds && !exit_signal; r++)
+	{
+		const uint64_t start = get_time();
+		uint64_t elapsed;
+
+		bench->run(state, bench->ops);
+		elapsed = get_time() - start;
+		rates[r] = elapsed ? bench->ops * 1e9 / elapsed : 0;
+	}
+
+	finish_emulator(state);
+
+	if(r == 0)
+	{
+		return true;
+	}
+
+	qsort(rates, r, sizeof(double), compare_double);
+
+	fprintf(to_stdout, "%-24s %-6s %14.0f %14.0f %14.0f %6.2f%%\n",
+		bench->name, bench->unit, rates[r / 2], rates[0], rates[r - 1],
+		rates[r / 2] ? 100.0 * (rates[r - 1] - rates[0]) / rates[r / 2] : 0);
+	fflush(to_stdout);
+
+	return true;
+}
+
+int main(int argc, char *argv[])
+{
+	const char *dir = BENCH_ROM_DIR, *log_path = NULL;
+	unsigned long rounds = 9;
+	char *filters[64];
+	int i_arg, nfilters = 0;
+	FILE *log = NULL;
+	size_t i;
+
+	to_stdout = stdout;
+	to_stderr = stderr;
+
+	register_handlers();
+
+	for(i_arg = 1; i_arg < argc; i_arg++)
+	{
+		const char *arg = argv[i_arg];
+
+		if(arg[0] != '-' || arg[1] == '\0')
+		{
+			if(nfilters == 64)
+			{
+				usage(argv[0]);
+				return EXIT_FAILURE;
+			}
+
+			filters[nfilters++] = argv[i_arg];
+			continue;
+		}
+
+		if(arg[2] != '\0' || i_arg + 1 >= argc)
+		{
+			usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+
+		switch(arg[1])
+		{
+		case 'd':
+			dir = argv[++i_arg];
+			break;
+		case 'r':
+			rounds = strtoul(argv[++i_arg], NULL, 0);
+			break;
+		case 'l':
+			log_path = argv[++i_arg];
+			break;
+		default:
+			usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	if(rounds == 0 || rounds > 64)
+	{
+		usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	if(log_path && (log = fopen(log_path, "w")) == NULL)
+	{
+		fprintf(to_stderr, "Could not open %s\n", log_path);
+		return EXIT_FAILURE;
+	}
+
+	make_patterns();
+
+	fprintf(to_stdout, "%-24s %-6s %14s %14s %14s %7s\n", "benchmark", "unit",
+		"median/s", "min/s", "max/s", "spread");
+
+	for(i = 0; i < sizeof(benches) / sizeof(*benches) && !exit_signal; i++)
+	{
+		if(selected(benches[i].name, filters, nfilters) &&
+			!run_bench(&benches[i], dir, (unsigned)rounds, log))
+		{
+			fprintf(to_stderr, "Could not load %s/%s\n", dir, benches[i].rom);
+			return EXIT_FAILURE;
+		}
+	}
+
+	if(log)
+	{
+		fclose(log);
+	}
+
+	return EXIT_SUCCESS;
+}
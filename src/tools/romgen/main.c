@@ -0,0 +1,496 @@
+/*
+ * Assembles the synthetic ROMs sgherm-microbench runs on.  Run at build
+ * time; everything here is plain C so no assembler is needed.
+ */
+
+#include <stdint.h>	// uint[XX]_t
+#include <stdio.h>	// fopen, fwrite, fprintf
+#include <stdlib.h>	// calloc, free, exit
+#include <string.h>	// memcpy, strlen
+
+#define BANK_SIZE	0x4000
+
+//! Where every program starts; 0x100 jumps here
+#define CODE_START	0x150
+
+//! Fixed subroutine: returns at the start of the next VBlank
+#define WAIT_FRAME	0x0080
+
+//! Tables copied by the programs live here, clear of the code
+#define TABLE_START	0x1000
+
+typedef struct
+{
+	uint8_t *data;		//! The image
+	size_t size;		//! Its length, a whole number of banks
+	size_t at;		//! File offset of the next byte
+} rom_builder;
+
+typedef struct
+{
+	const char *file;	//! Output name
+	void (*build)(rom_builder *);
+} rom_def;
+
+
+static const uint8_t logo[0x30] =
+{
+	0xCE, 0xED, 0x66, 0x66, 0xCC, 0x0D, 0x00, 0x0B,
+	0x03, 0x73, 0x00, 0x83, 0x00, 0x0C, 0x00, 0x0D,
+	0x00, 0x08, 0x11, 0x1F, 0x88, 0x89, 0x00, 0x0E,
+	0xDC, 0xCC, 0x6E, 0xE6, 0xDD, 0xDD, 0xD9, 0x99,
+	0xBB, 0xBB, 0x67, 0x63, 0x6E, 0x0E, 0xEC, 0xCC,
+	0xDD, 0xDC, 0x99, 0x9F, 0xBB, 0xB9, 0x33, 0x3E,
+};
+
+//! CPU address of a file offset, as mapped when its bank is selected
+static uint16_t here(const rom_builder *b)
+{
+	return (uint16_t)(b->at < BANK_SIZE ? b->at : 0x4000 | (b->at & 0x3FFF));
+}
+
+static void op(rom_builder *b, uint8_t o)
+{
+	if(b->at >= b->size)
+	{
+		fprintf(stderr, "ROM overflow at %lx\n", (unsigned long)b->at);
+		exit(EXIT_FAILURE);
+	}
+
+	b->data[b->at++] = o;
+}
+
+static void op8(rom_builder *b, uint8_t o, uint8_t imm)
+{
+	op(b, o);
+	op(b, imm);
+}
+
+static void op16(rom_builder *b, uint8_t o, uint16_t imm)
+{
+	op(b, o);
+	op(b, imm & 0xFF);
+	op(b, imm >> 8);
+}
+
+//! JR-family o (0x18, 0x20, 0x28, 0x30, 0x38) to target
+static void jr(rom_builder *b, uint8_t o, uint16_t target)
+{
+	const int offset = (int)target - (int)(here(b) + 2);
+
+	if(offset < -128 || offset > 127)
+	{
+		fprintf(stderr, "JR to %04X out of range at %04X\n", target, here(b));
+		exit(EXIT_FAILURE);
+	}
+
+	op8(b, o, (uint8_t)offset);
+}
+
+static void header(rom_builder *b, const char *title, uint8_t type,
+	uint8_t rom_size, uint8_t ram_size)
+{
+	static const uint8_t entry[4] = { 0x00, 0xC3, CODE_START & 0xFF, CODE_START >> 8 };
+
+	memcpy(b->data + 0x100, entry, sizeof(entry));
+	memcpy(b->data + 0x104, logo, sizeof(logo));
+	memcpy(b->data + 0x134, title, strlen(title) < 15 ? strlen(title) : 15);
+	b->data[0x147] = type;
+	b->data[0x148] = rom_size;
+	b->data[0x149] = ram_size;
+
+	// WAIT_FRAME: let any VBlank in progress finish, then wait for the next
+	b->at = WAIT_FRAME;
+	op8(b, 0xF0, 0x44);		// LDH A,(LY)
+	op8(b, 0xFE, 0x90);		// CP 144
+	jr(b, 0x28, WAIT_FRAME);	// JR Z
+	op8(b, 0xF0, 0x44);		// LDH A,(LY)
+	op8(b, 0xFE, 0x90);		// CP 144
+	jr(b, 0x20, WAIT_FRAME + 6);	// JR NZ
+	op(b, 0xC9);			// RET
+
+	b->at = CODE_START;
+	op(b, 0xF3);			// DI
+	op16(b, 0x31, 0xFFFE);		// LD SP,FFFE
+}
+
+static void checksums(rom_builder *b)
+{
+	uint8_t c = 0;
+	uint16_t global = 0;
+	size_t i;
+
+	for(i = 0x134; i < 0x14D; i++)
+	{
+		c = (uint8_t)(c - b->data[i] - 1);
+	}
+	b->data[0x14D] = c;
+
+	for(i = 0; i < b->size; i++)
+	{
+		if(i != 0x14E && i != 0x14F)
+		{
+			global = (uint16_t)(global + b->data[i]);
+		}
+	}
+	b->data[0x14E] = global >> 8;
+	b->data[0x14F] = global & 0xFF;
+}
+
+//! Turn the LCD off at the next VBlank so VRAM and OAM are free
+static void lcd_off(rom_builder *b)
+{
+	op16(b, 0xCD, WAIT_FRAME);	// CALL WAIT_FRAME
+	op(b, 0xAF);			// XOR A
+	op8(b, 0xE0, 0x40);		// LDH (LCDC),A
+}
+
+//! Fill VRAM from start up to (but not including) end_hi << 8 with L ^ H
+static void fill_vram(rom_builder *b, uint16_t start, uint8_t end_hi)
+{
+	uint16_t loop;
+
+	op16(b, 0x21, start);		// LD HL,start
+	loop = here(b);
+	op(b, 0x7D);			// LD A,L
+	op(b, 0xAC);			// XOR H
+	op(b, 0x22);			// LD (HL+),A
+	op(b, 0x7C);			// LD A,H
+	op8(b, 0xFE, end_hi);		// CP end_hi
+	jr(b, 0x20, loop);		// JR NZ
+}
+
+//! Every ALU op on registers, in a tight loop
+static void build_alu(rom_builder *b)
+{
+	uint16_t loop;
+
+	header(b, "SGHBENCH ALU", 0x00, 0x00, 0x00);
+	op8(b, 0x3E, 0x01);		// LD A,1
+	op16(b, 0x01, 0x0305);		// LD BC,0305
+	op16(b, 0x11, 0x070B);		// LD DE,070B
+	op16(b, 0x21, 0x0D11);		// LD HL,0D11
+
+	loop = here(b);
+	op(b, 0x80);			// ADD A,B
+	op(b, 0x89);			// ADC A,C
+	op(b, 0x92);			// SUB D
+	op(b, 0x9B);			// SBC A,E
+	op(b, 0xA4);			// AND H
+	op(b, 0xB5);			// OR L
+	op(b, 0xA8);			// XOR B
+	op(b, 0xB9);			// CP C
+	op(b, 0x3C);			// INC A
+	op(b, 0x15);			// DEC D
+	op(b, 0x27);			// DAA
+	op(b, 0x09);			// ADD HL,BC
+	op(b, 0x13);			// INC DE
+	op(b, 0x2F);			// CPL
+	op(b, 0x17);			// RLA
+	op(b, 0x0F);			// RRCA
+	op8(b, 0xC6, 0x35);		// ADD A,35
+	op8(b, 0xEE, 0x5A);		// XOR 5A
+	jr(b, 0x18, loop);		// JR loop
+}
+
+//! Copy 4 KiB from switchable ROM to WRAM, then WRAM to WRAM, forever
+static void build_memcpy(rom_builder *b)
+{
+	uint16_t outer, copy;
+	size_t i;
+	int pass;
+
+	header(b, "SGHBENCH MEMCPY", 0x01, 0x01, 0x00);
+
+	// Something other than zeroes to copy
+	for(i = BANK_SIZE; i < 2 * BANK_SIZE; i++)
+	{
+		b->data[i] = (uint8_t)(i * 0x9D >> 3);
+	}
+
+	op8(b, 0x3E, 0x01);		// LD A,1
+	op16(b, 0xEA, 0x2000);		// LD (2000),A
+
+	outer = here(b);
+	for(pass = 0; pass < 2; pass++)
+	{
+		op16(b, 0x21, pass ? 0xC000 : 0x4000);	// LD HL,source
+		op16(b, 0x11, pass ? 0xD000 : 0xC000);	// LD DE,dest
+		op16(b, 0x01, 0x1000);			// LD BC,1000
+
+		copy = here(b);
+		op(b, 0x2A);			// LD A,(HL+)
+		op(b, 0x12);			// LD (DE),A
+		op(b, 0x13);			// INC DE
+		op(b, 0x0B);			// DEC BC
+		op(b, 0x78);			// LD A,B
+		op(b, 0xB1);			// OR C
+		jr(b, 0x20, copy);		// JR NZ
+	}
+
+	op16(b, 0xC3, outer);		// JP outer
+}
+
+//! Rotates, shifts, swaps and bit tests, on registers and (HL)
+static void build_cb(rom_builder *b)
+{
+	static const uint8_t cb_ops[] =
+	{
+		0x37,	// SWAP A
+		0x07,	// RLC A
+		0x19,	// RR C
+		0x20,	// SLA B
+		0x3A,	// SRL D
+		0x2B,	// SRA E
+		0x47,	// BIT 0,A
+		0xC7,	// SET 0,A
+		0x87,	// RES 0,A
+		0x7E,	// BIT 7,(HL)
+		0xC6,	// SET 0,(HL)
+		0x16,	// RL (HL)
+		0x0E,	// RRC (HL)
+		0x36,	// SWAP (HL)
+		0x5C,	// BIT 3,H
+		0xBD,	// RES 7,L
+	};
+	uint16_t loop;
+	size_t i;
+
+	header(b, "SGHBENCH CB", 0x00, 0x00, 0x00);
+	op8(b, 0x3E, 0x5A);		// LD A,5A
+	op16(b, 0x01, 0x1234);		// LD BC,1234
+	op16(b, 0x11, 0x5678);		// LD DE,5678
+	op16(b, 0x21, 0xC000);		// LD HL,C000
+
+	loop = here(b);
+	for(i = 0; i < sizeof(cb_ops); i++)
+	{
+		op8(b, 0xCB, cb_ops[i]);
+	}
+	jr(b, 0x18, loop);		// JR loop
+}
+
+//! Switch ROM and RAM banks as fast as possible, touching each
+static void build_banks(rom_builder *b)
+{
+	uint16_t loop;
+	size_t bank;
+
+	// MBC5+RAM, 512 KiB ROM (32 banks), 32 KiB RAM (4 banks)
+	header(b, "SGHBENCH BANKS", 0x1A, 0x04, 0x03);
+
+	// Each bank says which it is
+	for(bank = 1; bank < b->size / BANK_SIZE; bank++)
+	{
+		b->data[bank * BANK_SIZE] = (uint8_t)bank;
+	}
+
+	op8(b, 0x3E, 0x0A);		// LD A,0A
+	op16(b, 0xEA, 0x0000);		// LD (0000),A (RAM on)
+	op8(b, 0x06, 0x00);		// LD B,0
+
+	loop = here(b);
+	op(b, 0x78);			// LD A,B
+	op8(b, 0xE6, 0x1F);		// AND 1F
+	op16(b, 0xEA, 0x2000);		// LD (2000),A
+	op16(b, 0xFA, 0x4000);		// LD A,(4000)
+	op(b, 0x4F);			// LD C,A
+	op(b, 0x78);			// LD A,B
+	op8(b, 0xE6, 0x03);		// AND 03
+	op16(b, 0xEA, 0x4000);		// LD (4000),A
+	op(b, 0x79);			// LD A,C
+	op16(b, 0xEA, 0xA000);		// LD (A000),A
+	op(b, 0x04);			// INC B
+	jr(b, 0x18, loop);		// JR loop
+}
+
+//! Forty 8x16 sprites, ten on every covered line, drifting right
+static void build_sprites(rom_builder *b)
+{
+	uint8_t *oam = b->data + TABLE_START;
+	uint16_t copy, loop, move;
+	int i;
+
+	header(b, "SGHBENCH SPRITES", 0x00, 0x00, 0x00);
+
+	// Four rows of ten, overlapping in pairs so lines hit the limit
+	for(i = 0; i < 40; i++)
+	{
+		oam[i * 4] = (uint8_t)(16 + (i / 10) * 24 + (i & 1) * 4);
+		oam[i * 4 + 1] = (uint8_t)(8 + (i % 10) * 15);
+		oam[i * 4 + 2] = (uint8_t)(i * 2);
+		oam[i * 4 + 3] = (uint8_t)((i & 3) << 5);	// Flips, OBP1
+	}
+
+	lcd_off(b);
+	fill_vram(b, 0x8000, 0x98);	// All tiles
+
+	op16(b, 0x21, TABLE_START);	// LD HL,table
+	op16(b, 0x11, 0xFE00);		// LD DE,OAM
+	copy = here(b);
+	op(b, 0x2A);			// LD A,(HL+)
+	op(b, 0x12);			// LD (DE),A
+	op(b, 0x1C);			// INC E
+	op(b, 0x7B);			// LD A,E
+	op8(b, 0xFE, 0xA0);		// CP A0
+	jr(b, 0x20, copy);		// JR NZ
+
+	op8(b, 0x3E, 0xE4);		// LD A,E4
+	op8(b, 0xE0, 0x47);		// LDH (BGP),A
+	op8(b, 0xE0, 0x48);		// LDH (OBP0),A
+	op8(b, 0x3E, 0x1B);		// LD A,1B
+	op8(b, 0xE0, 0x49);		// LDH (OBP1),A
+	op8(b, 0x3E, 0x97);		// LD A,97 (on, 8000 tiles, 8x16, OBJ, BG)
+	op8(b, 0xE0, 0x40);		// LDH (LCDC),A
+
+	loop = here(b);
+	op16(b, 0xCD, WAIT_FRAME);	// CALL WAIT_FRAME
+	op16(b, 0x21, 0xFE01);		// LD HL,OAM X
+	op8(b, 0x06, 40);		// LD B,40
+	move = here(b);
+	op(b, 0x34);			// INC (HL)
+	op(b, 0x7D);			// LD A,L
+	op8(b, 0xC6, 0x04);		// ADD A,4
+	op(b, 0x6F);			// LD L,A
+	op(b, 0x05);			// DEC B
+	jr(b, 0x20, move);		// JR NZ
+	jr(b, 0x18, loop);		// JR loop
+}
+
+//! Background and window full of tiles, scrolling diagonally
+static void build_scroll(rom_builder *b)
+{
+	uint16_t loop;
+
+	header(b, "SGHBENCH SCROLL", 0x00, 0x00, 0x00);
+
+	lcd_off(b);
+	fill_vram(b, 0x8000, 0xA0);	// Tiles and both maps
+
+	op8(b, 0x3E, 0xE4);		// LD A,E4
+	op8(b, 0xE0, 0x47);		// LDH (BGP),A
+	op8(b, 0x3E, 0x60);		// LD A,60
+	op8(b, 0xE0, 0x4A);		// LDH (WY),A
+	op8(b, 0x3E, 0x57);		// LD A,57
+	op8(b, 0xE0, 0x4B);		// LDH (WX),A
+	op8(b, 0x3E, 0xF1);		// LD A,F1 (on, window at 9C00, 8000 tiles, BG)
+	op8(b, 0xE0, 0x40);		// LDH (LCDC),A
+
+	loop = here(b);
+	op16(b, 0xCD, WAIT_FRAME);	// CALL WAIT_FRAME
+	op8(b, 0xF0, 0x43);		// LDH A,(SCX)
+	op(b, 0x3C);			// INC A
+	op8(b, 0xE0, 0x43);		// LDH (SCX),A
+	op8(b, 0xF0, 0x42);		// LDH A,(SCY)
+	op8(b, 0xC6, 0x02);		// ADD A,2
+	op8(b, 0xE0, 0x42);		// LDH (SCY),A
+	jr(b, 0x18, loop);		// JR loop
+}
+
+//! Retrigger every channel with new pitches and rewrite wave RAM
+static void build_apu(rom_builder *b)
+{
+	static const uint8_t init[][2] =
+	{
+		{ 0x26, 0x80 },		// NR52: on
+		{ 0x24, 0x77 },		// NR50: full volume
+		{ 0x25, 0xFF },		// NR51: everything everywhere
+		{ 0x11, 0x80 },		// NR11: 50% duty
+		{ 0x12, 0xF3 },		// NR12: loud, decaying
+		{ 0x16, 0x40 },		// NR21: 25% duty
+		{ 0x17, 0xF2 },		// NR22
+		{ 0x1A, 0x80 },		// NR30: wave on
+		{ 0x1C, 0x20 },		// NR32: full volume
+		{ 0x21, 0xF1 },		// NR42
+		{ 0x22, 0x35 },		// NR43
+	};
+	uint16_t loop, wave;
+	size_t i;
+
+	header(b, "SGHBENCH APU", 0x00, 0x00, 0x00);
+
+	for(i = 0; i < sizeof(init) / sizeof(*init); i++)
+	{
+		op8(b, 0x3E, init[i][1]);	// LD A,value
+		op8(b, 0xE0, init[i][0]);	// LDH (reg),A
+	}
+
+	op8(b, 0x06, 0x00);		// LD B,0
+
+	loop = here(b);
+	op(b, 0x04);			// INC B
+	op(b, 0x78);			// LD A,B
+	op8(b, 0xE0, 0x13);		// LDH (NR13),A
+	op8(b, 0xE0, 0x18);		// LDH (NR23),A
+	op8(b, 0xE0, 0x1D);		// LDH (NR33),A
+	op8(b, 0x3E, 0x86);		// LD A,86 (trigger, high pitch bits)
+	op8(b, 0xE0, 0x14);		// LDH (NR14),A
+	op8(b, 0xE0, 0x19);		// LDH (NR24),A
+	op8(b, 0xE0, 0x1E);		// LDH (NR34),A
+	op8(b, 0xE0, 0x23);		// LDH (NR44),A
+
+	op8(b, 0x0E, 0x30);		// LD C,30
+	wave = here(b);
+	op(b, 0x78);			// LD A,B
+	op(b, 0x81);			// ADD A,C
+	op(b, 0xE2);			// LD (FF00+C),A
+	op(b, 0x0C);			// INC C
+	op(b, 0x79);			// LD A,C
+	op8(b, 0xFE, 0x40);		// CP 40
+	jr(b, 0x20, wave);		// JR NZ
+	jr(b, 0x18, loop);		// JR loop
+}
+
+static const rom_def roms[] =
+{
+	{ "alu.gb", build_alu },
+	{ "memcpy.gb", build_memcpy },
+	{ "cb.gb", build_cb },
+	{ "banks.gb", build_banks },
+	{ "sprites.gb", build_sprites },
+	{ "scroll.gb", build_scroll },
+	{ "apu.gb", build_apu },
+};
+
+int main(int argc, char *argv[])
+{
+	size_t i;
+
+	if(argc != 2)
+	{
+		fprintf(stderr, "Usage: %s DIR\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	for(i = 0; i < sizeof(roms) / sizeof(*roms); i++)
+	{
+		rom_builder b;
+		char path[4096];
+		FILE *f;
+
+		// Header first: it sets the size code everything else obeys
+		b.size = 32 * BANK_SIZE;
+		b.at = 0;
+		if((b.data = (uint8_t *)calloc(1, b.size)) == NULL)
+		{
+			fprintf(stderr, "Out of memory\n");
+			return EXIT_FAILURE;
+		}
+
+		roms[i].build(&b);
+		b.size = (size_t)(2 * BANK_SIZE) << b.data[0x148];
+		checksums(&b);
+
+		snprintf(path, sizeof(path), "%s/%s", argv[1], roms[i].file);
+		if((f = fopen(path, "wb")) == NULL ||
+			fwrite(b.data, b.size, 1, f) != 1 || fclose(f) != 0)
+		{
+			fprintf(stderr, "Could not write %s\n", path);
+			return EXIT_FAILURE;
+		}
+
+		free(b.data);
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,416 @@
+/*
+ * Shows the metrics every running instance publishes (see metrics.h).
+ * Blocks are mapped read-only and never written, so watching an instance
+ * can't slow it down.
+ */
+
+#include "config.h"	// bool, uint[XX]_t, ATOMIC_LOAD64
+
+#include "metrics.h"	// metrics_block, METRICS_*
+#include "input.h"	// LAG_SECOND_FRAMES
+#include "util_time.h"	// get_time, sleep_nsec
+
+#include <dirent.h>	// opendir, readdir
+#include <errno.h>	// errno, ESRCH
+#include <fcntl.h>	// O_RDONLY
+#include <signal.h>	// kill
+#include <stddef.h>	// offsetof
+#include <stdio.h>	// printf, fprintf
+#include <stdlib.h>	// strtoul, qsort, realloc, free
+#include <string.h>	// strncmp, strcmp, strncpy, strlen
+#include <sys/mman.h>	// shm_open, shm_unlink, mmap, munmap
+#include <sys/stat.h>	// fstat
+#include <unistd.h>	// close, isatty
+
+//! Where Linux lists POSIX shared memory
+#define SHM_DIR "/dev/shm"
+
+//! Blocks not updated for this long are shown as idle
+#define IDLE_NSEC 2000000000ULL
+
+//! Frames at least this slow (microseconds) count as late
+#define LATE_USEC 20000
+
+typedef struct
+{
+	char name[64];		//! shm_open name, with the leading slash
+	metrics_block block;	//! Copy taken this refresh
+	bool valid;		//! block holds something we understand
+	uint64_t prev_frames;	//! Frames at the refresh before
+	uint64_t prev_time;	//! update_time then (0 = new)
+} top_entry;
+
+typedef struct
+{
+	top_entry *e;
+	size_t count, alloc;
+} top_list;
+
+
+static void usage(const char *name)
+{
+	fprintf(stderr, "Usage: %s [options] [NAME...]\n"
+		"  -1         print once and exit\n"
+		"  -i MS      refresh every MS milliseconds (default 1000)\n"
+		"  -v         show each instance's frame time histogram\n"
+		"  -c         remove blocks left behind by dead processes\n"
+		"Shows every %s* block in %s unless NAMEs are given.\n",
+		name, METRICS_PREFIX, SHM_DIR);
+}
+
+static int compare_entries(const void *a, const void *b)
+{
+	return strcmp(((const top_entry *)a)->name, ((const top_entry *)b)->name);
+}
+
+//! Add a name unless it's there already
+static bool list_add(top_list *list, const char *name)
+{
+	size_t i;
+
+	if(strlen(name) >= sizeof(list->e[0].name))
+	{
+		// Not one of ours
+		return true;
+	}
+
+	for(i = 0; i < list->count; i++)
+	{
+		if(strcmp(list->e[i].name, name) == 0)
+		{
+			return true;
+		}
+	}
+
+	if(list->count == list->alloc)
+	{
+		size_t alloc = list->alloc ? list->alloc * 2 : 16;
+		top_entry *e = (top_entry *)realloc(list->e, alloc * sizeof(top_entry));
+
+		if(e == NULL)
+		{
+			return false;
+		}
+
+		list->e = e;
+		list->alloc = alloc;
+	}
+
+	memset(&(list->e[list->count]), 0, sizeof(top_entry));
+	strncpy(list->e[list->count].name, name, sizeof(list->e[0].name) - 1);
+	list->count++;
+	return true;
+}
+
+//! Pick up blocks that have appeared since the last scan
+static void scan(top_list *list)
+{
+	DIR *dir = opendir(SHM_DIR);
+	struct dirent *ent;
+	char name[sizeof(ent->d_name) + 1];
+
+	if(dir == NULL)
+	{
+		return;
+	}
+
+	while((ent = readdir(dir)) != NULL)
+	{
+		// The directory lists them without the slash
+		if(strncmp(ent->d_name, METRICS_PREFIX + 1,
+			sizeof(METRICS_PREFIX) - 2) != 0)
+		{
+			continue;
+		}
+
+		snprintf(name, sizeof(name), "/%s", ent->d_name);
+		list_add(list, name);
+	}
+
+	closedir(dir);
+	qsort(list->e, list->count, sizeof(top_entry), compare_entries);
+}
+
+//! Copy the block word by word; false if it's gone or not ours
+static bool snapshot(top_entry *entry)
+{
+	const size_t first = offsetof(metrics_block, start_time);
+	const metrics_block *shared;
+	struct stat st;
+	uint64_t *dst;
+	const uint64_t *src;
+	size_t i;
+	int fd;
+
+	if((fd = shm_open(entry->name, O_RDONLY, 0)) < 0)
+	{
+		return false;
+	}
+
+	if(fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(metrics_block) ||
+		(shared = (const metrics_block *)mmap(NULL, sizeof(metrics_block),
+		PROT_READ, MAP_SHARED, fd, 0)) == MAP_FAILED)
+	{
+		close(fd);
+		return false;
+	}
+
+	close(fd);
+
+	entry->valid = false;
+	if(ATOMIC_LOAD64(&(shared->update_time)) != 0 &&
+		shared->magic == METRICS_MAGIC &&
+		shared->version == METRICS_VERSION &&
+		shared->size >= sizeof(metrics_block))
+	{
+		memcpy(&(entry->block), shared, first);
+		entry->block.title[sizeof(entry->block.title) - 1] = '\0';
+
+		dst = (uint64_t *)((char *)&(entry->block) + first);
+		src = (const uint64_t *)((const char *)shared + first);
+		for(i = 0; i < (sizeof(metrics_block) - first) / sizeof(uint64_t); i++)
+		{
+			dst[i] = ATOMIC_LOAD64(&(src[i]));
+		}
+
+		entry->valid = true;
+	}
+
+	munmap((void *)shared, sizeof(metrics_block));
+	return true;
+}
+
+static bool pid_alive(uint32_t pid)
+{
+	return kill((pid_t)pid, 0) == 0 || errno != ESRCH;
+}
+
+static void print_entry(top_entry *entry, uint64_t now, bool verbose)
+{
+	static const uint64_t limits[METRICS_FRAME_BUCKETS] = METRICS_BUCKET_LIMITS;
+	const metrics_block *b = &(entry->block);
+	const char *status;
+	char target[24];
+	double fps = 0, halt = 0, late = 0;
+	uint64_t total = 0, slow = 0;
+	unsigned i;
+
+	for(i = 0; i < METRICS_FRAME_BUCKETS; i++)
+	{
+		total += b->frame_time[i];
+		if(i > 0 && limits[i - 1] >= LATE_USEC)
+		{
+			slow += b->frame_time[i];
+		}
+	}
+
+	if(b->finished)
+	{
+		status = "done";
+	}
+	else if(!pid_alive(b->pid))
+	{
+		status = "dead";
+	}
+	else if(now - b->update_time > IDLE_NSEC)
+	{
+		status = "idle";
+	}
+	else
+	{
+		status = "run";
+	}
+
+	if(entry->prev_time != 0 && b->update_time > entry->prev_time)
+	{
+		fps = (b->frames - entry->prev_frames) * 1e9 /
+			(b->update_time - entry->prev_time);
+	}
+
+	if(b->cycles)
+	{
+		halt = 100.0 * b->halt_cycles / b->cycles;
+	}
+
+	if(total)
+	{
+		late = 100.0 * slow / total;
+	}
+
+	if(b->target_speed == 0)
+	{
+		snprintf(target, sizeof(target), "max");
+	}
+	else
+	{
+		snprintf(target, sizeof(target), "%llux",
+			(unsigned long long)b->target_speed);
+	}
+
+	printf("%-22s %-16s %-4s %7.2fx %6s %7.1f %10llu %5.1f%% %5.1f%% "
+		"%2llu/%-2d %5llu/%-5llu %6llu\n",
+		entry->name + sizeof(METRICS_PREFIX) - 1, b->title, status,
+		b->speed / 1000.0, target, fps, (unsigned long long)b->frames,
+		halt, late, (unsigned long long)b->lag_second, LAG_SECOND_FRAMES,
+		(unsigned long long)b->audio_fill,
+		(unsigned long long)b->audio_size,
+		(unsigned long long)b->save_flushes);
+
+	if(verbose)
+	{
+		printf("  frame ms:");
+		for(i = 0; i < METRICS_FRAME_BUCKETS; i++)
+		{
+			if(limits[i])
+			{
+				printf(" <%.1f:%llu", limits[i] / 1000.0,
+					(unsigned long long)b->frame_time[i]);
+			}
+			else
+			{
+				printf(" more:%llu", (unsigned long long)b->frame_time[i]);
+			}
+		}
+		printf("\n");
+	}
+
+	entry->prev_frames = b->frames;
+	entry->prev_time = b->update_time;
+}
+
+int main(int argc, char *argv[])
+{
+	top_list list = { NULL, 0, 0 };
+	unsigned long interval = 1000;
+	bool once = false, verbose = false, clean = false, named = false;
+	bool tty = isatty(STDOUT_FILENO);
+	size_t i;
+	int i_arg;
+
+	for(i_arg = 1; i_arg < argc; i_arg++)
+	{
+		const char *arg = argv[i_arg];
+
+		if(arg[0] != '-')
+		{
+			// As given to shm_open; the slash is optional
+			char name[64];
+
+			snprintf(name, sizeof(name), "%s%s", arg[0] == '/' ? "" : "/",
+				arg);
+			if(!list_add(&list, name))
+			{
+				fprintf(stderr, "Out of memory\n");
+				return EXIT_FAILURE;
+			}
+
+			named = true;
+			continue;
+		}
+
+		if(arg[1] == '\0' || arg[2] != '\0')
+		{
+			usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+
+		switch(arg[1])
+		{
+		case '1':
+			once = true;
+			break;
+		case 'v':
+			verbose = true;
+			break;
+		case 'c':
+			clean = true;
+			break;
+		case 'i':
+			if(++i_arg < argc)
+			{
+				interval = strtoul(argv[i_arg], NULL, 0);
+				break;
+			}
+			/* fallthrough */
+		default:
+			usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	if(interval == 0)
+	{
+		interval = 1;
+	}
+
+	for(;;)
+	{
+		const uint64_t now = get_time();
+		size_t shown = 0, kept;
+
+		if(!named)
+		{
+			scan(&list);
+		}
+
+		if(tty && !once)
+		{
+			// Home and clear
+			printf("\033[H\033[2J");
+		}
+
+		printf("%-22s %-16s %-4s %8s %6s %7s %10s %6s %6s %5s %11s %6s\n",
+			"INSTANCE", "TITLE", "STAT", "SPEED", "TARGET", "FPS",
+			"FRAMES", "HALT", "LATE", "LAG", "AUDIO", "SAVES");
+
+		for(i = 0, kept = 0; i < list.count; i++)
+		{
+			top_entry *entry = &(list.e[i]);
+
+			if(!snapshot(entry))
+			{
+				// Gone; forget it unless asked for by name
+				if(named)
+				{
+					list.e[kept++] = *entry;
+				}
+				continue;
+			}
+			else if(entry->valid && clean && !entry->block.finished &&
+				!pid_alive(entry->block.pid))
+			{
+				shm_unlink(entry->name);
+				printf("%-22s removed\n",
+					entry->name + sizeof(METRICS_PREFIX) - 1);
+				continue;
+			}
+
+			if(entry->valid)
+			{
+				print_entry(entry, now, verbose);
+				shown++;
+			}
+
+			list.e[kept++] = *entry;
+		}
+
+		list.count = kept;
+
+		if(shown == 0)
+		{
+			printf("No instances are publishing metrics (run with -M)\n");
+		}
+
+		fflush(stdout);
+
+		if(once)
+		{
+			break;
+		}
+
+		sleep_nsec((uint64_t)interval * 1000000ULL);
+	}
+
+	free(list.e);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,374 @@
+#include "config.h"	// bool, uint[XX]_t
+
+#include "trace.h"	// trace_record, trace_file_header
+#include "debug.h"	// disassemble
+#include "print.h"	// to_stdout, to_stderr
+
+#include <stdio.h>	// fopen, fread, fprintf
+#include <stdlib.h>	// strtoull, malloc, free
+#include <string.h>	// memcmp, memmove
+
+
+//! Records read from the file at once
+#define CHUNK 4096
+
+//! Most context lines shown before a difference
+#define MAX_CONTEXT 64
+
+typedef struct
+{
+	FILE *f;
+	const char *path;
+	trace_file_header header;
+
+	trace_record buf[CHUNK];
+	size_t have, next;	//! Records in buf, and the next to return
+	uint64_t left;		//! Records still in the file
+} trace_reader;
+
+typedef struct
+{
+	uint32_t pc_lo, pc_hi;	//! Inclusive
+	int32_t bank;		//! -1 = any
+	uint64_t cycle_lo, cycle_hi;	//! Inclusive
+} trace_filter;
+
+
+static bool reader_open(trace_reader *r, const char *path)
+{
+	trace_file_header *h = &(r->header);
+
+	r->path = path;
+	r->have = r->next = 0;
+
+	if((r->f = fopen(path, "rb")) == NULL)
+	{
+		fprintf(to_stderr, "Could not open %s\n", path);
+		return false;
+	}
+
+	if(fread(h, sizeof(*h), 1, r->f) != 1 || memcmp(h->magic, TRACE_MAGIC, 4) != 0)
+	{
+		fprintf(to_stderr, "%s is not a trace\n", path);
+	}
+	else if(h->byte_order != TRACE_BYTE_ORDER)
+	{
+		fprintf(to_stderr, "%s was written on a host of the other endianness\n", path);
+	}
+	else if(h->version != TRACE_VERSION || h->record_size != sizeof(trace_record))
+	{
+		fprintf(to_stderr, "%s is trace version %u, expected %u\n", path,
+			h->version, TRACE_VERSION);
+	}
+	else
+	{
+		r->left = h->count;
+		return true;
+	}
+
+	fclose(r->f);
+	return false;
+}
+
+static const trace_record * reader_next(trace_reader *r)
+{
+	if(r->next == r->have)
+	{
+		const size_t want = r->left < CHUNK ? (size_t)r->left : CHUNK;
+
+		if(want == 0)
+		{
+			return NULL;
+		}
+
+		if((r->have = fread(r->buf, sizeof(trace_record), want, r->f)) == 0)
+		{
+			fprintf(to_stderr, "%s is truncated\n", r->path);
+			r->left = 0;
+			return NULL;
+		}
+
+		r->left -= r->have;
+		r->next = 0;
+	}
+
+	return &(r->buf[r->next++]);
+}
+
+static bool keep(const trace_filter *filter, const trace_record *rec)
+{
+	return rec->pc >= filter->pc_lo && rec->pc <= filter->pc_hi &&
+		(filter->bank < 0 || rec->bank == (uint16_t)filter->bank) &&
+		rec->cycle >= filter->cycle_lo && rec->cycle <= filter->cycle_hi;
+}
+
+//! Next record that passes the filter, or NULL at the end
+static const trace_record * next_kept(trace_reader *r, const trace_filter *filter)
+{
+	const trace_record *rec;
+
+	while((rec = reader_next(r)) != NULL && !keep(filter, rec));
+
+	return rec;
+}
+
+static void print_record(const char *prefix, const trace_record *rec)
+{
+	char text[32], bytes[12];
+
+	disassemble(text, sizeof(text), rec->pc, rec->opcode, rec->operand);
+
+	switch(rec->length)
+	{
+	case 3:
+		snprintf(bytes, sizeof(bytes), "%02X %02X %02X", rec->opcode,
+			rec->operand[0], rec->operand[1]);
+		break;
+	case 2:
+		snprintf(bytes, sizeof(bytes), "%02X %02X", rec->opcode,
+			rec->operand[0]);
+		break;
+	default:
+		snprintf(bytes, sizeof(bytes), "%02X", rec->opcode);
+		break;
+	}
+
+	fprintf(to_stdout, "%s%14llu  %02X:%04X  %-8s  %-16s  "
+		"AF=%04X BC=%04X DE=%04X HL=%04X SP=%04X\n", prefix,
+		(unsigned long long)rec->cycle, rec->bank, rec->pc, bytes, text,
+		rec->af, rec->bc, rec->de, rec->hl, rec->sp);
+}
+
+static bool same(const trace_record *a, const trace_record *b)
+{
+	// Operand bytes past the length are whatever was lying around
+	return a->cycle == b->cycle && a->pc == b->pc && a->bank == b->bank &&
+		a->af == b->af && a->bc == b->bc && a->de == b->de &&
+		a->hl == b->hl && a->sp == b->sp && a->opcode == b->opcode &&
+		a->length == b->length &&
+		(a->length < 2 || a->operand[0] == b->operand[0]) &&
+		(a->length < 3 || a->operand[1] == b->operand[1]);
+}
+
+static int dump(trace_reader *r, const trace_filter *filter, uint64_t limit)
+{
+	const trace_record *rec;
+	uint64_t shown = 0;
+
+	if(r->header.dropped)
+	{
+		fprintf(to_stdout, "# %llu older instructions were overwritten\n",
+			(unsigned long long)r->header.dropped);
+	}
+
+	while(shown < limit && (rec = next_kept(r, filter)) != NULL)
+	{
+		print_record("", rec);
+		shown++;
+	}
+
+	return EXIT_SUCCESS;
+}
+
+static int diff(trace_reader *a, trace_reader *b, const trace_filter *filter,
+	uint64_t limit, unsigned context)
+{
+	trace_record history[MAX_CONTEXT];
+	uint64_t index = 0, differences = 0;
+	unsigned kept = 0, i;
+
+	if(memcmp(a->header.title, b->header.title, sizeof(a->header.title)) != 0)
+	{
+		fprintf(to_stdout, "# Traces are of different ROMs\n");
+	}
+
+	while(differences < limit)
+	{
+		const trace_record *x = next_kept(a, filter);
+		const trace_record *y = next_kept(b, filter);
+
+		if(x == NULL || y == NULL)
+		{
+			if(x != NULL || y != NULL)
+			{
+				fprintf(to_stdout, "# %s ends after %llu instructions\n",
+					x ? b->path : a->path, (unsigned long long)index);
+				differences++;
+			}
+			break;
+		}
+
+		if(same(x, y))
+		{
+			// Keep the last few for context
+			if(context > 0)
+			{
+				if(kept == context)
+				{
+					memmove(history, history + 1,
+						(context - 1) * sizeof(trace_record));
+					kept--;
+				}
+				history[kept++] = *x;
+			}
+		}
+		else
+		{
+			fprintf(to_stdout, "# Instruction %llu differs\n",
+				(unsigned long long)index);
+			for(i = 0; i < kept; i++)
+			{
+				print_record("  ", &(history[i]));
+			}
+			print_record("< ", x);
+			print_record("> ", y);
+
+			kept = 0;
+			differences++;
+		}
+
+		index++;
+	}
+
+	if(differences == 0)
+	{
+		fprintf(to_stdout, "# %llu instructions, no differences\n",
+			(unsigned long long)index);
+	}
+
+	return differences ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+//! Parse "LO-HI" or "N" (as LO = HI = N)
+static void parse_range(const char *s, int base, uint64_t *lo, uint64_t *hi)
+{
+	char *end;
+
+	*lo = *hi = strtoull(s, &end, base);
+	if(*end == '-')
+	{
+		*hi = strtoull(end + 1, NULL, base);
+	}
+}
+
+static void usage(const char *name)
+{
+	fprintf(to_stderr, "Usage: %s [options] TRACE\n"
+		"  -p LO-HI   only instructions at these addresses (hex)\n"
+		"  -b BANK    only instructions in this ROM bank\n"
+		"  -c LO-HI   only instructions fetched in this cycle window\n"
+		"  -n COUNT   stop after COUNT instructions (or differences)\n"
+		"  -d OTHER   compare with OTHER instead of printing\n"
+		"  -C LINES   instructions shown before each difference (default 3)\n"
+		"Traces are written by the frontends' -T option.\n", name);
+}
+
+int main(int argc, char *argv[])
+{
+	const char *path = NULL, *other = NULL;
+	uint64_t limit = UINT64_MAX, lo, hi;
+	unsigned long context = 3;
+	trace_reader *a, *b;
+	trace_filter filter;
+	int i_arg, ret;
+
+	to_stdout = stdout;
+	to_stderr = stderr;
+
+	filter.pc_lo = 0;
+	filter.pc_hi = 0xFFFF;
+	filter.bank = -1;
+	filter.cycle_lo = 0;
+	filter.cycle_hi = UINT64_MAX;
+
+	for(i_arg = 1; i_arg < argc; i_arg++)
+	{
+		const char *arg = argv[i_arg];
+
+		if(arg[0] != '-' || arg[1] == '\0')
+		{
+			path = arg;
+			continue;
+		}
+
+		if(arg[2] != '\0' || i_arg + 1 >= argc)
+		{
+			usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+
+		arg = argv[++i_arg];
+		switch(argv[i_arg - 1][1])
+		{
+		case 'p':
+			parse_range(arg, 16, &lo, &hi);
+			filter.pc_lo = (uint32_t)lo;
+			filter.pc_hi = (uint32_t)hi;
+			break;
+		case 'b':
+			filter.bank = (int32_t)strtoul(arg, NULL, 0);
+			break;
+		case 'c':
+			parse_range(arg, 0, &(filter.cycle_lo), &(filter.cycle_hi));
+			break;
+		case 'n':
+			limit = strtoull(arg, NULL, 0);
+			break;
+		case 'd':
+			other = arg;
+			break;
+		case 'C':
+			context = strtoul(arg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	if(path == NULL || context > MAX_CONTEXT)
+	{
+		usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	// Too big for the stack
+	a = (trace_reader *)malloc(sizeof(trace_reader));
+	b = (trace_reader *)malloc(sizeof(trace_reader));
+	if(a == NULL || b == NULL)
+	{
+		fprintf(to_stderr, "Out of memory\n");
+		return EXIT_FAILURE;
+	}
+
+	if(!reader_open(a, path))
+	{
+		return EXIT_FAILURE;
+	}
+
+	if(other == NULL)
+	{
+		ret = dump(a, &filter, limit);
+	}
+	else if(!reader_open(b, other))
+	{
+		ret = EXIT_FAILURE;
+	}
+	else
+	{
+		if(limit == UINT64_MAX)
+		{
+			// Everything after the first difference is usually noise
+			limit = 1;
+		}
+
+		ret = diff(a, b, &filter, limit, (unsigned)context);
+		fclose(b->f);
+	}
+
+	fclose(a->f);
+	free(a);
+	free(b);
+
+	return ret;
+}
@@ -0,0 +1,145 @@
+#include "config.h"	// bool, uint[XX]_t
+
+#include "sgherm.h"	// emu_state
+#include "trace.h"	// trace_*
+#include "ctl_unit.h"	// REG_*
+#include "print.h"	// error, info
+
+#include <stdio.h>	// fopen, fwrite
+#include <stdlib.h>	// malloc, free
+#include <string.h>	// memcpy, memset
+
+
+struct trace_state_t
+{
+	trace_record *ring;	//! Most recent records
+	size_t capacity;	//! Records ring holds
+	uint64_t written;	//! Records ever written; next goes at written % capacity
+};
+
+
+bool trace_start(emu_state *restrict state, size_t records)
+{
+	trace_state *trace = (trace_state *)calloc(1, sizeof(trace_state));
+
+	if(records == 0)
+	{
+		records = TRACE_DEFAULT_RECORDS;
+	}
+
+	// Pages are only touched, and so only resident, as the ring fills
+	if(trace == NULL || (trace->ring = (trace_record *)malloc(
+		records * sizeof(trace_record))) == NULL)
+	{
+		error(state, "Could not allocate a trace of %lu records",
+			(unsigned long)records);
+		free(trace);
+		return false;
+	}
+
+	trace->capacity = records;
+	state->debug.trace = trace;
+	return true;
+}
+
+void trace_instr(emu_state *restrict state, uint8_t opcode,
+	const uint8_t *operand, int length)
+{
+	trace_state *trace = state->debug.trace;
+	trace_record *r = &(trace->ring[trace->written++ % trace->capacity]);
+
+	if(length < 1)
+	{
+		// Invalid opcodes are still one byte long
+		length = 1;
+	}
+
+	r->cycle = state->cycles;
+	r->pc = REG_PC(state) - length;
+	r->bank = (r->pc >= 0x4000 && r->pc < 0x8000) ? state->mbc.rom_bank : 0;
+	r->af = REG_AF(state);
+	r->bc = REG_BC(state);
+	r->de = REG_DE(state);
+	r->hl = REG_HL(state);
+	r->sp = REG_SP(state);
+	r->opcode = opcode;
+	r->operand[0] = operand[0];
+	r->operand[1] = operand[1];
+	r->length = (uint8_t)length;
+}
+
+static bool write_trace(const emu_state *restrict state, trace_state *trace,
+	FILE *f)
+{
+	const size_t count = trace->written < trace->capacity ?
+		(size_t)trace->written : trace->capacity;
+	const size_t oldest = (size_t)((trace->written - count) % trace->capacity);
+	const size_t first = (oldest + count <= trace->capacity) ?
+		count : trace->capacity - oldest;
+	trace_file_header header;
+	size_t i;
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, TRACE_MAGIC, 4);
+	header.version = TRACE_VERSION;
+	header.record_size = sizeof(trace_record);
+	header.byte_order = TRACE_BYTE_ORDER;
+	header.count = count;
+	header.dropped = trace->written - count;
+	memcpy(header.title, state->cart_data + 0x134, sizeof(header.title));
+
+	// Padding goes out as zeroes, so equal runs give equal files
+	for(i = 0; i < count; i++)
+	{
+		memset(trace->ring[(oldest + i) % trace->capacity].pad, 0,
+			sizeof(trace->ring[0].pad));
+	}
+
+	return fwrite(&header, sizeof(header), 1, f) == 1 &&
+		fwrite(trace->ring + oldest, sizeof(trace_record), first, f) == first &&
+		fwrite(trace->ring, sizeof(trace_record), count - first, f) ==
+			count - first;
+}
+
+void trace_stop(emu_state *restrict state)
+{
+	trace_state *trace = state->debug.trace;
+	const char *path = state->opts.trace_path;
+	FILE *f;
+	bool ok;
+
+	if(trace == NULL)
+	{
+		return;
+	}
+
+	state->debug.trace = NULL;
+
+	if(path == NULL)
+	{
+		// Nowhere to put it
+	}
+	else if((f = fopen(path, "wb")) == NULL)
+	{
+		error(state, "Could not create trace %s", path);
+	}
+	else
+	{
+		ok = write_trace(state, trace, f);
+		ok = (fclose(f) == 0) && ok;
+
+		if(ok)
+		{
+			info(state, "Wrote %llu instructions to %s",
+				(unsigned long long)(trace->written < trace->capacity ?
+				trace->written : trace->capacity), path);
+		}
+		else
+		{
+			error(state, "Could not write trace %s", path);
+		}
+	}
+
+	free(trace->ring);
+	free(trace);
+}
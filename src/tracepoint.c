@@ -0,0 +1,271 @@
+#include "config.h"	// bool, uint[XX]_t
+
+#include "sgherm.h"	// emu_state
+#include "tracepoint.h"	// tracepoint_*
+#include "history.h"	// history_last_pc
+#include "print.h"	// error, info
+
+#include <stdio.h>	// fopen, fprintf
+#include <stdlib.h>	// malloc, free
+
+
+struct tracepoint_state_t
+{
+	tracepoint_record *ring;	//! Most recent events
+	size_t capacity;		//! Records ring holds
+	uint64_t written;		//! Records ever written; next at written % capacity
+};
+
+//! Timeline rows, one per kind of hardware
+enum
+{
+	ROW_INTERRUPTS = 1,
+	ROW_LCDC,
+	ROW_DMA,
+	ROW_TIMER,
+	ROW_MBC,
+};
+
+static const char * const row_names[] =
+{
+	NULL, "Interrupts", "LCDC mode", "DMA", "Timer", "MBC",
+};
+
+static const char * const interrupt_names[] =
+{
+	"VBlank", "STAT", "Timer", "Serial", "Joypad",
+};
+
+static const char * const mode_names[] =
+{
+	"HBlank (0)", "VBlank (1)", "OAM scan (2)", "Transfer (3)",
+};
+
+//! Length of an OAM DMA in cycles
+#define DMA_CYCLES 640
+
+
+bool tracepoint_start(emu_state *restrict state, size_t records)
+{
+	tracepoint_state *tp = (tracepoint_state *)calloc(1,
+		sizeof(tracepoint_state));
+
+	if(records == 0)
+	{
+		records = TRACEPOINT_DEFAULT_RECORDS;
+	}
+
+	if(tp == NULL || (tp->ring = (tracepoint_record *)malloc(
+		records * sizeof(tracepoint_record))) == NULL)
+	{
+		error(state, "Could not allocate %lu tracepoint records",
+			(unsigned long)records);
+		free(tp);
+		return false;
+	}
+
+	tp->capacity = records;
+	state->debug.tracepoints = tp;
+	return true;
+}
+
+void tracepoint_emit(emu_state *restrict state, tracepoint_event event,
+	uint32_t arg, uint8_t extra)
+{
+	tracepoint_state *tp = state->debug.tracepoints;
+	tracepoint_record *r = &(tp->ring[tp->written++ % tp->capacity]);
+
+	r->cycle = state->cycles;
+	r->pc = history_last_pc(&(state->debug.history));
+	r->event = (uint8_t)event;
+	r->extra = extra;
+	r->arg = arg;
+}
+
+//! Emulated microseconds, the unit trace-event timestamps are in
+static double cycle_us(uint64_t cycle)
+{
+	return cycle * 1e6 / CPU_FREQ_DMG;
+}
+
+//! Fields every event has, up to the opening of args
+static void event_head(FILE *f, const char *name, const char *ph, int row,
+	const tracepoint_record *r)
+{
+	fprintf(f, ",\n{\"name\":\"%s\",\"ph\":\"%s\",\"pid\":1,\"tid\":%d,"
+		"\"ts\":%.3f,", name, ph, row, cycle_us(r->cycle));
+}
+
+static void event_args(FILE *f, const tracepoint_record *r)
+{
+	fprintf(f, "\"args\":{\"pc\":\"%04X\",\"cycle\":%llu", r->pc,
+		(unsigned long long)r->cycle);
+}
+
+static void write_event(FILE *f, const tracepoint_record *r,
+	const tracepoint_record *next_mode)
+{
+	char name[32];
+	unsigned i;
+
+	switch(r->event)
+	{
+	case TP_INTERRUPT:
+		// One instant per interrupt raised
+		for(i = 0; i < 5; i++)
+		{
+			if(r->arg & (1u << i))
+			{
+				event_head(f, interrupt_names[i], "i", ROW_INTERRUPTS, r);
+				fprintf(f, "\"s\":\"t\",");
+				event_args(f, r);
+				fprintf(f, "}}");
+			}
+		}
+		break;
+	case TP_LCDC_MODE:
+		// Lasts until the next change; the last one gets no length
+		event_head(f, mode_names[r->arg & 3], "X", ROW_LCDC, r);
+		fprintf(f, "\"dur\":%.3f,", next_mode ?
+			cycle_us(next_mode->cycle) - cycle_us(r->cycle) : 0);
+		event_args(f, r);
+		fprintf(f, ",\"ly\":%u}}", r->extra);
+		break;
+	case TP_DMA:
+		event_head(f, "OAM DMA", "X", ROW_DMA, r);
+		fprintf(f, "\"dur\":%.3f,", cycle_us(DMA_CYCLES));
+		event_args(f, r);
+		fprintf(f, ",\"source\":\"%04X\"}}", (unsigned)r->arg);
+		break;
+	case TP_HDMA:
+		event_head(f, "HDMA", "i", ROW_DMA, r);
+		fprintf(f, "\"s\":\"t\",");
+		event_args(f, r);
+		fprintf(f, ",\"source\":\"%04X\",\"dest\":\"%04X\",\"bytes\":%u}}",
+			(unsigned)(r->arg >> 16), (unsigned)(r->arg & 0xFFFF),
+			16u * (r->extra + 1u));
+		break;
+	case TP_TIMER_OVERFLOW:
+		event_head(f, "TIMA overflow", "i", ROW_TIMER, r);
+		fprintf(f, "\"s\":\"t\",");
+		event_args(f, r);
+		fprintf(f, ",\"tma\":%u}}", (unsigned)r->arg);
+		break;
+	case TP_ROM_BANK:
+	case TP_RAM_BANK:
+		snprintf(name, sizeof(name), "%s bank %u",
+			r->event == TP_ROM_BANK ? "ROM" : "RAM", (unsigned)r->arg);
+		event_head(f, name, "i", ROW_MBC, r);
+		fprintf(f, "\"s\":\"t\",");
+		event_args(f, r);
+		fprintf(f, "}}");
+		break;
+	}
+}
+
+static bool write_events(emu_state *restrict state, tracepoint_state *tp,
+	FILE *f)
+{
+	const size_t count = tp->written < tp->capacity ?
+		(size_t)tp->written : tp->capacity;
+	const size_t oldest = tp->written < tp->capacity ?
+		0 : (size_t)(tp->written % tp->capacity);
+	const tracepoint_record *mode = NULL;
+	char title[17];
+	size_t i, row;
+
+	// Printable title only; it goes in a JSON string
+	for(i = 0; i < 16; i++)
+	{
+		const char c = (char)state->cart_data[0x134 + i];
+
+		title[i] = (c >= 0x20 && c < 0x7F && c != '"' && c != '\\') ?
+			c : '\0';
+		if(title[i] == '\0')
+		{
+			break;
+		}
+	}
+	title[i] = '\0';
+
+	fprintf(f, "{\"displayTimeUnit\":\"ns\",\"otherData\":{\"dropped\":%llu},\n"
+		"\"traceEvents\":[\n{\"name\":\"process_name\",\"ph\":\"M\","
+		"\"pid\":1,\"tid\":0,\"args\":{\"name\":\"%s\"}}",
+		(unsigned long long)(tp->written - count), title);
+
+	for(row = ROW_INTERRUPTS; row <= ROW_MBC; row++)
+	{
+		fprintf(f, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,"
+			"\"tid\":%lu,\"args\":{\"name\":\"%s\"}}", (unsigned long)row,
+			row_names[row]);
+	}
+
+	for(i = 0; i < count; i++)
+	{
+		const tracepoint_record *r = &(tp->ring[(oldest + i) % tp->capacity]);
+
+		if(r->event != TP_LCDC_MODE)
+		{
+			write_event(f, r, NULL);
+			continue;
+		}
+
+		// A mode's length is only known at the next change
+		if(mode != NULL)
+		{
+			write_event(f, mode, r);
+		}
+		mode = r;
+	}
+
+	if(mode != NULL)
+	{
+		write_event(f, mode, NULL);
+	}
+
+	fprintf(f, "\n]}\n");
+	return !ferror(f);
+}
+
+void tracepoint_stop(emu_state *restrict state)
+{
+	tracepoint_state *tp = state->debug.tracepoints;
+	const char *path = state->opts.events_path;
+	FILE *f;
+	bool ok;
+
+	if(tp == NULL)
+	{
+		return;
+	}
+
+	state->debug.tracepoints = NULL;
+
+	if(path == NULL)
+	{
+		// Nowhere to put them
+	}
+	else if((f = fopen(path, "w")) == NULL)
+	{
+		error(state, "Could not create event trace %s", path);
+	}
+	else
+	{
+		ok = write_events(state, tp, f);
+		ok = (fclose(f) == 0) && ok;
+
+		if(ok)
+		{
+			info(state, "Wrote %llu events to %s",
+				(unsigned long long)(tp->written < tp->capacity ?
+				tp->written : tp->capacity), path);
+		}
+		else
+		{
+			error(state, "Could not write event trace %s", path);
+		}
+	}
+
+	free(tp->ring);
+	free(tp);
+}